@@ -0,0 +1,119 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Helpers to encode values into the binary files written by the converter,
+// and to decode them back. Values are stored in the byte order of the
+// machine.
+
+#ifndef BASE_BINARY_CODEC_H_
+#define BASE_BINARY_CODEC_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace base {
+
+// Append a value to an encoded buffer.
+// @param value the value to encode.
+// @param out the buffer receiving the bytes of the value.
+template<typename T>
+void EncodeValue(const T& value, std::string* out) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Append a string to an encoded buffer, as its number of characters
+// followed by its characters. Wide characters are stored on 32 bits.
+// @param value the string to encode.
+// @param out the buffer receiving the bytes of the string.
+inline void EncodeString(const std::string& value, std::string* out) {
+  EncodeValue(static_cast<uint32_t>(value.size()), out);
+  out->append(value);
+}
+
+inline void EncodeString(const std::wstring& value, std::string* out) {
+  EncodeValue(static_cast<uint32_t>(value.size()), out);
+  for (size_t i = 0; i < value.size(); ++i)
+    EncodeValue(static_cast<uint32_t>(value[i]), out);
+}
+
+// Reads the values of an encoded buffer, in the order they were encoded.
+class BinaryDecoder {
+ public:
+  // @param data the encoded bytes.
+  // @param size the number of encoded bytes.
+  BinaryDecoder(const uint8_t* data, size_t size)
+      : data_(data), size_(size), offset_(0) {
+  }
+
+  // Decode the next value.
+  // @param value receives the value.
+  // @returns true on success, false if the buffer is too short.
+  template<typename T>
+  bool Decode(T* value) {
+    if (size_ - offset_ < sizeof(T))
+      return false;
+    ::memcpy(value, data_ + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return true;
+  }
+
+  // Decode the next string.
+  // @param value receives the string.
+  // @returns true on success, false if the buffer is too short.
+  bool DecodeString(std::string* value) {
+    uint32_t length = 0;
+    if (!Decode(&length) || length > remaining())
+      return false;
+    value->assign(reinterpret_cast<const char*>(data_ + offset_), length);
+    offset_ += length;
+    return true;
+  }
+
+  bool DecodeString(std::wstring* value) {
+    uint32_t length = 0;
+    if (!Decode(&length) || length > remaining() / sizeof(uint32_t))
+      return false;
+    value->clear();
+    for (uint32_t i = 0; i < length; ++i) {
+      uint32_t character = 0;
+      Decode(&character);
+      value->push_back(static_cast<wchar_t>(character));
+    }
+    return true;
+  }
+
+  // @returns the number of bytes not yet decoded.
+  size_t remaining() const { return size_ - offset_; }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t offset_;
+};
+
+}  // namespace base
+
+#endif  // BASE_BINARY_CODEC_H_
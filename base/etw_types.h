@@ -0,0 +1,254 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Declarations of the ETW types used by the converter. On Windows, they come
+// from the SDK headers. On other platforms, the subset of types needed to
+// decode ETW events is declared with the same layout and values, so that
+// the portable parts of the converter can be built and tested.
+
+#ifndef BASE_ETW_TYPES_H_
+#define BASE_ETW_TYPES_H_
+
+#if defined(_WIN32)
+
+// Restrict the import to the windows basic includes.
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>  // NOLINT
+// Turns the DEFINE_GUID for EventTraceGuid into a const.
+#define INITGUID
+#include <guiddef.h>
+#include <evntcons.h>
+#include <tdh.h>
+
+#else  // defined(_WIN32)
+
+#include <cstdint>
+#include <cstring>
+
+struct GUID {
+  uint32_t Data1;
+  uint16_t Data2;
+  uint16_t Data3;
+  uint8_t Data4[8];
+};
+
+inline bool IsEqualGUID(const GUID& left, const GUID& right) {
+  return ::memcmp(&left, &right, sizeof(GUID)) == 0;
+}
+
+inline bool operator==(const GUID& left, const GUID& right) {
+  return IsEqualGUID(left, right);
+}
+
+inline bool operator!=(const GUID& left, const GUID& right) {
+  return !IsEqualGUID(left, right);
+}
+
+union LARGE_INTEGER {
+  int64_t QuadPart;
+};
+
+struct EVENT_DESCRIPTOR {
+  uint16_t Id;
+  uint8_t Version;
+  uint8_t Channel;
+  uint8_t Level;
+  uint8_t Opcode;
+  uint16_t Task;
+  uint64_t Keyword;
+};
+
+struct EVENT_HEADER {
+  uint16_t Size;
+  uint16_t HeaderType;
+  uint16_t Flags;
+  uint16_t EventProperty;
+  uint32_t ThreadId;
+  uint32_t ProcessId;
+  LARGE_INTEGER TimeStamp;
+  GUID ProviderId;
+  EVENT_DESCRIPTOR EventDescriptor;
+  uint64_t ProcessorTime;
+  GUID ActivityId;
+};
+
+struct ETW_BUFFER_CONTEXT {
+  uint8_t ProcessorNumber;
+  uint8_t Alignment;
+  uint16_t LoggerId;
+};
+
+struct EVENT_HEADER_EXTENDED_DATA_ITEM {
+  uint16_t Reserved1;
+  uint16_t ExtType;
+  uint16_t Linkage;
+  uint16_t DataSize;
+  uint64_t DataPtr;
+};
+
+struct EVENT_RECORD {
+  EVENT_HEADER EventHeader;
+  ETW_BUFFER_CONTEXT BufferContext;
+  uint16_t ExtendedDataCount;
+  uint16_t UserDataLength;
+  EVENT_HEADER_EXTENDED_DATA_ITEM* ExtendedData;
+  void* UserData;
+  void* UserContext;
+};
+typedef EVENT_RECORD* PEVENT_RECORD;
+
+// Calling convention of the callbacks of the trace consumption API.
+#define WINAPI
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+typedef uint32_t ULONG;
+
+struct EVENT_TRACE_LOGFILEW;
+
+typedef void (*PEVENT_RECORD_CALLBACK)(PEVENT_RECORD event_record);
+typedef ULONG (*PEVENT_TRACE_BUFFER_CALLBACK)(EVENT_TRACE_LOGFILEW* logfile);
+
+// The subset of the trace file information passed to the buffer callbacks.
+struct EVENT_TRACE_LOGFILEW {
+  wchar_t* LogFileName;
+  wchar_t* LoggerName;
+  int64_t CurrentTime;
+  ULONG BuffersRead;
+  ULONG ProcessTraceMode;
+  ULONG BufferSize;
+  ULONG Filled;
+  ULONG EventsLost;
+  PEVENT_TRACE_BUFFER_CALLBACK BufferCallback;
+  PEVENT_RECORD_CALLBACK EventRecordCallback;
+  void* Context;
+};
+typedef EVENT_TRACE_LOGFILEW EVENT_TRACE_LOGFILE;
+typedef EVENT_TRACE_LOGFILEW* PEVENT_TRACE_LOGFILEW;
+typedef EVENT_TRACE_LOGFILEW* PEVENT_TRACE_LOGFILE;
+
+// EVENT_HEADER flags.
+const uint16_t EVENT_HEADER_FLAG_EXTENDED_INFO = 0x0001;
+const uint16_t EVENT_HEADER_FLAG_PRIVATE_SESSION = 0x0002;
+const uint16_t EVENT_HEADER_FLAG_STRING_ONLY = 0x0004;
+const uint16_t EVENT_HEADER_FLAG_TRACE_MESSAGE = 0x0008;
+const uint16_t EVENT_HEADER_FLAG_NO_CPUTIME = 0x0010;
+const uint16_t EVENT_HEADER_FLAG_32_BIT_HEADER = 0x0020;
+const uint16_t EVENT_HEADER_FLAG_64_BIT_HEADER = 0x0040;
+const uint16_t EVENT_HEADER_FLAG_CLASSIC_HEADER = 0x0100;
+
+// Event type of the trace header events.
+const uint8_t EVENT_TRACE_TYPE_INFO = 0x00;
+
+// GUID of the trace header events {68fdd900-4a3e-11d1-84f4-0000f80464e3}.
+const GUID EventTraceGuid = { 0x68FDD900, 0x4A3E, 0x11D1,
+    { 0x84, 0xF4, 0x00, 0x00, 0xF8, 0x04, 0x64, 0xE3 }};
+
+// Trace Data Helper input types.
+enum _TDH_IN_TYPE {
+  TDH_INTYPE_NULL,
+  TDH_INTYPE_UNICODESTRING,
+  TDH_INTYPE_ANSISTRING,
+  TDH_INTYPE_INT8,
+  TDH_INTYPE_UINT8,
+  TDH_INTYPE_INT16,
+  TDH_INTYPE_UINT16,
+  TDH_INTYPE_INT32,
+  TDH_INTYPE_UINT32,
+  TDH_INTYPE_INT64,
+  TDH_INTYPE_UINT64,
+  TDH_INTYPE_FLOAT,
+  TDH_INTYPE_DOUBLE,
+  TDH_INTYPE_BOOLEAN,
+  TDH_INTYPE_BINARY,
+  TDH_INTYPE_GUID,
+  TDH_INTYPE_POINTER,
+  TDH_INTYPE_FILETIME,
+  TDH_INTYPE_SYSTEMTIME,
+  TDH_INTYPE_SID,
+  TDH_INTYPE_HEXINT32,
+  TDH_INTYPE_HEXINT64,
+  TDH_INTYPE_COUNTEDSTRING = 300,
+  TDH_INTYPE_COUNTEDANSISTRING,
+  TDH_INTYPE_REVERSEDCOUNTEDSTRING,
+  TDH_INTYPE_REVERSEDCOUNTEDANSISTRING,
+  TDH_INTYPE_NONNULLTERMINATEDSTRING,
+  TDH_INTYPE_NONNULLTERMINATEDANSISTRING,
+  TDH_INTYPE_UNICODECHAR,
+  TDH_INTYPE_ANSICHAR,
+  TDH_INTYPE_SIZET,
+  TDH_INTYPE_HEXDUMP,
+  TDH_INTYPE_WBEMSID
+};
+
+// Trace Data Helper output types.
+enum _TDH_OUT_TYPE {
+  TDH_OUTTYPE_NULL,
+  TDH_OUTTYPE_STRING,
+  TDH_OUTTYPE_DATETIME,
+  TDH_OUTTYPE_BYTE,
+  TDH_OUTTYPE_UNSIGNEDBYTE,
+  TDH_OUTTYPE_SHORT,
+  TDH_OUTTYPE_UNSIGNEDSHORT,
+  TDH_OUTTYPE_INT,
+  TDH_OUTTYPE_UNSIGNEDINT,
+  TDH_OUTTYPE_LONG,
+  TDH_OUTTYPE_UNSIGNEDLONG,
+  TDH_OUTTYPE_FLOAT,
+  TDH_OUTTYPE_DOUBLE,
+  TDH_OUTTYPE_BOOLEAN,
+  TDH_OUTTYPE_GUID,
+  TDH_OUTTYPE_HEXBINARY,
+  TDH_OUTTYPE_HEXINT8,
+  TDH_OUTTYPE_HEXINT16,
+  TDH_OUTTYPE_HEXINT32,
+  TDH_OUTTYPE_HEXINT64
+};
+
+// Flags of an event property.
+enum _PROPERTY_FLAGS {
+  PropertyStruct = 0x1,
+  PropertyParamLength = 0x2,
+  PropertyParamCount = 0x4,
+  PropertyWBEMXmlFragment = 0x8,
+  PropertyParamFixedLength = 0x10
+};
+
+// Source of the description of an event.
+enum _DECODING_SOURCE {
+  DecodingSourceXMLFile,
+  DecodingSourceWbem,
+  DecodingSourceWPP,
+  DecodingSourceTlg
+};
+
+#endif  // defined(_WIN32)
+
+#endif  // BASE_ETW_TYPES_H_
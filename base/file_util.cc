@@ -0,0 +1,209 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "base/file_util.h"
+
+#if defined(_WIN32)
+// Restrict the import to the windows basic includes.
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>  // NOLINT
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+namespace base {
+
+bool FileExists(const std::wstring& path) {
+#if defined(_WIN32)
+  DWORD attrib = ::GetFileAttributes(path.c_str());
+  return (attrib != INVALID_FILE_ATTRIBUTES &&
+         !(attrib & FILE_ATTRIBUTE_DIRECTORY));
+#else
+  struct stat info;
+  if (::stat(NarrowNativePath(path).c_str(), &info) != 0)
+    return false;
+  return S_ISREG(info.st_mode);
+#endif
+}
+
+bool GetFileSize(const std::wstring& path, uint64_t* size) {
+  assert(size != NULL);
+#if defined(_WIN32)
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!::GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data) ||
+      (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+    return false;
+  }
+  *size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) |
+      data.nFileSizeLow;
+#else
+  struct stat info;
+  if (::stat(NarrowNativePath(path).c_str(), &info) != 0 ||
+      !S_ISREG(info.st_mode)) {
+    return false;
+  }
+  *size = static_cast<uint64_t>(info.st_size);
+#endif
+  return true;
+}
+
+bool TruncateFile(const std::wstring& path, uint64_t size) {
+#if defined(_WIN32)
+  HANDLE file = ::CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER offset;
+  offset.QuadPart = static_cast<LONGLONG>(size);
+  bool success = ::SetFilePointerEx(file, offset, NULL, FILE_BEGIN) &&
+      ::SetEndOfFile(file);
+  ::CloseHandle(file);
+  return success;
+#else
+  return ::truncate(NarrowNativePath(path).c_str(),
+                    static_cast<off_t>(size)) == 0;
+#endif
+}
+
+bool RenameFile(const std::wstring& from, const std::wstring& to) {
+#if defined(_WIN32)
+  return ::MoveFileEx(from.c_str(), to.c_str(),
+                      MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) !=
+      FALSE;
+#else
+  return ::rename(NarrowNativePath(from).c_str(),
+                  NarrowNativePath(to).c_str()) == 0;
+#endif
+}
+
+bool RemoveFile(const std::wstring& path) {
+#if defined(_WIN32)
+  return ::DeleteFile(path.c_str()) != FALSE;
+#else
+  return ::unlink(NarrowNativePath(path).c_str()) == 0;
+#endif
+}
+
+bool SyncFile(const std::wstring& path) {
+#if defined(_WIN32)
+  HANDLE file = ::CreateFile(path.c_str(), GENERIC_WRITE,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  bool success = ::FlushFileBuffers(file) != FALSE;
+  ::CloseHandle(file);
+  return success;
+#else
+  int file = ::open(NarrowNativePath(path).c_str(), O_RDONLY);
+  if (file < 0)
+    return false;
+  bool success = ::fsync(file) == 0;
+  return ::close(file) == 0 && success;
+#endif
+}
+
+bool SyncFolder(const std::wstring& path) {
+#if defined(_WIN32)
+  // The folder entries are written through by RenameFile.
+  return !path.empty();
+#else
+  int folder = ::open(NarrowNativePath(path).c_str(),
+                      O_RDONLY | O_DIRECTORY);
+  if (folder < 0)
+    return false;
+  // Some file systems can't sync folders, and write their entries anyway.
+  bool success = ::fsync(folder) == 0 || errno == EINVAL;
+  return ::close(folder) == 0 && success;
+#endif
+}
+
+bool CreateFolder(const std::wstring& path) {
+#if defined(_WIN32)
+  if (::CreateDirectory(path.c_str(), NULL) != FALSE)
+    return true;
+  DWORD attrib = ::GetFileAttributes(path.c_str());
+  return (attrib != INVALID_FILE_ATTRIBUTES &&
+          (attrib & FILE_ATTRIBUTE_DIRECTORY) != 0);
+#else
+  if (::mkdir(NarrowNativePath(path).c_str(), 0755) == 0)
+    return true;
+  struct stat info;
+  if (::stat(NarrowNativePath(path).c_str(), &info) != 0)
+    return false;
+  return S_ISDIR(info.st_mode);
+#endif
+}
+
+std::wstring GetFolder(const std::wstring& path) {
+#if defined(_WIN32)
+  size_t separator = path.find_last_of(L"\\/");
+#else
+  size_t separator = path.rfind(kPathSeparator);
+#endif
+  if (separator == std::wstring::npos)
+    return L".";
+  if (separator == 0)
+    return path.substr(0, 1);
+  return path.substr(0, separator);
+}
+
+std::wstring JoinPath(const std::wstring& left, const std::wstring& right) {
+  if (left.empty())
+    return right;
+  std::wstring path(left);
+  if (path[path.size() - 1] != kPathSeparator)
+    path.push_back(kPathSeparator);
+  path.append(right);
+  return path;
+}
+
+#if !defined(_WIN32)
+std::wstring WidenNativePath(const char* path) {
+  std::wstring result;
+  size_t length = ::strlen(path);
+  result.reserve(length);
+  for (size_t i = 0; i < length; ++i)
+    result.push_back(static_cast<unsigned char>(path[i]));
+  return result;
+}
+
+std::string NarrowNativePath(const std::wstring& path) {
+  std::string result;
+  result.reserve(path.size());
+  for (size_t i = 0; i < path.size(); ++i)
+    result.push_back(static_cast<char>(path[i]));
+  return result;
+}
+#endif  // !defined(_WIN32)
+
+}  // namespace base
@@ -0,0 +1,117 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Portable helpers to manipulate file paths and files.
+
+#ifndef BASE_FILE_UTIL_H_
+#define BASE_FILE_UTIL_H_
+
+#include <cstdint>
+#include <string>
+
+namespace base {
+
+// The separator between the components of a path.
+#if defined(_WIN32)
+const wchar_t kPathSeparator = L'\\';
+#else
+const wchar_t kPathSeparator = L'/';
+#endif
+
+// Check whether a path designates an existing regular file.
+// @param path the path to check.
+// @returns true if the file exists, false otherwise.
+bool FileExists(const std::wstring& path);
+
+// Get the size of a regular file.
+// @param path the path of the file.
+// @param size receives the size of the file, in bytes.
+// @returns true on success, false if the file does not exist.
+bool GetFileSize(const std::wstring& path, uint64_t* size);
+
+// Discard the end of a file.
+// @param path the path of the file.
+// @param size the number of bytes kept.
+// @returns true on success, false otherwise.
+bool TruncateFile(const std::wstring& path, uint64_t size);
+
+// Rename a file, replacing the destination file when it exists. The
+// destination designates either the previous file or the renamed one.
+// @param from the path of the file to rename.
+// @param to the new path of the file.
+// @returns true on success, false otherwise.
+bool RenameFile(const std::wstring& from, const std::wstring& to);
+
+// Delete a file.
+// @param path the path of the file.
+// @returns true on success, false otherwise.
+bool RemoveFile(const std::wstring& path);
+
+// Write the content of a file to the disk, so that it survives a crash of
+// the system.
+// @param path the path of the file.
+// @returns true on success, false otherwise.
+bool SyncFile(const std::wstring& path);
+
+// Write the entries of a folder to the disk, so that the files created or
+// renamed in the folder survive a crash of the system.
+// @param path the path of the folder.
+// @returns true on success, false otherwise.
+bool SyncFolder(const std::wstring& path);
+
+// Create a folder, unless it exists.
+// @param path the path of the folder.
+// @returns true when the folder exists, false otherwise.
+bool CreateFolder(const std::wstring& path);
+
+// Get the folder holding a file.
+// @param path the path of the file.
+// @returns the path of the folder, or "." when |path| has a single
+//     component.
+std::wstring GetFolder(const std::wstring& path);
+
+// Join two components of a path.
+// @param left the first component.
+// @param right the second component.
+// @returns the joined path.
+std::wstring JoinPath(const std::wstring& left, const std::wstring& right);
+
+#if !defined(_WIN32)
+// Convert a path received from the system to the wide representation used
+// by the converter. Each byte of the path is kept in its own wide character,
+// so that NarrowNativePath gives back the exact same bytes.
+// @param path the path, as received from the system.
+// @returns the wide representation of the path.
+std::wstring WidenNativePath(const char* path);
+
+// Convert a path produced by WidenNativePath back to the system encoding.
+// @param path the wide representation of the path.
+// @returns the path, as expected by the system.
+std::string NarrowNativePath(const std::wstring& path);
+#endif  // !defined(_WIN32)
+
+}  // namespace base
+
+#endif  // BASE_FILE_UTIL_H_
@@ -0,0 +1,198 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "base/mapped_file.h"
+
+#include <cassert>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base/file_util.h"
+#endif
+
+namespace base {
+
+namespace {
+
+// The granularity at which pages are touched. Pages are at least this big.
+const size_t kTouchSize = 4096;
+
+#if defined(_WIN32)
+// PrefetchVirtualMemory is only available since Windows 8: it is looked up
+// at runtime.
+struct MemoryRangeEntry {
+  void* VirtualAddress;
+  SIZE_T NumberOfBytes;
+};
+typedef BOOL (WINAPI *PrefetchVirtualMemoryFunction)(
+    HANDLE process, ULONG_PTR number_of_entries,
+    MemoryRangeEntry* virtual_addresses, ULONG flags);
+
+PrefetchVirtualMemoryFunction GetPrefetchVirtualMemory() {
+  static PrefetchVirtualMemoryFunction function =
+      reinterpret_cast<PrefetchVirtualMemoryFunction>(
+          ::GetProcAddress(::GetModuleHandleW(L"kernel32.dll"),
+                           "PrefetchVirtualMemory"));
+  return function;
+}
+#endif
+
+}  // namespace
+
+MappedFile::MappedFile() : data_(NULL), size_(0) {}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::wstring& path) {
+  Close();
+
+  file_.Set(::CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+  if (file_.get() == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if (!::GetFileSizeEx(file_.get(), &size) || size.QuadPart <= 0 ||
+      static_cast<uint64_t>(size.QuadPart) > SIZE_MAX) {
+    file_.Close();
+    return false;
+  }
+
+  // CreateFileMapping returns NULL, not INVALID_HANDLE_VALUE, on failure.
+  HANDLE mapping = ::CreateFileMapping(file_.get(), NULL, PAGE_READONLY,
+                                       0, 0, NULL);
+  if (mapping == NULL) {
+    file_.Close();
+    return false;
+  }
+  mapping_.Set(mapping);
+
+  void* view = ::MapViewOfFile(mapping_.get(), FILE_MAP_READ, 0, 0, 0);
+  if (view == NULL) {
+    mapping_.Close();
+    file_.Close();
+    return false;
+  }
+
+  data_ = static_cast<const uint8_t*>(view);
+  size_ = static_cast<size_t>(size.QuadPart);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != NULL)
+    ::UnmapViewOfFile(data_);
+  data_ = NULL;
+  size_ = 0;
+  mapping_.Close();
+  file_.Close();
+}
+
+void MappedFile::Prefetch(size_t offset, size_t size) const {
+  assert(offset <= size_ && size <= size_ - offset);
+
+  PrefetchVirtualMemoryFunction prefetch = GetPrefetchVirtualMemory();
+  if (prefetch == NULL || size == 0)
+    return;
+
+  MemoryRangeEntry range;
+  range.VirtualAddress = const_cast<uint8_t*>(data_ + offset);
+  range.NumberOfBytes = size;
+  prefetch(::GetCurrentProcess(), 1, &range, 0);
+}
+
+#else  // defined(_WIN32)
+
+bool MappedFile::Open(const std::wstring& path) {
+  Close();
+
+  int fd = ::open(NarrowNativePath(path).c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (::fstat(fd, &info) != 0 || info.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+
+  size_t size = static_cast<size_t>(info.st_size);
+  void* view = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  // The mapping stays valid once the file descriptor is closed.
+  ::close(fd);
+  if (view == MAP_FAILED)
+    return false;
+
+  // The file is mostly read sequentially.
+  ::madvise(view, size, MADV_SEQUENTIAL);
+
+  data_ = static_cast<const uint8_t*>(view);
+  size_ = size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != NULL)
+    ::munmap(const_cast<uint8_t*>(data_), size_);
+  data_ = NULL;
+  size_ = 0;
+}
+
+void MappedFile::Prefetch(size_t offset, size_t size) const {
+  assert(offset <= size_ && size <= size_ - offset);
+
+  if (size == 0)
+    return;
+
+  // The advised range must start on a page boundary.
+  static const size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  size_t start = offset - offset % page_size;
+  ::madvise(const_cast<uint8_t*>(data_ + start), offset + size - start,
+            MADV_WILLNEED);
+}
+
+#endif  // defined(_WIN32)
+
+void MappedFile::Load(size_t offset, size_t size) const {
+  assert(offset <= size_ && size <= size_ - offset);
+
+  // Reading a byte of each page waits for the page to be in memory.
+  const volatile uint8_t* data = data_ + offset;
+  for (size_t i = 0; i < size; i += kTouchSize)
+    data[i];
+  if (size != 0)
+    data[size - 1];
+}
+
+}  // namespace base
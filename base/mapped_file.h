@@ -0,0 +1,96 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Read-only mapping of a file in memory.
+
+#ifndef BASE_MAPPED_FILE_H_
+#define BASE_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(_WIN32)
+#include "base/scoped_handle.h"
+#endif
+
+#include "base/disallow_copy_and_assign.h"
+
+namespace base {
+
+// Maps the whole content of a file in memory, for reading. The mapping is
+// released when the MappedFile is deleted (or before if Close() is called).
+// The file is expected to be read mostly sequentially: the system reads it
+// ahead, and ranges about to be read can be prefetched explicitly.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Map a file in memory. The previously mapped file is closed.
+  // @param path the path of the file to map.
+  // @returns true on success, false if the file cannot be mapped or is empty.
+  bool Open(const std::wstring& path);
+
+  // Release the mapping.
+  void Close();
+
+  // @returns true when a file is mapped.
+  bool IsOpen() const { return data_ != NULL; }
+
+  // @returns the content of the mapped file.
+  const uint8_t* data() const { return data_; }
+
+  // @returns the size of the mapped file, in bytes.
+  size_t size() const { return size_; }
+
+  // Ask the system to start reading a range of the file in memory, without
+  // waiting for it.
+  // @param offset the offset of the range.
+  // @param size the size of the range, in bytes.
+  void Prefetch(size_t offset, size_t size) const;
+
+  // Wait until a range of the file is in memory, by touching its pages.
+  // @param offset the offset of the range.
+  // @param size the size of the range, in bytes.
+  void Load(size_t offset, size_t size) const;
+
+ private:
+#if defined(_WIN32)
+  // The handles of the file and of its mapping.
+  ScopedHandle file_;
+  ScopedHandle mapping_;
+#endif
+
+  // The content of the mapped file.
+  const uint8_t* data_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+}  // namespace base
+
+#endif  // BASE_MAPPED_FILE_H_
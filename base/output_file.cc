@@ -0,0 +1,550 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "base/output_file.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base/file_util.h"
+
+// The io_uring interface is used through its system calls.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// The writes rely on IORING_OP_WRITE, added with IORING_FEAT_RW_CUR_POS.
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#define OUTPUT_FILE_IO_URING
+#endif
+#endif
+#endif
+#endif  // !defined(_WIN32)
+
+namespace base {
+
+namespace {
+
+// The maximal number of bytes given to a single write.
+const size_t kMaxWriteLength = 1 << 30;
+
+}  // namespace
+
+#if defined(OUTPUT_FILE_IO_URING)
+
+// The rings shared with the kernel. The writes are submitted and completed
+// by a single thread.
+struct OutputFile::Ring {
+  Ring()
+      : fd(-1),
+        sq_ring(MAP_FAILED),
+        sq_ring_size(0),
+        cq_ring(MAP_FAILED),
+        cq_ring_size(0),
+        sqes_map(MAP_FAILED),
+        sqes_size(0) {
+  }
+
+  ~Ring() {
+    if (sqes_map != MAP_FAILED)
+      ::munmap(sqes_map, sqes_size);
+    if (cq_ring != MAP_FAILED)
+      ::munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED)
+      ::munmap(sq_ring, sq_ring_size);
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  // Create the rings.
+  // @param entries the maximal number of writes in flight.
+  // @returns true on success, false if io_uring is not available.
+  bool Init(unsigned entries) {
+    io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+    fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0 || (params.features & IORING_FEAT_RW_CUR_POS) == 0)
+      return false;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sq_ring = ::mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq_ring = ::mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqes_map = ::mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED ||
+        sqes_map == MAP_FAILED) {
+      return false;
+    }
+
+    char* sq = static_cast<char*>(sq_ring);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqes = static_cast<io_uring_sqe*>(sqes_map);
+
+    char* cq = static_cast<char*>(cq_ring);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  // Submit a write.
+  // @param file the file to write.
+  // @param raw the bytes to write.
+  // @param length the number of bytes to write.
+  // @param offset the offset of the write in the file.
+  // @param user_data the value returned with the completion of the write.
+  // @returns true on success, false if the write is not submitted.
+  bool Submit(int file, const char* raw, size_t length, uint64_t offset,
+              uint64_t user_data) {
+    unsigned tail = *sq_tail;
+    unsigned index = tail & sq_mask;
+    io_uring_sqe* sqe = &sqes[index];
+    ::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = file;
+    sqe->addr = reinterpret_cast<uintptr_t>(raw);
+    sqe->len = static_cast<uint32_t>(length);
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (true) {
+      long submitted =
+          ::syscall(__NR_io_uring_enter, fd, 1, 0, 0, NULL, 0);
+      if (submitted == 1)
+        return true;
+      if (submitted < 0 && errno == EINTR)
+        continue;
+
+      // The kernel did not consume the write: withdraw it.
+      __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+      return false;
+    }
+  }
+
+  // Wait for the completion of a write.
+  // @param user_data receives the value given to Submit.
+  // @param result receives the number of bytes written, or a negative error
+  //     code.
+  // @returns true on success, false if the completions cannot be waited for.
+  bool Wait(uint64_t* user_data, int* result) {
+    while (true) {
+      unsigned head = *cq_head;
+      if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        const io_uring_cqe& cqe = cqes[head & cq_mask];
+        *user_data = cqe.user_data;
+        *result = cqe.res;
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+
+      if (::syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS,
+                    NULL, 0) < 0 &&
+          errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        return false;
+      }
+    }
+  }
+
+  int fd;
+
+  // The mappings of the rings.
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  void* sqes_map;
+  size_t sqes_size;
+
+  // The submission ring.
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned* sq_array;
+  io_uring_sqe* sqes;
+
+  // The completion ring.
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  io_uring_cqe* cqes;
+};
+
+#else  // defined(OUTPUT_FILE_IO_URING)
+
+struct OutputFile::Ring {
+  bool Init(unsigned entries) { return false; }
+  bool Wait(uint64_t* user_data, int* result) { return false; }
+};
+
+#endif  // defined(OUTPUT_FILE_IO_URING)
+
+OutputFile::OutputFile()
+    : direct_(false),
+      queue_depth_(1),
+#if !defined(_WIN32)
+      file_(-1),
+#endif
+      size_(0),
+      direct_file_(false),
+      direct_alignment_(GetDirectAlignment()),
+      ring_(NULL),
+      pending_writes_(0) {
+}
+
+OutputFile::~OutputFile() {
+  // The writes in flight refer to the file.
+  while (pending_writes_ != 0) {
+    const char* raw = NULL;
+    WaitWrite(&raw);
+  }
+  Close();
+}
+
+void OutputFile::set_queue_depth(size_t depth) {
+  assert(!IsOpen());
+  assert(depth != 0);
+  queue_depth_ = depth;
+}
+
+size_t OutputFile::GetDirectAlignment() {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return info.dwPageSize;
+#else
+  return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+#endif
+}
+
+bool OutputFile::Open(const std::wstring& path, bool append) {
+  assert(!IsOpen());
+
+#if defined(_WIN32)
+  file_.Set(::CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                         append ? OPEN_EXISTING : CREATE_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL, NULL));
+  if (file_.get() == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  size.QuadPart = 0;
+  if (append && !::GetFileSizeEx(file_.get(), &size)) {
+    file_.Close();
+    return false;
+  }
+  size_ = static_cast<uint64_t>(size.QuadPart);
+  direct_file_ = false;
+#else
+  std::string native_path = NarrowNativePath(path);
+  int flags = append ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC;
+
+  // The file systems without direct writes refuse to open the file.
+  direct_file_ = false;
+#if defined(O_DIRECT)
+  if (direct_) {
+    file_ = ::open(native_path.c_str(), flags | O_DIRECT, 0644);
+    direct_file_ = file_ >= 0;
+  }
+#endif
+  if (file_ < 0)
+    file_ = ::open(native_path.c_str(), flags, 0644);
+  if (file_ < 0)
+    return false;
+
+  struct stat info;
+  if (::fstat(file_, &info) != 0) {
+    Close();
+    return false;
+  }
+  size_ = static_cast<uint64_t>(info.st_size);
+
+  // The file system may require a larger alignment than the page size, or
+  // refuse the direct writes to this file.
+  direct_alignment_ = GetDirectAlignment();
+#if defined(STATX_DIOALIGN)
+  struct statx dio_info;
+  if (direct_file_ &&
+      ::statx(file_, "", AT_EMPTY_PATH, STATX_DIOALIGN, &dio_info) == 0 &&
+      (dio_info.stx_mask & STATX_DIOALIGN) != 0) {
+    if (dio_info.stx_dio_offset_align == 0)
+      DisableDirect();
+    direct_alignment_ = std::max<size_t>(
+        direct_alignment_, std::max(dio_info.stx_dio_offset_align,
+                                    dio_info.stx_dio_mem_align));
+  }
+#endif
+  if (size_ % direct_alignment_ != 0)
+    DisableDirect();
+#endif
+
+  // Without io_uring, each write completes when it is started.
+  if (queue_depth_ > 1) {
+    ring_ = new Ring();
+    if (ring_->Init(static_cast<unsigned>(queue_depth_))) {
+      writes_.resize(queue_depth_);
+      for (size_t slot = queue_depth_; slot != 0; --slot)
+        free_slots_.push_back(slot - 1);
+    } else {
+      delete ring_;
+      ring_ = NULL;
+    }
+  }
+
+  return true;
+}
+
+bool OutputFile::Close() {
+  assert(pending_writes_ == 0);
+
+  delete ring_;
+  ring_ = NULL;
+  writes_.clear();
+  free_slots_.clear();
+
+  if (!IsOpen())
+    return false;
+
+  direct_file_ = false;
+#if defined(_WIN32)
+  file_.Close();
+  return true;
+#else
+  bool success = ::close(file_) == 0;
+  file_ = -1;
+  return success;
+#endif
+}
+
+bool OutputFile::Sync() {
+  assert(pending_writes_ == 0);
+
+  if (!IsOpen())
+    return false;
+#if defined(_WIN32)
+  return ::FlushFileBuffers(file_.get()) != FALSE;
+#else
+  return ::fsync(file_) == 0;
+#endif
+}
+
+bool OutputFile::IsOpen() const {
+#if defined(_WIN32)
+  return file_.get() != INVALID_HANDLE_VALUE;
+#else
+  return file_ >= 0;
+#endif
+}
+
+void OutputFile::StartWrite(const char* raw, size_t length) {
+  assert(IsOpen());
+  assert(CanStartWrite());
+  assert(raw != NULL || length == 0);
+
+  uint64_t offset = size_;
+  size_ += length;
+  ++pending_writes_;
+
+  // Direct writes must be aligned: the file is cached from the first
+  // unaligned write on, e.g. the end of the file.
+  if (direct_file_ &&
+      (reinterpret_cast<uintptr_t>(raw) % direct_alignment_ != 0 ||
+       length % direct_alignment_ != 0 || offset % direct_alignment_ != 0)) {
+    DisableDirect();
+  }
+
+  if (ring_ != NULL) {
+    size_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    Write& write = writes_[slot];
+    write.raw = raw;
+    write.length = length;
+    write.offset = offset;
+    write.written = 0;
+    if (SubmitWrite(slot))
+      return;
+    free_slots_.push_back(slot);
+  }
+
+  // Without a submitted write, the write completes now.
+  Completion completion = { raw, WriteAt(raw, length, offset) };
+  completions_.push_back(completion);
+}
+
+bool OutputFile::WaitWrite(const char** raw) {
+  assert(raw != NULL);
+  assert(pending_writes_ != 0);
+
+  while (completions_.empty()) {
+    assert(ring_ != NULL);
+
+    uint64_t user_data = 0;
+    int result = 0;
+    if (!ring_->Wait(&user_data, &result)) {
+      // The submitted writes are lost: report them as failed. The kernel
+      // holds the pages of their bytes until they complete.
+      delete ring_;
+      ring_ = NULL;
+      for (size_t slot = 0; slot < writes_.size(); ++slot) {
+        if (std::find(free_slots_.begin(), free_slots_.end(), slot) !=
+            free_slots_.end()) {
+          continue;
+        }
+        Completion completion = { writes_[slot].raw, false };
+        completions_.push_back(completion);
+      }
+      break;
+    }
+
+    size_t slot = static_cast<size_t>(user_data);
+    Write& write = writes_[slot];
+    if (result > 0)
+      write.written += static_cast<size_t>(result);
+
+    // Submit the rest of a short write.
+    if (result > 0 && write.written < write.length && SubmitWrite(slot))
+      continue;
+
+    // The rest of a failed write is written without io_uring, e.g. when
+    // the file system refuses direct writes.
+    bool success = true;
+    if (write.written < write.length) {
+      if (result == -EINVAL)
+        DisableDirect();
+      success = WriteAt(write.raw + write.written,
+                        write.length - write.written,
+                        write.offset + write.written);
+    }
+
+    Completion completion = { write.raw, success };
+    completions_.push_back(completion);
+    free_slots_.push_back(slot);
+  }
+
+  const Completion& completion = completions_.front();
+  *raw = completion.raw;
+  bool success = completion.success;
+  completions_.pop_front();
+  --pending_writes_;
+  return success;
+}
+
+#if defined(_WIN32)
+
+bool OutputFile::WriteAt(const char* raw, size_t length, uint64_t offset) {
+  while (length != 0) {
+    OVERLAPPED overlapped;
+    ::memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    DWORD written = 0;
+    DWORD chunk = static_cast<DWORD>(std::min(length, kMaxWriteLength));
+    if (!::WriteFile(file_.get(), raw, chunk, &written, &overlapped) ||
+        written == 0) {
+      return false;
+    }
+
+    raw += written;
+    length -= written;
+    offset += written;
+  }
+  return true;
+}
+
+bool OutputFile::SubmitWrite(size_t slot) {
+  return false;
+}
+
+void OutputFile::DisableDirect() {
+  direct_file_ = false;
+}
+
+#else  // defined(_WIN32)
+
+bool OutputFile::WriteAt(const char* raw, size_t length, uint64_t offset) {
+  while (length != 0) {
+    ssize_t written = ::pwrite(file_, raw, std::min(length, kMaxWriteLength),
+                               static_cast<off_t>(offset));
+    if (written < 0 && errno == EINTR)
+      continue;
+
+    // The file system may refuse a direct write: write it through the cache.
+    if (written < 0 && errno == EINVAL && direct_file_) {
+      DisableDirect();
+      continue;
+    }
+    if (written <= 0)
+      return false;
+
+    raw += written;
+    length -= static_cast<size_t>(written);
+    offset += static_cast<uint64_t>(written);
+  }
+  return true;
+}
+
+bool OutputFile::SubmitWrite(size_t slot) {
+#if defined(OUTPUT_FILE_IO_URING)
+  const Write& write = writes_[slot];
+  size_t length = std::min(write.length - write.written, kMaxWriteLength);
+  return ring_->Submit(file_, write.raw + write.written, length,
+                       write.offset + write.written, slot);
+#else
+  return false;
+#endif
+}
+
+void OutputFile::DisableDirect() {
+#if defined(O_DIRECT)
+  if (direct_file_) {
+    int flags = ::fcntl(file_, F_GETFL);
+    if (flags != -1)
+      ::fcntl(file_, F_SETFL, flags & ~O_DIRECT);
+  }
+#endif
+  direct_file_ = false;
+}
+
+#endif  // defined(_WIN32)
+
+}  // namespace base
@@ -0,0 +1,198 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Sequential writing of a file, with writes in flight.
+
+#ifndef BASE_OUTPUT_FILE_H_
+#define BASE_OUTPUT_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include "base/scoped_handle.h"
+#endif
+
+#include "base/disallow_copy_and_assign.h"
+
+namespace base {
+
+// Writes a file sequentially: each write is placed after the bytes of the
+// previous one. A write is started, then waited for; several writes may be
+// in flight, and they may complete in any order.
+//
+// On POSIX systems, the file is written with pwrite, and optionally:
+//  - without the system cache (O_DIRECT), while the writes are aligned on
+//    the direct alignment of the file;
+//  - through io_uring on Linux, which keeps several writes in flight.
+// Each option falls back to the plain writes when the system lacks it. On
+// Windows, the writes are synchronous and cached.
+//
+// Example:
+//
+//  OutputFile file;
+//  file.Open(L"stream", false);
+//  file.StartWrite(buffer, length);
+//  const char* written = NULL;
+//  file.WaitWrite(&written);
+//  file.Close();
+class OutputFile {
+ public:
+  // @returns the alignment of the addresses, sizes and offsets of the
+  //     writes done without the system cache, before a file is open: the
+  //     page size of the system.
+  static size_t GetDirectAlignment();
+
+  OutputFile();
+  ~OutputFile();
+
+  // Write the file without the system cache. Must be called before the file
+  // is opened.
+  // @param direct true to bypass the system cache when the writes allow it.
+  void set_direct(bool direct) { direct_ = direct; }
+
+  // Keep several writes in flight, through io_uring. Must be called before
+  // the file is opened.
+  // @param depth the maximal number of writes in flight. 1 to complete each
+  //     write when it is started.
+  void set_queue_depth(size_t depth);
+
+  // Open a file for writing.
+  // @param path the path of the file.
+  // @param append true to write after the content of the file, false to
+  //     create the file or discard its content.
+  // @returns true on success, false otherwise.
+  bool Open(const std::wstring& path, bool append);
+
+  // Close the file. The started writes must be waited for first.
+  // @returns true on success, false if the file cannot be closed.
+  bool Close();
+
+  // @returns true when a file is open.
+  bool IsOpen() const;
+
+  // Write the content of the file to the disk, so that it survives a crash
+  // of the system. The started writes must be waited for first.
+  // @returns true on success, false otherwise.
+  bool Sync();
+
+  // @returns true when a write can be started.
+  bool CanStartWrite() const { return pending_writes_ < queue_depth_; }
+
+  // Start writing bytes after the bytes of the previous write. The bytes
+  // must stay valid until the write is waited for. A failure is reported by
+  // WaitWrite.
+  // @param raw the bytes to write.
+  // @param length the number of bytes to write.
+  void StartWrite(const char* raw, size_t length);
+
+  // Wait for the completion of a started write.
+  // @param raw receives the bytes given to StartWrite.
+  // @returns true on success, false if the write failed.
+  bool WaitWrite(const char** raw);
+
+  // @returns the number of started writes not waited for.
+  size_t pending_writes() const { return pending_writes_; }
+
+  // @returns true while the file is written without the system cache.
+  bool direct() const { return direct_file_; }
+
+  // @returns the alignment of the writes done without the system cache to
+  //     the open file: the page size, or the alignment required by its file
+  //     system when larger.
+  size_t direct_alignment() const { return direct_alignment_; }
+
+  // @returns true when the writes are submitted through io_uring.
+  bool queued() const { return ring_ != NULL; }
+
+ private:
+  // The submission and completion rings of io_uring.
+  struct Ring;
+
+  // A write in flight.
+  struct Write {
+    const char* raw;
+    size_t length;
+    uint64_t offset;
+    size_t written;
+  };
+
+  // A completed write, not waited for yet.
+  struct Completion {
+    const char* raw;
+    bool success;
+  };
+
+  // Write bytes at an offset, on the calling thread.
+  // @returns true on success, false otherwise.
+  bool WriteAt(const char* raw, size_t length, uint64_t offset);
+
+  // Submit the rest of a write to io_uring.
+  // @param slot the index of the write in |writes_|.
+  // @returns true on success, false otherwise.
+  bool SubmitWrite(size_t slot);
+
+  // Stop writing the file without the system cache.
+  void DisableDirect();
+
+  // The requested options.
+  bool direct_;
+  size_t queue_depth_;
+
+#if defined(_WIN32)
+  ScopedHandle file_;
+#else
+  int file_;
+#endif
+
+  // The offset of the next write.
+  uint64_t size_;
+
+  // True while the file is written without the system cache, and the
+  // alignment of its writes.
+  bool direct_file_;
+  size_t direct_alignment_;
+
+  // The io_uring rings, NULL when the writes complete when started.
+  Ring* ring_;
+
+  // The writes submitted to io_uring, indexed by their slot, and the unused
+  // slots.
+  std::vector<Write> writes_;
+  std::vector<size_t> free_slots_;
+
+  // The writes completed but not waited for.
+  std::deque<Completion> completions_;
+  size_t pending_writes_;
+
+  DISALLOW_COPY_AND_ASSIGN(OutputFile);
+};
+
+}  // namespace base
+
+#endif  // BASE_OUTPUT_FILE_H_
@@ -0,0 +1,106 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// A minimal unit test harness, without dependencies. A test is a function
+// registered with TEST; the tests of an executable are run by the main
+// function of base/unittest_main.cc. The EXPECT_* macros report a failure
+// and let the test continue; the ASSERT_* macros return from the test.
+//
+// Example:
+//
+//  TEST(MetadataTest, EmptyDictionary) {
+//    converter::Metadata metadata;
+//    EXPECT_EQ(0U, metadata.size());
+//  }
+
+#ifndef BASE_UNITTEST_H_
+#define BASE_UNITTEST_H_
+
+#include <string>
+
+#include "base/disallow_copy_and_assign.h"
+
+namespace base {
+
+typedef void (*TestFunction)();
+
+// Registers a test at static initialization.
+class TestRegistrar {
+ public:
+  // @param name the name of the test.
+  // @param function the body of the test.
+  TestRegistrar(const char* name, TestFunction function);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(TestRegistrar);
+};
+
+// Report the failure of an expectation of the running test.
+// @param file the source file of the expectation.
+// @param line the line of the expectation.
+// @param expression the text of the failed expectation.
+void AddTestFailure(const char* file, int line, const char* expression);
+
+// Write a file used by a test, in the working directory.
+// @param name the name of the file.
+// @param content the content of the file.
+// @returns the path of the file, or an empty path on failure.
+std::wstring WriteTestFile(const std::wstring& name,
+                           const std::string& content);
+
+// Run the registered tests, in the order of their registration.
+// @returns the number of failed tests.
+int RunAllTests();
+
+}  // namespace base
+
+#define TEST(test_case, name)                                                  \
+  void test_case##_##name();                                                   \
+  static base::TestRegistrar test_case##_##name##_registrar(                   \
+      #test_case "." #name, test_case##_##name);                               \
+  void test_case##_##name()
+
+#define EXPECT_TRUE(condition)                                                 \
+  do {                                                                         \
+    if (!(condition))                                                          \
+      base::AddTestFailure(__FILE__, __LINE__, #condition);                    \
+  } while (0)
+
+#define EXPECT_FALSE(condition) EXPECT_TRUE(!(condition))
+#define EXPECT_EQ(expected, actual) EXPECT_TRUE((expected) == (actual))
+#define EXPECT_NE(expected, actual) EXPECT_TRUE((expected) != (actual))
+
+#define ASSERT_TRUE(condition)                                                 \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      base::AddTestFailure(__FILE__, __LINE__, #condition);                    \
+      return;                                                                  \
+    }                                                                          \
+  } while (0)
+
+#define ASSERT_FALSE(condition) ASSERT_TRUE(!(condition))
+#define ASSERT_EQ(expected, actual) ASSERT_TRUE((expected) == (actual))
+
+#endif  // BASE_UNITTEST_H_
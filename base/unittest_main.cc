@@ -0,0 +1,110 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// The main function of the unit test executables: runs the tests registered
+// with TEST (see base/unittest.h).
+
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "base/file_util.h"
+#include "base/unittest.h"
+
+namespace base {
+
+namespace {
+
+struct Test {
+  const char* name;
+  TestFunction function;
+};
+
+// The registered tests. Built on first use, as the tests register during
+// the static initialization.
+std::vector<Test>& GetTests() {
+  static std::vector<Test> tests;
+  return tests;
+}
+
+// The number of failed expectations of the running test.
+size_t failures = 0;
+
+}  // namespace
+
+TestRegistrar::TestRegistrar(const char* name, TestFunction function) {
+  Test test = { name, function };
+  GetTests().push_back(test);
+}
+
+void AddTestFailure(const char* file, int line, const char* expression) {
+  std::cerr << file << ":" << line << ": Failure: " << expression
+            << std::endl;
+  ++failures;
+}
+
+std::wstring WriteTestFile(const std::wstring& name,
+                           const std::string& content) {
+#if defined(_WIN32)
+  const std::wstring& native_path = name;
+#else
+  std::string native_path = NarrowNativePath(name);
+#endif
+
+  std::ofstream stream(native_path.c_str(),
+      std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+  stream.write(content.data(), content.size());
+  stream.close();
+  if (stream.fail())
+    return std::wstring();
+  return name;
+}
+
+int RunAllTests() {
+  const std::vector<Test>& tests = GetTests();
+  int failed_tests = 0;
+  for (size_t i = 0; i < tests.size(); ++i) {
+    std::cerr << "[ RUN      ] " << tests[i].name << std::endl;
+    failures = 0;
+    tests[i].function();
+    if (failures == 0) {
+      std::cerr << "[       OK ] " << tests[i].name << std::endl;
+    } else {
+      std::cerr << "[  FAILED  ] " << tests[i].name << std::endl;
+      ++failed_tests;
+    }
+  }
+
+  std::cerr << tests.size() - failed_tests << " of " << tests.size()
+            << " tests passed." << std::endl;
+  return failed_tests;
+}
+
+}  // namespace base
+
+int main() {
+  return base::RunAllTests() == 0 ? 0 : 1;
+}
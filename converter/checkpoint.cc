@@ -0,0 +1,271 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/checkpoint.h"
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+
+#include "base/binary_codec.h"
+#include "base/file_util.h"
+#include "base/mapped_file.h"
+
+namespace converter {
+
+namespace {
+
+// The magic number at the start of a checkpoint file, with the version of
+// its format.
+const char kCheckpointMagic[8] = { 'E', 'T', 'W', 'C', 'K', 'P', 'T', '3' };
+
+// The buffer of no position, in a checkpoint file.
+const uint64_t kNoBuffer = static_cast<uint64_t>(-1);
+
+void EncodeEvent(const Metadata::Event& event, std::string* out) {
+  assert(out != NULL);
+
+  base::EncodeString(event.name(), out);
+  base::EncodeValue(event.guid(), out);
+  base::EncodeValue(event.opcode(), out);
+  base::EncodeValue(event.version(), out);
+  base::EncodeValue(event.event_id(), out);
+  base::EncodeValue(static_cast<uint32_t>(event.size()), out);
+  for (size_t i = 0; i < event.size(); ++i) {
+    const Metadata::Field& field = event.at(i);
+    base::EncodeValue(static_cast<uint32_t>(field.type()), out);
+    base::EncodeString(field.name(), out);
+    base::EncodeValue(static_cast<uint64_t>(field.size()), out);
+    base::EncodeString(field.field_size(), out);
+    base::EncodeValue(static_cast<uint64_t>(field.parent()), out);
+  }
+}
+
+bool DecodeEvent(base::BinaryDecoder* decoder, Metadata::Event* event) {
+  assert(decoder != NULL);
+  assert(event != NULL);
+
+  std::string name;
+  GUID guid;
+  unsigned char opcode = 0;
+  unsigned char version = 0;
+  unsigned short event_id = 0;
+  uint32_t number_of_fields = 0;
+  if (!decoder->DecodeString(&name) || !decoder->Decode(&guid) ||
+      !decoder->Decode(&opcode) || !decoder->Decode(&version) ||
+      !decoder->Decode(&event_id) || !decoder->Decode(&number_of_fields)) {
+    return false;
+  }
+  event->set_name(name);
+  event->set_info(guid, opcode, version, event_id);
+
+  for (uint32_t i = 0; i < number_of_fields; ++i) {
+    uint32_t type = 0;
+    std::string field_name;
+    uint64_t size = 0;
+    std::string field_size;
+    uint64_t parent = 0;
+    if (!decoder->Decode(&type) || !decoder->DecodeString(&field_name) ||
+        !decoder->Decode(&size) || !decoder->DecodeString(&field_size) ||
+        !decoder->Decode(&parent) || type > Metadata::Field::GUID) {
+      return false;
+    }
+
+    // A field has either a fixed size, or the name of its size field.
+    Metadata::Field::FieldType field_type =
+        static_cast<Metadata::Field::FieldType>(type);
+    if (!field_size.empty()) {
+      event->AddField(Metadata::Field(field_type, field_name, field_size,
+                                      static_cast<size_t>(parent)));
+    } else {
+      event->AddField(Metadata::Field(field_type, field_name,
+                                      static_cast<size_t>(size),
+                                      static_cast<size_t>(parent)));
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
+bool Checkpoint::Load(const std::wstring& path) {
+  base::MappedFile file;
+  if (!base::FileExists(path) || !file.Open(path))
+    return false;
+
+  base::BinaryDecoder decoder(file.data(), file.size());
+  char magic[sizeof(kCheckpointMagic)];
+  for (size_t i = 0; i < sizeof(magic); ++i) {
+    if (!decoder.Decode(&magic[i]))
+      return false;
+  }
+  if (::memcmp(magic, kCheckpointMagic, sizeof(magic)) != 0)
+    return false;
+
+  uint8_t complete = 0;
+  uint32_t number_of_traces = 0;
+  if (!decoder.Decode(&complete) || !decoder.Decode(&last_timestamp_) ||
+      !decoder.Decode(&stream_size_) || !decoder.Decode(&packet_size_) ||
+      !decoder.Decode(&number_of_traces)) {
+    return false;
+  }
+  complete_ = complete != 0;
+
+  traces_.clear();
+  for (uint32_t i = 0; i < number_of_traces; ++i) {
+    Trace trace;
+    uint32_t number_of_positions = 0;
+    if (!decoder.DecodeString(&trace.path) ||
+        !decoder.Decode(&trace.start_time) ||
+        !decoder.Decode(&trace.buffers) ||
+        !decoder.Decode(&trace.last_buffer_offset) ||
+        !decoder.Decode(&trace.last_buffer_filled) ||
+        !decoder.Decode(&number_of_positions)) {
+      return false;
+    }
+    for (uint32_t j = 0; j < number_of_positions; ++j) {
+      uint64_t buffer = 0;
+      uint64_t offset = 0;
+      if (!decoder.Decode(&buffer) || !decoder.Decode(&offset))
+        return false;
+      ETLPosition position;
+      if (buffer != kNoBuffer) {
+        position.buffer = static_cast<size_t>(buffer);
+        position.offset = static_cast<size_t>(offset);
+      }
+      trace.positions.push_back(position);
+    }
+    traces_.push_back(trace);
+  }
+
+  if (!decoder.DecodeString(&open_packet_.bytes) ||
+      !decoder.Decode(&open_packet_.events) ||
+      !decoder.Decode(&open_packet_.start_timestamp) ||
+      !decoder.Decode(&open_packet_.stop_timestamp)) {
+    return false;
+  }
+
+  uint32_t number_of_events = 0;
+  if (!decoder.Decode(&number_of_events))
+    return false;
+  events_.clear();
+  for (uint32_t i = 0; i < number_of_events; ++i) {
+    Metadata::Event event;
+    if (!DecodeEvent(&decoder, &event))
+      return false;
+    events_.push_back(event);
+  }
+
+  uint32_t number_of_observers = 0;
+  if (!decoder.Decode(&number_of_observers))
+    return false;
+  observer_states_.clear();
+  for (uint32_t i = 0; i < number_of_observers; ++i) {
+    std::string state;
+    if (!decoder.DecodeString(&state))
+      return false;
+    observer_states_.push_back(state);
+  }
+
+  return decoder.remaining() == 0;
+}
+
+bool Checkpoint::Save(const std::wstring& path) const {
+  std::string out;
+  out.append(kCheckpointMagic, sizeof(kCheckpointMagic));
+  base::EncodeValue(static_cast<uint8_t>(complete_ ? 1 : 0), &out);
+  base::EncodeValue(last_timestamp_, &out);
+  base::EncodeValue(stream_size_, &out);
+  base::EncodeValue(packet_size_, &out);
+
+  base::EncodeValue(static_cast<uint32_t>(traces_.size()), &out);
+  for (size_t i = 0; i < traces_.size(); ++i) {
+    const Trace& trace = traces_[i];
+    base::EncodeString(trace.path, &out);
+    base::EncodeValue(trace.start_time, &out);
+    base::EncodeValue(trace.buffers, &out);
+    base::EncodeValue(trace.last_buffer_offset, &out);
+    base::EncodeValue(trace.last_buffer_filled, &out);
+    base::EncodeValue(static_cast<uint32_t>(trace.positions.size()), &out);
+    for (size_t j = 0; j < trace.positions.size(); ++j) {
+      const ETLPosition& position = trace.positions[j];
+      uint64_t buffer = kNoBuffer;
+      if (position.buffer != ETLPosition::kNoBuffer)
+        buffer = position.buffer;
+      base::EncodeValue(buffer, &out);
+      base::EncodeValue(static_cast<uint64_t>(position.offset), &out);
+    }
+  }
+
+  base::EncodeString(open_packet_.bytes, &out);
+  base::EncodeValue(open_packet_.events, &out);
+  base::EncodeValue(open_packet_.start_timestamp, &out);
+  base::EncodeValue(open_packet_.stop_timestamp, &out);
+
+  base::EncodeValue(static_cast<uint32_t>(events_.size()), &out);
+  for (size_t i = 0; i < events_.size(); ++i)
+    EncodeEvent(events_[i], &out);
+
+  base::EncodeValue(static_cast<uint32_t>(observer_states_.size()), &out);
+  for (size_t i = 0; i < observer_states_.size(); ++i)
+    base::EncodeString(observer_states_[i], &out);
+
+  // Write the checkpoint aside, on the disk, then replace the previous one:
+  // after a crash of the system, the checkpoint is the previous or the new
+  // one.
+  std::wstring temporary_path = path + L".tmp";
+#if defined(_WIN32)
+  const std::wstring& native_path = temporary_path;
+#else
+  std::string native_path = base::NarrowNativePath(temporary_path);
+#endif
+
+  std::ofstream stream(native_path.c_str(),
+      std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+  stream.write(out.data(), out.size());
+  stream.close();
+  return !stream.fail() && base::SyncFile(temporary_path) &&
+      base::RenameFile(temporary_path, path) &&
+      base::SyncFolder(base::GetFolder(path));
+}
+
+void Checkpoint::SetMetadata(const Metadata& metadata) {
+  events_.clear();
+  for (size_t i = 0; i < metadata.size(); ++i)
+    events_.push_back(metadata.GetEventWithId(i));
+}
+
+void Checkpoint::RestoreMetadata(Metadata* metadata) const {
+  assert(metadata != NULL);
+  assert(metadata->size() == 0);
+
+  // The ids are given in order to the distinct layouts.
+  for (size_t i = 0; i < events_.size(); ++i)
+    metadata->GetIdForEvent(events_[i]);
+  assert(metadata->size() == events_.size());
+}
+
+}  // namespace converter
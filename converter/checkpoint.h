@@ -0,0 +1,163 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// The checkpoint of a conversion, to resume an interrupted conversion or to
+// convert later only the buffers added to growing trace files. The
+// checkpoint records, for each trace file, the position of the next event
+// to convert from each processor; the timestamp of the last converted event;
+// the size of the CTF stream and the size of its packets; the events of the
+// packet not yet written to the stream; and the dictionary of event layouts,
+// so that the events converted later keep the same ids; and the state of the
+// ETW observers.
+//
+// A later conversion appends the packets of the next events to the stream,
+// and rewrites the metadata stream. Values are stored in the byte order of
+// the machine.
+
+#ifndef CONVERTER_CHECKPOINT_H_
+#define CONVERTER_CHECKPOINT_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "converter/etl_reader.h"
+#include "converter/metadata.h"
+
+namespace converter {
+
+class Checkpoint {
+ public:
+  // The position of the conversion in a trace file. A trace file grows by
+  // adding buffers at its end.
+  struct Trace {
+    Trace()
+        : start_time(0), buffers(0), last_buffer_offset(0),
+          last_buffer_filled(0) {
+    }
+
+    // The path and the start time of the trace file, as a FILETIME.
+    std::wstring path;
+    int64_t start_time;
+
+    // The number of buffers of the trace file, and the location and the
+    // filling of the last one, to check that the buffers did not change.
+    uint64_t buffers;
+    uint64_t last_buffer_offset;
+    uint64_t last_buffer_filled;
+
+    // The position of the next event to convert from each processor.
+    std::vector<ETLPosition> positions;
+  };
+
+  // The events converted after the last full packet. They are packed with
+  // the next events when the conversion resumes.
+  struct OpenPacket {
+    OpenPacket() : events(0), start_timestamp(0), stop_timestamp(0) {}
+
+    // The bytes of the packet, starting with its header, the number of its
+    // events and the range of their timestamps.
+    std::string bytes;
+    uint64_t events;
+    uint64_t start_timestamp;
+    uint64_t stop_timestamp;
+  };
+
+  Checkpoint()
+      : complete_(false), last_timestamp_(0), stream_size_(0),
+        packet_size_(0) {
+  }
+
+  // Load a checkpoint file.
+  // @param path the path of the checkpoint file.
+  // @returns true on success, false if the file is missing or invalid.
+  bool Load(const std::wstring& path);
+
+  // Save the checkpoint to a file. The file is replaced at once: it holds
+  // either the previous checkpoint or this one, even if the conversion is
+  // interrupted.
+  // @param path the path of the checkpoint file.
+  // @returns true on success, false otherwise.
+  bool Save(const std::wstring& path) const;
+
+  // Keep a copy of the dictionary of event layouts.
+  // @param metadata the dictionary of event layouts.
+  void SetMetadata(const Metadata& metadata);
+
+  // Restore the dictionary of event layouts, with the same ids.
+  // @param metadata an empty dictionary receiving the event layouts.
+  void RestoreMetadata(Metadata* metadata) const;
+
+  // The positions of the conversion in the trace files, in the order they
+  // are converted.
+  const std::vector<Trace>& traces() const { return traces_; }
+  void set_traces(const std::vector<Trace>& traces) { traces_ = traces; }
+
+  // Whether all the events of the trace files were converted. Only the
+  // events added later to the trace files are left.
+  bool complete() const { return complete_; }
+  void set_complete(bool complete) { complete_ = complete; }
+
+  // The timestamp of the last converted event.
+  uint64_t last_timestamp() const { return last_timestamp_; }
+  void set_last_timestamp(uint64_t timestamp) { last_timestamp_ = timestamp; }
+
+  // The size of the CTF stream, in bytes.
+  uint64_t stream_size() const { return stream_size_; }
+  void set_stream_size(uint64_t size) { stream_size_ = size; }
+
+  // The maximal size of the packets of the CTF stream.
+  uint64_t packet_size() const { return packet_size_; }
+  void set_packet_size(uint64_t size) { packet_size_ = size; }
+
+  // The events converted after the last packet written to the stream.
+  const OpenPacket& open_packet() const { return open_packet_; }
+  void set_open_packet(const OpenPacket& packet) { open_packet_ = packet; }
+
+  // The states of the ETW observers, in the order they are registered.
+  const std::vector<std::string>& observer_states() const {
+    return observer_states_;
+  }
+  void set_observer_states(const std::vector<std::string>& states) {
+    observer_states_ = states;
+  }
+
+ private:
+  std::vector<Trace> traces_;
+  bool complete_;
+  uint64_t last_timestamp_;
+  uint64_t stream_size_;
+  uint64_t packet_size_;
+  OpenPacket open_packet_;
+
+  // The event layouts, in the order of their ids.
+  std::vector<Metadata::Event> events_;
+
+  std::vector<std::string> observer_states_;
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_CHECKPOINT_H_
@@ -25,13 +25,200 @@
 
 #include "converter/ctf_producer.h"
 
+#if defined(_WIN32)
+// Restrict the import to the windows basic includes.
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>  // NOLINT
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <string>
 
+#include "base/file_util.h"
+#include "base/mapped_file.h"
+#include "base/stopwatch.h"
+
 namespace converter {
 
+namespace {
+
+// The size of the blocks of the writing thread: the bytes are written to the
+// streams in large writes.
+const size_t kWriteBlockSize = 1 << 20;
+
+// The packet index of a stream file, in the format of LTTng: a header, with
+// the magic number, the version of the format and the size of an entry,
+// followed by an entry per packet. The values are in big-endian order.
+const uint32_t kPacketIndexMagic = 0xC1F1DCC1;
+const uint32_t kPacketIndexMajor = 1;
+const uint32_t kPacketIndexMinor = 0;
+const size_t kPacketIndexHeaderSize = 16;
+
+// An entry holds the fields of the version 1.0 of the format: offset,
+// packet_size, content_size, timestamp_begin, timestamp_end,
+// events_discarded and stream_id. They are followed by the number of events
+// of the packet, which the readers skip through the size of an entry.
+const size_t kPacketIndexEntrySize = 8 * 8;
+
+// The folder of the packet indexes, in the CTF root folder.
+const wchar_t kPacketIndexFolder[] = L"index";
+
+template<typename T>
+void EncodeBigEndian(T value, std::string* out) {
+  assert(out != NULL);
+  for (size_t i = sizeof(T); i > 0; --i)
+    out->push_back(static_cast<char>((value >> (8 * (i - 1))) & 0xFF));
+}
+
+template<typename T>
+T DecodeBigEndian(const uint8_t* raw) {
+  assert(raw != NULL);
+  T value = 0;
+  for (size_t i = 0; i < sizeof(T); ++i)
+    value = static_cast<T>((value << 8) | raw[i]);
+  return value;
+}
+
+std::wstring GetPacketIndexPath(const std::wstring& folder,
+                                const std::wstring& filename) {
+  return base::JoinPath(base::JoinPath(folder, kPacketIndexFolder),
+                        filename + L".idx");
+}
+
+// Count the entries of a packet index describing the first bytes of a
+// stream file.
+// @param path the path of the packet index.
+// @param size the number of bytes of the stream file.
+// @param entries receives the number of entries describing the first |size|
+//     bytes.
+// @returns true when the entries describe exactly the first |size| bytes,
+//     false otherwise.
+bool CountPacketIndexEntries(const std::wstring& path, uint64_t size,
+                             uint64_t* entries) {
+  assert(entries != NULL);
+
+  base::MappedFile file;
+  if (!base::FileExists(path) || !file.Open(path) ||
+      file.size() < kPacketIndexHeaderSize) {
+    return false;
+  }
+  const uint8_t* raw = file.data();
+  if (DecodeBigEndian<uint32_t>(raw) != kPacketIndexMagic ||
+      DecodeBigEndian<uint32_t>(raw + 4) != kPacketIndexMajor ||
+      DecodeBigEndian<uint32_t>(raw + 8) != kPacketIndexMinor ||
+      DecodeBigEndian<uint32_t>(raw + 12) != kPacketIndexEntrySize) {
+    return false;
+  }
+
+  // The packets are contiguous: each entry starts where the previous packet
+  // ends.
+  size_t count = (file.size() - kPacketIndexHeaderSize) /
+      kPacketIndexEntrySize;
+  uint64_t offset = 0;
+  *entries = 0;
+  while (offset < size && *entries < count) {
+    const uint8_t* entry = raw + kPacketIndexHeaderSize +
+        *entries * kPacketIndexEntrySize;
+    uint64_t packet_size = DecodeBigEndian<uint64_t>(entry + 8) / 8;
+    if (DecodeBigEndian<uint64_t>(entry) != offset || packet_size == 0)
+      return false;
+    offset += packet_size;
+    ++*entries;
+  }
+  return offset == size;
+}
+
+}  // namespace
+
+// The bytes of a block are aligned for the writes without the system cache.
+// A borrowed block holds the bytes of a caller of Write instead: it is not
+// reused once written.
+struct CTFProducer::Block {
+  explicit Block(size_t alignment)
+      : storage(kWriteBlockSize + alignment),
+        size(0),
+        borrowed(false) {
+    size_t misalignment =
+        reinterpret_cast<uintptr_t>(&storage[0]) % alignment;
+    data = &storage[0];
+    if (misalignment != 0)
+      data += alignment - misalignment;
+  }
+
+  Block(const char* raw, size_t length)
+      : data(const_cast<char*>(raw)),
+        size(length),
+        borrowed(true) {
+  }
+
+  std::vector<char> storage;
+  char* data;
+  size_t size;
+  bool borrowed;
+};
+
+const size_t CTFProducer::kDefaultWriteBlocks = 2;
+
+CTFProducer::CTFProducer()
+    : stream_size_(0),
+      max_stream_size_(0),
+      max_stream_duration_(0),
+      next_stream_file_(0),
+      stream_start_timestamp_(0),
+      stream_files_(0),
+      packet_index_(false),
+      block_(NULL),
+      write_blocks_(0),
+      direct_io_(false),
+      io_uring_(false),
+      stopping_(false),
+      write_failed_(false),
+      max_write_queue_depth_(0),
+      write_stall_time_(0),
+      write_time_(0) {
+}
+
+CTFProducer::~CTFProducer() {
+  // The writing thread writes the queued blocks before stopping.
+  if (writer_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    block_queued_.notify_one();
+    writer_.join();
+  }
+
+  delete block_;
+  for (size_t i = 0; i < free_blocks_.size(); ++i)
+    delete free_blocks_[i];
+}
+
+void CTFProducer::set_write_blocks(size_t blocks) {
+  assert(!stream_.IsOpen());
+  assert(write_blocks_ == 0);
+  assert(blocks != 1);
+
+  if (blocks == 0)
+    return;
+  write_blocks_ = blocks;
+  size_t alignment = base::OutputFile::GetDirectAlignment();
+  for (size_t i = 0; i < blocks; ++i)
+    free_blocks_.push_back(new Block(alignment));
+  writer_ = std::thread(&CTFProducer::RunWriter, this);
+}
+
+#if defined(_WIN32)
+
 bool CTFProducer::OpenFolder(const std::wstring& folder, bool overwrite) {
   if (!folder_.empty() || folder.empty())
     return false;
@@ -45,7 +232,11 @@ bool CTFProducer::OpenFolder(const std::wstring& folder, bool overwrite) {
   if (!overwrite || GetLastError() != ERROR_ALREADY_EXISTS)
     return false;
 
-  // Erase all files in the folder.
+  return EraseFolderContent(folder_);
+}
+
+bool CTFProducer::EraseFolderContent(const std::wstring& folder) {
+  // Erase all files in the folder, and the folder of the packet indexes.
   bool erase_all_sucessful = true;
   WIN32_FIND_DATA FindFileData;
   std::wstring pattern = folder + L"\\*";
@@ -54,11 +245,20 @@ bool CTFProducer::OpenFolder(const std::wstring& folder, bool overwrite) {
     std::wstring filename = FindFileData.cFileName;
     std::wstring path = folder + L"\\" + filename;
 
-    // Erase the current file.
-    if (filename != L"." && filename != L".." &&
-        DeleteFile(path.c_str()) == FALSE) {
-      std::wcerr << L"Could not erase file \"" << path << L"\"" << std::endl;
-      erase_all_sucessful = false;
+    // Erase the current file or folder.
+    if (filename != L"." && filename != L"..") {
+      bool erased = false;
+      if ((FindFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+        erased = EraseFolderContent(path) &&
+                 RemoveDirectory(path.c_str()) != FALSE;
+      } else {
+        erased = DeleteFile(path.c_str()) != FALSE;
+      }
+      if (!erased) {
+        std::wcerr << L"Could not erase file \"" << path << L"\""
+                   << std::endl;
+        erase_all_sucessful = false;
+      }
     }
 
     // Move to the next file.
@@ -72,26 +272,247 @@ bool CTFProducer::OpenFolder(const std::wstring& folder, bool overwrite) {
   return erase_all_sucessful;
 }
 
+#else  // defined(_WIN32)
+
+bool CTFProducer::OpenFolder(const std::wstring& folder, bool overwrite) {
+  if (!folder_.empty() || folder.empty())
+    return false;
+  folder_ = folder;
+
+  // Try to create the folder.
+  std::string native_folder = base::NarrowNativePath(folder_);
+  if (::mkdir(native_folder.c_str(), 0755) == 0)
+    return true;
+
+  // We cannot overwrite the folder.
+  if (!overwrite || errno != EEXIST)
+    return false;
+
+  return EraseFolderContent(folder_);
+}
+
+bool CTFProducer::EraseFolderContent(const std::wstring& folder) {
+  std::string native_folder = base::NarrowNativePath(folder);
+  DIR* dir = ::opendir(native_folder.c_str());
+  if (dir == NULL)
+    return false;
+
+  // Erase all files in the folder, and the folder of the packet indexes.
+  bool erase_all_sucessful = true;
+  while (struct dirent* entry = ::readdir(dir)) {
+    std::string filename = entry->d_name;
+    if (filename == "." || filename == "..")
+      continue;
+
+    std::string path = native_folder + "/" + filename;
+    struct stat info;
+    if (::lstat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+      if (!EraseFolderContent(base::WidenNativePath(path.c_str())) ||
+          ::rmdir(path.c_str()) != 0) {
+        erase_all_sucessful = false;
+      }
+      continue;
+    }
+
+    if (::unlink(path.c_str()) != 0) {
+      std::wcerr << L"Could not erase file \""
+                 << base::WidenNativePath(path.c_str()) << L"\"" << std::endl;
+      erase_all_sucessful = false;
+    }
+  }
+  ::closedir(dir);
+
+  // Returns success when all files are removed.
+  return erase_all_sucessful;
+}
+
+#endif  // defined(_WIN32)
+
+bool CTFProducer::ReopenFolder(const std::wstring& folder) {
+  if (!folder_.empty() || folder.empty())
+    return false;
+  folder_ = folder;
+  return true;
+}
+
 bool CTFProducer::OpenStream(const std::wstring& filename) {
-  assert(!stream_.is_open());
+  assert(!stream_.IsOpen());
+
+  stream_name_ = filename;
+  next_stream_file_ = 0;
+  return OpenStreamFile();
+}
+
+bool CTFProducer::OpenStreamFile() {
+  // The files of a rotated stream are numbered from 0.
+  std::wstring filename = stream_name_;
+  if (rotated()) {
+    std::wstringstream ss;
+    ss << stream_name_ << L"." << next_stream_file_;
+    filename = ss.str();
+  }
+  ++next_stream_file_;
+  ++stream_files_;
+
+  if (packet_index_ && !OpenPacketIndex(filename, 0))
+    return false;
+
+  ConfigureStream();
+  stream_size_ = 0;
+  ResetWriteFailure();
+  return stream_.Open(base::JoinPath(folder_, filename), false);
+}
+
+bool CTFProducer::AppendStream(const std::wstring& filename, uint64_t size) {
+  assert(!stream_.IsOpen());
+  assert(!rotated());
+
+  std::wstring path = base::JoinPath(folder_, filename);
+  uint64_t file_size = 0;
+  if (!base::GetFileSize(path, &file_size) || file_size < size)
+    return false;
+  if (file_size > size && !base::TruncateFile(path, size))
+    return false;
+
+  // A packet index that would not describe the appended packets is removed.
+  std::wstring index_path = GetPacketIndexPath(folder_, filename);
+  if (packet_index_) {
+    if (!OpenPacketIndex(filename, size))
+      return false;
+  } else if (base::FileExists(index_path) && !base::RemoveFile(index_path)) {
+    return false;
+  }
+
+  stream_name_ = filename;
+  next_stream_file_ = 1;
+  ++stream_files_;
+
+  ConfigureStream();
+  stream_size_ = size;
+  ResetWriteFailure();
+  return stream_.Open(path, true);
+}
+
+bool CTFProducer::CheckPacketIndex(const std::wstring& folder,
+                                   const std::wstring& name, uint64_t size) {
+  uint64_t entries = 0;
+  return CountPacketIndexEntries(GetPacketIndexPath(folder, name), size,
+                                 &entries);
+}
+
+bool CTFProducer::OpenPacketIndex(const std::wstring& filename,
+                                  uint64_t size) {
+  assert(!index_.is_open());
+
+  if (!base::CreateFolder(base::JoinPath(folder_, kPacketIndexFolder)))
+    return false;
+  std::wstring path = GetPacketIndexPath(folder_, filename);
+  index_path_ = path;
+#if defined(_WIN32)
+  const std::wstring& native_path = path;
+#else
+  std::string native_path = base::NarrowNativePath(path);
+#endif
 
-  std::wstringstream ss;
-  ss << folder_ << L"\\" << filename;
+  // Keep the entries of the packets kept in the stream file.
+  if (size != 0) {
+    uint64_t entries = 0;
+    if (!CountPacketIndexEntries(path, size, &entries) ||
+        !base::TruncateFile(path, kPacketIndexHeaderSize +
+                                  entries * kPacketIndexEntrySize)) {
+      return false;
+    }
+    index_.open(native_path.c_str(),
+                std::ofstream::out | std::ofstream::app |
+                std::ofstream::binary);
+    return index_.is_open();
+  }
+
+  std::string header;
+  EncodeBigEndian(kPacketIndexMagic, &header);
+  EncodeBigEndian(kPacketIndexMajor, &header);
+  EncodeBigEndian(kPacketIndexMinor, &header);
+  EncodeBigEndian(static_cast<uint32_t>(kPacketIndexEntrySize), &header);
+  index_.open(native_path.c_str(),
+              std::ofstream::out | std::ofstream::trunc |
+              std::ofstream::binary);
+  index_.write(header.data(), header.size());
+  return index_.is_open() && !index_.fail();
+}
 
-  stream_.open(ss.str(),
+bool CTFProducer::RewriteStream(const std::wstring& filename,
+                                const char* raw, size_t length) {
+  assert(raw != NULL || length == 0);
+
+  // Write the new content aside, on the disk, then replace the stream.
+  std::wstring path = base::JoinPath(folder_, filename);
+  std::wstring temporary_path = path + L".tmp";
+#if defined(_WIN32)
+  const std::wstring& native_path = temporary_path;
+#else
+  std::string native_path = base::NarrowNativePath(temporary_path);
+#endif
+
+  std::ofstream stream(native_path.c_str(),
       std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
-  return stream_.good();
+  stream.write(raw, length);
+  stream.close();
+  return !stream.fail() && base::SyncFile(temporary_path) &&
+      base::RenameFile(temporary_path, path) && base::SyncFolder(folder_);
 }
 
 bool CTFProducer::CloseStream() {
-  if (!stream_.is_open())
+  if (!stream_.IsOpen())
     return false;
-  stream_.close();
+  bool flushed = Flush();
+  bool closed = stream_.Close();
+  if (index_.is_open()) {
+    index_.close();
+    closed = closed && !index_.fail();
+  }
+  return flushed && closed;
+}
 
-  if (stream_.fail())
+bool CTFProducer::WritePacket(const char* raw, size_t length,
+                              size_t content_size, size_t events,
+                              uint64_t start_timestamp,
+                              uint64_t stop_timestamp) {
+  if (!stream_.IsOpen())
     return false;
 
-  return true;
+  if (stream_size_ != 0) {
+    // Start the next file when this packet would exceed the bounds of the
+    // active one. The active file is complete once closed.
+    bool full = max_stream_size_ != 0 &&
+        stream_size_ + length > max_stream_size_;
+    bool long_enough = max_stream_duration_ != 0 &&
+        stop_timestamp > stream_start_timestamp_ &&
+        stop_timestamp - stream_start_timestamp_ > max_stream_duration_;
+    if ((full || long_enough) && (!CloseStream() || !OpenStreamFile()))
+      return false;
+  }
+
+  if (stream_size_ == 0)
+    stream_start_timestamp_ = start_timestamp;
+
+  if (index_.is_open()) {
+    // The sizes are in bits. No event is discarded, and the streams have no
+    // id: the trace has a single stream class.
+    std::string entry;
+    EncodeBigEndian(stream_size_, &entry);
+    EncodeBigEndian(static_cast<uint64_t>(length) * 8, &entry);
+    EncodeBigEndian(static_cast<uint64_t>(content_size) * 8, &entry);
+    EncodeBigEndian(start_timestamp, &entry);
+    EncodeBigEndian(stop_timestamp, &entry);
+    EncodeBigEndian(static_cast<uint64_t>(0), &entry);
+    EncodeBigEndian(static_cast<uint64_t>(0), &entry);
+    EncodeBigEndian(static_cast<uint64_t>(events), &entry);
+    index_.write(entry.data(), entry.size());
+    if (index_.fail())
+      return false;
+  }
+
+  return Write(raw, length);
 }
 
 bool CTFProducer::Write(const char* raw, size_t length) {
@@ -100,12 +521,171 @@ bool CTFProducer::Write(const char* raw, size_t length) {
 
   assert(raw != NULL);
 
-  if (!stream_.is_open())
+  if (!stream_.IsOpen())
     return false;
-  assert(stream_.good());
-  stream_.write(raw, length);
+  stream_size_ += length;
+
+  if (write_blocks_ == 0) {
+    const char* written = NULL;
+    stream_.StartWrite(raw, length);
+    if (!stream_.WaitWrite(&written))
+      write_failed_ = true;
+    return !write_failed_;
+  }
+
+  // A write of a block or more is not copied, unless the copy keeps the
+  // writes aligned for the writes without the system cache.
+  size_t alignment = stream_.direct_alignment();
+  bool aligned = reinterpret_cast<uintptr_t>(raw) % alignment == 0 &&
+                 length % alignment == 0;
+  if (length >= kWriteBlockSize && (!direct_io_ || aligned))
+    return WriteBorrowedBlock(raw, length);
+
+  // Fill the blocks, and queue each one once full.
+  while (length != 0) {
+    if (block_ == NULL) {
+      base::Stopwatch stopwatch;
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (free_blocks_.empty())
+        block_written_.wait(lock);
+      block_ = free_blocks_.back();
+      free_blocks_.pop_back();
+      write_stall_time_ += stopwatch.Elapsed();
+    }
+
+    size_t size = std::min(length, kWriteBlockSize - block_->size);
+    ::memcpy(block_->data + block_->size, raw, size);
+    block_->size += size;
+    raw += size;
+    length -= size;
+    if (block_->size == kWriteBlockSize && !QueueBlock())
+      return false;
+  }
 
   return true;
 }
 
+bool CTFProducer::WriteBorrowedBlock(const char* raw, size_t length) {
+  assert(write_blocks_ != 0);
+
+  // The bytes of the block being filled are written first.
+  if (block_ != NULL && !QueueBlock())
+    return false;
+
+  // The caller's bytes are valid until Write returns: wait for their write,
+  // even when a previous write failed.
+  Block borrowed(raw, length);
+  block_ = &borrowed;
+  QueueBlock();
+
+  base::Stopwatch stopwatch;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (borrowed.size != 0)
+    block_written_.wait(lock);
+  write_stall_time_ += stopwatch.Elapsed();
+  return !write_failed_;
+}
+
+bool CTFProducer::Flush() {
+  bool indexed = !index_.is_open() || !index_.flush().fail();
+  if (write_blocks_ == 0)
+    return indexed && !write_failed_;
+
+  if (block_ != NULL && !QueueBlock())
+    return false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!queued_blocks_.empty() || !writing_blocks_.empty())
+    block_written_.wait(lock);
+  return indexed && !write_failed_;
+}
+
+bool CTFProducer::Sync() {
+  if (!Flush() || !stream_.Sync() || !base::SyncFolder(folder_))
+    return false;
+  return !index_.is_open() ||
+      (base::SyncFile(index_path_) &&
+       base::SyncFolder(base::GetFolder(index_path_)));
+}
+
+void CTFProducer::ConfigureStream() {
+  // The caller's bytes are written directly without a writing thread: only
+  // the blocks are aligned.
+  stream_.set_direct(direct_io_ && write_blocks_ != 0);
+  stream_.set_queue_depth(io_uring_ && write_blocks_ != 0 ? write_blocks_ : 1);
+}
+
+bool CTFProducer::QueueBlock() {
+  assert(block_ != NULL);
+
+  bool failed = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_blocks_.push_back(block_);
+    max_write_queue_depth_ =
+        std::max(max_write_queue_depth_,
+                 queued_blocks_.size() + writing_blocks_.size());
+    failed = write_failed_;
+  }
+  block_ = NULL;
+  block_queued_.notify_one();
+  return !failed;
+}
+
+void CTFProducer::ResetWriteFailure() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  assert(queued_blocks_.empty());
+  assert(writing_blocks_.empty());
+  write_failed_ = false;
+}
+
+void CTFProducer::RunWriter() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    while (!stopping_ && queued_blocks_.empty() && writing_blocks_.empty())
+      block_queued_.wait(lock);
+    if (queued_blocks_.empty() && writing_blocks_.empty())
+      return;
+
+    // Start writing the next queued block while the stream accepts more
+    // writes in flight, otherwise wait for a write. The stream is only used
+    // by this thread while blocks are queued or being written.
+    Block* block = NULL;
+    if (!queued_blocks_.empty() && stream_.CanStartWrite()) {
+      block = queued_blocks_.front();
+      queued_blocks_.pop_front();
+      writing_blocks_.push_back(block);
+    }
+    lock.unlock();
+    base::Stopwatch stopwatch;
+    const char* written = NULL;
+    bool failed = false;
+    if (block != NULL)
+      stream_.StartWrite(block->data, block->size);
+    else
+      failed = !stream_.WaitWrite(&written);
+    double elapsed = stopwatch.Elapsed();
+    lock.lock();
+
+    write_time_ += elapsed;
+    if (written == NULL)
+      continue;
+
+    // The writes may complete in any order.
+    for (size_t i = 0; i < writing_blocks_.size(); ++i) {
+      if (writing_blocks_[i]->data != written)
+        continue;
+      block = writing_blocks_[i];
+      writing_blocks_.erase(writing_blocks_.begin() + i);
+      break;
+    }
+    assert(block != NULL);
+    write_failed_ = write_failed_ || failed;
+    block->size = 0;
+    if (!block->borrowed)
+      free_blocks_.push_back(block);
+    block_written_.notify_all();
+  }
+}
+
 }  // namespace converter
@@ -28,15 +28,17 @@
 #ifndef CONVERTER_CTF_PRODUCER_H_
 #define CONVERTER_CTF_PRODUCER_H_
 
-// Restrict the import to the windows basic includes.
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>  // NOLINT
-
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "base/disallow_copy_and_assign.h"
+#include "base/output_file.h"
 
 namespace converter {
 
@@ -54,9 +56,28 @@ namespace converter {
 //    encoder.Write(buffer, length);
 //  encoder.CloseStream();
 //
+// The streams may be written on a dedicated thread: the written bytes are
+// copied into blocks, and the full blocks are queued to the thread. Writing
+// waits for a block to be free when all the blocks are queued. The writes of
+// a block or more are queued without copy, and waited for. The blocks
+// may be written without the system cache, and several blocks may be in
+// flight through io_uring (see base::OutputFile).
+//
+// A stream may be rotated: it is then written to a sequence of files,
+// <name>.0, <name>.1..., each holding whole packets and bounded in size or in
+// duration. The files share the metadata of the trace, and each file is
+// complete once the next one is opened.
+//
+// Each stream file may come with the index of its packets, in the format of
+// LTTng: index/<file>.idx. Viewers seek in the file through its index,
+// without reading the header of each packet first.
 class CTFProducer {
  public:
-  CTFProducer() {}
+  // The default number of blocks of the writing thread.
+  static const size_t kDefaultWriteBlocks;
+
+  CTFProducer();
+  ~CTFProducer();
 
   // Forward declaration.
   class Packet;
@@ -68,27 +89,230 @@ class CTFProducer {
   // @returns true on success, false otherwise.
   bool OpenFolder(const std::wstring& folder, bool overwrite);
 
+  // Open an existing CTF root folder, keeping its files.
+  // @param folder the root folder of the trace file.
+  // @returns true on success, false otherwise.
+  bool ReopenFolder(const std::wstring& folder);
+
   // Open and change the active output stream.
   // @param name the name of the stream.
   // @returns true on success, false otherwise.
   bool OpenStream(const std::wstring& name);
 
-  // Close the active output stream.
+  // Open an existing output stream to append bytes to it, and change the
+  // active output stream. The bytes after the first |size| bytes of the
+  // stream are discarded first.
+  // @param name the name of the stream.
+  // @param size the number of bytes of the stream to keep.
+  // @returns true on success, false if the stream is shorter than |size| or
+  //     cannot be opened.
+  bool AppendStream(const std::wstring& name, uint64_t size);
+
+  // Close the active output stream, once all its bytes are written.
   // @returns true on success, false otherwise.
   bool CloseStream();
 
-  // Write bytes to the active output stream.
+  // Write a packet to the active output stream, and add it to the packet
+  // index. When the stream is rotated, the packet starts the next file of
+  // the stream if the current file would exceed its bounds; a file holds at
+  // least one packet.
+  // @param raw the bytes of the packet.
+  // @param length the size of the packet, in bytes.
+  // @param content_size the size of the packet without its padding, in
+  //     bytes.
+  // @param events the number of events of the packet.
+  // @param start_timestamp the timestamp of the first event of the packet.
+  // @param stop_timestamp the timestamp of the last event of the packet.
+  // @returns true on success, false otherwise.
+  bool WritePacket(const char* raw, size_t length, size_t content_size,
+                   size_t events, uint64_t start_timestamp,
+                   uint64_t stop_timestamp);
+
+  // Write bytes to the active output stream. With a writing thread, the
+  // bytes are written later, unless they fill a block: a failure may be
+  // reported by a later call.
   // @param raw the bytes to write.
   // @param length the number of bytes to write.
   // @returns true on success, false otherwise.
   bool Write(const char* raw, size_t length);
 
+  // Wait until the bytes given to Write are written to the active output
+  // stream, and its packet index is written.
+  // @returns true on success, false if a write failed.
+  bool Flush();
+
+  // Write the bytes given to Write and the packet index to the disk, so that
+  // they survive a crash of the system.
+  // @returns true on success, false if a write failed.
+  bool Sync();
+
+  // Write the streams on a dedicated thread, which overlaps the writes with
+  // the conversion. Must be called before the first stream is opened.
+  // @param blocks the number of blocks of the writing thread, at least 2:
+  //     one is filled while the others are written. 0 to write the streams
+  //     on the calling thread.
+  void set_write_blocks(size_t blocks);
+
+  // @returns the number of blocks of the writing thread, 0 without thread.
+  size_t write_blocks() const { return write_blocks_; }
+
+  // Write the streams without the system cache, when they are written on a
+  // dedicated thread. The packets should be multiples of the page size (see
+  // base::OutputFile::GetDirectAlignment): the stream is cached from the
+  // first unaligned write on.
+  // @param direct_io true to bypass the system cache.
+  void set_direct_io(bool direct_io) { direct_io_ = direct_io; }
+
+  // @returns true when the streams bypass the system cache.
+  bool direct_io() const { return direct_io_; }
+
+  // Submit the writes of the dedicated thread through io_uring, which keeps
+  // all the queued blocks in flight. Ignored where io_uring is unavailable.
+  // @param io_uring true to submit the writes through io_uring.
+  void set_io_uring(bool io_uring) { io_uring_ = io_uring; }
+
+  // @returns true when the writes are submitted through io_uring.
+  bool io_uring() const { return io_uring_; }
+
+  // Rotate the streams to a new file when the current file would exceed a
+  // size. Must be called before the first stream is opened.
+  // @param size the maximal size of a file, in bytes. 0 for no bound.
+  void set_max_stream_size(uint64_t size) { max_stream_size_ = size; }
+
+  // @returns the maximal size of the files of a stream, 0 for no bound.
+  uint64_t max_stream_size() const { return max_stream_size_; }
+
+  // Rotate the streams to a new file when the packets of the current file
+  // would span more than a duration. Must be called before the first stream
+  // is opened.
+  // @param duration the maximal duration of a file, in the units of the
+  //     timestamps. 0 for no bound.
+  void set_max_stream_duration(uint64_t duration) {
+    max_stream_duration_ = duration;
+  }
+
+  // @returns the maximal duration of the files of a stream, 0 for no bound.
+  uint64_t max_stream_duration() const { return max_stream_duration_; }
+
+  // Write the index of the packets of each stream file. Must be called
+  // before the first stream is opened.
+  // @param packet_index true to write the packet indexes.
+  void set_packet_index(bool packet_index) { packet_index_ = packet_index; }
+
+  // @returns true when the packet indexes are written.
+  bool packet_index() const { return packet_index_; }
+
+  // Check that the packet index of a stream file describes its first bytes,
+  // before appending to the stream file.
+  // @param folder the CTF root folder.
+  // @param name the name of the stream file.
+  // @param size the number of bytes of the stream file kept.
+  // @returns true when the index describes exactly the first |size| bytes,
+  //     false if it is missing or describes other packets.
+  static bool CheckPacketIndex(const std::wstring& folder,
+                               const std::wstring& name, uint64_t size);
+
+  // @returns true when the streams are rotated.
+  bool rotated() const {
+    return max_stream_size_ != 0 || max_stream_duration_ != 0;
+  }
+
+  // @returns the number of files opened for the streams.
+  size_t stream_files() const { return stream_files_; }
+
+  // @returns the maximal number of blocks queued to the writing thread.
+  size_t max_write_queue_depth() const { return max_write_queue_depth_; }
+
+  // @returns the time spent by Write waiting for a free block or for the
+  //     write of its bytes, in seconds.
+  double write_stall_time() const { return write_stall_time_; }
+
+  // @returns the time spent writing the blocks to the streams, in seconds.
+  double write_time() const { return write_time_; }
+
+  // Replace the content of a stream other than the active one, at once: the
+  // stream holds either its previous content or the new one, even if the
+  // conversion is interrupted or the system crashes.
+  // @param name the name of the stream.
+  // @param raw the new content of the stream.
+  // @param length the number of bytes of the new content.
+  // @returns true on success, false otherwise.
+  bool RewriteStream(const std::wstring& name, const char* raw,
+                     size_t length);
+
+  // @returns the CTF root folder.
+  const std::wstring& folder() const { return folder_; }
+
+  // @returns the number of bytes of the active file of the output stream.
+  uint64_t stream_size() const { return stream_size_; }
+
  private:
   // The CTF root folder.
   std::wstring folder_;
 
-  // The active output stream.
-  std::ofstream stream_;
+  // A block of the writing thread.
+  struct Block;
+
+  // Erase the files of a folder, and its subfolders.
+  static bool EraseFolderContent(const std::wstring& folder);
+
+  // Open the next file of the active output stream.
+  bool OpenStreamFile();
+
+  // Open the packet index of a stream file. The entries after the first
+  // |size| bytes of the stream file are discarded first.
+  bool OpenPacketIndex(const std::wstring& filename, uint64_t size);
+
+  // Write bytes through the writing thread without copying them into a
+  // block, and wait for their write.
+  bool WriteBorrowedBlock(const char* raw, size_t length);
+
+  void ConfigureStream();
+  bool QueueBlock();
+  void ResetWriteFailure();
+  void RunWriter();
+
+  // The active output stream, and the size of its active file.
+  base::OutputFile stream_;
+  uint64_t stream_size_;
+
+  // The bounds of the files of a rotated stream; the name of the active
+  // stream, the index of its next file and the timestamp of the first packet
+  // of its active file; the number of files opened for all the streams.
+  uint64_t max_stream_size_;
+  uint64_t max_stream_duration_;
+  std::wstring stream_name_;
+  size_t next_stream_file_;
+  uint64_t stream_start_timestamp_;
+  size_t stream_files_;
+
+  // The packet index of the active stream file.
+  bool packet_index_;
+  std::ofstream index_;
+  std::wstring index_path_;
+
+  // The block being filled, the free blocks, the blocks queued to the
+  // writing thread in the order they are written, and the blocks being
+  // written. The blocks are owned by the producer.
+  Block* block_;
+  std::vector<Block*> free_blocks_;
+  std::deque<Block*> queued_blocks_;
+  std::vector<Block*> writing_blocks_;
+  size_t write_blocks_;
+  bool direct_io_;
+  bool io_uring_;
+
+  // The writing thread, and the state shared with it.
+  std::thread writer_;
+  std::mutex mutex_;
+  std::condition_variable block_queued_;
+  std::condition_variable block_written_;
+  bool stopping_;
+  bool write_failed_;
+
+  size_t max_write_queue_depth_;
+  double write_stall_time_;
+  double write_time_;
 
   DISALLOW_COPY_AND_ASSIGN(CTFProducer);
 };
@@ -0,0 +1,276 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "converter/ctf_producer.h"
+
+#include <string>
+#include <vector>
+
+#include "base/disallow_copy_and_assign.h"
+#include "base/file_util.h"
+#include "base/mapped_file.h"
+#include "base/unittest.h"
+
+namespace converter {
+
+namespace {
+
+// The CTF root folder of the tests, and the name of their stream.
+const wchar_t kFolder[] = L"ctf_producer_unittest";
+const wchar_t kStream[] = L"stream";
+
+// The size of the packets written by the tests, and of their content.
+const size_t kPacketSize = 256;
+const size_t kContentSize = 200;
+
+// The packet index header, and the size of an entry.
+const uint32_t kPacketIndexMagic = 0xC1F1DCC1;
+const size_t kPacketIndexHeaderSize = 16;
+const size_t kPacketIndexEntrySize = 64;
+
+// A packet written to a stream, and the fields of its index entry.
+struct Packet {
+  Packet(char fill, size_t events, uint64_t start_timestamp)
+      : bytes(kPacketSize, fill),
+        events(events),
+        start_timestamp(start_timestamp),
+        stop_timestamp(start_timestamp + 5) {
+  }
+
+  std::string bytes;
+  size_t events;
+  uint64_t start_timestamp;
+  uint64_t stop_timestamp;
+};
+
+// @returns the packets numbered from |first| to |last|, excluded.
+std::vector<Packet> MakePackets(size_t first, size_t last) {
+  std::vector<Packet> packets;
+  for (size_t i = first; i < last; ++i)
+    packets.push_back(Packet(static_cast<char>('a' + i), i + 1, 1000 + 10 * i));
+  return packets;
+}
+
+// Write packets to the active stream of a producer.
+// @returns true on success, false otherwise.
+bool WritePackets(const std::vector<Packet>& packets, CTFProducer* producer) {
+  for (size_t i = 0; i < packets.size(); ++i) {
+    const Packet& packet = packets[i];
+    if (!producer->WritePacket(packet.bytes.data(), packet.bytes.size(),
+                               kContentSize, packet.events,
+                               packet.start_timestamp,
+                               packet.stop_timestamp)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// @returns the value of |size| bytes in big-endian order.
+uint64_t DecodeBigEndian(const uint8_t* raw, size_t size) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < size; ++i)
+    value = (value << 8) | raw[i];
+  return value;
+}
+
+// @returns the path of the packet index of a stream file, in the CTF root
+//     folder.
+std::wstring IndexName(const std::wstring& name) {
+  return base::JoinPath(L"index", name + L".idx");
+}
+
+// @returns the content of a file of the CTF root folder, or "missing".
+std::string ReadFile(const std::wstring& name) {
+  base::MappedFile file;
+  if (!file.Open(base::JoinPath(kFolder, name)))
+    return "missing";
+  return std::string(reinterpret_cast<const char*>(file.data()), file.size());
+}
+
+// Check a stream file and its packet index.
+// @param name the name of the stream file.
+// @param packets the packets expected in the stream file.
+void ExpectStreamFile(const std::wstring& name,
+                      const std::vector<Packet>& packets) {
+  std::string expected;
+  for (size_t i = 0; i < packets.size(); ++i)
+    expected += packets[i].bytes;
+  EXPECT_TRUE(expected == ReadFile(name));
+
+  // The index is in the format of LTTng, in big-endian order: a header and
+  // an entry per packet, sizes in bits.
+  std::string index = ReadFile(IndexName(name));
+  ASSERT_EQ(kPacketIndexHeaderSize + packets.size() * kPacketIndexEntrySize,
+            index.size());
+  const uint8_t* raw = reinterpret_cast<const uint8_t*>(index.data());
+  EXPECT_EQ(kPacketIndexMagic, DecodeBigEndian(raw, 4));
+  EXPECT_EQ(1U, DecodeBigEndian(raw + 4, 4));
+  EXPECT_EQ(0U, DecodeBigEndian(raw + 8, 4));
+  EXPECT_EQ(kPacketIndexEntrySize, DecodeBigEndian(raw + 12, 4));
+
+  for (size_t i = 0; i < packets.size(); ++i) {
+    const uint8_t* entry =
+        raw + kPacketIndexHeaderSize + i * kPacketIndexEntrySize;
+    EXPECT_EQ(i * kPacketSize, DecodeBigEndian(entry, 8));
+    EXPECT_EQ(kPacketSize * 8, DecodeBigEndian(entry + 8, 8));
+    EXPECT_EQ(kContentSize * 8, DecodeBigEndian(entry + 16, 8));
+    EXPECT_EQ(packets[i].start_timestamp, DecodeBigEndian(entry + 24, 8));
+    EXPECT_EQ(packets[i].stop_timestamp, DecodeBigEndian(entry + 32, 8));
+    EXPECT_EQ(0U, DecodeBigEndian(entry + 40, 8));
+    EXPECT_EQ(0U, DecodeBigEndian(entry + 48, 8));
+    EXPECT_EQ(packets[i].events, DecodeBigEndian(entry + 56, 8));
+  }
+}
+
+// The files of the rotated stream written by the tests, removed with the
+// object.
+class RotatedStream {
+ public:
+  RotatedStream() {}
+
+  ~RotatedStream() {
+    const wchar_t* kFiles[] = { L"stream.0", L"stream.1", L"stream.2" };
+    for (size_t i = 0; i < 3; ++i) {
+      base::RemoveFile(base::JoinPath(kFolder, kFiles[i]));
+      base::RemoveFile(base::JoinPath(kFolder, IndexName(kFiles[i])));
+    }
+  }
+
+  // Write a rotated stream of 7 packets, 3 packets per file.
+  // @returns true on success, false otherwise.
+  bool Write();
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(RotatedStream);
+};
+
+bool RotatedStream::Write() {
+  CTFProducer producer;
+  producer.set_write_blocks(0);
+  producer.set_packet_index(true);
+  producer.set_max_stream_size(3 * kPacketSize);
+  return producer.OpenFolder(kFolder, true) &&
+      producer.OpenStream(kStream) &&
+      WritePackets(MakePackets(0, 7), &producer) &&
+      producer.CloseStream() &&
+      producer.stream_files() == 3;
+}
+
+}  // namespace
+
+TEST(CTFProducerTest, RotatedStreamIndexes) {
+  RotatedStream stream;
+  ASSERT_TRUE(stream.Write());
+
+  std::vector<Packet> packets = MakePackets(0, 7);
+  ExpectStreamFile(L"stream.0",
+                   std::vector<Packet>(packets.begin(), packets.begin() + 3));
+  ExpectStreamFile(L"stream.1",
+                   std::vector<Packet>(packets.begin() + 3,
+                                       packets.begin() + 6));
+  ExpectStreamFile(L"stream.2",
+                   std::vector<Packet>(packets.begin() + 6, packets.end()));
+
+  // The index describes the packets of the stream file, and its prefixes
+  // ending on a packet boundary.
+  EXPECT_TRUE(CTFProducer::CheckPacketIndex(kFolder, L"stream.1",
+                                            3 * kPacketSize));
+  EXPECT_TRUE(CTFProducer::CheckPacketIndex(kFolder, L"stream.1",
+                                            kPacketSize));
+  EXPECT_FALSE(CTFProducer::CheckPacketIndex(kFolder, L"stream.1",
+                                             kPacketSize + 1));
+  EXPECT_FALSE(CTFProducer::CheckPacketIndex(kFolder, L"stream.1",
+                                             4 * kPacketSize));
+  EXPECT_FALSE(CTFProducer::CheckPacketIndex(kFolder, L"stream.3",
+                                             kPacketSize));
+}
+
+TEST(CTFProducerTest, AppendToRotatedStreamFile) {
+  RotatedStream stream;
+  ASSERT_TRUE(stream.Write());
+
+  // Keep the first 2 packets of the second file, then append 2 packets.
+  CTFProducer producer;
+  producer.set_write_blocks(0);
+  producer.set_packet_index(true);
+  ASSERT_TRUE(producer.ReopenFolder(kFolder));
+  ASSERT_TRUE(producer.AppendStream(L"stream.1", 2 * kPacketSize));
+  EXPECT_EQ(2 * kPacketSize, producer.stream_size());
+  std::vector<Packet> appended = MakePackets(10, 12);
+  EXPECT_TRUE(WritePackets(appended, &producer));
+  EXPECT_TRUE(producer.CloseStream());
+
+  std::vector<Packet> packets = MakePackets(3, 5);
+  packets.insert(packets.end(), appended.begin(), appended.end());
+  ExpectStreamFile(L"stream.1", packets);
+  EXPECT_TRUE(CTFProducer::CheckPacketIndex(kFolder, L"stream.1",
+                                            4 * kPacketSize));
+
+  // The other files are left unchanged.
+  ExpectStreamFile(L"stream.0", MakePackets(0, 3));
+  ExpectStreamFile(L"stream.2", MakePackets(6, 7));
+}
+
+TEST(CTFProducerTest, AppendStreamRejectsUnindexedSize) {
+  RotatedStream stream;
+  ASSERT_TRUE(stream.Write());
+
+  // The stream file is shorter than the size to keep.
+  CTFProducer longer;
+  longer.set_packet_index(true);
+  ASSERT_TRUE(longer.ReopenFolder(kFolder));
+  EXPECT_FALSE(longer.AppendStream(L"stream.2", 2 * kPacketSize));
+
+  // The size to keep doesn't end on a packet of the index.
+  CTFProducer unaligned;
+  unaligned.set_packet_index(true);
+  ASSERT_TRUE(unaligned.ReopenFolder(kFolder));
+  EXPECT_FALSE(unaligned.AppendStream(L"stream.0", kPacketSize + 8));
+}
+
+TEST(CTFProducerTest, AppendStreamWithoutIndex) {
+  RotatedStream stream;
+  ASSERT_TRUE(stream.Write());
+
+  // The index would not describe the appended packets: it is removed.
+  CTFProducer producer;
+  producer.set_write_blocks(0);
+  ASSERT_TRUE(producer.ReopenFolder(kFolder));
+  ASSERT_TRUE(producer.AppendStream(L"stream.0", kPacketSize));
+  EXPECT_TRUE(WritePackets(MakePackets(10, 11), &producer));
+  EXPECT_TRUE(producer.CloseStream());
+
+  std::vector<Packet> packets = MakePackets(0, 1);
+  std::vector<Packet> appended = MakePackets(10, 11);
+  EXPECT_TRUE(packets[0].bytes + appended[0].bytes ==
+              ReadFile(L"stream.0"));
+  EXPECT_EQ("missing", ReadFile(IndexName(L"stream.0")));
+  EXPECT_FALSE(CTFProducer::CheckPacketIndex(kFolder, L"stream.0",
+                                             2 * kPacketSize));
+}
+
+}  // namespace converter
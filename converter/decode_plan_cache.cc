@@ -0,0 +1,72 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/decode_plan_cache.h"
+
+#include <cstring>
+
+namespace converter {
+
+size_t DecodePlanCache::KeyHash::operator()(const Key& key) const {
+  // Mix the descriptor fields with the multiplicative constant of FNV-1a.
+  uint64_t data4 = 0;
+  ::memcpy(&data4, key.provider.Data4, sizeof(data4));
+  uint64_t hash = key.provider.Data1;
+  hash = hash * 0x100000001B3ULL ^ key.provider.Data2;
+  hash = hash * 0x100000001B3ULL ^ key.provider.Data3;
+  hash = hash * 0x100000001B3ULL ^ data4;
+  hash = hash * 0x100000001B3ULL ^ key.id;
+  hash = hash * 0x100000001B3ULL ^ key.version;
+  hash = hash * 0x100000001B3ULL ^ key.opcode;
+  return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+DecodePlan* DecodePlanCache::GetPlan(const EVENT_RECORD& record) {
+  const EVENT_DESCRIPTOR& descriptor = record.EventHeader.EventDescriptor;
+
+  Key key;
+  key.provider = record.EventHeader.ProviderId;
+  key.id = descriptor.Id;
+  key.version = descriptor.Version;
+  key.opcode = descriptor.Opcode;
+
+  PlanMap::iterator it = plans_.find(key);
+  if (it != plans_.end()) {
+    ++hits_;
+    return &it->second;
+  }
+
+  // Build the plan of this kind of event. An event without schema is kept in
+  // the cache as an invalid plan.
+  ++misses_;
+  DecodePlan& plan = plans_[key];
+  plan.valid = source_->GetEventSchema(record, &plan.schema);
+  if (!plan.valid)
+    plan.schema = EventSchema();
+
+  return &plan;
+}
+
+}  // namespace converter
@@ -0,0 +1,164 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// The decode plan cache keeps, for each kind of event, what is needed to
+// decode its payload: the event schema and the metadata id of the layout
+// produced by the last decoded event. Kinds of events are identified by the
+// provider, id, version and opcode of their event descriptor.
+//
+// The schema of an event is retrieved from the schema source the first time
+// the event is seen. Following events reuse the cached plan and skip the
+// schema source entirely. Events without a schema are cached too, so they are
+// rejected without querying the source again.
+
+#ifndef CONVERTER_DECODE_PLAN_CACHE_H_
+#define CONVERTER_DECODE_PLAN_CACHE_H_
+
+#include <cassert>
+#include <cstdint>
+#include <unordered_map>
+
+#include "converter/decode_program.h"
+#include "converter/event_schema.h"
+#include "base/disallow_copy_and_assign.h"
+#include "base/etw_types.h"
+
+namespace converter {
+
+// The information needed to decode the events of a given kind.
+struct DecodePlan {
+  DecodePlan() : valid(false), event_id(0), fingerprint(0) {}
+
+  // Whether the schema source provided a schema for these events.
+  bool valid;
+
+  // The schema of the events.
+  EventSchema schema;
+
+  // The metadata id and the fingerprint of the layout produced by the last
+  // event decoded with this plan, or 0 when unknown. Events with the same
+  // fingerprint reuse the id without looking up the metadata.
+  size_t event_id;
+  uint64_t fingerprint;
+
+  // The compiled decoders of the events with 32-bit and 64-bit pointers.
+  DecodeProgram programs[2];
+
+  // @param pointer_size the size of the pointers of the events.
+  // @returns the decoder of the events, or NULL when the size of their
+  //     pointers is unknown.
+  DecodeProgram* GetProgram(size_t pointer_size) {
+    if (pointer_size == 4)
+      return &programs[0];
+    if (pointer_size == 8)
+      return &programs[1];
+    return NULL;
+  }
+};
+
+class DecodePlanCache {
+ public:
+  // Constructor.
+  // @param source the source of the event schemas. Not owned.
+  explicit DecodePlanCache(SchemaSource* source)
+      : source_(source), hits_(0), misses_(0) {
+    assert(source != NULL);
+  }
+
+  // Retrieve the decode plan of an event. On a cache miss, the schema is
+  // retrieved from the schema source.
+  // @param record the event to decode.
+  // @returns the decode plan of the event. The plan stays valid as long as
+  //     the cache is not cleared.
+  DecodePlan* GetPlan(const EVENT_RECORD& record);
+
+  // Remove all the plans from the cache.
+  void Clear() { plans_.clear(); }
+
+  // @returns the source of the event schemas.
+  SchemaSource* source() const { return source_; }
+
+  // Replace the source of the event schemas. The plans built from the
+  // previous source are removed.
+  // @param source the source of the event schemas. Not owned.
+  void set_source(SchemaSource* source) {
+    assert(source != NULL);
+    source_ = source;
+    Clear();
+  }
+
+  // @returns the number of plans in the cache.
+  size_t size() const { return plans_.size(); }
+
+  // @returns the number of lookups resolved from the cache.
+  size_t hits() const { return hits_; }
+
+  // @returns the number of lookups that queried the schema source.
+  size_t misses() const { return misses_; }
+
+  // Account for the lookups of another cache, e.g. a cache used by another
+  // thread.
+  // @param other the cache whose lookups are accounted.
+  void AddStatistics(const DecodePlanCache& other) {
+    hits_ += other.hits_;
+    misses_ += other.misses_;
+  }
+
+ private:
+  // Identifies a kind of event.
+  struct Key {
+    GUID provider;
+    uint16_t id;
+    uint8_t version;
+    uint8_t opcode;
+
+    bool operator==(const Key& key) const {
+      return id == key.id && version == key.version &&
+          opcode == key.opcode && IsEqualGUID(provider, key.provider);
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  typedef std::unordered_map<Key, DecodePlan, KeyHash> PlanMap;
+
+  // The source of the event schemas.
+  SchemaSource* source_;
+
+  // The cached plans.
+  PlanMap plans_;
+
+  // Statistics about the lookups.
+  size_t hits_;
+  size_t misses_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecodePlanCache);
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_DECODE_PLAN_CACHE_H_
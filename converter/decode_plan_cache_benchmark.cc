@@ -0,0 +1,134 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Benchmark of the decode plan cache. Looks up the plans of a stream of
+// events of a few kinds, and compares with querying the schema source for
+// every event, as done without the cache.
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base/stopwatch.h"
+#include "converter/decode_plan_cache.h"
+
+namespace {
+
+using converter::DecodePlan;
+using converter::DecodePlanCache;
+using converter::EventSchema;
+using converter::SchemaSource;
+
+// Number of kinds of events in the stream.
+const size_t kKindCount = 64;
+
+// Number of properties of each schema.
+const size_t kPropertyCount = 8;
+
+// Number of events looked up.
+const size_t kEventCount = 2000000;
+
+// A schema source which builds a schema with |kPropertyCount| properties.
+// It stands for a source copying the schema out of the provider manifest.
+class BenchmarkSchemaSource : public SchemaSource {
+ public:
+  virtual bool GetEventSchema(const EVENT_RECORD& record,
+                              EventSchema* schema) {
+    schema->name = "Event" +
+        std::to_string(record.EventHeader.EventDescriptor.Id);
+    schema->properties.resize(kPropertyCount);
+    for (size_t i = 0; i < kPropertyCount; ++i) {
+      EventSchema::Property& property = schema->properties[i];
+      property.name = "property" + std::to_string(i);
+      property.source_name = L"property" + std::to_wstring(i);
+      property.in_type = TDH_INTYPE_UINT32;
+      property.length = 4;
+    }
+    return true;
+  }
+
+  virtual bool GetPropertyData(const EVENT_RECORD& /* record */,
+                               const EventSchema::Property& /* property */,
+                               size_t /* element */,
+                               std::vector<char>* /* buffer */,
+                               size_t* /* size */) {
+    return false;
+  }
+};
+
+}  // namespace
+
+int main() {
+  std::vector<EVENT_RECORD> records(kKindCount);
+  for (size_t i = 0; i < kKindCount; ++i) {
+    ::memset(&records[i], 0, sizeof(records[i]));
+    records[i].EventHeader.ProviderId.Data1 = static_cast<uint32_t>(i % 4);
+    records[i].EventHeader.EventDescriptor.Id = static_cast<uint16_t>(i);
+    records[i].EventHeader.EventDescriptor.Opcode =
+        static_cast<uint8_t>(i % 3);
+  }
+
+  BenchmarkSchemaSource source;
+
+  // Query the source for every event.
+  size_t properties = 0;
+  base::Stopwatch source_stopwatch;
+  for (size_t i = 0; i < kEventCount; ++i) {
+    EventSchema schema;
+    if (source.GetEventSchema(records[i % kKindCount], &schema))
+      properties += schema.properties.size();
+  }
+  double source_seconds = source_stopwatch.Elapsed();
+
+  // Query the cache for every event.
+  DecodePlanCache cache(&source);
+  size_t cached_properties = 0;
+  base::Stopwatch cache_stopwatch;
+  for (size_t i = 0; i < kEventCount; ++i) {
+    DecodePlan* plan = cache.GetPlan(records[i % kKindCount]);
+    if (plan->valid)
+      cached_properties += plan->schema.properties.size();
+  }
+  double cache_seconds = cache_stopwatch.Elapsed();
+
+  std::cout << std::fixed << std::setprecision(1)
+            << kEventCount << " events of " << kKindCount << " kinds.\n"
+            << "  schema source: " << std::setw(7)
+            << source_seconds * 1e9 / kEventCount << " ns/event\n"
+            << "  plan cache:    " << std::setw(7)
+            << cache_seconds * 1e9 / kEventCount << " ns/event ("
+            << cache.hits() << " hits, " << cache.misses() << " misses)"
+            << std::endl;
+
+  if (cached_properties != properties || cache.misses() != kKindCount ||
+      cache.hits() != kEventCount - kKindCount) {
+    std::cerr << "Unexpected cache behavior." << std::endl;
+    return 1;
+  }
+  return 0;
+}
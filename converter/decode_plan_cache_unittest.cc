@@ -0,0 +1,221 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "converter/decode_plan_cache.h"
+
+#include <cstring>
+#include <string>
+
+#include "base/unittest.h"
+
+namespace converter {
+
+namespace {
+
+// Id of the events without schema.
+const uint16_t kUnknownEventId = 0xDEAD;
+
+const GUID kProvider = {
+    0x11111111, 0x2222, 0x3333, { 0, 1, 2, 3, 4, 5, 6, 7 } };
+const GUID kOtherProvider = {
+    0x11111111, 0x2222, 0x3333, { 0, 1, 2, 3, 4, 5, 6, 8 } };
+
+// A schema source which describes every event but the ones with the id
+// |kUnknownEventId|, and counts its queries.
+class FakeSchemaSource : public SchemaSource {
+ public:
+  FakeSchemaSource() : queries_(0) {}
+
+  virtual bool GetEventSchema(const EVENT_RECORD& record,
+                              EventSchema* schema) {
+    ++queries_;
+    const EVENT_DESCRIPTOR& descriptor = record.EventHeader.EventDescriptor;
+    if (descriptor.Id == kUnknownEventId) {
+      // Leave a partial schema behind, which the cache must discard.
+      schema->name = "Partial";
+      return false;
+    }
+
+    schema->name = "Event" + std::to_string(descriptor.Id) + "v" +
+        std::to_string(descriptor.Version) + "o" +
+        std::to_string(descriptor.Opcode);
+    EventSchema::Property property;
+    property.name = "value";
+    property.in_type = TDH_INTYPE_UINT32;
+    property.length = 4;
+    schema->properties.push_back(property);
+    return true;
+  }
+
+  virtual bool GetPropertyData(const EVENT_RECORD& /* record */,
+                               const EventSchema::Property& /* property */,
+                               size_t /* element */,
+                               std::vector<char>* /* buffer */,
+                               size_t* /* size */) {
+    return false;
+  }
+
+  size_t queries() const { return queries_; }
+
+ private:
+  size_t queries_;
+};
+
+EVENT_RECORD MakeRecord(const GUID& provider, uint16_t id, uint8_t version,
+                        uint8_t opcode) {
+  EVENT_RECORD record;
+  ::memset(&record, 0, sizeof(record));
+  record.EventHeader.ProviderId = provider;
+  record.EventHeader.EventDescriptor.Id = id;
+  record.EventHeader.EventDescriptor.Version = version;
+  record.EventHeader.EventDescriptor.Opcode = opcode;
+  return record;
+}
+
+}  // namespace
+
+TEST(DecodePlanCacheTest, MissThenHit) {
+  FakeSchemaSource source;
+  DecodePlanCache cache(&source);
+  EXPECT_TRUE(cache.source() == &source);
+
+  EVENT_RECORD record = MakeRecord(kProvider, 1, 0, 10);
+  DecodePlan* plan = cache.GetPlan(record);
+  ASSERT_TRUE(plan != NULL);
+  EXPECT_TRUE(plan->valid);
+  EXPECT_EQ(std::string("Event1v0o10"), plan->schema.name);
+  EXPECT_EQ(1U, plan->schema.properties.size());
+  EXPECT_EQ(1U, source.queries());
+  EXPECT_EQ(0U, cache.hits());
+  EXPECT_EQ(1U, cache.misses());
+
+  // The same kind of event reuses the plan without querying the source.
+  EXPECT_TRUE(cache.GetPlan(record) == plan);
+  EXPECT_EQ(1U, source.queries());
+  EXPECT_EQ(1U, cache.hits());
+  EXPECT_EQ(1U, cache.misses());
+  EXPECT_EQ(1U, cache.size());
+}
+
+TEST(DecodePlanCacheTest, KeyedOnDescriptor) {
+  FakeSchemaSource source;
+  DecodePlanCache cache(&source);
+
+  EVENT_RECORD record = MakeRecord(kProvider, 1, 0, 10);
+  DecodePlan* plan = cache.GetPlan(record);
+
+  // Each field of the key selects a different plan.
+  EVENT_RECORD other_provider = MakeRecord(kOtherProvider, 1, 0, 10);
+  EVENT_RECORD other_id = MakeRecord(kProvider, 2, 0, 10);
+  EVENT_RECORD other_version = MakeRecord(kProvider, 1, 1, 10);
+  EVENT_RECORD other_opcode = MakeRecord(kProvider, 1, 0, 11);
+  EXPECT_TRUE(cache.GetPlan(other_provider) != plan);
+  EXPECT_TRUE(cache.GetPlan(other_id) != plan);
+  EXPECT_TRUE(cache.GetPlan(other_version) != plan);
+  EXPECT_TRUE(cache.GetPlan(other_opcode) != plan);
+  EXPECT_EQ(5U, cache.size());
+  EXPECT_EQ(5U, source.queries());
+  EXPECT_EQ(std::string("Event1v1o10"),
+            cache.GetPlan(other_version)->schema.name);
+
+  // Fields outside of the key do not.
+  EVENT_RECORD same_kind = record;
+  same_kind.EventHeader.EventDescriptor.Level = 4;
+  same_kind.EventHeader.EventDescriptor.Task = 7;
+  same_kind.EventHeader.EventDescriptor.Keyword = 0xFF;
+  same_kind.EventHeader.ProcessId = 1234;
+  same_kind.UserDataLength = 4;
+  EXPECT_TRUE(cache.GetPlan(same_kind) == plan);
+  EXPECT_EQ(5U, source.queries());
+  EXPECT_EQ(5U, cache.misses());
+  EXPECT_EQ(2U, cache.hits());
+}
+
+TEST(DecodePlanCacheTest, SchemaMissIsCached) {
+  FakeSchemaSource source;
+  DecodePlanCache cache(&source);
+
+  EVENT_RECORD record = MakeRecord(kProvider, kUnknownEventId, 0, 0);
+  DecodePlan* plan = cache.GetPlan(record);
+  ASSERT_TRUE(plan != NULL);
+  EXPECT_FALSE(plan->valid);
+  EXPECT_TRUE(plan->schema.name.empty());
+  EXPECT_TRUE(plan->schema.properties.empty());
+
+  // The event is rejected again without querying the source.
+  EXPECT_TRUE(cache.GetPlan(record) == plan);
+  EXPECT_FALSE(plan->valid);
+  EXPECT_EQ(1U, source.queries());
+  EXPECT_EQ(1U, cache.hits());
+  EXPECT_EQ(1U, cache.misses());
+}
+
+TEST(DecodePlanCacheTest, ClearQueriesTheSourceAgain) {
+  FakeSchemaSource source;
+  DecodePlanCache cache(&source);
+
+  EVENT_RECORD record = MakeRecord(kProvider, 1, 0, 10);
+  cache.GetPlan(record)->event_id = 3;
+  cache.Clear();
+  EXPECT_EQ(0U, cache.size());
+
+  DecodePlan* plan = cache.GetPlan(record);
+  EXPECT_EQ(0U, plan->event_id);
+  EXPECT_EQ(2U, source.queries());
+  EXPECT_EQ(0U, cache.hits());
+  EXPECT_EQ(2U, cache.misses());
+}
+
+TEST(DecodePlanCacheTest, AddStatistics) {
+  FakeSchemaSource source;
+  DecodePlanCache cache(&source);
+  DecodePlanCache other(&source);
+
+  EVENT_RECORD record = MakeRecord(kProvider, 1, 0, 10);
+  cache.GetPlan(record);
+  other.GetPlan(record);
+  other.GetPlan(record);
+  other.GetPlan(record);
+
+  cache.AddStatistics(other);
+  EXPECT_EQ(2U, cache.hits());
+  EXPECT_EQ(2U, cache.misses());
+  EXPECT_EQ(1U, cache.size());
+
+  // The other cache is left unchanged.
+  EXPECT_EQ(2U, other.hits());
+  EXPECT_EQ(1U, other.misses());
+}
+
+TEST(DecodePlanCacheTest, ProgramsByPointerSize) {
+  DecodePlan plan;
+  EXPECT_TRUE(plan.GetProgram(4) == &plan.programs[0]);
+  EXPECT_TRUE(plan.GetProgram(8) == &plan.programs[1]);
+  EXPECT_TRUE(plan.GetProgram(0) == NULL);
+  EXPECT_TRUE(plan.GetProgram(2) == NULL);
+}
+
+}  // namespace converter
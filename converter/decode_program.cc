@@ -0,0 +1,443 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/decode_program.h"
+
+#include <cassert>
+#include <cstring>
+
+#include "converter/payload_walker.h"
+
+namespace converter {
+
+const size_t DecodeProgram::kMaxCountRegisters;
+const size_t DecodeProgram::kNoCountRegister;
+
+bool DecodeProgram::Compile(const EventSchema& schema,
+                            size_t pointer_size,
+                            const Metadata::Event& layout) {
+  compiled_ = true;
+  valid_ = false;
+  passthrough_size_ = 0;
+  instructions_.clear();
+  layout_ = layout;
+  event_id_ = 0;
+
+  // Assign a register to the properties holding the number of elements or
+  // the length of a following property.
+  std::vector<size_t> count_registers(schema.properties.size(),
+                                      kNoCountRegister);
+  size_t registers = 0;
+  for (size_t i = 0; i < schema.properties.size(); ++i) {
+    const EventSchema::Property& property = schema.properties[i];
+    size_t count_property = i;
+    if (property.flags == PropertyParamCount)
+      count_property = property.count_property;
+    else if (property.flags == PropertyParamLength)
+      count_property = property.length_property;
+    else
+      continue;
+
+    if (count_property >= i ||
+        !PayloadWalker::IsCountProperty(schema.properties[count_property])) {
+      return false;
+    }
+    if (count_registers[count_property] == kNoCountRegister) {
+      if (registers == kMaxCountRegisters)
+        return false;
+      count_registers[count_property] = registers++;
+    }
+  }
+
+  const size_t root = Metadata::kRootScope;
+  for (size_t i = 0; i < schema.properties.size(); ++i) {
+    const EventSchema::Property& property = schema.properties[i];
+
+    // A binary value whose length is held by a previous property.
+    if (property.flags == PropertyParamLength) {
+      const std::string& length_name =
+          schema.properties[property.length_property].name;
+      if (property.in_type != TDH_INTYPE_BINARY || property.count > 1 ||
+          !IsCountField(layout_, length_name)) {
+        return false;
+      }
+      layout_.AddField(Metadata::Field(Metadata::Field::BINARY_VAR,
+                                       property.name,
+                                       length_name,
+                                       root));
+      Emit(COPY, 1, count_registers[property.length_property]);
+      continue;
+    }
+
+    bool counted = property.flags == PropertyParamCount;
+    if (!counted && (property.flags != 0 || property.count == 0))
+      return false;
+
+    // Determine the instruction decoding an element of the property, and the
+    // type of the decoded value.
+    OpCode op = COPY;
+    size_t size = PayloadWalker::GetFixedSize(property, pointer_size);
+    switch (property.in_type) {
+      case TDH_INTYPE_UNICODESTRING:
+        op = UTF16_STRING;
+        break;
+      case TDH_INTYPE_ANSISTRING:
+        op = ANSI_STRING;
+        break;
+      case TDH_INTYPE_BOOLEAN:
+        op = BOOLEAN32;
+        break;
+    }
+
+    // Strings of fixed length are not null-terminated.
+    bool is_string = op == UTF16_STRING || op == ANSI_STRING;
+    if (is_string && property.length != 0)
+      return false;
+
+    Metadata::Field::FieldType type = Metadata::Field::INVALID;
+    if ((!is_string && size == 0) ||
+        !GetFieldType(property.in_type, property.out_type, size, &type)) {
+      return false;
+    }
+
+    // Describe the decoded values.
+    size_t parent = root;
+    if (counted) {
+      const std::string& count_name =
+          schema.properties[property.count_property].name;
+      if (!IsCountField(layout_, count_name))
+        return false;
+      layout_.AddField(Metadata::Field(Metadata::Field::ARRAY_VAR,
+                                       property.name,
+                                       count_name,
+                                       root));
+      parent = layout_.size() - 1;
+    } else if (property.count > 1) {
+      layout_.AddField(Metadata::Field(Metadata::Field::ARRAY_FIXED,
+                                       property.name,
+                                       property.count,
+                                       root));
+      parent = layout_.size() - 1;
+    }
+    layout_.AddField(Metadata::Field(type, property.name, parent));
+
+    if (counted) {
+      // The elements are decoded as many times as the count register.
+      Emit(op, size, count_registers[property.count_property]);
+    } else if (count_registers[i] != kNoCountRegister) {
+      // The count is copied, and loaded for the following properties.
+      Emit(LOAD_COUNT, size, count_registers[i]);
+    } else {
+      for (size_t element = 0; element < property.count; ++element)
+        Emit(op, size, kNoCountRegister);
+    }
+  }
+
+  // A program made of a single copy decodes payloads holding only fixed-size
+  // values: the layout describes the native layout of the payload.
+  if (instructions_.size() == 1 && instructions_[0].op == COPY &&
+      instructions_[0].count_register == kNoCountRegister) {
+    passthrough_size_ = instructions_[0].size;
+  }
+
+  valid_ = true;
+  return true;
+}
+
+bool DecodeProgram::Run(const uint8_t* payload, size_t length,
+                        Metadata::Packet* packet) const {
+  assert(valid_);
+  assert(payload != NULL || length == 0);
+  assert(packet != NULL);
+
+  const uint8_t* data = payload;
+  const uint8_t* end = payload + length;
+
+  // The values of the count properties.
+  uint64_t counts[kMaxCountRegisters] = {};
+
+  for (size_t i = 0; i < instructions_.size(); ++i) {
+    const Instruction& instruction = instructions_[i];
+    size_t remaining = end - data;
+
+    // The number of times the instruction is run.
+    uint64_t count = 1;
+    if (instruction.op != LOAD_COUNT &&
+        instruction.count_register != kNoCountRegister) {
+      count = counts[instruction.count_register];
+    }
+
+    switch (instruction.op) {
+      case COPY: {
+        if (count > remaining / instruction.size)
+          return false;
+        size_t size = static_cast<size_t>(count) * instruction.size;
+        packet->EncodeBytes(data, size);
+        data += size;
+        break;
+      }
+
+      case LOAD_COUNT:
+        if (remaining < instruction.size)
+          return false;
+        counts[instruction.count_register] =
+            PayloadWalker::LoadCount(data, instruction.size);
+        packet->EncodeBytes(data, instruction.size);
+        data += instruction.size;
+        break;
+
+      default:
+        for (uint64_t element = 0; element < count; ++element) {
+          if (!RunElement(instruction.op, &data, end, packet))
+            return false;
+        }
+        break;
+    }
+  }
+
+  return true;
+}
+
+bool DecodeProgram::RunElement(OpCode op, const uint8_t** data,
+                               const uint8_t* end, Metadata::Packet* packet) {
+  assert(data != NULL);
+  assert(packet != NULL);
+
+  const uint8_t* element = *data;
+  size_t remaining = end - element;
+
+  switch (op) {
+    case BOOLEAN32: {
+      uint32_t value = 0;
+      if (remaining < sizeof(value))
+        return false;
+      ::memcpy(&value, element, sizeof(value));
+      packet->EncodeUInt8(value != 0);
+      *data += sizeof(value);
+      return true;
+    }
+
+    case UTF16_STRING: {
+      size_t offset = 0;
+      while (offset + 1 < remaining &&
+             (element[offset] != 0 || element[offset + 1] != 0)) {
+        offset += 2;
+      }
+      if (offset + 1 >= remaining)
+        return false;
+      packet->EncodeUTF16String(reinterpret_cast<const uint16_t*>(element),
+                                offset / 2);
+      *data += offset + 2;
+      return true;
+    }
+
+    case ANSI_STRING: {
+      const void* terminator = remaining > 0 ?
+          ::memchr(element, 0, remaining) : NULL;
+      if (terminator == NULL)
+        return false;
+      size_t size = static_cast<const uint8_t*>(terminator) - element + 1;
+      packet->EncodeBytes(element, size);
+      *data += size;
+      return true;
+    }
+
+    default:
+      break;
+  }
+
+  assert(false);
+  return false;
+}
+
+bool DecodeProgram::GetFieldType(unsigned int in_type,
+                                 unsigned int out_type,
+                                 size_t size,
+                                 Metadata::Field::FieldType* type) {
+  assert(type != NULL);
+
+  switch (in_type) {
+    case TDH_INTYPE_UNICODESTRING:
+    case TDH_INTYPE_ANSISTRING:
+      *type = Metadata::Field::STRING;
+      return true;
+
+    case TDH_INTYPE_UNICODECHAR:
+      *type = Metadata::Field::XINT16;
+      return size == 2;
+
+    case TDH_INTYPE_ANSICHAR:
+    case TDH_INTYPE_INT8:
+    case TDH_INTYPE_UINT8:
+      switch (out_type) {
+        case TDH_OUTTYPE_HEXINT8:
+          *type = Metadata::Field::XINT8;
+          break;
+        case TDH_OUTTYPE_BYTE:
+          *type = Metadata::Field::INT8;
+          break;
+        case TDH_OUTTYPE_UNSIGNEDBYTE:
+          *type = Metadata::Field::UINT8;
+          break;
+        default:
+          if (in_type == TDH_INTYPE_INT8) {
+            *type = Metadata::Field::INT8;
+          } else {
+            *type = Metadata::Field::UINT8;
+          }
+          break;
+      }
+      return size == 1;
+
+    case TDH_INTYPE_INT16:
+    case TDH_INTYPE_UINT16:
+      switch (out_type) {
+        case TDH_OUTTYPE_HEXINT16:
+          *type = Metadata::Field::XINT16;
+          break;
+        case TDH_OUTTYPE_SHORT:
+          *type = Metadata::Field::INT16;
+          break;
+        case TDH_OUTTYPE_UNSIGNEDSHORT:
+          *type = Metadata::Field::UINT16;
+          break;
+        default:
+          if (in_type == TDH_INTYPE_INT16) {
+            *type = Metadata::Field::INT16;
+          } else {
+            *type = Metadata::Field::UINT16;
+          }
+          break;
+      }
+      return size == 2;
+
+    case TDH_INTYPE_INT32:
+    case TDH_INTYPE_UINT32:
+      switch (out_type) {
+        case TDH_OUTTYPE_HEXINT32:
+          *type = Metadata::Field::XINT32;
+          break;
+        case TDH_OUTTYPE_INT:
+          *type = Metadata::Field::INT32;
+          break;
+        case TDH_OUTTYPE_UNSIGNEDINT:
+          *type = Metadata::Field::UINT32;
+          break;
+        default:
+          if (in_type == TDH_INTYPE_INT32) {
+            *type = Metadata::Field::INT32;
+          } else {
+            *type = Metadata::Field::UINT32;
+          }
+          break;
+      }
+      return size == 4;
+
+    case TDH_INTYPE_INT64:
+    case TDH_INTYPE_UINT64:
+      switch (out_type) {
+        case TDH_OUTTYPE_HEXINT64:
+          *type = Metadata::Field::XINT64;
+          break;
+        default:
+          if (in_type == TDH_INTYPE_INT64) {
+            *type = Metadata::Field::INT64;
+          } else {
+            *type = Metadata::Field::UINT64;
+          }
+          break;
+      }
+      return size == 8;
+
+    case TDH_INTYPE_BOOLEAN:
+      *type = Metadata::Field::UINT8;
+      return size == 1 || size == 4;
+
+    case TDH_INTYPE_GUID:
+      *type = Metadata::Field::GUID;
+      return size == 16;
+
+    case TDH_INTYPE_HEXINT32:
+      *type = Metadata::Field::XINT32;
+      return size == 4;
+
+    case TDH_INTYPE_HEXINT64:
+      *type = Metadata::Field::XINT64;
+      return size == 8;
+
+    case TDH_INTYPE_FILETIME:
+      *type = Metadata::Field::UINT64;
+      return size == 8;
+
+    case TDH_INTYPE_POINTER:
+    case TDH_INTYPE_SIZET:
+      if (size == 4) {
+        *type = Metadata::Field::XINT32;
+        return true;
+      } else if (size == 8) {
+        *type = Metadata::Field::XINT64;
+        return true;
+      }
+      break;
+  }
+
+  return false;
+}
+
+bool DecodeProgram::IsCountField(const Metadata::Event& layout,
+                                 const std::string& name) {
+  for (size_t i = 0; i < layout.size(); ++i) {
+    const Metadata::Field& field = layout.at(i);
+    if (field.parent() != Metadata::kRootScope || field.name() != name)
+      continue;
+
+    switch (field.type()) {
+      case Metadata::Field::UINT8:
+      case Metadata::Field::UINT16:
+      case Metadata::Field::UINT32:
+      case Metadata::Field::UINT64:
+      case Metadata::Field::XINT8:
+      case Metadata::Field::XINT16:
+      case Metadata::Field::XINT32:
+      case Metadata::Field::XINT64:
+        return true;
+      default:
+        return false;
+    }
+  }
+  return false;
+}
+
+void DecodeProgram::Emit(OpCode op, size_t size, size_t count_register) {
+  if (op == COPY && count_register == kNoCountRegister &&
+      !instructions_.empty() && instructions_.back().op == COPY &&
+      instructions_.back().count_register == kNoCountRegister) {
+    instructions_.back().size += size;
+    return;
+  }
+  instructions_.push_back(Instruction(op, size, count_register));
+}
+
+}  // namespace converter
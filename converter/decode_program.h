@@ -0,0 +1,180 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// A decode program decodes the payloads of the events sharing a schema. The
+// program is compiled once from the event schema into a short list of
+// instructions, run by a small interpreter for each event: adjacent
+// fixed-size values are copied with a single copy, while strings and booleans
+// are converted.
+//
+// A program is only compiled when every property of the schema can be
+// decoded from the payload alone. Payloads that don't match the program
+// (e.g. truncated payloads) are rejected, and must be decoded field by field.
+//
+// Example: the schema { UINT32 a; UINT16 b[3]; UNICODESTRING c; POINTER d; }
+// compiles, for 64-bit pointers, to:
+//   COPY 10, UTF16_STRING, COPY 8.
+//
+// Payloads holding only fixed-size values compile to a single copy. The layout
+// of the decoded values is then the native layout of the payload, which is
+// passed through verbatim.
+//
+// The number of elements of counted arrays, and the length of binary values,
+// may be held by a previous property (PropertyParamCount and
+// PropertyParamLength). The program loads the value of that property in a
+// register, and repeats the instruction decoding an element as many times.
+// Example: the schema { UINT16 n; UINT32 a[n]; } compiles to:
+//   LOAD_COUNT 2 -> r0, COPY 4 x r0.
+
+#ifndef CONVERTER_DECODE_PROGRAM_H_
+#define CONVERTER_DECODE_PROGRAM_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "converter/event_schema.h"
+#include "converter/metadata.h"
+
+namespace converter {
+
+class DecodeProgram {
+ public:
+  DecodeProgram()
+      : compiled_(false), valid_(false), passthrough_size_(0), event_id_(0) {
+  }
+
+  // Compile the program decoding the payloads of events.
+  // @param schema the schema of the events.
+  // @param pointer_size the size of the pointers of the events.
+  // @param layout the description of the events, with their information
+  //     but without fields. The fields are added by the compilation.
+  // @returns true when the payloads can be decoded by the program, false
+  //     otherwise.
+  bool Compile(const EventSchema& schema,
+               size_t pointer_size,
+               const Metadata::Event& layout);
+
+  // Decode a payload.
+  // @param payload the payload to decode.
+  // @param length the length of the payload, in bytes.
+  // @param packet the packet receiving the decoded values.
+  // @returns true on success, false when the payload doesn't match the
+  //     program. On failure, |packet| holds partially decoded values.
+  bool Run(const uint8_t* payload, size_t length,
+           Metadata::Packet* packet) const;
+
+  // @returns whether the program has been compiled.
+  bool compiled() const { return compiled_; }
+
+  // @returns whether the program can decode payloads.
+  bool valid() const { return valid_; }
+
+  // @returns the size of the payloads decoded by copying them verbatim, or 0
+  //     when payloads must be decoded by running the program.
+  size_t passthrough_size() const { return passthrough_size_; }
+
+  // @returns the layout of the events decoded by the program.
+  const Metadata::Event& layout() const { return layout_; }
+
+  // @returns the metadata id of the layout, or 0 when not yet known.
+  size_t event_id() const { return event_id_; }
+  void set_event_id(size_t event_id) { event_id_ = event_id; }
+
+  // Determine the metadata type of a decoded property value.
+  // @param in_type the input type of the property (TDH_INTYPE_*).
+  // @param out_type the output type of the property (TDH_OUTTYPE_*).
+  // @param size the size of the value, in bytes.
+  // @param type receives the metadata type of the value.
+  // @returns true when the value can be decoded, false otherwise.
+  static bool GetFieldType(unsigned int in_type,
+                           unsigned int out_type,
+                           size_t size,
+                           Metadata::Field::FieldType* type);
+
+  // Determine whether a field of a layout can hold the number of elements
+  // of an array.
+  // @param layout the layout.
+  // @param name the name of the field.
+  // @returns true when |name| is a field of the root scope of |layout|
+  //     holding an unsigned integer, false otherwise.
+  static bool IsCountField(const Metadata::Event& layout,
+                           const std::string& name);
+
+ private:
+  enum OpCode {
+    // Copy |size| bytes.
+    COPY,
+    // Encode a 32-bit boolean as a 8-bit value.
+    BOOLEAN32,
+    // Encode a null-terminated UTF-16 string.
+    UTF16_STRING,
+    // Encode a null-terminated string.
+    ANSI_STRING,
+    // Copy a |size|-byte unsigned integer and load it in |count_register|.
+    LOAD_COUNT,
+  };
+
+  // The maximum number of count registers of a program.
+  static const size_t kMaxCountRegisters = 4;
+
+  // The register of the instructions run once.
+  static const size_t kNoCountRegister = static_cast<size_t>(-1);
+
+  struct Instruction {
+    Instruction(OpCode op, size_t size, size_t count_register)
+        : op(op), size(size), count_register(count_register) {
+    }
+    OpCode op;
+    size_t size;
+    // The register loaded by LOAD_COUNT. The other instructions are run as
+    // many times as the value of the register, or once when it is
+    // kNoCountRegister.
+    size_t count_register;
+  };
+
+  // Append an instruction, merging adjacent copies run once.
+  void Emit(OpCode op, size_t size, size_t count_register);
+
+  // Decode an element of a string or a boolean.
+  // @param op the instruction decoding the element.
+  // @param data the element, advanced past it on success.
+  // @param end the end of the payload.
+  // @param packet the packet receiving the decoded value.
+  // @returns true on success, false when the payload is too short.
+  static bool RunElement(OpCode op, const uint8_t** data, const uint8_t* end,
+                         Metadata::Packet* packet);
+
+  bool compiled_;
+  bool valid_;
+  size_t passthrough_size_;
+  std::vector<Instruction> instructions_;
+  Metadata::Event layout_;
+  size_t event_id_;
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_DECODE_PROGRAM_H_
@@ -0,0 +1,262 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Benchmark of the decode programs. A set of payloads is generated up front,
+// then decoded by running the program directly, and by a consumer through
+// the program and field by field.
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base/stopwatch.h"
+#include "converter/decode_program.h"
+#include "converter/etw_consumer.h"
+#include "etw_observer/etw_observer.h"
+
+namespace {
+
+using converter::DecodeProgram;
+using converter::ETWConsumer;
+using converter::EventSchema;
+using converter::Metadata;
+using converter::SchemaSource;
+
+// Number of generated payloads.
+const size_t kPayloadCount = 4096;
+
+// Number of times the payloads are decoded.
+const size_t kRepetitions = 100;
+
+// Number of times the payloads are decoded by a consumer.
+const size_t kConsumerRepetitions = 20;
+
+const size_t kPointerSize = 8;
+
+const GUID kBenchmarkProvider = {
+    0x7A1C0E55, 0x3B2D, 0x4F60, { 0x9A, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+                                  0x07 } };
+
+EventSchema::Property MakeProperty(const char* name,
+                                   unsigned int in_type,
+                                   unsigned int count) {
+  EventSchema::Property property;
+  property.name = name;
+  property.in_type = in_type;
+  property.count = count;
+  return property;
+}
+
+// A schema in the style of a file I/O event: { POINTER irp; POINTER file;
+// UINT32 thread; UINT64 offset; UINT32 size; BOOLEAN sync;
+// UNICODESTRING path; UINT16 flags[4]; }.
+EventSchema MakeSchema() {
+  EventSchema schema;
+  schema.name = "FileIo";
+  schema.properties.push_back(MakeProperty("irp", TDH_INTYPE_POINTER, 1));
+  schema.properties.push_back(MakeProperty("file", TDH_INTYPE_POINTER, 1));
+  schema.properties.push_back(MakeProperty("thread", TDH_INTYPE_UINT32, 1));
+  schema.properties.push_back(MakeProperty("offset", TDH_INTYPE_UINT64, 1));
+  schema.properties.push_back(MakeProperty("size", TDH_INTYPE_UINT32, 1));
+  schema.properties.push_back(MakeProperty("sync", TDH_INTYPE_BOOLEAN, 1));
+  schema.properties.push_back(
+      MakeProperty("path", TDH_INTYPE_UNICODESTRING, 1));
+  schema.properties.push_back(MakeProperty("flags", TDH_INTYPE_UINT16, 4));
+  return schema;
+}
+
+void Append(const void* data, size_t size, std::vector<uint8_t>* payload) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  payload->insert(payload->end(), bytes, bytes + size);
+}
+
+// Generate the payload |index| of the schema.
+void MakePayload(size_t index, std::vector<uint8_t>* payload) {
+  uint64_t irp = 0xFFFFE00012340000ULL + index * 64;
+  uint64_t file = 0xFFFFE00056780000ULL + (index % 31) * 128;
+  uint32_t thread = static_cast<uint32_t>(1000 + index % 17);
+  uint64_t offset = index * 4096;
+  uint32_t size = 4096;
+  uint32_t sync = index % 2;
+  Append(&irp, sizeof(irp), payload);
+  Append(&file, sizeof(file), payload);
+  Append(&thread, sizeof(thread), payload);
+  Append(&offset, sizeof(offset), payload);
+  Append(&size, sizeof(size), payload);
+  Append(&sync, sizeof(sync), payload);
+
+  std::string path = "C:\\Windows\\System32\\file" +
+      std::to_string(index % 97) + ".dll";
+  for (size_t i = 0; i <= path.size(); ++i) {
+    uint16_t unit = i < path.size() ? path[i] : 0;
+    Append(&unit, sizeof(unit), payload);
+  }
+
+  for (uint16_t i = 0; i < 4; ++i)
+    Append(&i, sizeof(i), payload);
+}
+
+// A schema source providing a single schema for every event.
+class BenchmarkSchemaSource : public SchemaSource {
+ public:
+  explicit BenchmarkSchemaSource(const EventSchema& schema)
+      : schema_(schema) {
+  }
+
+  virtual bool GetEventSchema(const EVENT_RECORD& /* record */,
+                              EventSchema* schema) {
+    *schema = schema_;
+    return true;
+  }
+
+  virtual bool GetPropertyData(const EVENT_RECORD& /* record */,
+                               const EventSchema::Property& /* property */,
+                               size_t /* element */,
+                               std::vector<char>* /* buffer */,
+                               size_t* /* size */) {
+    return false;
+  }
+
+ private:
+  EventSchema schema_;
+};
+
+// Forces a consumer to decode its payloads field by field.
+class FieldPathObserver : public etw_observer::ETWObserver {
+ public:
+  FieldPathObserver() : consumer_(NULL) {}
+
+  void set_consumer(ETWConsumer* consumer) { consumer_ = consumer; }
+
+  virtual bool ObservesPayloadFields(ETWConsumer* consumer,
+                                     PEVENT_RECORD /* pevent */) {
+    return consumer == consumer_;
+  }
+
+ private:
+  ETWConsumer* consumer_;
+} field_path_observer;
+
+// Decode the payloads with a consumer.
+// @param records the events to decode.
+// @param by_field whether the payloads are decoded field by field.
+// @param bytes receives the number of encoded bytes.
+// @returns the decoding time, in seconds.
+double DecodeWithConsumer(std::vector<EVENT_RECORD>* records, bool by_field,
+                          size_t* bytes) {
+  BenchmarkSchemaSource source(MakeSchema());
+  ETWConsumer consumer;
+  consumer.set_pack_events(false);
+  consumer.set_schema_source(&source);
+  field_path_observer.set_consumer(by_field ? &consumer : NULL);
+
+  Metadata::Packet encoded;
+  std::vector<ETWConsumer::EncodedEvent> events;
+  *bytes = 0;
+  base::Stopwatch stopwatch;
+  for (size_t repetition = 0; repetition < kConsumerRepetitions;
+       ++repetition) {
+    for (size_t i = 0; i < records->size(); ++i)
+      consumer.ProcessEvent(&(*records)[i]);
+    consumer.TakeEncodedEvents(&encoded, &events);
+    *bytes += encoded.size();
+  }
+  double seconds = stopwatch.Elapsed();
+
+  field_path_observer.set_consumer(NULL);
+  return seconds;
+}
+
+}  // namespace
+
+int main() {
+  std::vector<std::vector<uint8_t> > payloads(kPayloadCount);
+  size_t payload_bytes = 0;
+  for (size_t i = 0; i < kPayloadCount; ++i) {
+    MakePayload(i, &payloads[i]);
+    payload_bytes += payloads[i].size();
+  }
+
+  DecodeProgram program;
+  Metadata::Event layout;
+  if (!program.Compile(MakeSchema(), kPointerSize, layout)) {
+    std::cerr << "Cannot compile the program." << std::endl;
+    return 1;
+  }
+
+  // Run the program directly.
+  Metadata::Packet packet;
+  base::Stopwatch run_stopwatch;
+  for (size_t repetition = 0; repetition < kRepetitions; ++repetition) {
+    packet.Reset(0);
+    for (size_t i = 0; i < kPayloadCount; ++i) {
+      if (!program.Run(&payloads[i][0], payloads[i].size(), &packet)) {
+        std::cerr << "Payload " << i << " rejected." << std::endl;
+        return 1;
+      }
+    }
+  }
+  double run_seconds = run_stopwatch.Elapsed();
+
+  // Decode the events with a consumer.
+  std::vector<EVENT_RECORD> records(kPayloadCount);
+  for (size_t i = 0; i < kPayloadCount; ++i) {
+    EVENT_RECORD& record = records[i];
+    ::memset(&record, 0, sizeof(record));
+    record.EventHeader.ProviderId = kBenchmarkProvider;
+    record.EventHeader.EventDescriptor.Id = 64;
+    record.EventHeader.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+    record.EventHeader.TimeStamp.QuadPart = i;
+    record.UserDataLength = static_cast<uint16_t>(payloads[i].size());
+    record.UserData = &payloads[i][0];
+  }
+  size_t program_bytes = 0;
+  double program_seconds =
+      DecodeWithConsumer(&records, false, &program_bytes);
+  size_t field_bytes = 0;
+  double field_seconds = DecodeWithConsumer(&records, true, &field_bytes);
+
+  double events = static_cast<double>(kPayloadCount);
+  std::cout << std::fixed << std::setprecision(1)
+            << kPayloadCount << " payloads, " << payload_bytes / events
+            << " bytes on average.\n"
+            << "  program run:           " << std::setw(7)
+            << run_seconds * 1e9 / (events * kRepetitions) << " ns/event\n"
+            << "  consumer, program:     " << std::setw(7)
+            << program_seconds * 1e9 / (events * kConsumerRepetitions)
+            << " ns/event\n"
+            << "  consumer, field path:  " << std::setw(7)
+            << field_seconds * 1e9 / (events * kConsumerRepetitions)
+            << " ns/event" << std::endl;
+
+  if (program_bytes != field_bytes) {
+    std::cerr << "The decodings differ." << std::endl;
+    return 1;
+  }
+  return 0;
+}
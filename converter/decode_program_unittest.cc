@@ -0,0 +1,773 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "converter/decode_program.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "base/unittest.h"
+#include "converter/etw_consumer.h"
+#include "etw_observer/etw_observer.h"
+
+namespace converter {
+
+namespace {
+
+const GUID kTestProvider = {
+    0x5D4F8A21, 0x90B1, 0x4C3E, { 0x8F, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66,
+                                  0x77 } };
+
+// Builds an event payload.
+class PayloadBuilder {
+ public:
+  PayloadBuilder& UInt8(uint8_t value) { return Bytes(&value, 1); }
+  PayloadBuilder& UInt16(uint16_t value) { return Bytes(&value, 2); }
+  PayloadBuilder& UInt32(uint32_t value) { return Bytes(&value, 4); }
+  PayloadBuilder& UInt64(uint64_t value) { return Bytes(&value, 8); }
+
+  // Append a UTF-16 string, without its terminator.
+  PayloadBuilder& UTF16(const std::vector<uint16_t>& str) {
+    return Bytes(str.empty() ? NULL : &str[0], str.size() * 2);
+  }
+
+  // Append a string, without its terminator.
+  PayloadBuilder& Ansi(const char* str) {
+    return Bytes(str, ::strlen(str));
+  }
+
+  PayloadBuilder& Bytes(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    payload_.insert(payload_.end(), bytes, bytes + size);
+    return *this;
+  }
+
+  // Remove the last |size| bytes.
+  PayloadBuilder& Truncate(size_t size) {
+    payload_.resize(payload_.size() - size);
+    return *this;
+  }
+
+  const std::vector<uint8_t>& payload() const { return payload_; }
+
+ private:
+  std::vector<uint8_t> payload_;
+};
+
+// @returns the UTF-16 code units of a string of ASCII characters.
+std::vector<uint16_t> ToUTF16(const char* str) {
+  return std::vector<uint16_t>(str, str + ::strlen(str));
+}
+
+EventSchema::Property MakeProperty(const char* name,
+                                   unsigned int in_type,
+                                   unsigned int count) {
+  EventSchema::Property property;
+  property.name = name;
+  property.in_type = in_type;
+  property.count = count;
+  return property;
+}
+
+// @returns a property whose number of elements is held by another property.
+EventSchema::Property MakeCountedProperty(const char* name,
+                                          unsigned int in_type,
+                                          unsigned int count_property) {
+  EventSchema::Property property = MakeProperty(name, in_type, 0);
+  property.flags = PropertyParamCount;
+  property.count_property = count_property;
+  return property;
+}
+
+// @returns a binary property whose length is held by another property.
+EventSchema::Property MakeBinaryProperty(const char* name,
+                                         unsigned int length_property) {
+  EventSchema::Property property = MakeProperty(name, TDH_INTYPE_BINARY, 1);
+  property.flags = PropertyParamLength;
+  property.length_property = length_property;
+  return property;
+}
+
+// A schema with counted arrays: { UINT16 n; UINT32 a[n]; UINT8 m;
+// UNICODESTRING s[m]; UINT32 b[n]; }.
+EventSchema MakeCountedSchema() {
+  EventSchema schema;
+  schema.properties.push_back(MakeProperty("n", TDH_INTYPE_UINT16, 1));
+  schema.properties.push_back(MakeCountedProperty("a", TDH_INTYPE_UINT32, 0));
+  schema.properties.push_back(MakeProperty("m", TDH_INTYPE_UINT8, 1));
+  schema.properties.push_back(
+      MakeCountedProperty("s", TDH_INTYPE_UNICODESTRING, 2));
+  schema.properties.push_back(MakeCountedProperty("b", TDH_INTYPE_UINT32, 0));
+  return schema;
+}
+
+// Build a payload of the counted schema.
+PayloadBuilder MakeCountedPayload(uint16_t n, uint8_t m) {
+  PayloadBuilder builder;
+  builder.UInt16(n);
+  for (uint16_t i = 0; i < n; ++i)
+    builder.UInt32(100 + i);
+  builder.UInt8(m);
+  for (uint8_t i = 0; i < m; ++i)
+    builder.UTF16(ToUTF16(i % 2 == 0 ? "even" : "odd")).UInt16(0);
+  for (uint16_t i = 0; i < n; ++i)
+    builder.UInt32(200 + i);
+  return builder;
+}
+
+// A schema with every kind of instruction: { UINT32 a; UINT16 b[3];
+// UNICODESTRING c; POINTER d; BOOLEAN e; ANSISTRING f; GUID g; }.
+EventSchema MakeMixedSchema() {
+  EventSchema schema;
+  schema.name = "Mixed";
+  schema.event_guid.Data1 = 42;
+  schema.properties.push_back(MakeProperty("a", TDH_INTYPE_UINT32, 1));
+  schema.properties.push_back(MakeProperty("b", TDH_INTYPE_UINT16, 3));
+  schema.properties.push_back(
+      MakeProperty("c", TDH_INTYPE_UNICODESTRING, 1));
+  schema.properties.push_back(MakeProperty("d", TDH_INTYPE_POINTER, 1));
+  schema.properties.push_back(MakeProperty("e", TDH_INTYPE_BOOLEAN, 1));
+  schema.properties.push_back(MakeProperty("f", TDH_INTYPE_ANSISTRING, 1));
+  schema.properties.push_back(MakeProperty("g", TDH_INTYPE_GUID, 1));
+  return schema;
+}
+
+// Build a payload of the mixed schema.
+PayloadBuilder MakeMixedPayload(size_t pointer_size, const char* utf16,
+                                const char* ansi) {
+  PayloadBuilder builder;
+  builder.UInt32(0x01020304).UInt16(1).UInt16(2).UInt16(3);
+  builder.UTF16(ToUTF16(utf16)).UInt16(0);
+  if (pointer_size == 4)
+    builder.UInt32(0xDEADBEEF);
+  else
+    builder.UInt64(0x00007FF812345678ULL);
+  builder.UInt32(2).Ansi(ansi).UInt8(0);
+  for (uint8_t i = 0; i < 16; ++i)
+    builder.UInt8(i);
+  return builder;
+}
+
+// A schema source providing a single schema for every event. Values which
+// can't be located in the payload are not available.
+class TestSchemaSource : public SchemaSource {
+ public:
+  explicit TestSchemaSource(const EventSchema& schema) : schema_(schema) {}
+
+  virtual bool GetEventSchema(const EVENT_RECORD& /* record */,
+                              EventSchema* schema) {
+    *schema = schema_;
+    return true;
+  }
+
+  virtual bool GetPropertyData(const EVENT_RECORD& /* record */,
+                               const EventSchema::Property& /* property */,
+                               size_t /* element */,
+                               std::vector<char>* /* buffer */,
+                               size_t* /* size */) {
+    return false;
+  }
+
+ private:
+  EventSchema schema_;
+};
+
+// Forces a consumer to decode its events field by field, and counts the
+// fields reported by each consumer.
+class FieldPathObserver : public etw_observer::ETWObserver {
+ public:
+  FieldPathObserver() : consumer_(NULL), fields_(0), other_fields_(0) {}
+
+  // @param consumer the consumer decoding field by field, or NULL.
+  void Reset(ETWConsumer* consumer) {
+    consumer_ = consumer;
+    fields_ = 0;
+    other_fields_ = 0;
+  }
+
+  virtual bool ObservesPayloadFields(ETWConsumer* consumer,
+                                     PEVENT_RECORD /* pevent */) {
+    return consumer == consumer_;
+  }
+
+  virtual void OnDecodePayloadField(ETWConsumer* consumer,
+                                    size_t /* parent */,
+                                    size_t /* array_offset */,
+                                    const std::string& /* field_name */,
+                                    unsigned int /* in_type */,
+                                    unsigned int /* out_type */,
+                                    ULONG /* property_size */,
+                                    void* /* raw_data */) {
+    if (consumer == consumer_)
+      ++fields_;
+    else
+      ++other_fields_;
+  }
+
+  // @returns the number of fields decoded by the observed consumer.
+  size_t fields() const { return fields_; }
+
+  // @returns the number of fields decoded by the other consumers.
+  size_t other_fields() const { return other_fields_; }
+
+ private:
+  ETWConsumer* consumer_;
+  size_t fields_;
+  size_t other_fields_;
+} field_path_observer;
+
+// The output of a consumer.
+struct Encoding {
+  std::string bytes;
+  std::string metadata;
+  size_t fields;
+};
+
+// Encode events with a consumer.
+// @param schema the schema of the events.
+// @param pointer_size the size of the pointers of the events.
+// @param payloads the payloads of the events.
+// @param by_field whether the payloads are decoded field by field.
+// @param encoding receives the encoded events and the metadata.
+void Encode(const EventSchema& schema,
+            size_t pointer_size,
+            const std::vector<PayloadBuilder>& payloads,
+            bool by_field,
+            Encoding* encoding) {
+  TestSchemaSource source(schema);
+  ETWConsumer consumer;
+  consumer.set_pack_events(false);
+  consumer.set_schema_source(&source);
+  field_path_observer.Reset(by_field ? &consumer : NULL);
+
+  for (size_t i = 0; i < payloads.size(); ++i) {
+    std::vector<uint8_t> payload = payloads[i].payload();
+    EVENT_RECORD record;
+    ::memset(&record, 0, sizeof(record));
+    record.EventHeader.ProviderId = kTestProvider;
+    record.EventHeader.EventDescriptor.Id = 7;
+    record.EventHeader.EventDescriptor.Version = 1;
+    record.EventHeader.EventDescriptor.Opcode = 12;
+    record.EventHeader.Flags = pointer_size == 4 ?
+        EVENT_HEADER_FLAG_32_BIT_HEADER : EVENT_HEADER_FLAG_64_BIT_HEADER;
+    record.EventHeader.TimeStamp.QuadPart = 1000 + i;
+    record.UserDataLength = static_cast<uint16_t>(payload.size());
+    record.UserData = payload.empty() ? NULL : &payload[0];
+    consumer.ProcessEvent(&record);
+  }
+
+  Metadata::Packet bytes;
+  std::vector<ETWConsumer::EncodedEvent> events;
+  consumer.TakeEncodedEvents(&bytes, &events);
+  encoding->bytes.assign(reinterpret_cast<const char*>(bytes.raw_bytes()),
+                         bytes.size());
+  consumer.SerializeMetadata(&encoding->metadata);
+  encoding->fields = by_field ? field_path_observer.fields() :
+                                field_path_observer.other_fields();
+  field_path_observer.Reset(NULL);
+}
+
+// Decode events with the program and field by field.
+// @returns true when both decodings produce the same events and metadata.
+bool DecodesAsFields(const EventSchema& schema,
+                     size_t pointer_size,
+                     const std::vector<PayloadBuilder>& payloads) {
+  Encoding program;
+  Encode(schema, pointer_size, payloads, false, &program);
+  Encoding fields;
+  Encode(schema, pointer_size, payloads, true, &fields);
+
+  // The field by field decoding went through each field, the program did
+  // not.
+  return fields.fields != 0 && program.fields == 0 &&
+      !program.bytes.empty() &&
+      program.bytes == fields.bytes &&
+      program.metadata == fields.metadata;
+}
+
+// Compile the program of a schema.
+bool Compile(const EventSchema& schema, size_t pointer_size,
+             DecodeProgram* program) {
+  Metadata::Event layout;
+  return program->Compile(schema, pointer_size, layout);
+}
+
+// Run a program on a payload.
+bool Run(const DecodeProgram& program, const PayloadBuilder& builder,
+         Metadata::Packet* packet) {
+  const std::vector<uint8_t>& payload = builder.payload();
+  return program.Run(payload.empty() ? NULL : &payload[0], payload.size(),
+                     packet);
+}
+
+}  // namespace
+
+TEST(DecodeProgramTest, CompileMixedSchema) {
+  DecodeProgram program;
+  EXPECT_FALSE(program.compiled());
+  ASSERT_TRUE(Compile(MakeMixedSchema(), 8, &program));
+  EXPECT_TRUE(program.compiled());
+  EXPECT_TRUE(program.valid());
+  EXPECT_EQ(0U, program.passthrough_size());
+
+  // The array adds a field holding its elements.
+  const Metadata::Event& layout = program.layout();
+  ASSERT_EQ(8U, layout.size());
+  EXPECT_EQ(Metadata::Field::UINT32, layout.at(0).type());
+  EXPECT_EQ(Metadata::Field::ARRAY_FIXED, layout.at(1).type());
+  EXPECT_EQ(3U, layout.at(1).size());
+  EXPECT_EQ(Metadata::Field::UINT16, layout.at(2).type());
+  EXPECT_EQ(1U, layout.at(2).parent());
+  EXPECT_EQ(Metadata::Field::STRING, layout.at(3).type());
+  EXPECT_EQ(Metadata::Field::XINT64, layout.at(4).type());
+  EXPECT_EQ(Metadata::Field::UINT8, layout.at(5).type());
+  EXPECT_EQ(Metadata::Field::STRING, layout.at(6).type());
+  EXPECT_EQ(Metadata::Field::GUID, layout.at(7).type());
+
+  DecodeProgram program32;
+  ASSERT_TRUE(Compile(MakeMixedSchema(), 4, &program32));
+  EXPECT_EQ(Metadata::Field::XINT32, program32.layout().at(4).type());
+}
+
+TEST(DecodeProgramTest, RunMixedSchema) {
+  DecodeProgram program;
+  ASSERT_TRUE(Compile(MakeMixedSchema(), 4, &program));
+
+  Metadata::Packet packet;
+  ASSERT_TRUE(Run(program, MakeMixedPayload(4, "ab", "xyz"), &packet));
+
+  // The boolean is narrowed to a byte, the strings are terminated.
+  PayloadBuilder expected;
+  expected.UInt32(0x01020304).UInt16(1).UInt16(2).UInt16(3);
+  expected.Ansi("ab").UInt8(0).UInt32(0xDEADBEEF).UInt8(1);
+  expected.Ansi("xyz").UInt8(0);
+  for (uint8_t i = 0; i < 16; ++i)
+    expected.UInt8(i);
+  ASSERT_EQ(expected.payload().size(), packet.size());
+  EXPECT_EQ(0, ::memcmp(&expected.payload()[0], packet.raw_bytes(),
+                        packet.size()));
+}
+
+TEST(DecodeProgramTest, FixedArraysPassThrough) {
+  EventSchema schema;
+  schema.properties.push_back(MakeProperty("a", TDH_INTYPE_UINT64, 1));
+  schema.properties.push_back(MakeProperty("b", TDH_INTYPE_UINT8, 5));
+  schema.properties.push_back(MakeProperty("c", TDH_INTYPE_INT16, 2));
+
+  DecodeProgram program;
+  ASSERT_TRUE(Compile(schema, 8, &program));
+  EXPECT_EQ(8U + 5U + 4U, program.passthrough_size());
+  ASSERT_EQ(5U, program.layout().size());
+  EXPECT_EQ(Metadata::Field::ARRAY_FIXED, program.layout().at(1).type());
+  EXPECT_EQ(5U, program.layout().at(1).size());
+  EXPECT_EQ(Metadata::Field::ARRAY_FIXED, program.layout().at(3).type());
+  EXPECT_EQ(2U, program.layout().at(3).size());
+  EXPECT_EQ(Metadata::Field::INT16, program.layout().at(4).type());
+
+  PayloadBuilder payload;
+  payload.UInt64(1).UInt8(2).UInt8(3).UInt8(4).UInt8(5).UInt8(6);
+  payload.UInt16(7).UInt16(8);
+  Metadata::Packet packet;
+  ASSERT_TRUE(Run(program, payload, &packet));
+  ASSERT_EQ(17U, packet.size());
+  EXPECT_EQ(0, ::memcmp(&payload.payload()[0], packet.raw_bytes(), 17));
+
+  Metadata::Packet truncated;
+  EXPECT_FALSE(Run(program, payload.Truncate(1), &truncated));
+}
+
+TEST(DecodeProgramTest, Boolean) {
+  EventSchema schema;
+  schema.properties.push_back(MakeProperty("flag", TDH_INTYPE_BOOLEAN, 3));
+
+  DecodeProgram program;
+  ASSERT_TRUE(Compile(schema, 8, &program));
+  EXPECT_EQ(0U, program.passthrough_size());
+
+  // Any non-zero value is true.
+  PayloadBuilder payload;
+  payload.UInt32(0).UInt32(1).UInt32(0x80000000);
+  Metadata::Packet packet;
+  ASSERT_TRUE(Run(program, payload, &packet));
+  ASSERT_EQ(3U, packet.size());
+  EXPECT_EQ(0, packet.raw_bytes()[0]);
+  EXPECT_EQ(1, packet.raw_bytes()[1]);
+  EXPECT_EQ(1, packet.raw_bytes()[2]);
+
+  Metadata::Packet truncated;
+  EXPECT_FALSE(Run(program, payload.Truncate(2), &truncated));
+}
+
+TEST(DecodeProgramTest, TruncatedPayloads) {
+  DecodeProgram program;
+  ASSERT_TRUE(Compile(MakeMixedSchema(), 8, &program));
+
+  // Every strict prefix of the payload is rejected.
+  PayloadBuilder payload = MakeMixedPayload(8, "text", "ansi");
+  size_t size = payload.payload().size();
+  for (size_t length = 0; length < size; ++length) {
+    PayloadBuilder truncated = payload;
+    truncated.Truncate(size - length);
+    Metadata::Packet packet;
+    EXPECT_FALSE(Run(program, truncated, &packet));
+  }
+
+  Metadata::Packet packet;
+  EXPECT_TRUE(Run(program, payload, &packet));
+}
+
+TEST(DecodeProgramTest, UnterminatedStrings) {
+  EventSchema utf16_schema;
+  utf16_schema.properties.push_back(
+      MakeProperty("s", TDH_INTYPE_UNICODESTRING, 1));
+  DecodeProgram utf16;
+  ASSERT_TRUE(Compile(utf16_schema, 8, &utf16));
+
+  Metadata::Packet packet;
+  PayloadBuilder unterminated;
+  unterminated.UTF16(ToUTF16("abc"));
+  EXPECT_FALSE(Run(utf16, unterminated, &packet));
+
+  // A terminator split by the end of the payload is not a terminator.
+  PayloadBuilder split;
+  split.UTF16(ToUTF16("abc")).UInt8(0);
+  EXPECT_FALSE(Run(utf16, split, &packet));
+
+  // A zero byte inside a code unit is not a terminator.
+  PayloadBuilder inner_zero;
+  inner_zero.UInt16(0x0100).UInt8(0);
+  EXPECT_FALSE(Run(utf16, inner_zero, &packet));
+
+  EXPECT_FALSE(Run(utf16, PayloadBuilder(), &packet));
+
+  EventSchema ansi_schema;
+  ansi_schema.properties.push_back(
+      MakeProperty("s", TDH_INTYPE_ANSISTRING, 1));
+  DecodeProgram ansi;
+  ASSERT_TRUE(Compile(ansi_schema, 8, &ansi));
+
+  PayloadBuilder ansi_unterminated;
+  ansi_unterminated.Ansi("abc");
+  EXPECT_FALSE(Run(ansi, ansi_unterminated, &packet));
+  EXPECT_FALSE(Run(ansi, PayloadBuilder(), &packet));
+
+  // Empty strings are terminated.
+  PayloadBuilder empty;
+  empty.UInt16(0);
+  Metadata::Packet empty_packet;
+  EXPECT_TRUE(Run(utf16, empty, &empty_packet));
+  EXPECT_EQ(1U, empty_packet.size());
+  empty_packet.Reset(0);
+  EXPECT_TRUE(Run(ansi, empty, &empty_packet));
+  EXPECT_EQ(1U, empty_packet.size());
+}
+
+TEST(DecodeProgramTest, RejectsUnsupportedSchemas) {
+  DecodeProgram program;
+
+  EventSchema flags;
+  flags.properties.push_back(MakeProperty("s", TDH_INTYPE_UINT32, 1));
+  flags.properties[0].flags = 1;
+  EXPECT_FALSE(Compile(flags, 8, &program));
+  EXPECT_TRUE(program.compiled());
+  EXPECT_FALSE(program.valid());
+
+  // Strings of fixed length are not terminated.
+  EventSchema fixed_string;
+  fixed_string.properties.push_back(
+      MakeProperty("s", TDH_INTYPE_UNICODESTRING, 1));
+  fixed_string.properties[0].length = 8;
+  EXPECT_FALSE(Compile(fixed_string, 8, &program));
+
+  EventSchema empty_array;
+  empty_array.properties.push_back(MakeProperty("a", TDH_INTYPE_UINT32, 0));
+  EXPECT_FALSE(Compile(empty_array, 8, &program));
+
+  // Pointers have no size when the pointer size is unknown.
+  EventSchema pointer;
+  pointer.properties.push_back(MakeProperty("p", TDH_INTYPE_POINTER, 1));
+  EXPECT_FALSE(Compile(pointer, 0, &program));
+  EXPECT_TRUE(Compile(pointer, 4, &program));
+}
+
+TEST(DecodeProgramTest, CompileCountedArrays) {
+  DecodeProgram program;
+  ASSERT_TRUE(Compile(MakeCountedSchema(), 8, &program));
+  EXPECT_EQ(0U, program.passthrough_size());
+
+  // The arrays refer to the fields holding their number of elements.
+  const Metadata::Event& layout = program.layout();
+  ASSERT_EQ(8U, layout.size());
+  EXPECT_EQ(Metadata::Field::UINT16, layout.at(0).type());
+  EXPECT_EQ(Metadata::Field::ARRAY_VAR, layout.at(1).type());
+  EXPECT_EQ("n", layout.at(1).field_size());
+  EXPECT_EQ(Metadata::Field::UINT32, layout.at(2).type());
+  EXPECT_EQ(1U, layout.at(2).parent());
+  EXPECT_EQ(Metadata::Field::UINT8, layout.at(3).type());
+  EXPECT_EQ(Metadata::Field::ARRAY_VAR, layout.at(4).type());
+  EXPECT_EQ("m", layout.at(4).field_size());
+  EXPECT_EQ(Metadata::Field::STRING, layout.at(5).type());
+  EXPECT_EQ(Metadata::Field::ARRAY_VAR, layout.at(6).type());
+  EXPECT_EQ("n", layout.at(6).field_size());
+}
+
+TEST(DecodeProgramTest, RunCountedArrays) {
+  DecodeProgram program;
+  ASSERT_TRUE(Compile(MakeCountedSchema(), 8, &program));
+
+  Metadata::Packet packet;
+  ASSERT_TRUE(Run(program, MakeCountedPayload(2, 1), &packet));
+  PayloadBuilder expected;
+  expected.UInt16(2).UInt32(100).UInt32(101).UInt8(1).Ansi("even").UInt8(0);
+  expected.UInt32(200).UInt32(201);
+  ASSERT_EQ(expected.payload().size(), packet.size());
+  EXPECT_EQ(0, ::memcmp(&expected.payload()[0], packet.raw_bytes(),
+                        packet.size()));
+
+  // Empty arrays.
+  Metadata::Packet empty;
+  ASSERT_TRUE(Run(program, MakeCountedPayload(0, 0), &empty));
+  EXPECT_EQ(3U, empty.size());
+
+  // Every strict prefix of the payload is rejected, as are counts larger
+  // than the payload.
+  PayloadBuilder payload = MakeCountedPayload(3, 2);
+  size_t size = payload.payload().size();
+  for (size_t length = 0; length < size; ++length) {
+    PayloadBuilder truncated = payload;
+    truncated.Truncate(size - length);
+    Metadata::Packet truncated_packet;
+    EXPECT_FALSE(Run(program, truncated, &truncated_packet));
+  }
+  PayloadBuilder huge;
+  huge.UInt16(0xFFFF).UInt32(1);
+  Metadata::Packet huge_packet;
+  EXPECT_FALSE(Run(program, huge, &huge_packet));
+}
+
+TEST(DecodeProgramTest, BinaryOfParamLength) {
+  EventSchema schema;
+  schema.properties.push_back(MakeProperty("length", TDH_INTYPE_UINT32, 1));
+  schema.properties.push_back(MakeBinaryProperty("data", 0));
+  schema.properties.push_back(MakeProperty("tail", TDH_INTYPE_UINT8, 1));
+
+  DecodeProgram program;
+  ASSERT_TRUE(Compile(schema, 8, &program));
+  const Metadata::Event& layout = program.layout();
+  ASSERT_EQ(3U, layout.size());
+  EXPECT_EQ(Metadata::Field::BINARY_VAR, layout.at(1).type());
+  EXPECT_EQ("length", layout.at(1).field_size());
+
+  // The payload is copied verbatim.
+  PayloadBuilder payload;
+  payload.UInt32(3).UInt8(7).UInt8(8).UInt8(9).UInt8(10);
+  Metadata::Packet packet;
+  ASSERT_TRUE(Run(program, payload, &packet));
+  ASSERT_EQ(8U, packet.size());
+  EXPECT_EQ(0, ::memcmp(&payload.payload()[0], packet.raw_bytes(), 8));
+
+  Metadata::Packet truncated;
+  EXPECT_FALSE(Run(program, payload.Truncate(1), &truncated));
+}
+
+TEST(DecodeProgramTest, RejectsUnsupportedCounts) {
+  DecodeProgram program;
+
+  // The count must precede the array.
+  EventSchema after;
+  after.properties.push_back(MakeCountedProperty("a", TDH_INTYPE_UINT32, 1));
+  after.properties.push_back(MakeProperty("n", TDH_INTYPE_UINT32, 1));
+  EXPECT_FALSE(Compile(after, 8, &program));
+
+  // The count must be an unsigned integer, decoded as such.
+  EventSchema signed_count;
+  signed_count.properties.push_back(MakeProperty("n", TDH_INTYPE_INT32, 1));
+  signed_count.properties.push_back(
+      MakeCountedProperty("a", TDH_INTYPE_UINT32, 0));
+  EXPECT_FALSE(Compile(signed_count, 8, &program));
+  signed_count.properties[0].in_type = TDH_INTYPE_UINT32;
+  signed_count.properties[0].out_type = TDH_OUTTYPE_INT;
+  EXPECT_FALSE(Compile(signed_count, 8, &program));
+  signed_count.properties[0].out_type = TDH_OUTTYPE_NULL;
+  EXPECT_TRUE(Compile(signed_count, 8, &program));
+
+  // The length of strings is in characters.
+  EventSchema string_length;
+  string_length.properties.push_back(MakeProperty("n", TDH_INTYPE_UINT16, 1));
+  string_length.properties.push_back(MakeBinaryProperty("s", 0));
+  string_length.properties[1].in_type = TDH_INTYPE_UNICODESTRING;
+  EXPECT_FALSE(Compile(string_length, 8, &program));
+
+  // Counted and fixed length.
+  EventSchema both;
+  both.properties.push_back(MakeProperty("n", TDH_INTYPE_UINT16, 1));
+  both.properties.push_back(MakeCountedProperty("a", TDH_INTYPE_UINT32, 0));
+  both.properties[1].flags |= PropertyParamLength;
+  EXPECT_FALSE(Compile(both, 8, &program));
+
+  // The number of count properties is bounded.
+  EventSchema many;
+  const char* kNames[] = { "a", "b", "c", "d", "e" };
+  for (unsigned int i = 0; i < 5; ++i) {
+    many.properties.push_back(MakeProperty(kNames[i], TDH_INTYPE_UINT8, 1));
+    many.properties.push_back(
+        MakeCountedProperty(kNames[i], TDH_INTYPE_UINT8, 2 * i));
+    many.properties.back().name += "_array";
+  }
+  EXPECT_FALSE(Compile(many, 8, &program));
+  many.properties.resize(8);
+  EXPECT_TRUE(Compile(many, 8, &program));
+}
+
+TEST(DecodeProgramTest, EquivalentToFieldsMixed) {
+  const size_t kPointerSizes[] = { 4, 8 };
+  for (size_t i = 0; i < 2; ++i) {
+    size_t pointer_size = kPointerSizes[i];
+    std::vector<PayloadBuilder> payloads;
+    payloads.push_back(MakeMixedPayload(pointer_size, "first", "one"));
+    payloads.push_back(MakeMixedPayload(pointer_size, "", ""));
+    payloads.push_back(MakeMixedPayload(pointer_size, "a longer string",
+                                        "with a longer ansi string"));
+    EXPECT_TRUE(DecodesAsFields(MakeMixedSchema(), pointer_size, payloads));
+  }
+}
+
+TEST(DecodeProgramTest, EquivalentToFieldsNonAscii) {
+  // 2-byte, 3-byte and 4-byte UTF-8 sequences, and an unpaired surrogate.
+  std::vector<uint16_t> text = ToUTF16("x");
+  text.push_back(0x00E9);
+  text.push_back(0x20AC);
+  text.push_back(0xD83D);
+  text.push_back(0xDE00);
+  text.push_back(0xDC00);
+
+  EventSchema schema;
+  schema.properties.push_back(
+      MakeProperty("s", TDH_INTYPE_UNICODESTRING, 2));
+  std::vector<PayloadBuilder> payloads(1);
+  payloads[0].UTF16(text).UInt16(0).UTF16(ToUTF16("y")).UInt16(0);
+  EXPECT_TRUE(DecodesAsFields(schema, 8, payloads));
+}
+
+TEST(DecodeProgramTest, EquivalentToFieldsFixedArrays) {
+  EventSchema schema;
+  schema.properties.push_back(MakeProperty("a", TDH_INTYPE_UINT32, 4));
+  schema.properties.push_back(MakeProperty("b", TDH_INTYPE_INT64, 1));
+  schema.properties.push_back(MakeProperty("c", TDH_INTYPE_HEXINT32, 2));
+
+  std::vector<PayloadBuilder> payloads(2);
+  payloads[0].UInt32(1).UInt32(2).UInt32(3).UInt32(4).UInt64(5);
+  payloads[0].UInt32(6).UInt32(7);
+  payloads[1] = payloads[0];
+  // Trailing bytes are ignored by both decodings.
+  payloads[1].UInt32(8);
+  EXPECT_TRUE(DecodesAsFields(schema, 8, payloads));
+}
+
+TEST(DecodeProgramTest, EquivalentToFieldsBoolean) {
+  EventSchema schema;
+  schema.properties.push_back(MakeProperty("a", TDH_INTYPE_BOOLEAN, 1));
+  schema.properties.push_back(MakeProperty("b", TDH_INTYPE_BOOLEAN, 2));
+
+  std::vector<PayloadBuilder> payloads(2);
+  payloads[0].UInt32(0).UInt32(1).UInt32(0xFFFFFFFF);
+  payloads[1].UInt32(7).UInt32(0).UInt32(0x100);
+  EXPECT_TRUE(DecodesAsFields(schema, 4, payloads));
+}
+
+TEST(DecodeProgramTest, EquivalentToFieldsCountedArrays) {
+  std::vector<PayloadBuilder> payloads;
+  payloads.push_back(MakeCountedPayload(3, 2));
+  payloads.push_back(MakeCountedPayload(0, 0));
+  payloads.push_back(MakeCountedPayload(1, 0));
+  payloads.push_back(MakeCountedPayload(0, 3));
+  EXPECT_TRUE(DecodesAsFields(MakeCountedSchema(), 8, payloads));
+
+  // The arrays are sequences of the metadata.
+  Encoding encoding;
+  Encode(MakeCountedSchema(), 8, payloads, false, &encoding);
+  EXPECT_NE(std::string::npos, encoding.metadata.find("uint32  a[n];"));
+  EXPECT_NE(std::string::npos, encoding.metadata.find("string  s[m];"));
+}
+
+TEST(DecodeProgramTest, EquivalentToFieldsBinaryOfParamLength) {
+  EventSchema schema;
+  schema.properties.push_back(MakeProperty("size", TDH_INTYPE_UINT16, 1));
+  schema.properties.push_back(MakeBinaryProperty("data", 0));
+  schema.properties.push_back(
+      MakeProperty("name", TDH_INTYPE_ANSISTRING, 1));
+
+  std::vector<PayloadBuilder> payloads(2);
+  payloads[0].UInt16(5).Ansi("bytes").Ansi("name").UInt8(0);
+  payloads[1].UInt16(0).Ansi("empty").UInt8(0);
+  EXPECT_TRUE(DecodesAsFields(schema, 8, payloads));
+
+  Encoding encoding;
+  Encode(schema, 8, payloads, false, &encoding);
+  EXPECT_NE(std::string::npos,
+            encoding.metadata.find("uint8   data[size];"));
+}
+
+TEST(DecodeProgramTest, RejectedPayloadsDecodedAsFields) {
+  // Payloads rejected by the program are decoded field by field: the output
+  // doesn't depend on the program.
+  std::vector<PayloadBuilder> truncated(1, MakeMixedPayload(8, "ab", "c"));
+  truncated[0].Truncate(3);
+
+  EventSchema utf16_schema;
+  utf16_schema.properties.push_back(MakeProperty("n", TDH_INTYPE_UINT32, 1));
+  utf16_schema.properties.push_back(
+      MakeProperty("s", TDH_INTYPE_UNICODESTRING, 1));
+  std::vector<PayloadBuilder> utf16(1);
+  utf16[0].UInt32(1).UTF16(ToUTF16("abc"));
+
+  EventSchema ansi_schema;
+  ansi_schema.properties.push_back(MakeProperty("n", TDH_INTYPE_UINT32, 1));
+  ansi_schema.properties.push_back(
+      MakeProperty("s", TDH_INTYPE_ANSISTRING, 1));
+  std::vector<PayloadBuilder> ansi(1);
+  ansi[0].UInt32(1).Ansi("abc");
+
+  Encoding program;
+  Encoding fields;
+  Encode(MakeMixedSchema(), 8, truncated, false, &program);
+  Encode(MakeMixedSchema(), 8, truncated, true, &fields);
+  EXPECT_TRUE(program.bytes == fields.bytes);
+  EXPECT_TRUE(program.metadata == fields.metadata);
+
+  Encode(utf16_schema, 8, utf16, false, &program);
+  Encode(utf16_schema, 8, utf16, true, &fields);
+  EXPECT_TRUE(program.bytes == fields.bytes);
+  EXPECT_TRUE(program.metadata == fields.metadata);
+
+  Encode(ansi_schema, 8, ansi, false, &program);
+  Encode(ansi_schema, 8, ansi, true, &fields);
+  EXPECT_TRUE(program.bytes == fields.bytes);
+  EXPECT_TRUE(program.metadata == fields.metadata);
+}
+
+}  // namespace converter
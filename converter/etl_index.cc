@@ -0,0 +1,256 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/etl_index.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+
+#include "base/binary_codec.h"
+#include "base/file_util.h"
+#include "base/mapped_file.h"
+#include "converter/etl_reader.h"
+#include "converter/event_filter.h"
+
+namespace converter {
+
+namespace {
+
+// The magic number at the start of an index file, with the version of its
+// format.
+const char kIndexMagic[8] = { 'E', 'T', 'L', 'I', 'D', 'X', '0', '1' };
+
+// The extension of the index files, appended to the name of the trace.
+const wchar_t kIndexExtension[] = L".idx";
+
+// Orders the GUIDs by their bytes.
+struct GuidLess {
+  bool operator()(const GUID& left, const GUID& right) const {
+    return ::memcmp(&left, &right, sizeof(GUID)) < 0;
+  }
+};
+
+}  // namespace
+
+std::wstring ETLIndex::GetIndexPath(const std::wstring& trace_path) {
+  return trace_path + kIndexExtension;
+}
+
+void ETLIndex::Build(const ETLReader& reader) {
+  file_size_ = reader.file_size();
+  start_time_ = reader.info().start_time;
+  providers_.clear();
+  buffers_.clear();
+
+  std::map<GUID, uint32_t, GuidLess> provider_indexes;
+  ETLBufferReader buffer_reader;
+  EVENT_RECORD record;
+  for (size_t i = 0; i < reader.buffers().size(); ++i) {
+    const ETLBuffer& buffer = reader.buffers()[i];
+    Buffer summary;
+    summary.offset = buffer.offset;
+    summary.size = static_cast<uint32_t>(buffer.size);
+    summary.filled = static_cast<uint32_t>(buffer.filled);
+    summary.processor = buffer.context.ProcessorNumber;
+
+    // Only the event headers are decoded.
+    std::set<std::pair<uint32_t, uint16_t> > kinds;
+    buffer_reader.Reset(reader.info(), buffer);
+    while (buffer_reader.ReadNextEvent(&record)) {
+      const EVENT_HEADER& header = record.EventHeader;
+      int64_t timestamp = header.TimeStamp.QuadPart;
+      if (summary.events == 0) {
+        summary.first_timestamp = timestamp;
+        summary.last_timestamp = timestamp;
+      } else {
+        summary.first_timestamp = std::min(summary.first_timestamp, timestamp);
+        summary.last_timestamp = std::max(summary.last_timestamp, timestamp);
+      }
+      ++summary.events;
+
+      std::map<GUID, uint32_t, GuidLess>::iterator it =
+          provider_indexes.find(header.ProviderId);
+      if (it == provider_indexes.end()) {
+        uint32_t index = static_cast<uint32_t>(providers_.size());
+        it = provider_indexes.insert(
+            std::make_pair(header.ProviderId, index)).first;
+        providers_.push_back(header.ProviderId);
+      }
+      kinds.insert(std::make_pair(it->second,
+                                  EventFilter::GetEventId(header)));
+    }
+
+    summary.kinds.assign(kinds.begin(), kinds.end());
+    buffers_.push_back(summary);
+  }
+}
+
+bool ETLIndex::Load(const std::wstring& path) {
+  base::MappedFile file;
+  if (!base::FileExists(path) || !file.Open(path))
+    return false;
+
+  base::BinaryDecoder decoder(file.data(), file.size());
+  char magic[sizeof(kIndexMagic)];
+  for (size_t i = 0; i < sizeof(magic); ++i) {
+    if (!decoder.Decode(&magic[i]))
+      return false;
+  }
+  if (::memcmp(magic, kIndexMagic, sizeof(magic)) != 0)
+    return false;
+
+  uint32_t number_of_providers = 0;
+  uint32_t number_of_buffers = 0;
+  if (!decoder.Decode(&file_size_) || !decoder.Decode(&start_time_) ||
+      !decoder.Decode(&number_of_providers) ||
+      !decoder.Decode(&number_of_buffers)) {
+    return false;
+  }
+
+  // Check the counts before allocating memory for them.
+  if (number_of_providers > decoder.remaining() / sizeof(GUID))
+    return false;
+  providers_.resize(number_of_providers);
+  for (size_t i = 0; i < providers_.size(); ++i) {
+    if (!decoder.Decode(&providers_[i]))
+      return false;
+  }
+
+  buffers_.clear();
+  for (uint32_t i = 0; i < number_of_buffers; ++i) {
+    Buffer buffer;
+    uint32_t number_of_kinds = 0;
+    if (!decoder.Decode(&buffer.offset) || !decoder.Decode(&buffer.size) ||
+        !decoder.Decode(&buffer.filled) ||
+        !decoder.Decode(&buffer.processor) ||
+        !decoder.Decode(&buffer.events) ||
+        !decoder.Decode(&buffer.first_timestamp) ||
+        !decoder.Decode(&buffer.last_timestamp) ||
+        !decoder.Decode(&number_of_kinds)) {
+      return false;
+    }
+
+    for (uint32_t j = 0; j < number_of_kinds; ++j) {
+      uint32_t provider = 0;
+      uint16_t id = 0;
+      if (!decoder.Decode(&provider) || !decoder.Decode(&id) ||
+          provider >= number_of_providers) {
+        return false;
+      }
+      buffer.kinds.push_back(std::make_pair(provider, id));
+    }
+    buffers_.push_back(buffer);
+  }
+
+  return decoder.remaining() == 0;
+}
+
+bool ETLIndex::Save(const std::wstring& path) const {
+  std::string out;
+  out.append(kIndexMagic, sizeof(kIndexMagic));
+  base::EncodeValue(file_size_, &out);
+  base::EncodeValue(start_time_, &out);
+  base::EncodeValue(static_cast<uint32_t>(providers_.size()), &out);
+  base::EncodeValue(static_cast<uint32_t>(buffers_.size()), &out);
+  for (size_t i = 0; i < providers_.size(); ++i)
+    base::EncodeValue(providers_[i], &out);
+
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    const Buffer& buffer = buffers_[i];
+    base::EncodeValue(buffer.offset, &out);
+    base::EncodeValue(buffer.size, &out);
+    base::EncodeValue(buffer.filled, &out);
+    base::EncodeValue(buffer.processor, &out);
+    base::EncodeValue(buffer.events, &out);
+    base::EncodeValue(buffer.first_timestamp, &out);
+    base::EncodeValue(buffer.last_timestamp, &out);
+    base::EncodeValue(static_cast<uint32_t>(buffer.kinds.size()), &out);
+    for (size_t j = 0; j < buffer.kinds.size(); ++j) {
+      base::EncodeValue(buffer.kinds[j].first, &out);
+      base::EncodeValue(buffer.kinds[j].second, &out);
+    }
+  }
+
+#if defined(_WIN32)
+  const std::wstring& native_path = path;
+#else
+  std::string native_path = base::NarrowNativePath(path);
+#endif
+
+  std::ofstream stream(native_path.c_str(),
+      std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+  stream.write(out.data(), out.size());
+  stream.close();
+  return !stream.fail();
+}
+
+bool ETLIndex::Matches(const ETLReader& reader) const {
+  if (file_size_ != reader.file_size() ||
+      start_time_ != reader.info().start_time ||
+      buffers_.size() != reader.buffers().size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    const ETLBuffer& buffer = reader.buffers()[i];
+    if (buffers_[i].offset != buffer.offset ||
+        buffers_[i].size != buffer.size ||
+        buffers_[i].filled != buffer.filled ||
+        buffers_[i].processor != buffer.context.ProcessorNumber) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void ETLIndex::GetSkippedBuffers(int64_t start, int64_t end,
+                                 const EventFilter& filter,
+                                 std::vector<bool>* skipped) const {
+  assert(skipped != NULL);
+
+  skipped->assign(buffers_.size(), false);
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    const Buffer& buffer = buffers_[i];
+    if (buffer.events == 0 || buffer.last_timestamp < start ||
+        buffer.first_timestamp > end) {
+      (*skipped)[i] = true;
+      continue;
+    }
+
+    bool accepted = false;
+    for (size_t j = 0; !accepted && j < buffer.kinds.size(); ++j) {
+      const GUID& provider = providers_[buffer.kinds[j].first];
+      accepted = filter.Accepts(provider, buffer.kinds[j].second);
+    }
+    (*skipped)[i] = !accepted;
+  }
+}
+
+}  // namespace converter
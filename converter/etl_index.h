@@ -0,0 +1,133 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// A sidecar index of the buffers of an ETL file. The index records, for
+// each buffer, its location, its processor, the time range of its events
+// and the kinds of events it holds. It is built once by decoding the event
+// headers of the whole trace, and saved next to the trace file. Later
+// conversions restricted to a time range or filtered by provider skip the
+// buffers without relevant events without reading them.
+//
+// The index file starts with a header identifying the trace, followed by
+// the table of the providers and by the summary of each buffer. Values are
+// stored in the byte order of the machine.
+
+#ifndef CONVERTER_ETL_INDEX_H_
+#define CONVERTER_ETL_INDEX_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/etw_types.h"
+
+namespace converter {
+
+class ETLReader;
+class EventFilter;
+
+class ETLIndex {
+ public:
+  // The summary of a buffer of the trace.
+  struct Buffer {
+    Buffer()
+        : offset(0), size(0), filled(0), processor(0), events(0),
+          first_timestamp(0), last_timestamp(0) {
+    }
+
+    // The location of the buffer in the trace file, the number of its bytes
+    // holding events, and its processor.
+    uint64_t offset;
+    uint32_t size;
+    uint32_t filled;
+    uint32_t processor;
+
+    // The number of supported events of the buffer, and their time range,
+    // as FILETIMEs.
+    uint32_t events;
+    int64_t first_timestamp;
+    int64_t last_timestamp;
+
+    // The kinds of events of the buffer: the index of their provider in the
+    // table of the providers, and their id as given by
+    // EventFilter::GetEventId. Sorted.
+    std::vector<std::pair<uint32_t, uint16_t> > kinds;
+  };
+
+  ETLIndex() : file_size_(0), start_time_(0) {}
+
+  // @param trace_path the path of a trace file.
+  // @returns the path of the index of the trace file.
+  static std::wstring GetIndexPath(const std::wstring& trace_path);
+
+  // Build the index of a trace by decoding the headers of all its events.
+  // @param reader the reader of the opened trace.
+  void Build(const ETLReader& reader);
+
+  // Load an index file.
+  // @param path the path of the index file.
+  // @returns true on success, false if the file is missing or invalid.
+  bool Load(const std::wstring& path);
+
+  // Save the index to a file.
+  // @param path the path of the index file.
+  // @returns true on success, false otherwise.
+  bool Save(const std::wstring& path) const;
+
+  // Check whether the index describes the buffers of a trace. The size and
+  // the start time of the trace, and the location and the filling of each
+  // buffer, must match.
+  // @param reader the reader of the opened trace.
+  // @returns true when the index matches the trace.
+  bool Matches(const ETLReader& reader) const;
+
+  // Find the buffers without events in a time range accepted by a filter.
+  // @param start the start of the range, as a FILETIME.
+  // @param end the end of the range, as a FILETIME, included in the range.
+  // @param filter the filter of the events.
+  // @param skipped receives, for each buffer, whether it can be skipped.
+  void GetSkippedBuffers(int64_t start, int64_t end,
+                         const EventFilter& filter,
+                         std::vector<bool>* skipped) const;
+
+  // @returns the providers of the events of the trace.
+  const std::vector<GUID>& providers() const { return providers_; }
+
+  // @returns the summaries of the buffers, in file order.
+  const std::vector<Buffer>& buffers() const { return buffers_; }
+
+ private:
+  // The size and the start time of the trace, to recognize it.
+  uint64_t file_size_;
+  int64_t start_time_;
+
+  std::vector<GUID> providers_;
+  std::vector<Buffer> buffers_;
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_ETL_INDEX_H_
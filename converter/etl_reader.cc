@@ -0,0 +1,907 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/etl_reader.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include "base/stopwatch.h"
+
+namespace converter {
+
+namespace {
+
+// Size of the header of a buffer (WMI_BUFFER_HEADER), and offsets of the
+// fields used by the reader.
+const size_t kBufferHeaderSize = 0x48;
+const size_t kBufferSizeOffset = 0x00;
+const size_t kBufferSavedOffsetOffset = 0x04;
+const size_t kBufferContextOffset = 0x28;
+
+// Events are aligned on 8 bytes in the buffers.
+const size_t kEventAlignment = 8;
+
+// Flag set in the marker of every event header.
+const uint8_t kTraceHeaderFlag = 0x80;
+
+// Types of event headers.
+enum TraceHeaderType {
+  kHeaderTypeSystem32 = 1,
+  kHeaderTypeSystem64 = 2,
+  kHeaderTypeCompact32 = 3,
+  kHeaderTypeCompact64 = 4,
+  kHeaderTypeFullHeader32 = 10,
+  kHeaderTypePerfInfo32 = 16,
+  kHeaderTypePerfInfo64 = 17,
+  kHeaderTypeEventHeader32 = 18,
+  kHeaderTypeEventHeader64 = 19,
+  kHeaderTypeFullHeader64 = 20
+};
+
+// Sizes of the event headers.
+const size_t kSystemHeaderSize = 32;
+const size_t kCompactHeaderSize = 24;
+const size_t kPerfInfoHeaderSize = 16;
+const size_t kFullHeaderSize = 48;
+const size_t kEventHeaderSize = 80;
+const size_t kExtendedItemHeaderSize = 8;
+
+// Layout of the TRACE_LOGFILE_HEADER, up to the fields depending on the
+// pointer size.
+const size_t kLogfileHeaderFixedSize = 56;
+const size_t kTimeZoneInformationSize = 172;
+const size_t kLogfileHeaderTailSize = 32;
+
+// Clocks used for the event timestamps.
+const uint32_t kClockPerformanceCounter = 1;
+const uint32_t kClockSystemTime = 2;
+const uint32_t kClockCycleCounter = 3;
+
+// Number of FILETIME units in a second.
+const int64_t kFileTimeUnitsPerSecond = 10000000;
+
+// Index of no stream.
+const size_t kNoStream = static_cast<size_t>(-1);
+
+// The bounds of an unrestricted time range.
+const int64_t kMinimalTime = std::numeric_limits<int64_t>::min();
+const int64_t kMaximalTime = std::numeric_limits<int64_t>::max();
+
+// The providers of the kernel events, by group of their hook id.
+struct KernelGroup {
+  uint8_t group;
+  GUID provider;
+};
+
+const KernelGroup kKernelGroups[] = {
+  // EventTraceGuid.
+  { 0x00, { 0x68FDD900, 0x4A3E, 0x11D1,
+            { 0x84, 0xF4, 0x00, 0x00, 0xF8, 0x04, 0x64, 0xE3 } } },
+  // DiskIo.
+  { 0x01, { 0x3D6FA8D4, 0xFE05, 0x11D0,
+            { 0x9D, 0xDA, 0x00, 0xC0, 0x4F, 0xD7, 0xBA, 0x7C } } },
+  // PageFault.
+  { 0x02, { 0x3D6FA8D3, 0xFE05, 0x11D0,
+            { 0x9D, 0xDA, 0x00, 0xC0, 0x4F, 0xD7, 0xBA, 0x7C } } },
+  // Process.
+  { 0x03, { 0x3D6FA8D0, 0xFE05, 0x11D0,
+            { 0x9D, 0xDA, 0x00, 0xC0, 0x4F, 0xD7, 0xBA, 0x7C } } },
+  // FileIo.
+  { 0x04, { 0x90CBDC39, 0x4A3E, 0x11D1,
+            { 0x84, 0xF4, 0x00, 0x00, 0xF8, 0x04, 0x64, 0xE3 } } },
+  // Thread.
+  { 0x05, { 0x3D6FA8D1, 0xFE05, 0x11D0,
+            { 0x9D, 0xDA, 0x00, 0xC0, 0x4F, 0xD7, 0xBA, 0x7C } } },
+  // TcpIp.
+  { 0x06, { 0x9A280AC0, 0xC8E0, 0x11D1,
+            { 0x84, 0xE2, 0x00, 0xC0, 0x4F, 0xB9, 0x98, 0xA2 } } },
+  // UdpIp.
+  { 0x08, { 0xBF3A50C5, 0xA9C9, 0x4988,
+            { 0xA0, 0x05, 0x2D, 0xF0, 0xB7, 0xC8, 0x0F, 0x80 } } },
+  // Registry.
+  { 0x09, { 0xAE53722E, 0xC863, 0x11D2,
+            { 0x86, 0x59, 0x00, 0xC0, 0x4F, 0xA3, 0x21, 0xA1 } } },
+  // EventTraceConfig.
+  { 0x0B, { 0x01853A65, 0x418F, 0x4F36,
+            { 0xAE, 0xFC, 0xDC, 0x0F, 0x1D, 0x2F, 0xD2, 0x35 } } },
+  // PerfInfo.
+  { 0x0F, { 0xCE1DBFB4, 0x137E, 0x4DA6,
+            { 0x87, 0xB0, 0x3F, 0x59, 0xAA, 0x10, 0x2C, 0xBC } } },
+  // ImageLoad.
+  { 0x14, { 0x2CB15D1D, 0x5FC1, 0x11D2,
+            { 0xAB, 0xE1, 0x00, 0xA0, 0xC9, 0x11, 0xF5, 0x18 } } },
+  // StackWalk.
+  { 0x18, { 0xDEF2FE46, 0x7BD6, 0x4B80,
+            { 0xBD, 0x94, 0xF5, 0x7F, 0xE2, 0x0D, 0x0C, 0xE3 } } },
+  // ALPC.
+  { 0x1A, { 0x45D8CCCD, 0x539F, 0x4B72,
+            { 0xA8, 0xB7, 0x5C, 0x68, 0x31, 0x42, 0x60, 0x9A } } },
+};
+
+template<typename T>
+T LoadValue(const uint8_t* raw) {
+  T value;
+  ::memcpy(&value, raw, sizeof(T));
+  return value;
+}
+
+size_t AlignEvent(size_t offset) {
+  return (offset + kEventAlignment - 1) & ~(kEventAlignment - 1);
+}
+
+uint16_t GetPointerSizeFlag(uint8_t type) {
+  switch (type) {
+    case kHeaderTypeSystem32:
+    case kHeaderTypeCompact32:
+    case kHeaderTypeFullHeader32:
+    case kHeaderTypePerfInfo32:
+    case kHeaderTypeEventHeader32:
+      return EVENT_HEADER_FLAG_32_BIT_HEADER;
+    default:
+      return EVENT_HEADER_FLAG_64_BIT_HEADER;
+  }
+}
+
+}  // namespace
+
+ETLTraceInfo::ETLTraceInfo()
+    : buffer_size(0),
+      pointer_size(0),
+      number_of_processors(0),
+      events_lost(0),
+      buffers_lost(0),
+      clock_type(kClockSystemTime),
+      frequency(0),
+      start_time(0),
+      start_timestamp(0),
+      end_time(0) {
+}
+
+int64_t ETLTraceInfo::ToFileTime(int64_t timestamp) const {
+  if (clock_type == kClockSystemTime || frequency <= 0)
+    return timestamp;
+
+  // Split the conversion to avoid overflowing on long traces.
+  int64_t delta = timestamp - start_timestamp;
+  return start_time +
+      delta / frequency * kFileTimeUnitsPerSecond +
+      delta % frequency * kFileTimeUnitsPerSecond / frequency;
+}
+
+const size_t ETLPosition::kNoBuffer = static_cast<size_t>(-1);
+
+ETLBufferReader::ETLBufferReader()
+    : info_(NULL),
+      offset_(0),
+      event_offset_(0),
+      range_start_(kMinimalTime),
+      range_end_(kMaximalTime),
+      unsupported_events_(0),
+      skipped_events_(0) {
+  ::memset(&buffer_, 0, sizeof(buffer_));
+}
+
+void ETLBufferReader::Reset(const ETLTraceInfo& info,
+                            const ETLBuffer& buffer) {
+  assert(buffer.filled >= kBufferHeaderSize);
+  info_ = &info;
+  buffer_ = buffer;
+  offset_ = kBufferHeaderSize;
+  event_offset_ = kBufferHeaderSize;
+}
+
+bool ETLBufferReader::ReadNextEvent(EVENT_RECORD* record) {
+  assert(record != NULL);
+  assert(info_ != NULL);
+
+  while (offset_ + kPerfInfoHeaderSize <= buffer_.filled) {
+    const uint8_t* raw = buffer_.data + offset_;
+    size_t remaining = buffer_.filled - offset_;
+
+    // The end of the events is padded with bytes without the header flag.
+    uint8_t type = raw[2];
+    uint8_t marker_flags = raw[3];
+    if ((marker_flags & kTraceHeaderFlag) == 0)
+      return false;
+
+    // The size of the event is at the start of the header, except for the
+    // system headers which start with a version.
+    size_t size = 0;
+    size_t header_size = 0;
+    switch (type) {
+      case kHeaderTypeSystem32:
+      case kHeaderTypeSystem64:
+        size = LoadValue<uint16_t>(raw + 4);
+        header_size = kSystemHeaderSize;
+        break;
+      case kHeaderTypeCompact32:
+      case kHeaderTypeCompact64:
+        size = LoadValue<uint16_t>(raw + 4);
+        header_size = kCompactHeaderSize;
+        break;
+      case kHeaderTypePerfInfo32:
+      case kHeaderTypePerfInfo64:
+        size = LoadValue<uint16_t>(raw + 4);
+        header_size = kPerfInfoHeaderSize;
+        break;
+      case kHeaderTypeFullHeader32:
+      case kHeaderTypeFullHeader64:
+        size = LoadValue<uint16_t>(raw);
+        header_size = kFullHeaderSize;
+        break;
+      case kHeaderTypeEventHeader32:
+      case kHeaderTypeEventHeader64:
+        size = LoadValue<uint16_t>(raw);
+        header_size = kEventHeaderSize;
+        break;
+      default:
+        size = LoadValue<uint16_t>(raw);
+        break;
+    }
+
+    // A corrupted event ends the buffer: the next events cannot be found.
+    if (size < kPerfInfoHeaderSize || size > remaining)
+      return false;
+    event_offset_ = offset_;
+    offset_ += AlignEvent(size);
+
+    // Skip the events with a layout that cannot be represented as an
+    // EVENT_RECORD (instance, WPP messages, ...).
+    if (header_size == 0 || size < header_size) {
+      ++unsupported_events_;
+      continue;
+    }
+
+    ::memset(record, 0, sizeof(*record));
+    record->BufferContext = buffer_.context;
+
+    if (header_size == kEventHeaderSize) {
+      if (!DecodeEventHeader(raw, size, record)) {
+        ++unsupported_events_;
+        continue;
+      }
+    } else if (header_size == kFullHeaderSize) {
+      DecodeClassicHeader(raw, size, type, record);
+    } else {
+      DecodeSystemHeader(raw, size, type, record);
+    }
+
+    record->EventHeader.Flags |= GetPointerSizeFlag(type);
+    int64_t timestamp =
+        info_->ToFileTime(record->EventHeader.TimeStamp.QuadPart);
+    record->EventHeader.TimeStamp.QuadPart = timestamp;
+
+    // Drop the events out of the time range before their payload is used.
+    if (timestamp < range_start_ || timestamp > range_end_) {
+      ++skipped_events_;
+      continue;
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+bool ETLBufferReader::DecodeEventHeader(const uint8_t* raw, size_t size,
+                                        EVENT_RECORD* record) {
+  assert(raw != NULL);
+  assert(record != NULL);
+  assert(size >= kEventHeaderSize);
+
+  // The EVENT_HEADER is stored as is.
+  ::memcpy(&record->EventHeader, raw, kEventHeaderSize);
+  size_t offset = kEventHeaderSize;
+
+  // The extended data items follow the header, each aligned on 8 bytes.
+  // The linkage bit of an item tells whether another item follows.
+  extended_data_.clear();
+  if ((record->EventHeader.Flags & EVENT_HEADER_FLAG_EXTENDED_INFO) != 0) {
+    bool linkage = true;
+    while (linkage) {
+      if (offset + kExtendedItemHeaderSize > size)
+        return false;
+      const uint8_t* item = raw + offset;
+      EVENT_HEADER_EXTENDED_DATA_ITEM data;
+      ::memset(&data, 0, sizeof(data));
+      data.ExtType = LoadValue<uint16_t>(item + 2);
+      linkage = (LoadValue<uint16_t>(item + 4) & 1) != 0;
+      data.DataSize = LoadValue<uint16_t>(item + 6);
+      if (offset + kExtendedItemHeaderSize + data.DataSize > size)
+        return false;
+      data.DataPtr = reinterpret_cast<uintptr_t>(
+          item + kExtendedItemHeaderSize);
+      extended_data_.push_back(data);
+      offset = AlignEvent(offset + kExtendedItemHeaderSize + data.DataSize);
+    }
+    if (offset > size)
+      offset = size;
+  }
+
+  record->ExtendedDataCount = static_cast<uint16_t>(extended_data_.size());
+  if (!extended_data_.empty())
+    record->ExtendedData = &extended_data_[0];
+
+  record->UserData = const_cast<uint8_t*>(raw + offset);
+  record->UserDataLength = static_cast<uint16_t>(size - offset);
+  return true;
+}
+
+void ETLBufferReader::DecodeClassicHeader(const uint8_t* raw, size_t size,
+                                          uint8_t type,
+                                          EVENT_RECORD* record) const {
+  assert(raw != NULL);
+  assert(record != NULL);
+  assert(size >= kFullHeaderSize);
+
+  // Layout of an EVENT_TRACE_HEADER.
+  EVENT_HEADER& header = record->EventHeader;
+  header.Size = static_cast<uint16_t>(size);
+  header.HeaderType = type;
+  header.Flags = EVENT_HEADER_FLAG_CLASSIC_HEADER;
+  header.EventDescriptor.Opcode = raw[4];
+  header.EventDescriptor.Level = raw[5];
+  header.EventDescriptor.Version =
+      static_cast<uint8_t>(LoadValue<uint16_t>(raw + 6));
+  header.ThreadId = LoadValue<uint32_t>(raw + 8);
+  header.ProcessId = LoadValue<uint32_t>(raw + 12);
+  header.TimeStamp.QuadPart = LoadValue<int64_t>(raw + 16);
+  ::memcpy(&header.ProviderId, raw + 24, sizeof(GUID));
+  header.ProcessorTime = LoadValue<uint64_t>(raw + 40);
+
+  record->UserData = const_cast<uint8_t*>(raw + kFullHeaderSize);
+  record->UserDataLength = static_cast<uint16_t>(size - kFullHeaderSize);
+}
+
+void ETLBufferReader::DecodeSystemHeader(const uint8_t* raw, size_t size,
+                                         uint8_t type,
+                                         EVENT_RECORD* record) const {
+  assert(raw != NULL);
+  assert(record != NULL);
+
+  // Layout of a SYSTEM_TRACE_HEADER, of its compact form without the
+  // processor times, or of a PERFINFO_TRACE_HEADER without the thread and
+  // the process.
+  EVENT_HEADER& header = record->EventHeader;
+  header.Size = static_cast<uint16_t>(size);
+  header.HeaderType = type;
+  header.Flags = EVENT_HEADER_FLAG_CLASSIC_HEADER;
+  header.EventDescriptor.Version = raw[0];
+
+  // The hook id holds the group of the event and its opcode.
+  uint16_t hook_id = LoadValue<uint16_t>(raw + 6);
+  uint8_t group = static_cast<uint8_t>(hook_id >> 8);
+  header.EventDescriptor.Opcode = static_cast<uint8_t>(hook_id);
+  for (size_t i = 0; i < sizeof(kKernelGroups) / sizeof(kKernelGroups[0]);
+       ++i) {
+    if (kKernelGroups[i].group == group) {
+      header.ProviderId = kKernelGroups[i].provider;
+      break;
+    }
+  }
+
+  size_t header_size = 0;
+  if (type == kHeaderTypePerfInfo32 || type == kHeaderTypePerfInfo64) {
+    header.ThreadId = static_cast<uint32_t>(-1);
+    header.ProcessId = static_cast<uint32_t>(-1);
+    header.TimeStamp.QuadPart = LoadValue<int64_t>(raw + 8);
+    header_size = kPerfInfoHeaderSize;
+  } else {
+    header.ThreadId = LoadValue<uint32_t>(raw + 8);
+    header.ProcessId = LoadValue<uint32_t>(raw + 12);
+    header.TimeStamp.QuadPart = LoadValue<int64_t>(raw + 16);
+    if (type == kHeaderTypeSystem32 || type == kHeaderTypeSystem64) {
+      header.ProcessorTime = LoadValue<uint64_t>(raw + 24);
+      header_size = kSystemHeaderSize;
+    } else {
+      header.Flags |= EVENT_HEADER_FLAG_NO_CPUTIME;
+      header_size = kCompactHeaderSize;
+    }
+  }
+  assert(size >= header_size);
+
+  record->UserData = const_cast<uint8_t*>(raw + header_size);
+  record->UserDataLength = static_cast<uint16_t>(size - header_size);
+}
+
+ETLReader::ETLReader()
+    : range_start_(kMinimalTime),
+      range_end_(kMaximalTime),
+      started_(false),
+      consumed_stream_(kNoStream),
+      buffers_read_(0),
+      skipped_buffers_(0),
+      read_ahead_(0),
+      next_read_ahead_(0),
+      io_wait_time_(0) {
+}
+
+ETLReader::~ETLReader() {
+  Close();
+}
+
+bool ETLReader::Open(const std::wstring& path) {
+  Close();
+
+  if (!file_.Open(path)) {
+    std::wcerr << L"Cannot map trace file \"" << path << L"\"" << std::endl;
+    return false;
+  }
+
+  if (!ReadBuffers() || !ReadTraceInfo()) {
+    std::wcerr << L"Invalid trace file \"" << path << L"\"" << std::endl;
+    Close();
+    return false;
+  }
+
+  // Group the buffers by processor, keeping their order in the file.
+  std::vector<size_t> index_of_processor(256, kNoStream);
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    uint8_t processor = buffers_[i].context.ProcessorNumber;
+    if (index_of_processor[processor] == kNoStream) {
+      index_of_processor[processor] = processor_buffers_.size();
+      processor_buffers_.push_back(std::vector<size_t>());
+    }
+    processor_buffers_[index_of_processor[processor]].push_back(i);
+    selected_buffers_.push_back(i);
+  }
+
+  return true;
+}
+
+void ETLReader::SetTimeRange(int64_t start, int64_t end) {
+  assert(!started_);
+  range_start_ = start;
+  range_end_ = end;
+}
+
+void ETLReader::SkipBuffersOutOfTimeRange() {
+  std::vector<bool> skipped(buffers_.size(), false);
+  for (size_t i = 0; i < processor_buffers_.size(); ++i) {
+    const std::vector<size_t>& buffers = processor_buffers_[i];
+
+    // The first timestamp of each buffer, when it holds events.
+    std::vector<int64_t> first_timestamps(buffers.size());
+    std::vector<bool> has_events(buffers.size());
+    for (size_t j = 0; j < buffers.size(); ++j)
+      has_events[j] = GetFirstTimestamp(buffers[j], &first_timestamps[j]);
+
+    // A buffer holds no events after the first event of the next buffer
+    // with events.
+    int64_t next_timestamp = kMaximalTime;
+    for (size_t j = buffers.size(); j > 0; --j) {
+      size_t k = j - 1;
+      skipped[buffers[k]] = next_timestamp < range_start_ ||
+          (has_events[k] && first_timestamps[k] > range_end_);
+      if (has_events[k])
+        next_timestamp = first_timestamps[k];
+    }
+  }
+
+  SkipBuffers(skipped);
+}
+
+void ETLReader::SkipBuffers(const std::vector<bool>& skipped) {
+  assert(!started_);
+  assert(skipped.size() == buffers_.size());
+
+  for (size_t i = 0; i < processor_buffers_.size(); ++i) {
+    std::vector<size_t>& buffers = processor_buffers_[i];
+    std::vector<size_t> kept;
+    for (size_t j = 0; j < buffers.size(); ++j) {
+      if (skipped[buffers[j]])
+        ++skipped_buffers_;
+      else
+        kept.push_back(buffers[j]);
+    }
+    buffers.swap(kept);
+  }
+
+  // Collect the kept buffers in file order.
+  std::vector<size_t> selected;
+  for (size_t i = 0; i < selected_buffers_.size(); ++i) {
+    if (!skipped[selected_buffers_[i]])
+      selected.push_back(selected_buffers_[i]);
+  }
+  selected_buffers_.swap(selected);
+}
+
+void ETLReader::SetPositions(const std::vector<ETLPosition>& positions) {
+  assert(!started_);
+  assert(positions.size() <= processor_buffers_.size());
+
+  std::vector<bool> skipped(buffers_.size(), false);
+  for (size_t i = 0; i < positions.size(); ++i) {
+    if (positions[i].buffer == ETLPosition::kNoBuffer)
+      continue;
+    const std::vector<size_t>& buffers = processor_buffers_[i];
+    for (size_t j = 0; j < buffers.size(); ++j) {
+      if (buffers[j] < positions[i].buffer)
+        skipped[buffers[j]] = true;
+    }
+  }
+  SkipBuffers(skipped);
+  positions_ = positions;
+}
+
+void ETLReader::GetPositions(bool head_consumed,
+                             std::vector<ETLPosition>* positions) const {
+  assert(positions != NULL);
+
+  positions->clear();
+  positions->resize(processor_buffers_.size());
+  for (size_t i = 0; i < positions_.size(); ++i)
+    (*positions)[i] = positions_[i];
+  if (!started_)
+    return;
+
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    const Stream* stream = streams_[i];
+    if (stream->next_buffer == 0)
+      continue;
+
+    // The head of the stream is read again, unless it was consumed.
+    size_t buffer = (*stream->buffers)[stream->next_buffer - 1];
+    bool head_read = stream->has_head &&
+        (i != consumed_stream_ || !head_consumed);
+    size_t offset = head_read ? stream->reader.event_offset() :
+                                stream->reader.offset();
+    (*positions)[i] = ETLPosition(buffer, offset);
+  }
+}
+
+size_t ETLReader::GetFirstEventOffset(size_t buffer) const {
+  for (size_t i = 0; i < positions_.size(); ++i) {
+    if (positions_[i].buffer == buffer)
+      return positions_[i].offset;
+  }
+  return kBufferHeaderSize;
+}
+
+void ETLReader::Close() {
+  for (size_t i = 0; i < streams_.size(); ++i)
+    delete streams_[i];
+  streams_.clear();
+  while (!queue_.empty())
+    queue_.pop();
+  started_ = false;
+  consumed_stream_ = kNoStream;
+  buffers_read_ = 0;
+  skipped_buffers_ = 0;
+  next_read_ahead_ = 0;
+  io_wait_time_ = 0;
+
+  buffers_.clear();
+  processor_buffers_.clear();
+  selected_buffers_.clear();
+  positions_.clear();
+  range_start_ = kMinimalTime;
+  range_end_ = kMaximalTime;
+  info_ = ETLTraceInfo();
+  file_.Close();
+}
+
+bool ETLReader::ReadNextEvent(EVENT_RECORD* record) {
+  assert(record != NULL);
+
+  if (!started_)
+    Start();
+
+  // The stream of the previous event was not advanced, to keep the record
+  // returned by the previous call valid.
+  if (consumed_stream_ != kNoStream) {
+    size_t index = consumed_stream_;
+    consumed_stream_ = kNoStream;
+    if (AdvanceStream(index)) {
+      int64_t timestamp =
+          streams_[index]->head.EventHeader.TimeStamp.QuadPart;
+      queue_.push(QueueEntry(timestamp, index));
+    }
+  }
+
+  if (queue_.empty())
+    return false;
+
+  size_t index = queue_.top().second;
+  queue_.pop();
+  *record = streams_[index]->head;
+  consumed_stream_ = index;
+  return true;
+}
+
+void ETLReader::ReadAhead(size_t buffer) {
+  assert(buffer < buffers_.size());
+
+  // The skipped buffers are not read ahead.
+  size_t position = std::lower_bound(selected_buffers_.begin(),
+                                     selected_buffers_.end(), buffer) -
+                    selected_buffers_.begin();
+  size_t end = std::min(selected_buffers_.size(),
+                        position + read_ahead_ + 1);
+  next_read_ahead_ = std::max(next_read_ahead_, position + 1);
+  for (; next_read_ahead_ < end; ++next_read_ahead_) {
+    const ETLBuffer& ahead = buffers_[selected_buffers_[next_read_ahead_]];
+    file_.Prefetch(static_cast<size_t>(ahead.offset), ahead.size);
+  }
+}
+
+void ETLReader::LoadBuffer(size_t buffer) const {
+  assert(buffer < buffers_.size());
+  const ETLBuffer& loaded = buffers_[buffer];
+  file_.Load(static_cast<size_t>(loaded.offset), loaded.filled);
+}
+
+size_t ETLReader::unsupported_events() const {
+  size_t count = 0;
+  for (size_t i = 0; i < streams_.size(); ++i)
+    count += streams_[i]->reader.unsupported_events();
+  return count;
+}
+
+size_t ETLReader::skipped_events() const {
+  size_t count = 0;
+  for (size_t i = 0; i < streams_.size(); ++i)
+    count += streams_[i]->reader.skipped_events();
+  return count;
+}
+
+bool ETLReader::ReadBuffers() {
+  const uint8_t* data = file_.data();
+  size_t size = file_.size();
+
+  size_t offset = 0;
+  while (size - offset >= kBufferHeaderSize) {
+    const uint8_t* raw = data + offset;
+    size_t remaining = size - offset;
+
+    // A truncated trace ends at its last complete buffer.
+    uint32_t buffer_size = LoadValue<uint32_t>(raw + kBufferSizeOffset);
+    if (buffer_size < kBufferHeaderSize || buffer_size > remaining) {
+      std::wcerr << L"Invalid buffer at offset " << offset << std::endl;
+      break;
+    }
+
+    ETLBuffer buffer;
+    buffer.data = raw;
+    buffer.offset = offset;
+    buffer.size = buffer_size;
+    uint32_t saved_offset =
+        LoadValue<uint32_t>(raw + kBufferSavedOffsetOffset);
+    if (saved_offset >= kBufferHeaderSize && saved_offset <= buffer_size)
+      buffer.filled = saved_offset;
+    else
+      buffer.filled = buffer_size;
+    ::memcpy(&buffer.context, raw + kBufferContextOffset,
+             sizeof(buffer.context));
+    buffers_.push_back(buffer);
+
+    offset += buffer_size;
+  }
+
+  return !buffers_.empty();
+}
+
+bool ETLReader::ReadTraceInfo() {
+  assert(!buffers_.empty());
+
+  // The first event of the trace holds the TRACE_LOGFILE_HEADER. Its
+  // timestamp is read before the clock of the trace is known: it is kept
+  // in clock ticks.
+  ETLBufferReader reader;
+  reader.Reset(info_, buffers_[0]);
+  EVENT_RECORD record;
+  if (!reader.ReadNextEvent(&record) ||
+      !IsEqualGUID(record.EventHeader.ProviderId, EventTraceGuid) ||
+      record.EventHeader.EventDescriptor.Opcode != EVENT_TRACE_TYPE_INFO ||
+      record.UserDataLength < kLogfileHeaderFixedSize) {
+    return false;
+  }
+
+  const uint8_t* raw = static_cast<const uint8_t*>(record.UserData);
+  size_t size = record.UserDataLength;
+
+  info_.buffer_size = LoadValue<uint32_t>(raw);
+  info_.number_of_processors = LoadValue<uint32_t>(raw + 12);
+  info_.end_time = LoadValue<int64_t>(raw + 16);
+  info_.pointer_size = LoadValue<uint32_t>(raw + 44);
+  info_.events_lost = LoadValue<uint32_t>(raw + 48);
+  uint32_t cpu_speed = LoadValue<uint32_t>(raw + 52);
+
+  if (info_.pointer_size != 4 && info_.pointer_size != 8) {
+    bool is_32_bit = (record.EventHeader.Flags &
+                      EVENT_HEADER_FLAG_32_BIT_HEADER) != 0;
+    info_.pointer_size = is_32_bit ? 4 : 8;
+  }
+
+  // The logger and file names are pointers, followed by the time zone and
+  // by the clock information, aligned on 8 bytes.
+  size_t tail = AlignEvent(kLogfileHeaderFixedSize +
+                           2 * info_.pointer_size +
+                           kTimeZoneInformationSize);
+  int64_t perf_frequency = 0;
+  if (size >= tail + kLogfileHeaderTailSize) {
+    perf_frequency = LoadValue<int64_t>(raw + tail + 8);
+    info_.start_time = LoadValue<int64_t>(raw + tail + 16);
+    info_.clock_type = LoadValue<uint32_t>(raw + tail + 24);
+    info_.buffers_lost = LoadValue<uint32_t>(raw + tail + 28);
+  }
+
+  info_.start_timestamp = record.EventHeader.TimeStamp.QuadPart;
+  if (info_.clock_type == kClockPerformanceCounter)
+    info_.frequency = perf_frequency;
+  else if (info_.clock_type == kClockCycleCounter)
+    info_.frequency = static_cast<int64_t>(cpu_speed) * 1000000;
+
+  return true;
+}
+
+bool ETLReader::GetFirstTimestamp(size_t buffer,
+                                  int64_t* timestamp) const {
+  assert(buffer < buffers_.size());
+  assert(timestamp != NULL);
+
+  // Only the header of the first event is decoded.
+  ETLBufferReader reader;
+  reader.Reset(info_, buffers_[buffer]);
+  EVENT_RECORD record;
+  if (!reader.ReadNextEvent(&record))
+    return false;
+  *timestamp = record.EventHeader.TimeStamp.QuadPart;
+  return true;
+}
+
+void ETLReader::Start() {
+  assert(!started_);
+  started_ = true;
+
+  for (size_t i = 0; i < processor_buffers_.size(); ++i) {
+    Stream* stream = new Stream();
+    stream->buffers = &processor_buffers_[i];
+    stream->next_buffer = 0;
+    stream->has_head = false;
+    stream->reader.SetTimeRange(range_start_, range_end_);
+    streams_.push_back(stream);
+  }
+
+  // Read the first event of each processor.
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    if (AdvanceStream(i)) {
+      int64_t timestamp = streams_[i]->head.EventHeader.TimeStamp.QuadPart;
+      queue_.push(QueueEntry(timestamp, i));
+    }
+  }
+}
+
+bool ETLReader::AdvanceStream(size_t index) {
+  assert(index < streams_.size());
+  Stream* stream = streams_[index];
+
+  while (true) {
+    if (stream->next_buffer != 0) {
+      stream->has_head = stream->reader.ReadNextEvent(&stream->head);
+      if (stream->has_head)
+        return true;
+      ++buffers_read_;
+    }
+
+    if (stream->next_buffer == stream->buffers->size())
+      return false;
+    size_t index = (*stream->buffers)[stream->next_buffer];
+    base::Stopwatch stopwatch;
+    ReadAhead(index);
+    LoadBuffer(index);
+    io_wait_time_ += stopwatch.Elapsed();
+    stream->reader.Reset(info_, buffers_[index]);
+    stream->reader.Seek(GetFirstEventOffset(index));
+    ++stream->next_buffer;
+  }
+}
+
+ETLReaderMerger::ETLReaderMerger(const std::vector<ETLReader*>& readers)
+    : readers_(readers),
+      heads_(readers.size()),
+      started_(false),
+      consumed_reader_(kNoStream) {
+}
+
+bool ETLReaderMerger::ReadNextEvent(EVENT_RECORD* record) {
+  assert(record != NULL);
+
+  // Read the first event of each trace.
+  if (!started_) {
+    started_ = true;
+    for (size_t i = 0; i < readers_.size(); ++i) {
+      if (readers_[i]->ReadNextEvent(&heads_[i])) {
+        int64_t timestamp = heads_[i].EventHeader.TimeStamp.QuadPart;
+        queue_.push(QueueEntry(timestamp, i));
+      }
+    }
+  }
+
+  // The reader of the previous event was not advanced, to keep the record
+  // returned by the previous call valid.
+  if (consumed_reader_ != kNoStream) {
+    size_t index = consumed_reader_;
+    consumed_reader_ = kNoStream;
+    if (readers_[index]->ReadNextEvent(&heads_[index])) {
+      int64_t timestamp = heads_[index].EventHeader.TimeStamp.QuadPart;
+      queue_.push(QueueEntry(timestamp, index));
+    }
+  }
+
+  if (queue_.empty())
+    return false;
+
+  size_t index = queue_.top().second;
+  queue_.pop();
+  *record = heads_[index];
+  consumed_reader_ = index;
+  return true;
+}
+
+void ETLReaderMerger::GetPositions(
+    std::vector<std::vector<ETLPosition> >* positions) const {
+  assert(positions != NULL);
+
+  // The head of each reader is pending in the merger, except the head of
+  // the reader of the last returned event.
+  positions->resize(readers_.size());
+  for (size_t i = 0; i < readers_.size(); ++i)
+    readers_[i]->GetPositions(i == consumed_reader_, &(*positions)[i]);
+}
+
+size_t ETLReaderMerger::buffers_read() const {
+  size_t count = 0;
+  for (size_t i = 0; i < readers_.size(); ++i)
+    count += readers_[i]->buffers_read();
+  return count;
+}
+
+size_t ETLReaderMerger::unsupported_events() const {
+  size_t count = 0;
+  for (size_t i = 0; i < readers_.size(); ++i)
+    count += readers_[i]->unsupported_events();
+  return count;
+}
+
+double ETLReaderMerger::io_wait_time() const {
+  double time = 0;
+  for (size_t i = 0; i < readers_.size(); ++i)
+    time += readers_[i]->io_wait_time();
+  return time;
+}
+
+size_t ETLReaderMerger::skipped_events() const {
+  size_t count = 0;
+  for (size_t i = 0; i < readers_.size(); ++i)
+    count += readers_[i]->skipped_events();
+  return count;
+}
+
+}  // namespace converter
@@ -0,0 +1,439 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Reader of ETL trace files. The buffers and the events of the trace are
+// decoded directly from the file, without the Windows trace consumption API,
+// so that traces can be converted on any platform.
+//
+// An ETL file is a sequence of buffers. Each buffer starts with a buffer
+// header and holds the events logged on one processor, in timestamp order.
+// Each event starts with a header whose type tells its layout: the events
+// of manifest providers use an EVENT_HEADER, the classic providers use an
+// EVENT_TRACE_HEADER and the kernel uses compact system headers. The first
+// event of the file holds the TRACE_LOGFILE_HEADER describing the trace.
+
+#ifndef CONVERTER_ETL_READER_H_
+#define CONVERTER_ETL_READER_H_
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/disallow_copy_and_assign.h"
+#include "base/etw_types.h"
+#include "base/mapped_file.h"
+
+namespace converter {
+
+// The information about a trace, from its TRACE_LOGFILE_HEADER.
+struct ETLTraceInfo {
+  ETLTraceInfo();
+
+  // Convert a timestamp read in an event header to a FILETIME, the unit of
+  // the timestamps delivered by the Windows trace consumption API.
+  // @param timestamp the timestamp, in units of the clock of the trace.
+  // @returns the timestamp in 100ns intervals since January 1, 1601.
+  int64_t ToFileTime(int64_t timestamp) const;
+
+  uint32_t buffer_size;
+  uint32_t pointer_size;
+  uint32_t number_of_processors;
+  uint32_t events_lost;
+  uint32_t buffers_lost;
+
+  // The clock used for the event timestamps: 1 for the performance
+  // counter, 2 for the system time and 3 for the CPU cycle counter.
+  uint32_t clock_type;
+
+  // The number of clock ticks per second.
+  int64_t frequency;
+
+  // The start of the trace, as a FILETIME and in clock ticks.
+  int64_t start_time;
+  int64_t start_timestamp;
+
+  // The end of the trace, as a FILETIME.
+  int64_t end_time;
+};
+
+// A buffer of an ETL file.
+struct ETLBuffer {
+  // The bytes of the buffer, starting with its header.
+  const uint8_t* data;
+
+  // The number of bytes of the buffer holding events.
+  size_t filled;
+
+  // The offset of the buffer in the file, and its size.
+  uint64_t offset;
+  size_t size;
+
+  // The processor and the logger of the events of the buffer.
+  ETW_BUFFER_CONTEXT context;
+};
+
+// The position of a reader in the events of a processor: the next event to
+// read is at an offset of a buffer, and is followed by the events of the
+// next buffers of the processor.
+struct ETLPosition {
+  // The buffer of no position: all the buffers of the processor are read.
+  static const size_t kNoBuffer;
+
+  ETLPosition() : buffer(kNoBuffer), offset(0) {}
+  ETLPosition(size_t buffer, size_t offset) : buffer(buffer), offset(offset) {}
+
+  // The index of the buffer in the trace, in file order, and the offset of
+  // the next event in the buffer.
+  size_t buffer;
+  size_t offset;
+};
+
+// Decodes the events of one buffer. Decoded records point into the buffer,
+// and into the reader for their extended data: they stay valid until the
+// next call to ReadNextEvent or Reset.
+class ETLBufferReader {
+ public:
+  ETLBufferReader();
+
+  // Start reading the events of a buffer.
+  // @param info the information about the trace of the buffer.
+  // @param buffer the buffer to read.
+  void Reset(const ETLTraceInfo& info, const ETLBuffer& buffer);
+
+  // Continue reading the events of the buffer from an offset.
+  // @param offset the offset of the next event to read, as returned by
+  //     offset() or event_offset() while the buffer was read before.
+  void Seek(size_t offset) {
+    assert(offset <= buffer_.filled);
+    offset_ = offset;
+  }
+
+  // @returns the offset in the buffer of the next event to read.
+  size_t offset() const { return offset_; }
+
+  // @returns the offset in the buffer of the last decoded event.
+  size_t event_offset() const { return event_offset_; }
+
+  // Restrict the events read to a time range. The events out of the range
+  // are skipped once their header is decoded.
+  // @param start the start of the range, as a FILETIME.
+  // @param end the end of the range, as a FILETIME, included in the range.
+  void SetTimeRange(int64_t start, int64_t end) {
+    range_start_ = start;
+    range_end_ = end;
+  }
+
+  // Decode the next event of the buffer.
+  // @param record receives the decoded event.
+  // @returns true when an event was decoded, false at the end of the buffer.
+  bool ReadNextEvent(EVENT_RECORD* record);
+
+  // @returns the number of events skipped because their layout is not
+  //     supported.
+  size_t unsupported_events() const { return unsupported_events_; }
+
+  // @returns the number of events skipped because they are out of the time
+  //     range.
+  size_t skipped_events() const { return skipped_events_; }
+
+  // Decode an event stored with an EVENT_HEADER, followed by its extended
+  // data items and its payload. The decoded record points into |raw|, and
+  // into the reader for its extended data.
+  // @param raw the bytes of the event, starting with its header.
+  // @param size the number of bytes of the event.
+  // @param record receives the decoded event.
+  // @returns true on success, false if the event is truncated.
+  bool DecodeEventHeader(const uint8_t* raw, size_t size,
+                         EVENT_RECORD* record);
+
+ private:
+  void DecodeClassicHeader(const uint8_t* raw, size_t size, uint8_t type,
+                           EVENT_RECORD* record) const;
+  void DecodeSystemHeader(const uint8_t* raw, size_t size, uint8_t type,
+                          EVENT_RECORD* record) const;
+
+  // The trace and the buffer being read.
+  const ETLTraceInfo* info_;
+  ETLBuffer buffer_;
+
+  // The offset of the next event in the buffer, and of the last decoded
+  // event.
+  size_t offset_;
+  size_t event_offset_;
+
+  // The extended data items of the last decoded event.
+  std::vector<EVENT_HEADER_EXTENDED_DATA_ITEM> extended_data_;
+
+  // The time range of the events read.
+  int64_t range_start_;
+  int64_t range_end_;
+
+  size_t unsupported_events_;
+  size_t skipped_events_;
+
+  DISALLOW_COPY_AND_ASSIGN(ETLBufferReader);
+};
+
+// Reads the events of an ETL file. The buffers of each processor are read
+// in sequence, and the events of all processors are merged in timestamp
+// order, as the Windows trace consumption API does.
+class ETLReader {
+ public:
+  ETLReader();
+  ~ETLReader();
+
+  // Open an ETL file and decode its header.
+  // @param path the path of the ETL file.
+  // @returns true on success, false if the file is not a valid trace.
+  bool Open(const std::wstring& path);
+
+  // Close the ETL file.
+  void Close();
+
+  // @returns the information about the trace.
+  const ETLTraceInfo& info() const { return info_; }
+
+  // @returns the buffers of the trace, in file order.
+  const std::vector<ETLBuffer>& buffers() const { return buffers_; }
+
+  // @returns for each processor, the indexes of its buffers to decode, in
+  //     file order.
+  const std::vector<std::vector<size_t> >& processor_buffers() const {
+    return processor_buffers_;
+  }
+
+  // @returns the indexes of the buffers to decode, in file order.
+  const std::vector<size_t>& selected_buffers() const {
+    return selected_buffers_;
+  }
+
+  // Restrict the events read to a time range. The events out of the range
+  // are dropped once their header is decoded. Must be called before the
+  // first event is read.
+  // @param start the start of the range, as a FILETIME.
+  // @param end the end of the range, as a FILETIME, included in the range.
+  void SetTimeRange(int64_t start, int64_t end);
+
+  // Skip the buffers holding only events out of the time range, without
+  // decoding them. The events of a processor are in timestamp order: the
+  // events of a buffer are bounded by the first event of the buffer and by
+  // the first event of the next buffer of the same processor. Only the
+  // header of the first event of each buffer is decoded. Must be called
+  // before the first event is read.
+  void SkipBuffersOutOfTimeRange();
+
+  // Skip buffers without decoding them. Must be called before the first
+  // event is read.
+  // @param skipped for each buffer of the trace, whether it is skipped.
+  void SkipBuffers(const std::vector<bool>& skipped);
+
+  // Resume reading the events of each processor from a position. The
+  // buffers of a processor before its position are skipped. Must be called
+  // before the first event is read.
+  // @param positions the positions of the processors, in the order of
+  //     processor_buffers(). The processors without a position are read
+  //     from their first buffer.
+  void SetPositions(const std::vector<ETLPosition>& positions);
+
+  // Get the position of the next event to read from each processor.
+  // @param head_consumed whether the last event returned by ReadNextEvent
+  //     was consumed. Otherwise, it is read again from the positions.
+  // @param positions receives the positions of the processors, in the order
+  //     of processor_buffers().
+  void GetPositions(bool head_consumed,
+                    std::vector<ETLPosition>* positions) const;
+
+  // @param buffer the index of a buffer to decode.
+  // @returns the offset of the first event to read in the buffer: the start
+  //     of its events, or the offset of the position in the buffer.
+  size_t GetFirstEventOffset(size_t buffer) const;
+
+  // @returns the size of the ETL file, in bytes.
+  size_t file_size() const { return file_.size(); }
+
+  // @returns the start of the time range of the events read, as a FILETIME.
+  int64_t range_start() const { return range_start_; }
+
+  // @returns the end of the time range of the events read, as a FILETIME.
+  int64_t range_end() const { return range_end_; }
+
+  // Set the number of buffers read ahead, in file order, of the buffers
+  // being decoded. The buffers are then read from the file while the
+  // previous ones are decoded.
+  // @param buffers the number of buffers read ahead, 0 to rely on the read
+  //     ahead of the system only.
+  void set_read_ahead(size_t buffers) { read_ahead_ = buffers; }
+
+  // Start reading from the file the buffers following a buffer about to be
+  // decoded, up to the read ahead depth.
+  // @param buffer the index of the buffer about to be decoded.
+  void ReadAhead(size_t buffer);
+
+  // Wait until a buffer is read from the file. May be called from any
+  // thread.
+  // @param buffer the index of the buffer to wait for.
+  void LoadBuffer(size_t buffer) const;
+
+  // Decode the next event of the trace. The record points into the file and
+  // into the reader: it stays valid until the next call to ReadNextEvent.
+  // @param record receives the decoded event.
+  // @returns true when an event was decoded, false at the end of the trace.
+  bool ReadNextEvent(EVENT_RECORD* record);
+
+  // @returns the number of buffers whose events were all read.
+  size_t buffers_read() const { return buffers_read_; }
+
+  // @returns the number of events skipped because their layout is not
+  //     supported.
+  size_t unsupported_events() const;
+
+  // @returns the time spent by ReadNextEvent waiting for buffers to be read
+  //     from the file, in seconds.
+  double io_wait_time() const { return io_wait_time_; }
+
+  // @returns the number of buffers skipped because they are out of the time
+  //     range.
+  size_t skipped_buffers() const { return skipped_buffers_; }
+
+  // @returns the number of events skipped because they are out of the time
+  //     range, in the buffers read.
+  size_t skipped_events() const;
+
+ private:
+  // The buffers of a processor, read in sequence.
+  struct Stream {
+    const std::vector<size_t>* buffers;
+    size_t next_buffer;
+    ETLBufferReader reader;
+    EVENT_RECORD head;
+    bool has_head;
+  };
+
+  bool ReadBuffers();
+  bool ReadTraceInfo();
+  bool GetFirstTimestamp(size_t buffer, int64_t* timestamp) const;
+  void Start();
+  bool AdvanceStream(size_t index);
+
+  // The content of the ETL file.
+  base::MappedFile file_;
+
+  ETLTraceInfo info_;
+  std::vector<ETLBuffer> buffers_;
+  std::vector<std::vector<size_t> > processor_buffers_;
+  std::vector<size_t> selected_buffers_;
+
+  // The positions of the processors to resume from.
+  std::vector<ETLPosition> positions_;
+
+  // The time range of the events read.
+  int64_t range_start_;
+  int64_t range_end_;
+
+  // The streams of events of each processor, owned by the reader, and a
+  // queue of the streams having a pending event, ordered by timestamp.
+  std::vector<Stream*> streams_;
+  typedef std::pair<int64_t, size_t> QueueEntry;
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>,
+                      std::greater<QueueEntry> > queue_;
+  bool started_;
+
+  // The stream whose event was returned last, advanced by the next call to
+  // ReadNextEvent.
+  size_t consumed_stream_;
+
+  size_t buffers_read_;
+  size_t skipped_buffers_;
+
+  // The read ahead depth, and the position in |selected_buffers_| of the
+  // first buffer not yet read ahead.
+  size_t read_ahead_;
+  size_t next_read_ahead_;
+
+  double io_wait_time_;
+
+  DISALLOW_COPY_AND_ASSIGN(ETLReader);
+};
+
+// Merges the events of several ETL files in timestamp order, as the Windows
+// trace consumption API does when it processes several traces.
+class ETLReaderMerger {
+ public:
+  // @param readers the readers of opened traces, not owned. Events with the
+  //     same timestamp are read from the first reader first.
+  explicit ETLReaderMerger(const std::vector<ETLReader*>& readers);
+
+  // Decode the next event of the traces. The record stays valid until the
+  // next call to ReadNextEvent.
+  // @param record receives the decoded event.
+  // @returns true when an event was decoded, false at the end of the traces.
+  bool ReadNextEvent(EVENT_RECORD* record);
+
+  // Get the position of the next event to read from each processor of
+  // each trace. The events returned by ReadNextEvent are consumed.
+  // @param positions receives the positions of the processors of each
+  //     reader.
+  void GetPositions(std::vector<std::vector<ETLPosition> >* positions) const;
+
+  // @returns the number of buffers whose events were all read.
+  size_t buffers_read() const;
+
+  // @returns the number of events skipped because their layout is not
+  //     supported.
+  size_t unsupported_events() const;
+
+  // @returns the time spent waiting for buffers to be read from the files,
+  //     in seconds.
+  double io_wait_time() const;
+
+  // @returns the number of events skipped because they are out of the time
+  //     range, in the buffers read.
+  size_t skipped_events() const;
+
+ private:
+  std::vector<ETLReader*> readers_;
+
+  // The next event of each reader, and a queue of the readers having a
+  // pending event, ordered by timestamp.
+  std::vector<EVENT_RECORD> heads_;
+  typedef std::pair<int64_t, size_t> QueueEntry;
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>,
+                      std::greater<QueueEntry> > queue_;
+  bool started_;
+
+  // The reader whose event was returned last, advanced by the next call to
+  // ReadNextEvent.
+  size_t consumed_reader_;
+
+  DISALLOW_COPY_AND_ASSIGN(ETLReaderMerger);
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_ETL_READER_H_
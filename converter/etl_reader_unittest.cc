@@ -0,0 +1,671 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "converter/etl_reader.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "base/file_util.h"
+#include "base/unittest.h"
+
+namespace converter {
+
+namespace {
+
+// Size of the synthesized buffers.
+const uint32_t kBufferSize = 4096;
+
+// Size of a buffer header.
+const size_t kBufferHeaderSize = 0x48;
+
+// Types of event headers.
+const uint8_t kSystem32 = 1;
+const uint8_t kSystem64 = 2;
+const uint8_t kCompact32 = 3;
+const uint8_t kCompact64 = 4;
+const uint8_t kFullHeader32 = 10;
+const uint8_t kPerfInfo32 = 16;
+const uint8_t kPerfInfo64 = 17;
+const uint8_t kEventHeader32 = 18;
+const uint8_t kEventHeader64 = 19;
+const uint8_t kFullHeader64 = 20;
+
+// Flag set in the marker of every event header.
+const uint8_t kHeaderFlag = 0xC0;
+
+// Clock of the synthesized traces: a performance counter at 1 MHz.
+const int64_t kFrequency = 1000000;
+const int64_t kStartTime = 130000000000000000LL;
+const int64_t kStartTimestamp = 5000;
+
+const GUID kProvider = {
+    0x0A1B2C3D, 0x1111, 0x2222, { 1, 2, 3, 4, 5, 6, 7, 8 } };
+
+// The provider of the kernel process events (hook group 0x03).
+const GUID kProcessProvider = {
+    0x3D6FA8D0, 0xFE05, 0x11D0,
+    { 0x9D, 0xDA, 0x00, 0xC0, 0x4F, 0xD7, 0xBA, 0x7C } };
+
+// The provider of the kernel performance events (hook group 0x0F).
+const GUID kPerfInfoProvider = {
+    0xCE1DBFB4, 0x137E, 0x4DA6,
+    { 0x87, 0xB0, 0x3F, 0x59, 0xAA, 0x10, 0x2C, 0xBC } };
+
+// Builds little-endian binary data.
+class Bytes {
+ public:
+  Bytes& U8(uint8_t value) { return Raw(&value, 1); }
+  Bytes& U16(uint16_t value) { return Raw(&value, 2); }
+  Bytes& U32(uint32_t value) { return Raw(&value, 4); }
+  Bytes& U64(uint64_t value) { return Raw(&value, 8); }
+  Bytes& Guid(const GUID& guid) { return Raw(&guid, sizeof(guid)); }
+  Bytes& Append(const std::string& data) { return Raw(data.data(),
+                                                      data.size()); }
+
+  Bytes& Raw(const void* data, size_t size) {
+    data_.append(static_cast<const char*>(data), size);
+    return *this;
+  }
+
+  // Append bytes up to a size.
+  Bytes& PadTo(size_t size, uint8_t value) {
+    if (data_.size() < size)
+      data_.append(size - data_.size(), static_cast<char>(value));
+    return *this;
+  }
+
+  // Overwrite a 16-bit value.
+  void Set16(size_t offset, uint16_t value) {
+    ::memcpy(&data_[offset], &value, sizeof(value));
+  }
+
+  const std::string& data() const { return data_; }
+  size_t size() const { return data_.size(); }
+
+ private:
+  std::string data_;
+};
+
+size_t Align8(size_t size) {
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+// A kernel event with a system, compact or perfinfo header.
+std::string SystemEvent(uint8_t type, uint16_t hook_id, int64_t timestamp,
+                        const std::string& payload) {
+  size_t header_size = 32;
+  if (type == kCompact32 || type == kCompact64)
+    header_size = 24;
+  else if (type == kPerfInfo32 || type == kPerfInfo64)
+    header_size = 16;
+
+  Bytes event;
+  event.U16(2).U8(type).U8(kHeaderFlag);
+  event.U16(static_cast<uint16_t>(header_size + payload.size()));
+  event.U16(hook_id);
+  if (header_size != 16)
+    event.U32(100).U32(200);
+  event.U64(timestamp);
+  if (header_size == 32)
+    event.U32(5).U32(6);
+  return event.Append(payload).data();
+}
+
+// An extended data item of an event.
+struct ExtendedItem {
+  uint16_t type;
+  std::string data;
+};
+
+// An event of a manifest provider, with an EVENT_HEADER.
+std::string HeaderEvent(uint8_t type, uint16_t id, uint8_t opcode,
+                        int64_t timestamp, const std::string& payload,
+                        const std::vector<ExtendedItem>& items) {
+  Bytes extended;
+  for (size_t i = 0; i < items.size(); ++i) {
+    uint16_t linkage = i + 1 < items.size() ? 1 : 0;
+    extended.U16(0).U16(items[i].type).U16(linkage);
+    extended.U16(static_cast<uint16_t>(items[i].data.size()));
+    extended.Append(items[i].data);
+    extended.PadTo(Align8(extended.size()), 0);
+  }
+
+  uint16_t flags = items.empty() ? 0 : EVENT_HEADER_FLAG_EXTENDED_INFO;
+  Bytes event;
+  event.U16(static_cast<uint16_t>(80 + extended.size() + payload.size()));
+  event.U8(type).U8(kHeaderFlag).U16(flags).U16(0);
+  event.U32(10).U32(20).U64(timestamp).Guid(kProvider);
+  event.U16(id).U8(3).U8(0).U8(4).U8(opcode).U16(7).U64(0);
+  event.U64(0).PadTo(80, 0);
+  return event.Append(extended.data()).Append(payload).data();
+}
+
+std::string HeaderEvent(uint8_t type, uint16_t id, uint8_t opcode,
+                        int64_t timestamp, const std::string& payload) {
+  return HeaderEvent(type, id, opcode, timestamp, payload,
+                     std::vector<ExtendedItem>());
+}
+
+// An event of a classic provider, with an EVENT_TRACE_HEADER.
+std::string ClassicEvent(uint8_t type, uint8_t opcode, int64_t timestamp,
+                         const std::string& payload) {
+  Bytes event;
+  event.U16(static_cast<uint16_t>(48 + payload.size()));
+  event.U8(type).U8(kHeaderFlag).U8(opcode).U8(4).U16(3);
+  event.U32(11).U32(22).U64(timestamp).Guid(kProvider).U32(1).U32(2);
+  return event.Append(payload).data();
+}
+
+// A buffer holding events, padded with bytes without the header flag.
+std::string Buffer(uint8_t processor, const std::vector<std::string>& events) {
+  Bytes body;
+  for (size_t i = 0; i < events.size(); ++i) {
+    body.Append(events[i]);
+    body.PadTo(Align8(body.size()), 0);
+  }
+  uint32_t filled = static_cast<uint32_t>(kBufferHeaderSize + body.size());
+
+  Bytes buffer;
+  buffer.U32(kBufferSize).U32(filled).U32(filled).U32(0);
+  buffer.U64(0).U64(0).U64(0);
+  buffer.U8(processor).U8(0).U16(1);
+  buffer.PadTo(kBufferHeaderSize, 0);
+  buffer.Append(body.data());
+  return buffer.PadTo(kBufferSize, 0).data();
+}
+
+// The payload of the first event of a trace: a TRACE_LOGFILE_HEADER.
+std::string LogfileHeader(uint32_t pointer_size, uint32_t clock_type) {
+  uint32_t layout_pointer_size = pointer_size == 4 ? 4 : 8;
+  size_t tail = Align8(56 + 2 * layout_pointer_size + 172);
+
+  Bytes header;
+  header.U32(kBufferSize).U32(0x0105).U32(0).U32(2);
+  header.U64(kStartTime + 100000000);
+  header.PadTo(44, 0).U32(pointer_size).U32(3).U32(3000);
+  header.PadTo(tail + 8, 0).U64(kFrequency).U64(kStartTime);
+  header.U32(clock_type).U32(9);
+  return header.data();
+}
+
+// The first event of a trace.
+std::string TraceEvent(uint32_t pointer_size) {
+  uint8_t type = pointer_size == 4 ? kSystem32 : kSystem64;
+  return SystemEvent(type, 0x0000, kStartTimestamp,
+                     LogfileHeader(pointer_size, 1));
+}
+
+// Reads the events of a single buffer.
+class BufferFixture {
+ public:
+  explicit BufferFixture(const std::vector<std::string>& events)
+      : data_(Buffer(3, events)) {
+    buffer_.data = reinterpret_cast<const uint8_t*>(data_.data());
+    uint32_t filled = 0;
+    ::memcpy(&filled, data_.data() + 4, 4);
+    buffer_.filled = filled;
+    buffer_.offset = 0;
+    buffer_.size = data_.size();
+    buffer_.context.ProcessorNumber = 3;
+    buffer_.context.Alignment = 0;
+    buffer_.context.LoggerId = 1;
+    reader_.Reset(info_, buffer_);
+  }
+
+  ETLBufferReader* reader() { return &reader_; }
+
+ private:
+  std::string data_;
+  ETLTraceInfo info_;
+  ETLBuffer buffer_;
+  ETLBufferReader reader_;
+};
+
+// @returns the payload of a record.
+std::string Payload(const EVENT_RECORD& record) {
+  return std::string(static_cast<const char*>(record.UserData),
+                     record.UserDataLength);
+}
+
+// A trace file, removed when the test ends. Must outlive the readers of
+// the file.
+class TraceFile {
+ public:
+  explicit TraceFile(const std::string& content)
+      : path_(base::WriteTestFile(L"etl_reader_unittest.etl", content)) {
+  }
+
+  ~TraceFile() {
+    if (!path_.empty())
+      base::RemoveFile(path_);
+  }
+
+  // Open the trace.
+  // @param reader the reader opening the trace.
+  // @returns true on success, false otherwise.
+  bool Open(ETLReader* reader) const {
+    return !path_.empty() && reader->Open(path_);
+  }
+
+ private:
+  std::wstring path_;
+};
+
+}  // namespace
+
+TEST(ETLBufferReaderTest, EventHeader) {
+  std::vector<std::string> events;
+  events.push_back(HeaderEvent(kEventHeader64, 42, 7, 1234, "payload"));
+  events.push_back(HeaderEvent(kEventHeader32, 43, 8, 1235, ""));
+  BufferFixture fixture(events);
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  const EVENT_HEADER& header = record.EventHeader;
+  EXPECT_TRUE(IsEqualGUID(kProvider, header.ProviderId));
+  EXPECT_EQ(42, header.EventDescriptor.Id);
+  EXPECT_EQ(3, header.EventDescriptor.Version);
+  EXPECT_EQ(4, header.EventDescriptor.Level);
+  EXPECT_EQ(7, header.EventDescriptor.Opcode);
+  EXPECT_EQ(7, header.EventDescriptor.Task);
+  EXPECT_EQ(10U, header.ThreadId);
+  EXPECT_EQ(20U, header.ProcessId);
+  EXPECT_EQ(1234, header.TimeStamp.QuadPart);
+  EXPECT_TRUE((header.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER) != 0);
+  EXPECT_EQ(3, record.BufferContext.ProcessorNumber);
+  EXPECT_EQ(0, record.ExtendedDataCount);
+  EXPECT_EQ(std::string("payload"), Payload(record));
+  EXPECT_EQ(kBufferHeaderSize, fixture.reader()->event_offset());
+
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(43, record.EventHeader.EventDescriptor.Id);
+  EXPECT_TRUE(
+      (record.EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) != 0);
+  EXPECT_EQ(0, record.UserDataLength);
+  EXPECT_EQ(kBufferHeaderSize + 88, fixture.reader()->event_offset());
+
+  EXPECT_FALSE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(0U, fixture.reader()->unsupported_events());
+}
+
+TEST(ETLBufferReaderTest, ExtendedData) {
+  std::vector<ExtendedItem> items(2);
+  items[0].type = 5;
+  items[0].data = "abcd";
+  items[1].type = 7;
+  items[1].data = "0123456789";
+  std::vector<std::string> events;
+  events.push_back(HeaderEvent(kEventHeader64, 1, 2, 10, "xyz", items));
+  BufferFixture fixture(events);
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  ASSERT_EQ(2, record.ExtendedDataCount);
+  const EVENT_HEADER_EXTENDED_DATA_ITEM* item = record.ExtendedData;
+  EXPECT_EQ(5, item[0].ExtType);
+  EXPECT_EQ(4, item[0].DataSize);
+  EXPECT_EQ(0, ::memcmp(reinterpret_cast<const void*>(item[0].DataPtr),
+                        "abcd", 4));
+  EXPECT_EQ(7, item[1].ExtType);
+  EXPECT_EQ(10, item[1].DataSize);
+  EXPECT_EQ(0, ::memcmp(reinterpret_cast<const void*>(item[1].DataPtr),
+                        "0123456789", 10));
+  EXPECT_EQ(std::string("xyz"), Payload(record));
+}
+
+TEST(ETLBufferReaderTest, TruncatedExtendedData) {
+  // The item claims more data than the event holds.
+  std::vector<ExtendedItem> items(1);
+  items[0].type = 5;
+  items[0].data = "abcd";
+  Bytes truncated;
+  truncated.Append(HeaderEvent(kEventHeader64, 1, 2, 10, "", items));
+  truncated.Set16(80 + 6, 200);
+
+  // The linkage announces an item which is missing.
+  Bytes missing;
+  missing.Append(HeaderEvent(kEventHeader64, 1, 2, 11, "", items));
+  missing.Set16(80 + 4, 1);
+
+  std::vector<std::string> events;
+  events.push_back(truncated.data());
+  events.push_back(missing.data());
+  events.push_back(HeaderEvent(kEventHeader64, 3, 4, 12, "ok"));
+  BufferFixture fixture(events);
+
+  // The corrupted events are skipped.
+  EVENT_RECORD record;
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(3, record.EventHeader.EventDescriptor.Id);
+  EXPECT_EQ(std::string("ok"), Payload(record));
+  EXPECT_EQ(2U, fixture.reader()->unsupported_events());
+}
+
+TEST(ETLBufferReaderTest, ClassicHeader) {
+  std::vector<std::string> events;
+  events.push_back(ClassicEvent(kFullHeader64, 9, 77, "classic"));
+  events.push_back(ClassicEvent(kFullHeader32, 10, 78, ""));
+  BufferFixture fixture(events);
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  const EVENT_HEADER& header = record.EventHeader;
+  EXPECT_TRUE(IsEqualGUID(kProvider, header.ProviderId));
+  EXPECT_EQ(9, header.EventDescriptor.Opcode);
+  EXPECT_EQ(4, header.EventDescriptor.Level);
+  EXPECT_EQ(3, header.EventDescriptor.Version);
+  EXPECT_EQ(11U, header.ThreadId);
+  EXPECT_EQ(22U, header.ProcessId);
+  EXPECT_EQ(77, header.TimeStamp.QuadPart);
+  EXPECT_TRUE((header.Flags & EVENT_HEADER_FLAG_CLASSIC_HEADER) != 0);
+  EXPECT_TRUE((header.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER) != 0);
+  EXPECT_EQ(std::string("classic"), Payload(record));
+
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(10, record.EventHeader.EventDescriptor.Opcode);
+  EXPECT_TRUE(
+      (record.EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) != 0);
+  EXPECT_EQ(0, record.UserDataLength);
+}
+
+TEST(ETLBufferReaderTest, SystemHeaders) {
+  std::vector<std::string> events;
+  events.push_back(SystemEvent(kSystem64, 0x0301, 100, "system"));
+  events.push_back(SystemEvent(kSystem32, 0x0302, 101, ""));
+  events.push_back(SystemEvent(kCompact64, 0x0324, 102, "compact"));
+  events.push_back(SystemEvent(kCompact32, 0x0325, 103, "c"));
+  events.push_back(SystemEvent(kPerfInfo64, 0x0F2E, 104, "perfinfo"));
+  events.push_back(SystemEvent(kPerfInfo32, 0x0F2F, 105, "p"));
+  BufferFixture fixture(events);
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_TRUE(IsEqualGUID(kProcessProvider, record.EventHeader.ProviderId));
+  EXPECT_EQ(1, record.EventHeader.EventDescriptor.Opcode);
+  EXPECT_EQ(2, record.EventHeader.EventDescriptor.Version);
+  EXPECT_EQ(100U, record.EventHeader.ThreadId);
+  EXPECT_EQ(200U, record.EventHeader.ProcessId);
+  EXPECT_EQ(100, record.EventHeader.TimeStamp.QuadPart);
+  EXPECT_EQ(5U, static_cast<uint32_t>(record.EventHeader.ProcessorTime));
+  EXPECT_TRUE(
+      (record.EventHeader.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER) != 0);
+  EXPECT_EQ(std::string("system"), Payload(record));
+
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(2, record.EventHeader.EventDescriptor.Opcode);
+  EXPECT_TRUE(
+      (record.EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) != 0);
+  EXPECT_EQ(0, record.UserDataLength);
+
+  // Compact headers have no processor times.
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(0x24, record.EventHeader.EventDescriptor.Opcode);
+  EXPECT_EQ(100U, record.EventHeader.ThreadId);
+  EXPECT_EQ(102, record.EventHeader.TimeStamp.QuadPart);
+  EXPECT_TRUE((record.EventHeader.Flags & EVENT_HEADER_FLAG_NO_CPUTIME) != 0);
+  EXPECT_EQ(std::string("compact"), Payload(record));
+
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_TRUE(
+      (record.EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) != 0);
+  EXPECT_EQ(std::string("c"), Payload(record));
+
+  // Perfinfo headers have no thread and no process.
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_TRUE(IsEqualGUID(kPerfInfoProvider,
+                          record.EventHeader.ProviderId));
+  EXPECT_EQ(0x2E, record.EventHeader.EventDescriptor.Opcode);
+  EXPECT_EQ(static_cast<uint32_t>(-1), record.EventHeader.ThreadId);
+  EXPECT_EQ(static_cast<uint32_t>(-1), record.EventHeader.ProcessId);
+  EXPECT_EQ(104, record.EventHeader.TimeStamp.QuadPart);
+  EXPECT_EQ(std::string("perfinfo"), Payload(record));
+
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_TRUE(
+      (record.EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) != 0);
+  EXPECT_EQ(std::string("p"), Payload(record));
+
+  EXPECT_FALSE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(0U, fixture.reader()->unsupported_events());
+}
+
+TEST(ETLBufferReaderTest, UnsupportedEvents) {
+  // An unknown header type, and an event smaller than its header.
+  Bytes unknown;
+  unknown.U16(24).U8(0x15).U8(kHeaderFlag).PadTo(24, 0);
+  Bytes short_event;
+  short_event.Append(HeaderEvent(kEventHeader64, 1, 1, 1, ""));
+  short_event.Set16(0, 40);
+
+  std::vector<std::string> events;
+  events.push_back(unknown.data());
+  events.push_back(short_event.data().substr(0, 40));
+  events.push_back(ClassicEvent(kFullHeader64, 1, 2, "after"));
+  BufferFixture fixture(events);
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(std::string("after"), Payload(record));
+  EXPECT_EQ(2U, fixture.reader()->unsupported_events());
+}
+
+TEST(ETLBufferReaderTest, CorruptedEventsEndTheBuffer) {
+  // An event size smaller than the smallest header.
+  Bytes too_small;
+  too_small.Append(ClassicEvent(kFullHeader64, 1, 1, ""));
+  too_small.Set16(0, 8);
+  std::vector<std::string> small_events;
+  small_events.push_back(too_small.data());
+  small_events.push_back(ClassicEvent(kFullHeader64, 2, 2, ""));
+  BufferFixture small_fixture(small_events);
+  EVENT_RECORD record;
+  EXPECT_FALSE(small_fixture.reader()->ReadNextEvent(&record));
+
+  // An event size past the end of the buffer.
+  Bytes too_large;
+  too_large.Append(ClassicEvent(kFullHeader64, 1, 1, ""));
+  too_large.Set16(0, 4000);
+  std::vector<std::string> large_events;
+  large_events.push_back(ClassicEvent(kFullHeader64, 1, 1, ""));
+  large_events.push_back(too_large.data());
+  BufferFixture large_fixture(large_events);
+  EXPECT_TRUE(large_fixture.reader()->ReadNextEvent(&record));
+  EXPECT_FALSE(large_fixture.reader()->ReadNextEvent(&record));
+
+  // Bytes without the header flag.
+  Bytes padding;
+  padding.PadTo(48, 0x7F);
+  std::vector<std::string> padded_events;
+  padded_events.push_back(padding.data());
+  padded_events.push_back(ClassicEvent(kFullHeader64, 1, 1, ""));
+  BufferFixture padded_fixture(padded_events);
+  EXPECT_FALSE(padded_fixture.reader()->ReadNextEvent(&record));
+}
+
+TEST(ETLBufferReaderTest, TimeRange) {
+  std::vector<std::string> events;
+  for (int i = 0; i < 5; ++i)
+    events.push_back(ClassicEvent(kFullHeader64, 1, 10 + i, ""));
+  BufferFixture fixture(events);
+  fixture.reader()->SetTimeRange(11, 12);
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(11, record.EventHeader.TimeStamp.QuadPart);
+  ASSERT_TRUE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(12, record.EventHeader.TimeStamp.QuadPart);
+  EXPECT_FALSE(fixture.reader()->ReadNextEvent(&record));
+  EXPECT_EQ(3U, fixture.reader()->skipped_events());
+}
+
+TEST(ETLReaderTest, TraceInfoAndMerge) {
+  std::vector<std::string> cpu0;
+  cpu0.push_back(TraceEvent(8));
+  cpu0.push_back(ClassicEvent(kFullHeader64, 1, kStartTimestamp + 10, ""));
+  cpu0.push_back(ClassicEvent(kFullHeader64, 3, kStartTimestamp + 30, ""));
+  std::vector<std::string> cpu1;
+  cpu1.push_back(HeaderEvent(kEventHeader64, 2, 2, kStartTimestamp + 20, ""));
+  cpu1.push_back(HeaderEvent(kEventHeader64, 4, 4, kStartTimestamp + 40, ""));
+
+  TraceFile trace_file(Buffer(0, cpu0) + Buffer(1, cpu1));
+  ETLReader reader;
+  ASSERT_TRUE(trace_file.Open(&reader));
+
+  const ETLTraceInfo& info = reader.info();
+  EXPECT_EQ(kBufferSize, info.buffer_size);
+  EXPECT_EQ(8U, info.pointer_size);
+  EXPECT_EQ(2U, info.number_of_processors);
+  EXPECT_EQ(3U, info.events_lost);
+  EXPECT_EQ(9U, info.buffers_lost);
+  EXPECT_EQ(1U, info.clock_type);
+  EXPECT_EQ(kFrequency, info.frequency);
+  EXPECT_EQ(kStartTime, info.start_time);
+  EXPECT_EQ(kStartTimestamp, info.start_timestamp);
+  EXPECT_EQ(2U, reader.buffers().size());
+  EXPECT_EQ(2U, reader.processor_buffers().size());
+
+  // The events of both processors are merged in timestamp order, with the
+  // timestamps converted to FILETIME: 1 tick is 10 units.
+  EVENT_RECORD record;
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  EXPECT_EQ(kStartTime, record.EventHeader.TimeStamp.QuadPart);
+  for (int i = 1; i <= 4; ++i) {
+    ASSERT_TRUE(reader.ReadNextEvent(&record));
+    EXPECT_EQ(kStartTime + 100 * i, record.EventHeader.TimeStamp.QuadPart);
+    EXPECT_EQ(i % 2 == 0 ? 1 : 0, record.BufferContext.ProcessorNumber);
+  }
+  EXPECT_FALSE(reader.ReadNextEvent(&record));
+  EXPECT_EQ(2U, reader.buffers_read());
+}
+
+TEST(ETLReaderTest, PointerSize32) {
+  std::vector<std::string> events;
+  events.push_back(TraceEvent(4));
+  events.push_back(HeaderEvent(kEventHeader32, 1, 1, kStartTimestamp + 1,
+                               "p32"));
+
+  TraceFile trace_file(Buffer(0, events));
+  ETLReader reader;
+  ASSERT_TRUE(trace_file.Open(&reader));
+
+  // The clock information follows the 32-bit pointers.
+  EXPECT_EQ(4U, reader.info().pointer_size);
+  EXPECT_EQ(kFrequency, reader.info().frequency);
+  EXPECT_EQ(kStartTime, reader.info().start_time);
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  EXPECT_TRUE(
+      (record.EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) != 0);
+  EXPECT_EQ(kStartTime + 10, record.EventHeader.TimeStamp.QuadPart);
+  EXPECT_EQ(std::string("p32"), Payload(record));
+}
+
+TEST(ETLReaderTest, PointerSizeFromHeader) {
+  // Without a valid pointer size, the size of the header of the first event
+  // tells it.
+  std::vector<std::string> events;
+  events.push_back(SystemEvent(kSystem32, 0x0000, kStartTimestamp,
+                               LogfileHeader(0, 1)));
+  TraceFile trace_file(Buffer(0, events));
+  ETLReader reader;
+  ASSERT_TRUE(trace_file.Open(&reader));
+  EXPECT_EQ(4U, reader.info().pointer_size);
+}
+
+TEST(ETLReaderTest, InvalidTraces) {
+  // Shorter than a buffer header.
+  std::string too_short(kBufferHeaderSize - 1, '\0');
+
+  // A buffer smaller than its header.
+  std::vector<std::string> events;
+  events.push_back(TraceEvent(8));
+  std::string small = Buffer(0, events);
+  small[0] = 0x10;
+  small[1] = 0;
+
+  // The first event is not the trace information.
+  std::vector<std::string> no_info;
+  no_info.push_back(ClassicEvent(kFullHeader64, 1, 1, ""));
+
+  // The trace information is truncated.
+  std::vector<std::string> short_info;
+  short_info.push_back(SystemEvent(kSystem64, 0x0000, kStartTimestamp,
+                                   std::string(40, '\0')));
+
+  const std::string traces[] = {
+      too_short, small, Buffer(0, no_info), Buffer(0, short_info) };
+  for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); ++i) {
+    TraceFile trace_file(traces[i]);
+    ETLReader reader;
+    EXPECT_FALSE(trace_file.Open(&reader));
+    EXPECT_TRUE(reader.buffers().empty());
+  }
+}
+
+TEST(ETLReaderTest, TruncatedTrace) {
+  // A trace ends at its last complete buffer.
+  std::vector<std::string> cpu0;
+  cpu0.push_back(TraceEvent(8));
+  std::vector<std::string> cpu1;
+  cpu1.push_back(ClassicEvent(kFullHeader64, 1, kStartTimestamp + 1, ""));
+  std::string trace = Buffer(0, cpu0) + Buffer(1, cpu1);
+  trace.resize(trace.size() - 100);
+
+  TraceFile trace_file(trace);
+  ETLReader reader;
+  ASSERT_TRUE(trace_file.Open(&reader));
+  EXPECT_EQ(1U, reader.buffers().size());
+
+  EVENT_RECORD record;
+  EXPECT_TRUE(reader.ReadNextEvent(&record));
+  EXPECT_FALSE(reader.ReadNextEvent(&record));
+}
+
+TEST(ETLReaderTest, InvalidSavedOffset) {
+  // A buffer with an invalid saved offset is read up to its size. The
+  // padding without the header flag ends its events.
+  std::vector<std::string> events;
+  events.push_back(TraceEvent(8));
+  events.push_back(ClassicEvent(kFullHeader64, 1, kStartTimestamp + 1, ""));
+  std::string trace = Buffer(0, events);
+  ::memset(&trace[4], 0xFF, 4);
+
+  TraceFile trace_file(trace);
+  ETLReader reader;
+  ASSERT_TRUE(trace_file.Open(&reader));
+  EXPECT_EQ(kBufferSize, reader.buffers()[0].filled);
+
+  EVENT_RECORD record;
+  EXPECT_TRUE(reader.ReadNextEvent(&record));
+  EXPECT_TRUE(reader.ReadNextEvent(&record));
+  EXPECT_FALSE(reader.ReadNextEvent(&record));
+}
+
+}  // namespace converter
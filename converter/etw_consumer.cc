@@ -25,13 +25,27 @@
 
 #include "converter/etw_consumer.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <iostream>
+#include <limits>
 #include <sstream>
 
+#include "base/stopwatch.h"
+#include "converter/etl_index.h"
+#include "converter/etl_reader.h"
+#include "converter/parallel_decoder.h"
+#include "converter/record_stream_reader.h"
+#include "converter/unicode.h"
 #include "dissector/dissectors.h"
 #include "etw_observer/etw_observer.h"
 
+#if !defined(_WIN32)
+// snprintf has the same contract as sprintf_s for the formats used here.
+#define sprintf_s snprintf
+#endif
+
 namespace converter {
 
 namespace {
@@ -61,30 +75,131 @@ std::string GuidToString(const GUID& guid) {
   return std::string(buffer);
 }
 
-std::string ConvertString(const wchar_t* pstr) {
-  assert(pstr != NULL);
-  std::wstring wstr(pstr);
-  return std::string(wstr.begin(), wstr.end());
+// Read a value from a payload. Values in payloads are not aligned.
+template<typename T>
+T LoadValue(const void* data) {
+  T value;
+  ::memcpy(&value, data, sizeof(T));
+  return value;
 }
 
 void EncodeGUID(const GUID& guid, Metadata::Packet* packet) {
   assert(packet != NULL);
-  packet->EncodeUInt8(static_cast<uint8_t>(guid.Data1 >> 24));
-  packet->EncodeUInt8(static_cast<uint8_t>(guid.Data1 >> 16));
-  packet->EncodeUInt8(static_cast<uint8_t>(guid.Data1 >> 8));
-  packet->EncodeUInt8(static_cast<uint8_t>(guid.Data1));
 
-  packet->EncodeUInt8(static_cast<uint8_t>(guid.Data2 >> 8));
-  packet->EncodeUInt8(static_cast<uint8_t>(guid.Data2));
+  // Data1, Data2 and Data3 are encoded in big-endian order. Assemble the
+  // whole GUID and encode it with a single copy.
+  uint8_t raw[16];
+  raw[0] = static_cast<uint8_t>(guid.Data1 >> 24);
+  raw[1] = static_cast<uint8_t>(guid.Data1 >> 16);
+  raw[2] = static_cast<uint8_t>(guid.Data1 >> 8);
+  raw[3] = static_cast<uint8_t>(guid.Data1);
+
+  raw[4] = static_cast<uint8_t>(guid.Data2 >> 8);
+  raw[5] = static_cast<uint8_t>(guid.Data2);
+
+  raw[6] = static_cast<uint8_t>(guid.Data3 >> 8);
+  raw[7] = static_cast<uint8_t>(guid.Data3);
 
-  packet->EncodeUInt8(static_cast<uint8_t>(guid.Data3 >> 8));
-  packet->EncodeUInt8(static_cast<uint8_t>(guid.Data3));
+  ::memcpy(&raw[8], guid.Data4, 8);
 
-  packet->EncodeBytes(guid.Data4, 8);
+  packet->EncodeBytes(raw, sizeof(raw));
+}
+
+// Number of FILETIME units in a second.
+const double kFileTimeUnitsPerSecond = 10000000.0;
+
+// Offset a FILETIME by a number of seconds, saturating on overflow.
+// @param origin the FILETIME to offset.
+// @param seconds the offset, in seconds. May be infinite.
+// @returns the offset FILETIME.
+int64_t ToFileTimeOffset(int64_t origin, double seconds) {
+  double time = static_cast<double>(origin) +
+      seconds * kFileTimeUnitsPerSecond;
+  if (time >= static_cast<double>(std::numeric_limits<int64_t>::max()))
+    return std::numeric_limits<int64_t>::max();
+  if (time <= static_cast<double>(std::numeric_limits<int64_t>::min()))
+    return std::numeric_limits<int64_t>::min();
+  return static_cast<int64_t>(time);
+}
+
+// The number of events converted between two reads of the clock, to check
+// whether a checkpoint is due.
+const size_t kCheckpointClockPeriod = 1024;
+
+// Get the position of the conversion in a trace file.
+// @param path the path of the trace file.
+// @param reader the reader of the trace file.
+// @param positions the position of the next event to convert from each
+//     processor of the trace file.
+// @returns the position of the conversion.
+Checkpoint::Trace GetTracePosition(const std::wstring& path,
+                                   const ETLReader& reader,
+                                   const std::vector<ETLPosition>& positions) {
+  Checkpoint::Trace position;
+  position.path = path;
+  position.positions = positions;
+  position.start_time = reader.info().start_time;
+  position.buffers = reader.buffers().size();
+  if (!reader.buffers().empty()) {
+    const ETLBuffer& last = reader.buffers().back();
+    position.last_buffer_offset = last.offset;
+    position.last_buffer_filled = last.filled;
+  }
+  return position;
 }
 
 }  // namespace
 
+const size_t ETWConsumer::kDefaultReadAhead = 8;
+
+ETWConsumer::~ETWConsumer() {
+  for (size_t i = 0; i < cpu_queues_.size(); ++i)
+    delete cpu_queues_[i];
+}
+
+void ETWConsumer::GetCpuStreamName(size_t cpu, std::wstring* name) const {
+  assert(name != NULL);
+
+  std::wstringstream ss;
+  ss << L"stream_" << cpu;
+  *name = ss.str();
+}
+
+void ETWConsumer::SelectCpu(size_t cpu) {
+  assert(split_cpu_);
+  assert(!event_pending_);
+
+  while (cpu_queues_.size() <= cpu)
+    cpu_queues_.push_back(new SendingQueue());
+  if (cpu == active_cpu_)
+    return;
+
+  // Put the active queue aside, then take the queue of the processor.
+  SwapSendingQueue(cpu_queues_[active_cpu_]);
+  SwapSendingQueue(cpu_queues_[cpu]);
+  active_cpu_ = cpu;
+}
+
+void ETWConsumer::SwapSendingQueue(SendingQueue* queue) {
+  assert(queue != NULL);
+
+  sending_queue_.Swap(&queue->bytes);
+  full_packets_.swap(queue->full_packets);
+  std::swap(sent_packets_, queue->sent_packets);
+  std::swap(sent_offset_, queue->sent_offset);
+  std::swap(open_packet_offset_, queue->open_packet_offset);
+  std::swap(open_packet_events_, queue->open_packet_events);
+  std::swap(open_packet_start_timestamp_, queue->open_packet_start_timestamp);
+  std::swap(open_packet_stop_timestamp_, queue->open_packet_stop_timestamp);
+}
+
+size_t ETWConsumer::sending_queue_allocations() const {
+  size_t allocations = sending_queue_.allocations();
+  for (size_t i = 0; i < cpu_queues_.size(); ++i)
+    allocations += cpu_queues_[i]->bytes.allocations();
+  return allocations;
+}
+
 bool ETWConsumer::GetBufferName(PEVENT_TRACE_LOGFILEW ptrace,
                                 std::wstring* name) const {
   assert(name != NULL);
@@ -100,6 +215,13 @@ bool ETWConsumer::GetBufferName(PEVENT_TRACE_LOGFILEW ptrace,
 }
 
 bool ETWConsumer::ConsumeAllEvents() {
+  if (!record_stream_.empty())
+    return ConsumeRecordStream();
+
+  if (native_reader_)
+    return ConsumeAllEventsWithReader();
+
+#if defined(_WIN32)
   // Open all trace files, and keep handles in a vector.
   std::vector<TRACEHANDLE> handles;
   for (size_t i = 0; i < traces_.size(); ++i) {
@@ -126,11 +248,12 @@ bool ETWConsumer::ConsumeAllEvents() {
 
   // Reserve some memory space for internal buffers.
   data_property_buffer_.resize(1024);
-  packet_info_buffer_.resize(64*1024);
 
   // Ask the ETW API to consume all traces and calls the registered callbacks.
   bool valid = true;
-  ULONG status = ::ProcessTrace(&handles[0], 1, 0, 0);
+  // The events of all the traces are merged in timestamp order.
+  ULONG status = ::ProcessTrace(&handles[0],
+                                static_cast<ULONG>(handles.size()), 0, 0);
   if (status != ERROR_SUCCESS) {
     std::wcerr << L"ProcessTrace failed with error " << status << std::endl;
     valid = false;
@@ -142,102 +265,693 @@ bool ETWConsumer::ConsumeAllEvents() {
 
   // Free unused memory.
   data_property_buffer_.clear();
-  packet_info_buffer_.clear();
+  decode_plans_.Clear();
 
   return valid;
+#else
+  std::wcerr << L"The trace consumption API is not available." << std::endl;
+  return false;
+#endif
 }
 
-bool ETWConsumer::IsFullPacketReady() {
-  if (packets_.empty())
+bool ETWConsumer::ConsumeAllEventsWithReader() {
+  assert(event_callback_ != NULL);
+
+  // If no trace files, leave with an error.
+  if (traces_.empty())
     return false;
-  return packet_total_bytes_ >= packet_maximal_size_;
+
+  // Observers expect to see the events in order, on a single thread, and
+  // so does the writer recording them. The events decoded in parallel are
+  // replayed to the observers which tell the events they observe.
+  std::vector<EventFilter> observed_events;
+  bool observed = true;
+  etw_observer::ETWObserver* observer = etw_observer::GetFirstETWObserver();
+  for (; observer != NULL && observed; observer = observer->next()) {
+    observed_events.push_back(EventFilter());
+    observed = observer->GetObservedEvents(&observed_events.back());
+  }
+  if (jobs_ > 1 && !observed) {
+    std::wcerr << L"An observer needs all the events: decoding on a single "
+               << L"thread." << std::endl;
+  }
+  bool sequential = !observed || record_writer_ != NULL;
+
+  // Open all trace files.
+  std::vector<ETLReader*> readers;
+  bool valid = true;
+  for (size_t i = 0; i < traces_.size(); ++i) {
+    ETLReader* reader = new ETLReader();
+    readers.push_back(reader);
+    reader->set_read_ahead(read_ahead_);
+    if (!reader->Open(traces_[i])) {
+      valid = false;
+      break;
+    }
+  }
+
+  if (valid && resumed_)
+    ResumeReaders(readers);
+
+  if (valid && (has_time_range_ || use_index_))
+    SelectBuffers(readers);
+
+  if (valid) {
+    // The information passed to the buffer callback, as filled by the
+    // trace consumption API. The buffers of all the trace files are
+    // numbered as the buffers of a single trace.
+    EVENT_TRACE_LOGFILE logfile;
+    ::memset(&logfile, 0, sizeof(logfile));
+    logfile.LogFileName = const_cast<wchar_t*>(traces_[0].c_str());
+    for (size_t i = 0; i < readers.size(); ++i) {
+      logfile.BufferSize =
+          std::max<ULONG>(logfile.BufferSize, readers[i]->info().buffer_size);
+      logfile.EventsLost += readers[i]->info().events_lost;
+    }
+    logfile.BufferCallback = buffer_callback_;
+    logfile.EventRecordCallback = event_callback_;
+
+    // Reserve some memory space for internal buffers.
+    data_property_buffer_.resize(1024);
+
+    // Each trace file is decoded on its own thread, at least.
+    if (!sequential && (jobs_ > 1 || readers.size() > 1)) {
+      size_t jobs = std::max(jobs_, readers.size());
+      valid = ConsumeTracesInParallel(readers, jobs, observed_events,
+                                      &logfile);
+    } else {
+      valid = ConsumeTracesWithReaders(readers, &logfile);
+    }
+
+    // Free unused memory.
+    data_property_buffer_.clear();
+    decode_plans_.Clear();
+  }
+
+  // Close all trace files.
+  for (size_t i = 0; i < readers.size(); ++i)
+    delete readers[i];
+
+  return valid;
+}
+
+void ETWConsumer::SelectBuffers(const std::vector<ETLReader*>& readers) {
+  assert(!readers.empty());
+  assert(readers.size() == traces_.size());
+
+  // The range is relative to the start of the earliest trace file.
+  int64_t start = std::numeric_limits<int64_t>::min();
+  int64_t end = std::numeric_limits<int64_t>::max();
+  if (has_time_range_) {
+    int64_t origin = readers[0]->info().start_time;
+    for (size_t i = 1; i < readers.size(); ++i)
+      origin = std::min(origin, readers[i]->info().start_time);
+    start = ToFileTimeOffset(origin, time_range_start_);
+    end = ToFileTimeOffset(origin, time_range_end_);
+  }
+
+  // The index only helps when some events are not converted.
+  bool selective = has_time_range_ || !event_filter_.Empty();
+  for (size_t i = 0; i < readers.size(); ++i) {
+    ETLReader* reader = readers[i];
+    if (has_time_range_)
+      reader->SetTimeRange(start, end);
+
+    if (use_index_) {
+      ETLIndex index;
+      LoadIndex(traces_[i], *reader, &index);
+      if (selective) {
+        std::vector<bool> skipped;
+        index.GetSkippedBuffers(start, end, event_filter_, &skipped);
+        reader->SkipBuffers(skipped);
+      }
+    } else if (has_time_range_) {
+      reader->SkipBuffersOutOfTimeRange();
+    }
+    skipped_buffers_ += reader->skipped_buffers();
+  }
+}
+
+void ETWConsumer::LoadIndex(const std::wstring& trace,
+                            const ETLReader& reader,
+                            ETLIndex* index) {
+  assert(index != NULL);
+
+  std::wstring path = ETLIndex::GetIndexPath(trace);
+  if (index->Load(path) && index->Matches(reader))
+    return;
+
+  // The index is missing or stale: build it from the trace.
+  index->Build(reader);
+  if (!index->Save(path)) {
+    std::wcerr << L"Cannot write the index file '" << path << L"'."
+               << std::endl;
+  }
+}
+
+bool ETWConsumer::Resume(const Checkpoint& checkpoint) {
+  assert(metadata_.size() == 0);
+  assert(IsSendingQueueEmpty());
+  assert(!split_cpu_);
+
+  const std::vector<Checkpoint::Trace>& positions = checkpoint.traces();
+  if (positions.size() != traces_.size())
+    return false;
+
+  // The converted buffers must be left unchanged by the growth of the trace
+  // files: a circular trace file overwrites its buffers.
+  for (size_t i = 0; i < positions.size(); ++i) {
+    const Checkpoint::Trace& position = positions[i];
+    ETLReader reader;
+    if (position.path != traces_[i] || !reader.Open(traces_[i]) ||
+        position.start_time != reader.info().start_time ||
+        position.buffers > reader.buffers().size()) {
+      return false;
+    }
+
+    if (position.buffers != 0) {
+      const ETLBuffer& last = reader.buffers()[position.buffers - 1];
+      if (position.last_buffer_offset != last.offset ||
+          position.last_buffer_filled != last.filled) {
+        return false;
+      }
+    }
+
+    // Each position must be in a buffer of its processor.
+    const std::vector<std::vector<size_t> >& processor_buffers =
+        reader.processor_buffers();
+    if (position.positions.size() > processor_buffers.size())
+      return false;
+    for (size_t j = 0; j < position.positions.size(); ++j) {
+      const ETLPosition& stream = position.positions[j];
+      if (stream.buffer == ETLPosition::kNoBuffer)
+        continue;
+      const std::vector<size_t>& buffers = processor_buffers[j];
+      if (stream.buffer >= position.buffers ||
+          std::find(buffers.begin(), buffers.end(), stream.buffer) ==
+              buffers.end() ||
+          stream.offset > reader.buffers()[stream.buffer].filled) {
+        return false;
+      }
+    }
+  }
+
+  // The checkpoint holds the state of each registered observer.
+  const std::vector<std::string>& states = checkpoint.observer_states();
+  size_t observers = 0;
+  etw_observer::ETWObserver* observer = etw_observer::GetFirstETWObserver();
+  for (; observer != NULL; observer = observer->next())
+    ++observers;
+  if (states.size() != observers)
+    return false;
+  observer = etw_observer::GetFirstETWObserver();
+  for (size_t i = 0; observer != NULL; observer = observer->next(), ++i) {
+    if (!observer->RestoreState(this, states[i]))
+      return false;
+  }
+
+  checkpoint.RestoreMetadata(&metadata_);
+  trace_positions_ = positions;
+  complete_ = checkpoint.complete();
+  last_timestamp_ = checkpoint.last_timestamp();
+
+  // Pack the events of the open packet with the next events.
+  const Checkpoint::OpenPacket& packet = checkpoint.open_packet();
+  if (packet.events != 0) {
+    sending_queue_.EncodeBytes(
+        reinterpret_cast<const uint8_t*>(packet.bytes.data()),
+        packet.bytes.size());
+    open_packet_events_ = static_cast<size_t>(packet.events);
+    open_packet_start_timestamp_ = packet.start_timestamp;
+    open_packet_stop_timestamp_ = packet.stop_timestamp;
+  }
+
+  resumed_ = true;
+  return true;
+}
+
+void ETWConsumer::UpdateCheckpoint(Checkpoint* checkpoint) const {
+  assert(checkpoint != NULL);
+  assert(full_packets_.empty());
+  assert(!event_pending_);
+
+  checkpoint->set_traces(trace_positions_);
+  checkpoint->set_complete(complete_);
+  checkpoint->set_last_timestamp(last_timestamp_);
+  checkpoint->SetMetadata(metadata_);
+
+  // The sent packets precede the open packet in the sending queue.
+  Checkpoint::OpenPacket packet;
+  if (open_packet_events_ != 0) {
+    packet.bytes.assign(
+        reinterpret_cast<const char*>(sending_queue_.raw_bytes()) +
+            open_packet_offset_,
+        sending_queue_.size() - open_packet_offset_);
+    packet.events = open_packet_events_;
+    packet.start_timestamp = open_packet_start_timestamp_;
+    packet.stop_timestamp = open_packet_stop_timestamp_;
+  }
+  checkpoint->set_open_packet(packet);
+
+  std::vector<std::string> states;
+  etw_observer::ETWObserver* observer = etw_observer::GetFirstETWObserver();
+  for (; observer != NULL; observer = observer->next()) {
+    states.push_back(std::string());
+    observer->SaveState(this, &states.back());
+  }
+  checkpoint->set_observer_states(states);
+}
+
+void ETWConsumer::ResumeReaders(const std::vector<ETLReader*>& readers) {
+  assert(readers.size() == trace_positions_.size());
+
+  for (size_t i = 0; i < readers.size(); ++i)
+    readers[i]->SetPositions(trace_positions_[i].positions);
+
+  // The events of a buffer added after the conversion of all the events may
+  // be older than the last converted event, when another processor flushed
+  // its buffer first: they cannot be appended to the stream in timestamp
+  // order. An interrupted conversion resumes with the same events instead.
+  if (!complete_)
+    return;
+  int64_t start = static_cast<int64_t>(last_timestamp_);
+  for (size_t i = 0; i < readers.size(); ++i)
+    readers[i]->SetTimeRange(start, std::numeric_limits<int64_t>::max());
+}
+
+bool ETWConsumer::IsCheckpointDue() {
+  if (checkpoint_callback_ == NULL)
+    return false;
+
+  // Reading the clock after each event would slow down the conversion.
+  if (checkpoint_countdown_ != 0) {
+    --checkpoint_countdown_;
+    return false;
+  }
+  checkpoint_countdown_ = kCheckpointClockPeriod;
+  if (checkpoint_stopwatch_.Elapsed() < checkpoint_interval_)
+    return false;
+
+  checkpoint_stopwatch_ = base::Stopwatch();
+  return true;
+}
+
+void ETWConsumer::RecordPositions(
+    const std::vector<ETLReader*>& readers,
+    const std::vector<std::vector<ETLPosition> >& positions,
+    bool complete) {
+  assert(readers.size() == traces_.size());
+  assert(positions.size() == readers.size());
+
+  trace_positions_.clear();
+  for (size_t i = 0; i < readers.size(); ++i) {
+    trace_positions_.push_back(
+        GetTracePosition(traces_[i], *readers[i], positions[i]));
+  }
+  complete_ = complete;
+}
+
+bool ETWConsumer::NotifyBuffersRead(size_t buffers_read,
+                                    EVENT_TRACE_LOGFILE* logfile) {
+  assert(logfile != NULL);
+
+  while (buffer_callback_ != NULL && logfile->BuffersRead < buffers_read) {
+    ++logfile->BuffersRead;
+    if (buffer_callback_(logfile) == FALSE)
+      return false;
+  }
+  return true;
+}
+
+bool ETWConsumer::ConsumeTracesWithReaders(
+    const std::vector<ETLReader*>& readers, EVENT_TRACE_LOGFILE* logfile) {
+  assert(logfile != NULL);
+
+  // Events are delivered in timestamp order. The buffer callback is
+  // called once all the events of a buffer have been delivered.
+  base::Stopwatch stopwatch;
+  ETLReaderMerger merger(readers);
+  EVENT_RECORD record;
+  std::vector<std::vector<ETLPosition> > positions;
+  bool valid = true;
+  bool done = false;
+  while (!done) {
+    done = !merger.ReadNextEvent(&record);
+
+    if (!NotifyBuffersRead(merger.buffers_read(), logfile)) {
+      valid = false;
+      break;
+    }
+
+    if (!done) {
+      event_callback_(&record);
+      if (IsCheckpointDue()) {
+        merger.GetPositions(&positions);
+        RecordPositions(readers, positions, false);
+        checkpoint_callback_();
+      }
+    }
+  }
+
+  if (valid) {
+    merger.GetPositions(&positions);
+    RecordPositions(readers, positions, true);
+  }
+
+  unsupported_events_ += merger.unsupported_events();
+  skipped_events_ += merger.skipped_events();
+  io_wait_time_ += merger.io_wait_time();
+  decode_time_ += stopwatch.Elapsed() - merger.io_wait_time();
+  return valid;
+}
+
+bool ETWConsumer::ConsumeRecordStream() {
+  assert(event_callback_ != NULL);
+
+  RecordStreamReader reader;
+  if (!reader.Open(record_stream_)) {
+    std::wcerr << L"Cannot open the record stream '" << record_stream_
+               << L"'." << std::endl;
+    return false;
+  }
+
+  // Reserve some memory space for internal buffers.
+  data_property_buffer_.resize(1024);
+
+  // Events are delivered in the order they arrive.
+  EVENT_RECORD record;
+  while (reader.ReadNextEvent(&record))
+    event_callback_(&record);
+
+  unsupported_events_ += reader.unsupported_events();
+
+  // Free unused memory.
+  data_property_buffer_.clear();
+  decode_plans_.Clear();
+
+  // A collector stopping in the middle of a frame loses only that frame.
+  if (reader.truncated())
+    std::wcerr << L"The record stream ends with a partial frame." << std::endl;
+  if (reader.corrupted()) {
+    std::wcerr << L"The record stream holds an invalid frame." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool ETWConsumer::ConsumeTracesInParallel(
+    const std::vector<ETLReader*>& readers, size_t jobs,
+    const std::vector<EventFilter>& observed_events,
+    EVENT_TRACE_LOGFILE* logfile) {
+  assert(logfile != NULL);
+  assert(packet_callback_ != NULL);
+
+  // The events decoded by the workers are added to the sending queue in
+  // timestamp order, as the event callback would have added them.
+  ParallelDecoder decoder(readers, jobs, event_filter_, observed_events,
+                          split_cpu_, &metadata_);
+  const uint8_t* bytes = NULL;
+  EncodedEvent event;
+  EVENT_RECORD record;
+  std::vector<std::vector<ETLPosition> > positions;
+  bool valid = true;
+  bool done = false;
+  while (!done) {
+    done = !decoder.ReadNextEvent(&bytes, &event);
+
+    if (!NotifyBuffersRead(decoder.buffers_read(), logfile)) {
+      valid = false;
+      break;
+    }
+
+    if (!done) {
+      if (decoder.GetObservedEvent(&record)) {
+        BeginObservedEvent(event, &record);
+        decoder.BindObservedEvent();
+        AddEncodedEvent(bytes, event);
+        EndObservedEvent(&record);
+      } else {
+        AddEncodedEvent(bytes, event);
+      }
+      packet_callback_();
+      if (IsCheckpointDue()) {
+        decoder.GetPositions(&positions);
+        RecordPositions(readers, positions, false);
+        checkpoint_callback_();
+      }
+    }
+  }
+
+  if (valid) {
+    decoder.GetPositions(&positions);
+    RecordPositions(readers, positions, true);
+  }
+
+  events_processed_ += decoder.events_processed();
+  unsupported_events_ += decoder.unsupported_events();
+  skipped_events_ += decoder.skipped_events();
+  io_wait_time_ += decoder.io_wait_time();
+  decode_time_ += decoder.decode_time();
+  if (valid)
+    decoder.AddStatistics(&decode_plans_, &passthrough_events_,
+                          &filtered_events_);
+  return valid;
+}
+
+void ETWConsumer::TakeEncodedEvents(Metadata::Packet* bytes,
+                                    std::vector<EncodedEvent>* events) {
+  assert(bytes != NULL);
+  assert(events != NULL);
+  assert(!pack_events_);
+  assert(!event_pending_);
+
+  bytes->Reset(0);
+  bytes->Swap(&sending_queue_);
+  events->clear();
+  events->swap(encoded_events_);
+}
+
+void ETWConsumer::AddEncodedEvent(const uint8_t* bytes,
+                                  const EncodedEvent& event) {
+  assert(bytes != NULL);
+
+  event_processor_ = event.processor;
+  if (split_cpu_)
+    SelectCpu(event.processor);
+
+  Metadata::Packet* packet = AcquirePacket();
+  size_t event_offset = packet->size();
+  packet->EncodeBytes(bytes + event.offset, event.size);
+  packet->set_timestamp(event.timestamp);
+  packet->set_event_id_offset(event_offset + event.event_id_offset);
+  AddPacketToSendingQueue(packet);
+}
+
+void ETWConsumer::BeginObservedEvent(const EncodedEvent& event,
+                                     PEVENT_RECORD pevent) {
+  assert(pevent != NULL);
+
+  // The events generated by the observers go to the stream of the event.
+  event_processor_ = event.processor;
+  if (split_cpu_)
+    SelectCpu(event.processor);
+
+  FOR_EACH_ETW_OBSERVER(OnBeginProcessEvent(this, pevent));
+}
+
+void ETWConsumer::EndObservedEvent(PEVENT_RECORD pevent) {
+  assert(pevent != NULL);
+
+  ReplayEventDecoding(pevent);
+  FOR_EACH_ETW_OBSERVER(OnEndProcessEvent(this, pevent));
+}
+
+bool ETWConsumer::IsFullPacketReady() {
+  return !full_packets_.empty();
 }
 
 bool ETWConsumer::IsSendingQueueEmpty() {
-  return packet_total_bytes_ == 0;
+  return full_packets_.empty() && open_packet_events_ == 0;
 }
 
-void ETWConsumer::FinalizePacket(const Metadata::Event& descr,
-                                 Metadata::Packet* packet) {
+size_t ETWConsumer::FinalizePacket(const Metadata::Event& descr,
+                                   Metadata::Packet* packet) {
+  size_t event_id = metadata_.GetIdForEvent(descr);
+  FinalizePacket(event_id, packet);
+  return event_id;
+}
+
+void ETWConsumer::FinalizePacket(size_t event_id, Metadata::Packet* packet) {
   assert(packet != NULL);
   assert(packet->event_id_offset() > 0);
-  size_t event_id = metadata_.GetIdForEvent(descr);
+  assert(event_id > 0 && event_id <= metadata_.size());
   packet->UpdateUInt32(packet->event_id_offset(), event_id);
 }
 
-void ETWConsumer::AddPacketToSendingQueue(const Metadata::Packet& packet) {
-  assert(packet.event_id_offset() > 0);
-  assert(packet.size() > packet.event_id_offset());
+Metadata::Packet* ETWConsumer::AcquirePacket() {
+  assert(!event_pending_);
+
+  // Events which are not packed are encoded one after the other.
+  if (!pack_events_) {
+    event_offset_ = sending_queue_.size();
+    event_pending_ = true;
+    return &sending_queue_;
+  }
+
+  // Recycle the memory of the sent packets once they are all sent. Only the
+  // open packet has to be moved.
+  if (sent_offset_ != 0 && sent_offset_ == open_packet_offset_) {
+    sending_queue_.Erase(0, sent_offset_);
+    open_packet_offset_ -= sent_offset_;
+    sent_offset_ = 0;
+  }
+
+  // Open a new packet when needed.
+  if (sending_queue_.size() == open_packet_offset_) {
+    const Metadata::Packet& header = GetPacketHeader();
+    sending_queue_.EncodeBytes(header.raw_bytes(), header.size());
+  }
+
+  event_offset_ = sending_queue_.size();
+  event_pending_ = true;
+  return &sending_queue_;
+}
+
+void ETWConsumer::ReleasePacket(Metadata::Packet* packet) {
+  assert(packet == &sending_queue_);
+  assert(event_pending_);
+  sending_queue_.Reset(event_offset_);
+  event_pending_ = false;
+}
+
+void ETWConsumer::AddPacketToSendingQueue(Metadata::Packet* packet) {
+  assert(packet == &sending_queue_);
+  assert(event_pending_);
+  assert(packet->event_id_offset() > event_offset_);
+  assert(packet->size() > packet->event_id_offset());
 
   // Check whether the event id has been updated by fetching it from the packet.
   assert(*reinterpret_cast<const uint32_t*>(
-              packet.raw_bytes() + packet.event_id_offset()) != 0);
+              packet->raw_bytes() + packet->event_id_offset()) != 0);
+
+  size_t event_size = sending_queue_.size() - event_offset_;
+
+  // Keep track of the location of events which are not packed.
+  if (!pack_events_) {
+    EncodedEvent event;
+    event.timestamp = packet->timestamp();
+    event.offset = event_offset_;
+    event.size = event_size;
+    event.event_id_offset = packet->event_id_offset() - event_offset_;
+    event.processor = event_processor_;
+    encoded_events_.push_back(event);
+    event_pending_ = false;
+    return;
+  }
 
-  packet_total_bytes_ += packet.size();
-  packets_.push_back(packet);
-}
+  size_t open_packet_size = event_offset_ - open_packet_offset_;
+
+  // Always keep the first event in the open packet: the payload of the first
+  // event may be bigger than the maximal packet size. Otherwise, close the
+  // open packet when the event does not fit.
+  if (open_packet_events_ != 0 &&
+      open_packet_size + event_size > packet_maximal_size_) {
+    size_t padding = ClosePacket(event_offset_);
+
+    // Insert the padding of the closed packet and the header of a new packet
+    // in front of the event.
+    const Metadata::Packet& header = GetPacketHeader();
+    sending_queue_.Insert(event_offset_, padding + header.size());
+    sending_queue_.UpdateBytes(open_packet_offset_,
+                               header.raw_bytes(), header.size());
+  }
 
-void ETWConsumer::PopPacketFromSendingQueue() {
-  assert(!packets_.empty());
-  assert(packet_total_bytes_ >= packets_.front().size());
-  packet_total_bytes_ -= packets_.front().size();
-  packets_.pop_front();
+  // Keep track of timestamps.
+  uint64_t timestamp = packet->timestamp();
+  last_timestamp_ = std::max(last_timestamp_, timestamp);
+  if (open_packet_events_ == 0) {
+    open_packet_start_timestamp_ = timestamp;
+    open_packet_stop_timestamp_ = timestamp;
+  } else {
+    open_packet_start_timestamp_ =
+        std::min<uint64_t>(open_packet_start_timestamp_, timestamp);
+    open_packet_stop_timestamp_ =
+        std::max<uint64_t>(open_packet_stop_timestamp_, timestamp);
+  }
+
+  ++open_packet_events_;
+  event_pending_ = false;
 }
 
-void ETWConsumer::BuildFullPacket(Metadata::Packet* output) {
-  assert(output != NULL);
-  assert(packet_total_bytes_ != 0);
-
-  // Encode and Write stream header.
-  EncodePacketHeader(output);
-
-  unsigned int packet_count = 0;
-  uint64_t start_timestamp = UINT64_MAX;
-  uint64_t stop_timestamp = 0;
-
-  while (packet_total_bytes_ > 0) {
-    const Metadata::Packet& packet = packets_.front();
-    // Always encode the first packet: the payload of the first packet may be
-    // bigger than the maximal packet size.
-    if (packet_count != 0) {
-      // Stop appending packet when maximal size is reached.
-      if (output->size() + packet.size() > packet_maximal_size_)
-        break;
-    }
+void ETWConsumer::BuildFullPacket(const uint8_t** raw, PacketInfo* packet) {
+  assert(raw != NULL);
+  assert(packet != NULL);
+  assert(!event_pending_);
+
+  // Pack the pending events into a last packet.
+  if (full_packets_.empty()) {
+    assert(open_packet_events_ != 0);
+    size_t padding = ClosePacket(sending_queue_.size());
+    sending_queue_.EncodeZeros(padding);
+  }
 
-    // Keep track of timestamps.
-    uint64_t timestamp = packet.timestamp();
-    start_timestamp = std::min<uint64_t>(start_timestamp, timestamp);
-    stop_timestamp = std::max<uint64_t>(stop_timestamp, timestamp);
+  // Slice the next full packet out of the sending queue.
+  *raw = sending_queue_.raw_bytes() + sent_offset_;
+  *packet = full_packets_[sent_packets_];
 
-    // Append this packet payload to the output packet.
-    output->EncodeBytes(packet.raw_bytes(), packet.size());
-    packet_count++;
-    PopPacketFromSendingQueue();
+  sent_offset_ += packet->size;
+  ++sent_packets_;
+  if (sent_packets_ == full_packets_.size()) {
+    full_packets_.clear();
+    sent_packets_ = 0;
   }
+}
+
+size_t ETWConsumer::ClosePacket(size_t content_end) {
+  assert(open_packet_events_ != 0);
+  assert(content_end > open_packet_offset_);
 
   // Get packet content size.
-  uint32_t content_size = output->size();
+  size_t content_size = content_end - open_packet_offset_;
 
-  // Add padding.
+  // Get packet size (payload + padding).
+  size_t packet_size = content_size;
   if (packet_maximal_size_ != 0) {
-    while ((output->size() % packet_maximal_size_) != 0)
-      output->EncodeUInt8(0);
+    size_t remainder = content_size % packet_maximal_size_;
+    if (remainder != 0)
+      packet_size += packet_maximal_size_ - remainder;
   }
 
-  // Get packet size (payload + padding).
-  uint32_t packet_size = output->size();
+  // Update the packet header.
+  UpdatePacketHeader(open_packet_offset_, content_size, packet_size,
+                     open_packet_start_timestamp_, open_packet_stop_timestamp_,
+                     &sending_queue_);
+
+  // The packet is ready to be sent. The next packet starts after the padding.
+  PacketInfo packet;
+  packet.size = packet_size;
+  packet.content_size = content_size;
+  packet.events = open_packet_events_;
+  packet.start_timestamp = open_packet_start_timestamp_;
+  packet.stop_timestamp = open_packet_stop_timestamp_;
+  full_packets_.push_back(packet);
+  open_packet_offset_ += packet_size;
+  open_packet_events_ = 0;
+
+  return packet_size - content_size;
+}
 
-  // Update the output packet header.
-  UpdatePacketHeader(content_size, packet_size,
-                     start_timestamp, stop_timestamp, output);
+const Metadata::Packet& ETWConsumer::GetPacketHeader() {
+  if (packet_header_.size() == 0)
+    EncodePacketHeader(&packet_header_);
+  return packet_header_;
 }
 
 void ETWConsumer::EncodeGeneratedEventHeader(uint64_t timestamp,
                                              unsigned char opcode,
                                              unsigned char version,
                                              const GUID& provider_id,
-                                             Metadata::Packet* packet) {
+                                             Metadata::Packet* packet) const {
   assert(packet != NULL);
 
   // Fill a "fake" ETW event header and send it through the usual header
@@ -258,7 +972,7 @@ void ETWConsumer::EncodeGeneratedEventHeader(uint64_t timestamp,
 
 void ETWConsumer::EncodeEventHeader(const EVENT_HEADER& header,
                                     const ETW_BUFFER_CONTEXT& buffer_context,
-                                    Metadata::Packet* packet) {
+                                    Metadata::Packet* packet) const {
   assert(packet != NULL);
 
   // Output stream.header.timestamp.
@@ -282,10 +996,12 @@ void ETWConsumer::EncodeEventHeader(const EVENT_HEADER& header,
   packet->EncodeUInt16(header.EventDescriptor.Task);
   packet->EncodeUInt64(header.EventDescriptor.Keyword);
 
-  // Output stream.context.pid/tid/cpu_id.
+  // Output stream.context.pid/tid/cpu_id. The processor is in the packet
+  // context of the processor streams.
   packet->EncodeUInt32(header.ProcessId);
   packet->EncodeUInt32(header.ThreadId);
-  packet->EncodeUInt8(buffer_context.ProcessorNumber);
+  if (!split_cpu_)
+    packet->EncodeUInt8(buffer_context.ProcessorNumber);
   packet->EncodeUInt16(buffer_context.LoggerId);
 
   // Output stream.context.uuid.
@@ -326,16 +1042,22 @@ void ETWConsumer::EncodePacketHeader(Metadata::Packet* packet) {
   // Output trace.header.start/stop_timestamp.
   packet->EncodeUInt64(0);
   packet->EncodeUInt64(0);
+
+  // Output stream.packet.context.cpu_id.
+  if (split_cpu_)
+    packet->EncodeUInt32(0);
 }
 
-void ETWConsumer::UpdatePacketHeader(uint32_t content_size,
+void ETWConsumer::UpdatePacketHeader(size_t packet_offset,
+                                     uint32_t content_size,
                                      uint32_t packet_size,
                                      uint64_t start_timestamp,
                                      uint64_t stop_timestamp,
                                      Metadata::Packet* packet) {
   assert(packet != NULL);
 
-  size_t packet_context_offset = packet->packet_context_offset();
+  size_t packet_context_offset =
+      packet_offset + GetPacketHeader().packet_context_offset();
 
   // content_size is encoded in bits.
   packet->UpdateUInt32(packet_context_offset, content_size * 8);
@@ -352,6 +1074,13 @@ void ETWConsumer::UpdatePacketHeader(uint32_t content_size,
   // Stop timestamp.
   packet->UpdateUInt64(packet_context_offset, stop_timestamp);
   packet_context_offset += 8;
+
+  // Processor of the stream.
+  if (split_cpu_) {
+    packet->UpdateUInt32(packet_context_offset,
+                         static_cast<uint32_t>(active_cpu_));
+    packet_context_offset += 4;
+  }
 }
 
 bool ETWConsumer::ProcessBuffer(PEVENT_TRACE_LOGFILEW ptrace) {
@@ -362,6 +1091,26 @@ bool ETWConsumer::ProcessBuffer(PEVENT_TRACE_LOGFILEW ptrace) {
 bool ETWConsumer::ProcessEvent(PEVENT_RECORD pevent) {
   assert(pevent != NULL);
 
+  ++events_processed_;
+
+  // A failed write is reported when the writer is closed.
+  if (record_writer_ != NULL)
+    record_writer_->WriteEvent(*pevent);
+
+  // Drop the rejected events before any decoding.
+  if (!event_filter_.Accepts(pevent->EventHeader)) {
+    ++filtered_events_;
+    return false;
+  }
+
+  // The events generated by the observers go to the stream of the event.
+  event_processor_ = pevent->BufferContext.ProcessorNumber;
+  if (split_cpu_ && pack_events_)
+    SelectCpu(event_processor_);
+
+  if (!observed_)
+    return ProcessEventInternal(pevent);
+
   FOR_EACH_ETW_OBSERVER(OnBeginProcessEvent(this, pevent));
   bool res = ProcessEventInternal(pevent);
   FOR_EACH_ETW_OBSERVER(OnEndProcessEvent(this, pevent));
@@ -377,12 +1126,15 @@ bool ETWConsumer::ProcessEventInternal(PEVENT_RECORD pevent) {
     return false;
   }
 
-  Metadata::Packet packet;
-  EncodeEventHeader(pevent->EventHeader, pevent->BufferContext, &packet);
+  Metadata::Packet* packet = AcquirePacket();
+  EncodeEventHeader(pevent->EventHeader, pevent->BufferContext, packet);
 
   // Decode the packet payload.
-  Metadata::Event descr;
-  size_t payload_position = packet.size();
+  Metadata::Event& descr = event_descr_;
+  descr.Clear();
+  size_t payload_position = packet->size();
+  DecodePlan* plan = NULL;
+  size_t event_id = 0;
 
   // Try to decode the payload using a dissector.
   const GUID& guid = pevent->EventHeader.ProviderId;
@@ -390,25 +1142,44 @@ bool ETWConsumer::ProcessEventInternal(PEVENT_RECORD pevent) {
   char* data = static_cast<char*>(pevent->UserData);
   uint32_t length = pevent->UserDataLength;
   if (!dissector::DecodeEventWithDissectors(guid, opcode, data, length,
-                                            &packet, &descr)) {
+                                            packet, &descr)) {
     // The above function should reset |descr| and |packet| in case of failure.
     assert(descr.size() == 0);
-    assert(packet.size() == payload_position);
+    assert(packet->size() == payload_position);
 
     // Try to decode the payload using trace data helper (TDH).
-    if (!DecodePayload(pevent, &packet, &descr)) {
+    if (!DecodePayload(pevent, packet, &descr, &plan, &event_id)) {
       // On failure, remove packet data and metadata.
+      plan = NULL;
+      event_id = 0;
       descr.Reset();
-      packet.Reset(payload_position);
+      packet->Reset(payload_position);
 
       // Send the raw payload.
-      if (!SendRawPayload(pevent, &packet, &descr))
+      if (!SendRawPayload(pevent, packet, &descr)) {
+        ReleasePacket(packet);
         return false;
+      }
     }
   }
 
-  // Update the event_id, now we have the full layout information.
-  FinalizePacket(descr, &packet);
+  // Update the event_id, now we have the full layout information. Events
+  // decoded by a program already know their id. Events decoded field by field
+  // with a plan usually have the same layout as the previous event of the
+  // plan: reuse its id without looking up the metadata.
+  if (event_id != 0) {
+    FinalizePacket(event_id, packet);
+  } else if (plan != NULL && plan->event_id != 0 &&
+             plan->fingerprint == descr.Fingerprint()) {
+    FinalizePacket(plan->event_id, packet);
+  } else {
+    uint64_t fingerprint = descr.Fingerprint();
+    event_id = FinalizePacket(descr, packet);
+    if (plan != NULL) {
+      plan->event_id = event_id;
+      plan->fingerprint = fingerprint;
+    }
+  }
 
   // Add this packet to the sending queue.
   AddPacketToSendingQueue(packet);
@@ -416,6 +1187,33 @@ bool ETWConsumer::ProcessEventInternal(PEVENT_RECORD pevent) {
   return true;
 }
 
+void ETWConsumer::ReplayEventDecoding(PEVENT_RECORD pevent) {
+  assert(pevent != NULL);
+
+  // Decode the event as ProcessEventInternal() does, for the observers only:
+  // the encoded event and its layout come from the consumer which decoded it
+  // first, which also counted its payload when passed through.
+  Metadata::Packet* packet = &replayed_event_;
+  packet->Reset(0);
+  Metadata::Event& descr = event_descr_;
+  descr.Clear();
+
+  const GUID& guid = pevent->EventHeader.ProviderId;
+  uint8_t opcode = pevent->EventHeader.EventDescriptor.Opcode;
+  char* data = static_cast<char*>(pevent->UserData);
+  uint32_t length = pevent->UserDataLength;
+  if (dissector::DecodeEventWithDissectors(guid, opcode, data, length,
+                                           packet, &descr)) {
+    return;
+  }
+
+  DecodePlan* plan = NULL;
+  size_t event_id = 0;
+  size_t passthrough_events = passthrough_events_;
+  DecodePayload(pevent, packet, &descr, &plan, &event_id);
+  passthrough_events_ = passthrough_events;
+}
+
 bool ETWConsumer::SendRawPayload(PEVENT_RECORD pevent,
                                  Metadata::Packet* packet,
                                  Metadata::Event* descr) {
@@ -424,8 +1222,8 @@ bool ETWConsumer::SendRawPayload(PEVENT_RECORD pevent,
   assert(descr != NULL);
 
   // Get raw data pointer and size.
-  USHORT length = pevent->UserDataLength;
-  PVOID data = pevent->UserData;
+  uint16_t length = pevent->UserDataLength;
+  void* data = pevent->UserData;
   const size_t parent = Metadata::kRootScope;
 
   // Create the metadata fields.
@@ -442,11 +1240,16 @@ bool ETWConsumer::SendRawPayload(PEVENT_RECORD pevent,
   return true;
 }
 
-bool ETWConsumer::DecodePayload(
-     PEVENT_RECORD pevent, Metadata::Packet* packet, Metadata::Event* descr) {
+bool ETWConsumer::DecodePayload(PEVENT_RECORD pevent,
+                                Metadata::Packet* packet,
+                                Metadata::Event* descr,
+                                DecodePlan** plan,
+                                size_t* event_id) {
   assert(pevent != NULL);
   assert(packet != NULL);
   assert(descr != NULL);
+  assert(plan != NULL);
+  assert(event_id != NULL);
 
   // Assume initial scope is the root scope.
   const size_t parent = Metadata::kRootScope;
@@ -456,9 +1259,9 @@ bool ETWConsumer::DecodePayload(
   // function.
   if ((pevent->EventHeader.Flags & EVENT_HEADER_FLAG_STRING_ONLY) != 0) {
     // Encode string data.
-    LPWSTR wptr = static_cast<LPWSTR>(pevent->UserData);
-    std::string str = ConvertString(wptr);
-    packet->EncodeString(str);
+    const uint16_t* str = static_cast<const uint16_t*>(pevent->UserData);
+    size_t length = GetUTF16Length(str, pevent->UserDataLength / 2);
+    packet->EncodeUTF16String(str, length);
 
     // Create the metadata fields.
     Metadata::Field field_data(Metadata::Field::STRING, "data", parent);
@@ -466,58 +1269,49 @@ bool ETWConsumer::DecodePayload(
     return true;
   }
 
-  // Decode the metadata via trace data helper (TDH) using
-  // TdhGetEventInformation.
-  DWORD buffer_size = packet_info_buffer_.size();
-  ::memset(&packet_info_buffer_[0], 0, buffer_size);
-  PTRACE_EVENT_INFO pinfo =
-      reinterpret_cast<PTRACE_EVENT_INFO>(&packet_info_buffer_[0]);
-
-  DWORD status = TdhGetEventInformation(pevent, 0, NULL, pinfo, &buffer_size);
-  if (status == ERROR_INSUFFICIENT_BUFFER) {
-    // The internal buffer is too small, resize it and try again.
-    packet_info_buffer_.resize(buffer_size);
-    pinfo = reinterpret_cast<PTRACE_EVENT_INFO>(&packet_info_buffer_[0]);
-    status = TdhGetEventInformation(pevent, 0, NULL, pinfo, &buffer_size);
-  }
-
-  if (status != ERROR_SUCCESS)
+  // Retrieve the decode plan of the event. The schema source is only queried
+  // the first time a kind of event is seen.
+  *plan = decode_plans_.GetPlan(*pevent);
+  if (!(*plan)->valid)
     return false;
+  const EventSchema& schema = (*plan)->schema;
 
   // Notify the observers that the event information has been extracted.
-  FOR_EACH_ETW_OBSERVER(OnExtractEventInfo(this, pevent, pinfo));
-
-  // Filter the decoding source we don't know how to handle.
-  if (pinfo->DecodingSource != DecodingSourceWbem &&
-      pinfo->DecodingSource != DecodingSourceXMLFile) {
-    return false;
+  if (observed_)
+    FOR_EACH_ETW_OBSERVER(OnExtractEventInfo(this, pevent, schema));
+
+  // Decode the payload with the compiled program of the plan, unless an
+  // observer needs the payload fields.
+  DecodeProgram* program =
+      (*plan)->GetProgram(PayloadWalker::GetPointerSize(*pevent));
+  if (program != NULL && !ObservesPayloadFields(pevent) &&
+      DecodePayloadWithProgram(pevent, schema, program, packet, event_id)) {
+    return true;
   }
 
+  // Start locating the properties in the payload.
+  payload_walker_.Reset(&schema, pevent);
+
   // Retrieve event descriptor information.
-  descr->set_info(pinfo->EventGuid,
+  descr->set_info(schema.event_guid,
                   pevent->EventHeader.EventDescriptor.Opcode,
                   pevent->EventHeader.EventDescriptor.Version,
                   pevent->EventHeader.EventDescriptor.Id);
 
   // Retrieve event opcode name.
-  if (pinfo->OpcodeNameOffset > 0) {
-    size_t name_offset = pinfo->OpcodeNameOffset;
-    LPWSTR opcode_ptr =
-        reinterpret_cast<LPWSTR>(&packet_info_buffer_[name_offset]);
-    std::string opcode_name = ConvertString(opcode_ptr);
-    descr->set_name(opcode_name);
-  }
+  if (!schema.name.empty())
+    descr->set_name(schema.name);
 
   // Decode each field.
-  for (size_t i = 0; i < pinfo->TopLevelPropertyCount; ++i) {
+  for (size_t i = 0; i < schema.properties.size(); ++i) {
     size_t packet_offset = packet->size();
     size_t descr_offset = descr->size();
-    if (!DecodePayloadField(pevent, pinfo, parent, i, packet, descr)) {
+    if (!DecodePayloadField(pevent, schema, parent, i, packet, descr)) {
       // Reset state.
       packet->Reset(packet_offset);
       descr->Reset(descr_offset);
       // Send this field in raw.
-      if (!SendRawPayloadField(pevent, pinfo, parent, i, packet, descr)) {
+      if (!SendRawPayloadField(pevent, schema, parent, i, packet, descr)) {
         // Reset state.
         packet->Reset(packet_offset);
         descr->Reset(descr_offset);
@@ -529,49 +1323,101 @@ bool ETWConsumer::DecodePayload(
   return true;
 }
 
+bool ETWConsumer::ObservesPayloadFields(PEVENT_RECORD pevent) {
+  assert(pevent != NULL);
+
+  if (!observed_)
+    return false;
+
+  etw_observer::ETWObserver* observer = etw_observer::GetFirstETWObserver();
+  for (; observer != NULL; observer = observer->next()) {
+    if (observer->ObservesPayloadFields(this, pevent))
+      return true;
+  }
+  return false;
+}
+
+bool ETWConsumer::DecodePayloadWithProgram(PEVENT_RECORD pevent,
+                                           const EventSchema& schema,
+                                           DecodeProgram* program,
+                                           Metadata::Packet* packet,
+                                           size_t* event_id) {
+  assert(pevent != NULL);
+  assert(program != NULL);
+  assert(packet != NULL);
+  assert(event_id != NULL);
+
+  // Compile the program the first time it is needed.
+  if (!program->compiled()) {
+    Metadata::Event layout;
+    layout.set_info(schema.event_guid,
+                    pevent->EventHeader.EventDescriptor.Opcode,
+                    pevent->EventHeader.EventDescriptor.Version,
+                    pevent->EventHeader.EventDescriptor.Id);
+    if (!schema.name.empty())
+      layout.set_name(schema.name);
+    program->Compile(schema, PayloadWalker::GetPointerSize(*pevent), layout);
+  }
+
+  if (!program->valid())
+    return false;
+
+  const uint8_t* payload = static_cast<const uint8_t*>(pevent->UserData);
+  size_t passthrough_size = program->passthrough_size();
+  if (passthrough_size != 0) {
+    // The payload holds only fixed-size values: pass it through.
+    if (pevent->UserDataLength < passthrough_size)
+      return false;
+    packet->EncodeBytes(payload, passthrough_size);
+    ++passthrough_events_;
+  } else {
+    // Run the program. Payloads that don't match are decoded field by field.
+    size_t payload_position = packet->size();
+    if (!program->Run(payload, pevent->UserDataLength, packet)) {
+      packet->Reset(payload_position);
+      return false;
+    }
+  }
+
+  // The layout only gets an id once an event has been decoded with it.
+  if (program->event_id() == 0)
+    program->set_event_id(metadata_.GetIdForEvent(program->layout()));
+  *event_id = program->event_id();
+
+  return true;
+}
+
 bool ETWConsumer::SendRawPayloadField(PEVENT_RECORD pevent,
-                                      PTRACE_EVENT_INFO pinfo,
+                                      const EventSchema& schema,
                                       size_t parent,
                                       unsigned int field_index,
                                       Metadata::Packet* packet,
                                       Metadata::Event* descr) const {
   assert(pevent != NULL);
-  assert(pinfo != NULL);
   assert(packet != NULL);
   assert(descr != NULL);
 
   // Retrieve the field to decode.
-  const EVENT_PROPERTY_INFO& field =
-      pinfo->EventPropertyInfoArray[field_index];
+  const EventSchema::Property& field = schema.properties[field_index];
 
   // Field length.
-  size_t length = pinfo->EventPropertyInfoArray[field_index].length;
+  size_t length = field.length;
 
   // Determine the offset
   size_t offset = 0;
   for (size_t i = 0; i < field_index; ++i)
-    offset += pinfo->EventPropertyInfoArray[i].length;
+    offset += schema.properties[i].length;
 
   if (offset + length > pevent->UserDataLength)
     return false;
 
   // Retrieve data.
-  PBYTE raw_data = static_cast<PBYTE>(pevent->UserData);
-  uint8_t* data = static_cast<uint8_t*>(&raw_data[offset]);
-
-  // Keep a raw byte pointer to ease indirection through pinfo.
-  PBYTE raw_info = reinterpret_cast<PBYTE>(pinfo);
-
-  // Retrieve field name.
-  assert(field.NameOffset != 0);
-  size_t name_offset = field.NameOffset;
-  LPWSTR name_ptr = reinterpret_cast<LPWSTR>(&raw_info[name_offset]);
-  std::string field_name = ConvertString(name_ptr);
+  uint8_t* data = static_cast<uint8_t*>(pevent->UserData) + offset;
 
   // Create a scope for the structure.
   unsigned int scope = descr->size();
   descr->AddField(
-      Metadata::Field(Metadata::Field::STRUCT_BEGIN, field_name, parent));
+      Metadata::Field(Metadata::Field::STRUCT_BEGIN, field.name, parent));
 
   // Create the metadata fields.
   descr->AddField(
@@ -590,104 +1436,132 @@ bool ETWConsumer::SendRawPayloadField(PEVENT_RECORD pevent,
 }
 
 bool ETWConsumer::DecodePayloadField(PEVENT_RECORD pevent,
-                                     PTRACE_EVENT_INFO pinfo,
+                                     const EventSchema& schema,
                                      size_t parent,
                                      unsigned int field_index,
                                      Metadata::Packet* packet,
                                      Metadata::Event* descr) {
   assert(pevent != NULL);
-  assert(pinfo != NULL);
   assert(packet != NULL);
   assert(descr != NULL);
 
   // Retrieve the field to decode.
-  const EVENT_PROPERTY_INFO& field =
-      pinfo->EventPropertyInfoArray[field_index];
+  const EventSchema::Property& field = schema.properties[field_index];
 
   // Retrieve field information.
-  size_t count = pinfo->EventPropertyInfoArray[field_index].count;
-  size_t flags = pinfo->EventPropertyInfoArray[field_index].Flags;
-
-  // Keep a raw byte pointer to ease indirection through pinfo.
-  PBYTE raw_info = (PBYTE)pinfo;
-
-  // Retrieve field name.
-  assert(field.NameOffset != 0);
-  size_t name_offset = field.NameOffset;
-  LPWSTR name_ptr = reinterpret_cast<LPWSTR>(&raw_info[name_offset]);
-  std::string field_name = ConvertString(name_ptr);
-
-  // Contains the field information.
-  Metadata::Field merged_field;
+  size_t count = field.count;
+  size_t flags = field.flags;
+  const std::string& field_name = field.name;
+
+  // A binary value whose length is held by a previous property, decoded as
+  // an unsigned integer.
+  if (flags == PropertyParamLength) {
+    if (field.in_type != TDH_INTYPE_BINARY || field.count > 1 ||
+        field.length_property >= field_index) {
+      return false;
+    }
+    const std::string& length_name =
+        schema.properties[field.length_property].name;
+    const uint8_t* data = NULL;
+    size_t size = 0;
+    if (!DecodeProgram::IsCountField(*descr, length_name) ||
+        !payload_walker_.GetPropertyData(field_index, 0, &data, &size)) {
+      return false;
+    }
+    decoded_field_.Assign(Metadata::Field::BINARY_VAR, field_name,
+                          length_name, parent);
+    descr->AddField(decoded_field_);
+    packet->EncodeBytes(data, size);
+    return true;
+  }
 
   // TODO(bergeret): Handle aggregate types (struct, ...).
-  if (flags != 0) {
+  bool counted = flags == PropertyParamCount;
+  if (flags != 0 && !counted) {
     std::cout << "Skip flags:" << flags << std::endl;
     return false;
   }
 
-  // Assume not empty.
-  assert(count >= 1);
-  if (count > 1) {
-    descr->AddField(Metadata::Field(Metadata::Field::ARRAY_FIXED,
-                                    field_name,
-                                    count,
-                                    parent));
+  if (counted) {
+    // The number of elements is held by a previous property, decoded as an
+    // unsigned integer.
+    if (field.count_property >= field_index)
+      return false;
+    const std::string& count_name =
+        schema.properties[field.count_property].name;
+    if (!DecodeProgram::IsCountField(*descr, count_name) ||
+        !payload_walker_.GetElementCount(field_index, &count)) {
+      return false;
+    }
+    decoded_field_.Assign(Metadata::Field::ARRAY_VAR, field_name, count_name,
+                          parent);
+    descr->AddField(decoded_field_);
+    parent = descr->size() - 1;
+
+    // The elements of an empty array are described by the schema alone.
+    if (count == 0) {
+      Metadata::Field::FieldType field_type = Metadata::Field::INVALID;
+      size_t size = PayloadWalker::GetFixedSize(
+          field, PayloadWalker::GetPointerSize(*pevent));
+      if (!DecodeProgram::GetFieldType(field.in_type, field.out_type, size,
+                                       &field_type)) {
+        return false;
+      }
+      decoded_field_.Assign(field_type, field_name, 0, parent);
+      descr->AddField(decoded_field_);
+      return true;
+    }
+  } else if (count > 1) {
+    decoded_field_.Assign(Metadata::Field::ARRAY_FIXED, field_name, count,
+                          parent);
+    descr->AddField(decoded_field_);
     parent = descr->size() - 1;
   }
 
-  // Decode each element of the array.
-  for (size_t element = 0; element < count; ++element) {
-    // Descriptor used to fetch properties information. Size 2 is
-    // needed to fetch length of aggregate types.
-    PROPERTY_DATA_DESCRIPTOR data_descriptors[2];
-    unsigned int descriptor_count = 0;
-
-    PBYTE name_ptr = reinterpret_cast<PBYTE>(pinfo) + field.NameOffset;
-    data_descriptors[0].PropertyName = reinterpret_cast<ULONGLONG>(name_ptr);
-
-    data_descriptors[0].ArrayIndex = element;
-    descriptor_count = 1;
-
-    // Determine the property size.
-    ULONG property_size = 0;
-    ULONG status = TdhGetPropertySize(pevent, 0, NULL, descriptor_count,
-                                      &data_descriptors[0], &property_size);
-    if (status != ERROR_SUCCESS)
-      return false;
+  // Assume not empty.
+  assert(count >= 1);
 
-    // Get a pointer to a buffer large enough to hold the property.
-    if (property_size > data_property_buffer_.size())
-      data_property_buffer_.resize(property_size);
-    ::memset(&data_property_buffer_[0], 0, data_property_buffer_.size());
-    PBYTE raw_data = reinterpret_cast<PBYTE>(&data_property_buffer_[0]);
+  // The field describing the elements.
+  size_t element_field = descr->size();
 
-    // Retrieve the property.
-    status = TdhGetProperty(pevent, 0, NULL, descriptor_count,
-                            &data_descriptors[0], property_size, raw_data);
-    if (status != ERROR_SUCCESS)
-      return false;
+  // Decode each element of the array.
+  SchemaSource* source = decode_plans_.source();
+  for (size_t element = 0; element < count; ++element) {
+    // Locate the property in the payload. Retrieve it from the schema source
+    // when its offset or its size can't be determined from the schema.
+    const uint8_t* data = NULL;
+    size_t property_size = 0;
+    if (!payload_walker_.GetPropertyData(field_index, element,
+                                         &data, &property_size)) {
+      if (!source->GetPropertyData(*pevent, field, element,
+                                   &data_property_buffer_, &property_size)) {
+        return false;
+      }
+      data = reinterpret_cast<const uint8_t*>(&data_property_buffer_[0]);
+    }
+    void* raw_data = const_cast<uint8_t*>(data);
 
-    unsigned int in_type = field.nonStructType.InType;
-    unsigned int out_type = field.nonStructType.OutType;
+    unsigned int in_type = field.in_type;
+    unsigned int out_type = field.out_type;
 
-    FOR_EACH_ETW_OBSERVER(OnDecodePayloadField(this, parent, element,
-                                               field_name, in_type, out_type,
-                                               property_size, raw_data));
+    if (observed_) {
+      FOR_EACH_ETW_OBSERVER(OnDecodePayloadField(this, parent, element,
+                                                 field_name, in_type,
+                                                 out_type, property_size,
+                                                 raw_data));
+    }
 
     // Decode the current field and append encoded value to the packet.
-    Metadata::Field current_field;
     bool valid = DecodePayloadField(parent, field_name, in_type, out_type,
-                                    property_size, raw_data, &current_field,
+                                    property_size, raw_data, &decoded_field_,
                                     packet);
     if (!valid)
       return false;
 
     // Validate that all elements in the array are compatible.
     if (element == 0) {
-      merged_field = current_field;
-      descr->AddField(merged_field);
-    } else if (merged_field != current_field) {
+      descr->AddField(decoded_field_);
+    } else if (descr->at(element_field) != decoded_field_) {
       // Error when not the first elements and elements differ.
       return false;
     }
@@ -711,169 +1585,37 @@ bool ETWConsumer::DecodePayloadField(size_t parent,
 
   // Try to decode the property with in/out type.
   Metadata::Field::FieldType field_type = Metadata::Field::INVALID;
+  if (!DecodeProgram::GetFieldType(in_type, out_type, property_size,
+                                   &field_type)) {
+    return false;
+  }
+
   switch (in_type) {
-    case TDH_INTYPE_UNICODESTRING:
-      packet->EncodeString(ConvertString((LPWSTR)raw_data));
-      // TODO(bergeret): We should keep unicode.
-      *field = Metadata::Field(Metadata::Field::STRING, field_name, parent);
-      return true;
+    case TDH_INTYPE_UNICODESTRING: {
+      const uint16_t* str = static_cast<const uint16_t*>(raw_data);
+      packet->EncodeUTF16String(str, GetUTF16Length(str, property_size / 2));
+      break;
+    }
 
     case TDH_INTYPE_ANSISTRING:
       packet->EncodeString((const char*)raw_data);
-      *field = Metadata::Field(Metadata::Field::STRING, field_name, parent);
-      return true;
-
-    case TDH_INTYPE_UNICODECHAR:
-      if (property_size == 2) {
-        field_type = Metadata::Field::XINT16;
-        packet->EncodeUInt16(*reinterpret_cast<uint16_t*>(raw_data));
-        *field = Metadata::Field(field_type, field_name, parent);
-        return true;
-      }
-      break;
-
-    case TDH_INTYPE_ANSICHAR:
-    case TDH_INTYPE_INT8:
-    case TDH_INTYPE_UINT8:
-      switch (out_type) {
-        case TDH_OUTTYPE_HEXINT8:
-          field_type = Metadata::Field::XINT8;
-          break;
-        case TDH_OUTTYPE_BYTE:
-          field_type = Metadata::Field::INT8;
-          break;
-        case TDH_OUTTYPE_UNSIGNEDBYTE:
-          field_type = Metadata::Field::UINT8;
-          break;
-        default:
-          if (in_type == TDH_INTYPE_INT8) {
-            field_type = Metadata::Field::INT8;
-          } else {
-            field_type = Metadata::Field::UINT8;
-          }
-          break;
-      }
-
-      if (property_size == 1) {
-        packet->EncodeUInt8(*reinterpret_cast<uint8_t*>(raw_data));
-        *field = Metadata::Field(field_type, field_name, parent);
-        return true;
-      }
-      break;
-
-    case TDH_INTYPE_INT16:
-    case TDH_INTYPE_UINT16:
-      switch (out_type) {
-        case TDH_OUTTYPE_HEXINT16:
-          field_type = Metadata::Field::XINT16;
-          break;
-        case TDH_OUTTYPE_SHORT:
-          field_type = Metadata::Field::INT16;
-          break;
-        case TDH_OUTTYPE_UNSIGNEDSHORT:
-          field_type = Metadata::Field::UINT16;
-          break;
-        default:
-          if (in_type == TDH_INTYPE_INT16) {
-            field_type = Metadata::Field::INT16;
-          } else {
-            field_type = Metadata::Field::UINT16;
-          }
-          break;
-      }
-
-      if (property_size == 2) {
-        packet->EncodeUInt16(*reinterpret_cast<uint16_t*>(raw_data));
-        *field = Metadata::Field(field_type, field_name, parent);
-        return true;
-      }
-      break;
-
-    case TDH_INTYPE_INT32:
-    case TDH_INTYPE_UINT32:
-      switch (out_type) {
-        case TDH_OUTTYPE_HEXINT32:
-          field_type = Metadata::Field::XINT32;
-          break;
-        case TDH_OUTTYPE_INT:
-          field_type = Metadata::Field::INT32;
-          break;
-        case TDH_OUTTYPE_UNSIGNEDINT:
-          field_type = Metadata::Field::UINT32;
-          break;
-        default:
-          if (in_type == TDH_INTYPE_INT32) {
-            field_type = Metadata::Field::INT32;
-          } else {
-            field_type = Metadata::Field::UINT32;
-          }
-          break;
-      }
-
-      if (property_size == 4) {
-        packet->EncodeUInt32(*reinterpret_cast<uint32_t*>(raw_data));
-        *field = Metadata::Field(field_type, field_name, parent);
-        return true;
-      }
-      break;
-
-    case TDH_INTYPE_INT64:
-    case TDH_INTYPE_UINT64:
-      switch (out_type) {
-        case TDH_OUTTYPE_HEXINT64:
-          field_type = Metadata::Field::XINT64;
-          break;
-        default:
-          if (in_type == TDH_INTYPE_INT64) {
-            field_type = Metadata::Field::INT64;
-          } else {
-            field_type = Metadata::Field::UINT64;
-          }
-          break;
-      }
-
-      if (property_size == 8) {
-        packet->EncodeUInt64(*reinterpret_cast<uint64_t*>(raw_data));
-        *field = Metadata::Field(field_type, field_name, parent);
-        return true;
-      }
       break;
 
     case TDH_INTYPE_BOOLEAN:
-      if (property_size == 1) {
-        packet->EncodeUInt8(*reinterpret_cast<uint8_t*>(raw_data) != 0);
-        *field = Metadata::Field(Metadata::Field::UINT8, field_name, parent);
-        return true;
-      } else if (property_size == 4) {
-        packet->EncodeUInt8(*reinterpret_cast<uint32_t*>(raw_data) != 0);
-        *field = Metadata::Field(Metadata::Field::UINT8, field_name, parent);
-        return true;
-      }
-      break;
-
-    case TDH_INTYPE_GUID:
-      if (property_size == 16) {
-        packet->EncodeBytes(reinterpret_cast<uint8_t*>(raw_data), 16);
-        *field = Metadata::Field(Metadata::Field::GUID, field_name, parent);
-        return true;
-      }
+      if (property_size == 1)
+        packet->EncodeUInt8(LoadValue<uint8_t>(raw_data) != 0);
+      else
+        packet->EncodeUInt8(LoadValue<uint32_t>(raw_data) != 0);
       break;
 
-    case TDH_INTYPE_POINTER:
-    case TDH_INTYPE_SIZET:
-      if (property_size == 4) {
-        packet->EncodeUInt32(*reinterpret_cast<uint32_t*>(raw_data));
-        *field = Metadata::Field(Metadata::Field::XINT32, field_name, parent);
-        return true;
-      } else if (property_size == 8) {
-        packet->EncodeUInt64(*reinterpret_cast<uint64_t*>(raw_data));
-        *field = Metadata::Field(Metadata::Field::XINT64, field_name, parent);
-        return true;
-      }
+    default:
+      // Other values have a fixed size and are encoded as is.
+      packet->EncodeBytes(static_cast<uint8_t*>(raw_data), property_size);
       break;
   }
 
-  return false;
+  field->Assign(field_type, field_name, 0, parent);
+  return true;
 }
 
 bool ETWConsumer::SerializeMetadata(std::string* result) const {
@@ -980,6 +1722,7 @@ bool ETWConsumer::SerializeMetadata(std::string* result) const {
       << "    uint32  packet_size;\n"
       << "    uint64  timestamp_begin;\n"
       << "    uint64  timestamp_end;\n"
+      << (split_cpu_ ? "    uint32  cpu_id;\n" : "")
       << "  };\n"
       << "  event.header := struct {\n"
       << "    uint64  timestamp;\n"
@@ -995,7 +1738,7 @@ bool ETWConsumer::SerializeMetadata(std::string* result) const {
       << "    xint64  ev_keyword;\n"
       << "    uint32  pid;\n"
       << "    uint32  tid;\n"
-      << "    uint8   cpu_id;\n"
+      << (split_cpu_ ? "" : "    uint8   cpu_id;\n")
       << "    uint16  logger_id;\n"
       << "    struct  uuid provider_id;\n"
       << "    struct  uuid activity_id;\n"
@@ -28,40 +28,120 @@
 #ifndef CONVERTER_ETW_CONSUMER_H_
 #define CONVERTER_ETW_CONSUMER_H_
 
-// Restrict the import to the windows basic includes.
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>  // NOLINT
-// Turns the DEFINE_GUID for EventTraceGuid into a const.
-#define INITGUID
-#include <guiddef.h>
-#include <evntcons.h>
-#include <tdh.h>
-
 #include <cassert>
-#include <list>
 #include <string>
 #include <vector>
 
+#include "converter/checkpoint.h"
+#include "converter/decode_plan_cache.h"
+#include "converter/etl_reader.h"
+#include "converter/event_filter.h"
 #include "converter/metadata.h"
+#include "converter/payload_walker.h"
+#include "converter/record_stream_writer.h"
+#include "converter/tdh_schema_source.h"
 #include "base/disallow_copy_and_assign.h"
+#include "base/etw_types.h"
+#include "base/stopwatch.h"
 
 namespace converter {
 
-// The ETW consumer uses the windows API to consume ETW events. By using the
-// Trace Data Helper (THD), the converter decodes payloads and event layouts.
-// Decoded payloads are serialized into CTF packets.
+class ETLIndex;
+
+// The ETW consumer uses the windows API to consume ETW events, or reads them
+// directly from the trace files with an ETLReader. By using the Trace Data
+// Helper (THD), the converter decodes payloads and event layouts. Decoded
+// payloads are serialized into CTF packets.
 class ETWConsumer {
  public:
+  // The default number of buffers read ahead by the native reader.
+  static const size_t kDefaultReadAhead;
+
+  // Callback called after events are added to the sending queue without
+  // going through the event callback, to send the full packets.
+  typedef void (*PacketCallback)();
+
+  // Callback called periodically while trace files are converted, between
+  // two events, to record a checkpoint of the conversion.
+  typedef void (*CheckpointCallback)();
+
+  // An event encoded in place by a consumer that does not pack its events
+  // into CTF packets.
+  struct EncodedEvent {
+    // The timestamp of the event.
+    uint64_t timestamp;
+    // The offset of the event in the encoded bytes, and its size.
+    size_t offset;
+    size_t size;
+    // The offset of the event id, from the start of the event.
+    size_t event_id_offset;
+    // The processor of the event.
+    uint8_t processor;
+  };
+
+  // The description of a full packet, gathered when the packet is closed.
+  struct PacketInfo {
+    // The size of the packet and of its content, in bytes.
+    size_t size;
+    size_t content_size;
+    // The number of events of the packet and the range of their timestamps.
+    size_t events;
+    uint64_t start_timestamp;
+    uint64_t stop_timestamp;
+  };
+
   ETWConsumer()
-      : event_callback_(NULL),
+      : record_writer_(NULL),
+        event_callback_(NULL),
         buffer_callback_(NULL),
-        packet_total_bytes_(0),
-        packet_maximal_size_(0) {
+        packet_callback_(NULL),
+        checkpoint_callback_(NULL),
+        checkpoint_interval_(0),
+        checkpoint_countdown_(0),
+        sent_packets_(0),
+        sent_offset_(0),
+        open_packet_offset_(0),
+        open_packet_events_(0),
+        open_packet_start_timestamp_(0),
+        open_packet_stop_timestamp_(0),
+        event_offset_(0),
+        event_pending_(false),
+        packet_maximal_size_(0),
+        pack_events_(true),
+        observed_(true),
+        split_cpu_(false),
+        active_cpu_(0),
+        event_processor_(0),
+        jobs_(1),
+        read_ahead_(kDefaultReadAhead),
+        io_wait_time_(0),
+        decode_time_(0),
+        has_time_range_(false),
+        time_range_start_(0),
+        time_range_end_(0),
+        skipped_buffers_(0),
+        skipped_events_(0),
+        use_index_(false),
+        resumed_(false),
+        complete_(false),
+        last_timestamp_(0),
+        filtered_events_(0),
+        events_processed_(0),
+#if defined(_WIN32)
+        native_reader_(false),
+#else
+        native_reader_(true),
+#endif
+        passthrough_events_(0),
+        unsupported_events_(0),
+        decode_plans_(&tdh_schema_source_) {
   }
 
+  ~ETWConsumer();
+
   // Check whether the list of registered trace is empty.
   // @returns true when there are no traces to consume, false otherwise.
-  bool Empty() const { return traces_.empty(); }
+  bool Empty() const { return traces_.empty() && record_stream_.empty(); }
 
   // Add a trace file for consuming.
   // @param filename the path to the trace file.
@@ -69,6 +149,23 @@ class ETWConsumer {
     traces_.push_back(filename);
   }
 
+  // Consume a stream of framed event records instead of trace files. The
+  // events are converted as they arrive, until the stream ends. The buffer
+  // callback is not called: the records are not grouped in buffers.
+  // @param source "-" for the standard input, "unix:<path>" to connect to
+  //     a Unix socket, or the path of a recorded stream file.
+  void SetRecordStream(const std::wstring& source) {
+    record_stream_ = source;
+  }
+
+  // Record the events consumed in a record stream, before they are
+  // filtered, to replay them later. The trace files are then decoded on a
+  // single thread.
+  // @param writer the writer of the record stream, or NULL. Not owned.
+  void set_record_writer(RecordStreamWriter* writer) {
+    record_writer_ = writer;
+  }
+
   // Set the global event callback called by the Windows API.
   // This callback must be a trampoline to this->ProcessEvent(...).
   // @param ec the callback to be called for each event.
@@ -85,11 +182,206 @@ class ETWConsumer {
     buffer_callback_ = bc;
   }
 
+  // Set the callback called after events are added to the sending queue by
+  // the parallel decoding of trace files. Required by the native reader.
+  // @param pc the callback to be called to send full packets.
+  void SetPacketCallback(PacketCallback pc) {
+    assert(pc != NULL);
+    packet_callback_ = pc;
+  }
+
+  // Set the callback called periodically while the native reader converts
+  // trace files. The callback sends the full packets, then records the
+  // position of the conversion with UpdateCheckpoint.
+  // @param cc the callback to be called to record a checkpoint.
+  // @param interval the minimal time between two calls, in seconds.
+  void SetCheckpointCallback(CheckpointCallback cc, double interval) {
+    assert(cc != NULL);
+    checkpoint_callback_ = cc;
+    checkpoint_interval_ = interval;
+  }
+
   // Set the maximal CTF packet size.
   // @param size The maximal packet size.
   void set_packet_maximal_size(size_t size) { packet_maximal_size_ = size; }
 
-  // Consume all registered trace files.
+  // Split the events into a CTF stream per processor. Each processor gets
+  // its own sending queue, and its number moves from the context of each
+  // event to the context of each packet. Not possible with a checkpoint.
+  // @param enabled true to split the events by processor.
+  void set_split_cpu(bool enabled) { split_cpu_ = enabled; }
+
+  // @returns true when the events are split by processor.
+  bool split_cpu() const { return split_cpu_; }
+
+  // @returns the processor whose sending queue is active, when the events
+  //     are split by processor: the full packets belong to its stream.
+  size_t active_cpu() const { return active_cpu_; }
+
+  // @returns the number of processor sending queues, when the events are
+  //     split by processor: one past the highest processor seen.
+  size_t cpu_count() const { return cpu_queues_.size(); }
+
+  // Activate the sending queue of a processor, when the events are split by
+  // processor. The events of a processor select its queue as they are
+  // processed. Must not be called while an event is being encoded.
+  // @param cpu the processor of the queue.
+  void SelectCpu(size_t cpu);
+
+  // Produce the CTF stream name of a processor.
+  // @param cpu the processor of the stream.
+  // @param name receives the stream name.
+  void GetCpuStreamName(size_t cpu, std::wstring* name) const;
+
+  // Select how trace files are read. The native reader decodes the trace
+  // files directly, without the Windows trace consumption API. It is the
+  // only reader available on other platforms.
+  // @param enabled true to read trace files with the native reader.
+  void set_native_reader(bool enabled) { native_reader_ = enabled; }
+
+  // Set the number of threads decoding the buffers of the trace files. The
+  // decoded events are merged in timestamp order and the output does not
+  // depend on the number of threads. Each trace file gets its own thread,
+  // at least. Decoding in parallel requires the native reader, and ETW
+  // observers which tell the events they observe: these events are replayed
+  // to them in order, on a single thread.
+  // @param jobs the number of decoding threads.
+  void set_jobs(size_t jobs) { jobs_ = jobs; }
+
+  // Set the number of buffers the native reader reads ahead of the buffers
+  // being decoded, in each trace file.
+  // @param buffers the number of buffers read ahead.
+  void set_read_ahead(size_t buffers) { read_ahead_ = buffers; }
+
+  // Set the filter of the events to convert. The rejected events are
+  // dropped before observers, dissectors or TDH see them.
+  // @param filter the filter of the events.
+  void SetEventFilter(const EventFilter& filter) { event_filter_ = filter; }
+
+  // @returns the filter of the events to convert.
+  const EventFilter& event_filter() const { return event_filter_; }
+
+  // Restrict the conversion to the events of a time range, with the native
+  // reader. The buffers out of the range are skipped without being decoded,
+  // and the other events out of the range are dropped before their payload
+  // is decoded.
+  // @param start the start of the range, in seconds since the start of the
+  //     earliest trace file.
+  // @param end the end of the range, in seconds since the start of the
+  //     earliest trace file. May be infinite.
+  void SetTimeRange(double start, double end) {
+    assert(start <= end);
+    has_time_range_ = true;
+    time_range_start_ = start;
+    time_range_end_ = end;
+  }
+
+  // Select whether the native reader uses the sidecar index of each trace
+  // file, to skip the buffers without events in the time range or accepted
+  // by the event filter. A missing or stale index is built and saved next
+  // to the trace file.
+  // @param enabled true to use the index of the trace files.
+  void set_use_index(bool enabled) { use_index_ = enabled; }
+
+  // Resume the conversion of the trace files from a checkpoint, with the
+  // native reader. The events of each processor are read from their
+  // position in the checkpoint, the events not yet written to the stream
+  // are packed again, and the dictionary of event layouts and the state of
+  // the ETW observers are restored. When all the events were converted, the
+  // events of the buffers added later that are older than the last
+  // converted event are dropped. Must be called before any event is
+  // processed.
+  // @param checkpoint the checkpoint of a previous conversion.
+  // @returns true when the trace files are the ones of the checkpoint and
+  //     only grew since, and the ETW observers are the ones of the
+  //     checkpoint, false otherwise.
+  bool Resume(const Checkpoint& checkpoint);
+
+  // Record in a checkpoint the position of the conversion in the trace
+  // files, the events not yet written to the stream, the dictionary of event
+  // layouts and the state of the ETW observers. Called from the checkpoint
+  // callback, once the full packets are sent, or once all the events are
+  // consumed and sent.
+  // @param checkpoint receives the position of the conversion.
+  void UpdateCheckpoint(Checkpoint* checkpoint) const;
+
+  // Select whether encoded events are packed into CTF packets. When events
+  // are not packed, they are kept in the order they are encoded until they
+  // are taken with TakeEncodedEvents. Used by the consumers decoding buffers
+  // in parallel.
+  // @param enabled false to keep encoded events out of packets.
+  void set_pack_events(bool enabled) { pack_events_ = enabled; }
+
+  // Select whether the ETW observers see the events processed. Used by the
+  // consumers decoding buffers in parallel: the observed events are replayed
+  // by the consumer merging them.
+  // @param enabled false to hide the events from the ETW observers.
+  void set_observed(bool enabled) { observed_ = enabled; }
+
+  // Take the events encoded since the last call, when events are not packed.
+  // @param bytes receives the encoded bytes of the events.
+  // @param events receives the location of each event in |bytes|.
+  void TakeEncodedEvents(Metadata::Packet* bytes,
+                         std::vector<EncodedEvent>* events);
+
+  // @returns the number of events encoded since the last call to
+  //     TakeEncodedEvents, when events are not packed.
+  size_t encoded_events() const { return encoded_events_.size(); }
+
+  // Add an event encoded by another consumer to the sending queue. The id of
+  // the event must already refer to the metadata of this consumer.
+  // @param bytes the encoded bytes holding the event.
+  // @param event the location of the event in |bytes|.
+  void AddEncodedEvent(const uint8_t* bytes, const EncodedEvent& event);
+
+  // @returns the dictionary of event layouts.
+  const Metadata& metadata() const { return metadata_; }
+
+  // @returns the number of events read from the trace files.
+  uint64_t events_processed() const { return events_processed_; }
+
+  // @returns the time the native reader spent waiting for the trace files
+  //     to be read, in seconds, summed over the decoding threads.
+  double io_wait_time() const { return io_wait_time_; }
+
+  // @returns the time the native reader spent decoding the trace files, in
+  //     seconds, summed over the decoding threads.
+  double decode_time() const { return decode_time_; }
+
+  // @returns the number of buffers skipped by the native reader because they
+  //     are out of the time range or hold no events accepted by the filter.
+  size_t skipped_buffers() const { return skipped_buffers_; }
+
+  // @returns the number of events dropped by the native reader because they
+  //     are out of the time range.
+  size_t skipped_events() const { return skipped_events_; }
+
+  // @returns the number of events rejected by the event filter.
+  size_t filtered_events() const { return filtered_events_; }
+
+  // @returns the cache of the decode plans.
+  const DecodePlanCache& decode_plans() const { return decode_plans_; }
+
+  // Replace the source of the event schemas of this consumer, which defaults
+  // to the Trace Data Helper. The consumers decoding buffers in parallel keep
+  // the default source.
+  // @param source the source of the event schemas. Not owned.
+  void set_schema_source(SchemaSource* source) {
+    decode_plans_.set_source(source);
+  }
+
+  // @returns the number of events whose payload was copied verbatim.
+  size_t passthrough_events() const { return passthrough_events_; }
+
+  // @returns the number of events skipped by the native reader because
+  //     their layout is not supported.
+  size_t unsupported_events() const { return unsupported_events_; }
+
+  // @returns the number of allocations of the sending queue buffers.
+  size_t sending_queue_allocations() const;
+
+  // Consume all registered trace files, or the record stream. The
+  // registered callbacks are called for each event and each buffer.
   // @returns true on success, false if an error occurred.
   bool ConsumeAllEvents();
 
@@ -115,28 +407,52 @@ class ETWConsumer {
   // @returns true on success, false otherwise.
   bool SerializeMetadata(std::string* results) const;
 
-  // Check if pending packets can make a full packet.
-  // @returns true if there is enough pending bytes.
+  // Check if a full packet is ready to be sent.
+  // @returns true if a full packet is ready.
   bool IsFullPacketReady();
 
   // Check if the pending queue is empty.
   // @return true if the queue is empty, false otherwise.
   bool IsSendingQueueEmpty();
 
-  // Remove the pending packets and build a full packet ready to send.
-  // @param packet Receives the full packet.
-  void BuildFullPacket(Metadata::Packet* packet);
+  // Remove the next full packet from the sending queue. When no full packet
+  // is ready, the pending events are packed into a last packet. The packet is
+  // not copied: |raw| points into the sending queue and stays valid until the
+  // next call to AcquirePacket.
+  // @param raw receives a pointer to the bytes of the full packet.
+  // @param packet receives the size and the content of the full packet.
+  void BuildFullPacket(const uint8_t** raw, PacketInfo* packet);
+
+  // Get the packet in which a new event is encoded. The event is encoded in
+  // place at the end of the sending queue: offsets in the packet are not
+  // relative to the start of the event. The event must be completed through
+  // AddPacketToSendingQueue or discarded through ReleasePacket before the
+  // next call to AcquirePacket.
+  // @returns the packet receiving the new event.
+  Metadata::Packet* AcquirePacket();
+
+  // Discard the event being encoded.
+  // @param packet the packet obtained through AcquirePacket.
+  void ReleasePacket(Metadata::Packet* packet);
 
   // Update the event id of a packet. Must be called before adding the
   // packet to the sending queue.
   // @param descr the description of the packet.
   // @param packet the packet to finalize.
-  void FinalizePacket(const Metadata::Event& descr,
-                      Metadata::Packet* packet);
+  // @returns the event id of the packet. Events with the same layout can be
+  //     finalized with this id, without building their description.
+  size_t FinalizePacket(const Metadata::Event& descr,
+                        Metadata::Packet* packet);
+
+  // Update the event id of a packet with an id previously returned by
+  // FinalizePacket for the same layout.
+  // @param event_id the event id of the packet.
+  // @param packet the packet to finalize.
+  void FinalizePacket(size_t event_id, Metadata::Packet* packet);
 
-  // Add a packet to the sending queue.
-  // @param packet the packet to add to the sending queue.
-  void AddPacketToSendingQueue(const Metadata::Packet& packet);
+  // Add the event being encoded to the sending queue.
+  // @param packet the packet obtained through AcquirePacket.
+  void AddPacketToSendingQueue(Metadata::Packet* packet);
 
   // Encode the header of a generated event.
   // @param timestamp timestamp of the generated event.
@@ -144,25 +460,58 @@ class ETWConsumer {
   // @param version version of the generated event.
   // @param provider_id GUID of the provider that generates the event.
   // @param packet packet in which the header is encoded.
-  static void EncodeGeneratedEventHeader(uint64_t timestamp,
-                                         unsigned char opcode,
-                                         unsigned char version,
-                                         const GUID& provider_id,
-                                         Metadata::Packet* packet);
+  void EncodeGeneratedEventHeader(uint64_t timestamp,
+                                  unsigned char opcode,
+                                  unsigned char version,
+                                  const GUID& provider_id,
+                                  Metadata::Packet* packet) const;
 
  private:
-  static void EncodeEventHeader(const EVENT_HEADER& header,
-                                const ETW_BUFFER_CONTEXT& buffer_context,
-                                Metadata::Packet* packet);
+  bool ConsumeAllEventsWithReader();
+  bool ConsumeRecordStream();
+  bool NotifyBuffersRead(size_t buffers_read, EVENT_TRACE_LOGFILE* logfile);
+  void SelectBuffers(const std::vector<ETLReader*>& readers);
+  void ResumeReaders(const std::vector<ETLReader*>& readers);
+  bool IsCheckpointDue();
+  void RecordPositions(
+      const std::vector<ETLReader*>& readers,
+      const std::vector<std::vector<ETLPosition> >& positions,
+      bool complete);
+  void LoadIndex(const std::wstring& trace, const ETLReader& reader,
+                 ETLIndex* index);
+  bool ConsumeTracesWithReaders(const std::vector<ETLReader*>& readers,
+                                EVENT_TRACE_LOGFILE* logfile);
+  bool ConsumeTracesInParallel(const std::vector<ETLReader*>& readers,
+                               size_t jobs,
+                               const std::vector<EventFilter>& observed_events,
+                               EVENT_TRACE_LOGFILE* logfile);
+
+  void EncodeEventHeader(const EVENT_HEADER& header,
+                         const ETW_BUFFER_CONTEXT& buffer_context,
+                         Metadata::Packet* packet) const;
 
   bool ProcessEventInternal(PEVENT_RECORD pevent);
 
+  // Replay the processing of an event decoded by another consumer to the ETW
+  // observers, as ProcessEvent() does: the encoded event is added to the
+  // sending queue between the two calls.
+  void BeginObservedEvent(const EncodedEvent& event, PEVENT_RECORD pevent);
+  void EndObservedEvent(PEVENT_RECORD pevent);
+  void ReplayEventDecoding(PEVENT_RECORD pevent);
+
   bool DecodePayload(PEVENT_RECORD pevent, Metadata::Packet* packet,
-                     Metadata::Event* descr);
+                     Metadata::Event* descr, DecodePlan** plan,
+                     size_t* event_id);
+  bool DecodePayloadWithProgram(PEVENT_RECORD pevent,
+                                const EventSchema& schema,
+                                DecodeProgram* program,
+                                Metadata::Packet* packet,
+                                size_t* event_id);
+  bool ObservesPayloadFields(PEVENT_RECORD pevent);
   bool SendRawPayload(PEVENT_RECORD pevent, Metadata::Packet* packet,
                       Metadata::Event* descr);
 
-  bool DecodePayloadField(PEVENT_RECORD pevent, PTRACE_EVENT_INFO pinfo,
+  bool DecodePayloadField(PEVENT_RECORD pevent, const EventSchema& schema,
                           size_t parent, unsigned int field,
                           Metadata::Packet* packet, Metadata::Event* descr);
 
@@ -172,7 +521,7 @@ class ETWConsumer {
                           Metadata::Field* field, Metadata::Packet* packet);
 
   bool SendRawPayloadField(PEVENT_RECORD pevent,
-                           PTRACE_EVENT_INFO pinfo,
+                           const EventSchema& schema,
                            size_t parent,
                            unsigned int field,
                            Metadata::Packet* packet,
@@ -186,36 +535,180 @@ class ETWConsumer {
                               std::stringstream* out) const;
 
   void EncodePacketHeader(Metadata::Packet* packet);
-  void UpdatePacketHeader(uint32_t content_size,
+  void UpdatePacketHeader(size_t packet_offset,
+                          uint32_t content_size,
                           uint32_t packet_size,
                           uint64_t start_timestamp,
                           uint64_t stop_timestamp,
                           Metadata::Packet* packet);
 
-  void PopPacketFromSendingQueue();
+  const Metadata::Packet& GetPacketHeader();
+  size_t ClosePacket(size_t content_end);
+
+  // The sending queue of a processor, kept aside while the queue of another
+  // processor is active.
+  struct SendingQueue {
+    SendingQueue()
+        : sent_packets(0),
+          sent_offset(0),
+          open_packet_offset(0),
+          open_packet_events(0),
+          open_packet_start_timestamp(0),
+          open_packet_stop_timestamp(0) {
+    }
+
+    Metadata::Packet bytes;
+    std::vector<PacketInfo> full_packets;
+    size_t sent_packets;
+    size_t sent_offset;
+    size_t open_packet_offset;
+    size_t open_packet_events;
+    uint64_t open_packet_start_timestamp;
+    uint64_t open_packet_stop_timestamp;
+  };
+
+  void SwapSendingQueue(SendingQueue* queue);
 
   // Trace files to consume.
   std::vector<std::wstring> traces_;
 
+  // The source of the record stream to consume, empty for none.
+  std::wstring record_stream_;
+
+  // The writer recording the events consumed, or NULL.
+  RecordStreamWriter* record_writer_;
+
   // Callbacks to register to the ETW API.
   PEVENT_RECORD_CALLBACK event_callback_;
   PEVENT_TRACE_BUFFER_CALLBACK buffer_callback_;
+  PacketCallback packet_callback_;
+
+  // The checkpoint callback, the time between two checkpoints, the time
+  // since the last one, and the number of events before its next check.
+  CheckpointCallback checkpoint_callback_;
+  double checkpoint_interval_;
+  base::Stopwatch checkpoint_stopwatch_;
+  size_t checkpoint_countdown_;
 
   // The dictionary of event layouts.
   Metadata metadata_;
 
-  // A pending queue of packets to send.
-  std::list<const Metadata::Packet> packets_;
+  // The sending queue. Events are encoded in place and packed into CTF
+  // packets as they are added. The queue holds, in order:
+  //   - the full packets already sent, up to |sent_offset_|,
+  //   - the full packets ready to be sent, up to |open_packet_offset_|,
+  //   - the open packet, a packet header followed by the pending events,
+  //   - the event being encoded, from |event_offset_|.
+  // The memory of the sent packets is recycled by AcquirePacket.
+  Metadata::Packet sending_queue_;
+
+  // The full packets, of which the first |sent_packets_| have been sent. The
+  // vector is cleared once they have all been sent, so its memory is reused.
+  std::vector<PacketInfo> full_packets_;
+  size_t sent_packets_;
+
+  // The offset of the first full packet not yet sent.
+  size_t sent_offset_;
+
+  // The offset of the open packet.
+  size_t open_packet_offset_;
 
-  // The total number of bytes in pending queue.
-  size_t packet_total_bytes_;
+  // The number of events in the open packet and their timestamp range.
+  size_t open_packet_events_;
+  uint64_t open_packet_start_timestamp_;
+  uint64_t open_packet_stop_timestamp_;
+
+  // The offset and the state of the event being encoded.
+  size_t event_offset_;
+  bool event_pending_;
+
+  // The encoded header of a packet, copied at the start of each packet.
+  Metadata::Packet packet_header_;
+
+  // The layout of the event being decoded, reused from event to event.
+  Metadata::Event event_descr_;
 
   // The threshold before merging and sending pending packets.
   size_t packet_maximal_size_;
 
+  // Whether encoded events are packed into CTF packets, and the location of
+  // the encoded events when they are not.
+  bool pack_events_;
+  std::vector<EncodedEvent> encoded_events_;
+
+  // Whether the ETW observers see the events processed, and the bytes of the
+  // replayed events, decoded for the observers only.
+  bool observed_;
+  Metadata::Packet replayed_event_;
+
+  // Whether the events are split by processor, the processor of the active
+  // sending queue, and the queues of the processors seen, indexed by
+  // processor. The entry of the active processor is empty: its queue is in
+  // |sending_queue_| and the members following it.
+  bool split_cpu_;
+  size_t active_cpu_;
+  std::vector<SendingQueue*> cpu_queues_;
+
+  // The processor of the event being processed.
+  uint8_t event_processor_;
+
+  // The number of threads decoding the buffers of the trace files.
+  size_t jobs_;
+
+  // The number of buffers read ahead by the native reader, and the time it
+  // spent waiting for the trace files and decoding them.
+  size_t read_ahead_;
+  double io_wait_time_;
+  double decode_time_;
+
+  // The time range of the converted events, in seconds since the start of
+  // the earliest trace file, and the buffers and events out of the range.
+  bool has_time_range_;
+  double time_range_start_;
+  double time_range_end_;
+  size_t skipped_buffers_;
+  size_t skipped_events_;
+
+  // Whether the buffers to skip are found in the index of the trace files.
+  bool use_index_;
+
+  // The position of the conversion in each trace file: where a resumed
+  // conversion starts, then where the conversion was at the last
+  // checkpoint. Whether all the events were converted at that position. And
+  // the timestamp of the last converted event.
+  bool resumed_;
+  std::vector<Checkpoint::Trace> trace_positions_;
+  bool complete_;
+  uint64_t last_timestamp_;
+
+  // The filter of the events to convert, and the number of events rejected.
+  EventFilter event_filter_;
+  size_t filtered_events_;
+
+  // The number of events read from the trace files.
+  uint64_t events_processed_;
+
+  // Whether trace files are read by the native reader.
+  bool native_reader_;
+
+  // The number of events whose payload was copied verbatim.
+  size_t passthrough_events_;
+
+  // The number of events skipped by the native reader.
+  size_t unsupported_events_;
+
+  // The source of the event schemas, and the decode plans built from them.
+  TdhSchemaSource tdh_schema_source_;
+  DecodePlanCache decode_plans_;
+
+  // Locates the properties in the payload of the event being decoded.
+  PayloadWalker payload_walker_;
+
+  // The field being decoded, reused from field to field.
+  Metadata::Field decoded_field_;
+
   // Temporary buffer used to hold raw data produced by the ETW API.
   std::vector<char> data_property_buffer_;
-  std::vector<char> packet_info_buffer_;
 
   DISALLOW_COPY_AND_ASSIGN(ETWConsumer);
 };
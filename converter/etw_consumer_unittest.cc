@@ -0,0 +1,247 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Checks that the consumer does not allocate memory per event once it has
+// seen every kind of event: a counting operator new measures the allocations
+// made while events are converted and full packets are built.
+
+#include "converter/etw_consumer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "base/unittest.h"
+#include "converter/event_schema.h"
+#include "etw_observer/etw_observer.h"
+
+namespace {
+
+// Whether the allocations are counted.
+bool count_allocations = false;
+
+// Number of allocations made while |count_allocations| was set.
+size_t allocation_count = 0;
+
+void* Allocate(size_t size) {
+  if (count_allocations)
+    ++allocation_count;
+  void* memory = ::malloc(size == 0 ? 1 : size);
+  if (memory == NULL)
+    throw std::bad_alloc();
+  return memory;
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  return Allocate(size);
+}
+
+void* operator new[](size_t size) {
+  return Allocate(size);
+}
+
+void operator delete(void* memory) throw() {
+  ::free(memory);
+}
+
+void operator delete[](void* memory) throw() {
+  ::free(memory);
+}
+
+namespace converter {
+
+namespace {
+
+// Events converted before the allocations are counted.
+const size_t kWarmUpEventCount = 2000;
+
+// Events converted while the allocations are counted.
+const size_t kEventCount = 20000;
+
+const GUID kProvider = {
+    0x5C0FFEE5, 0x1234, 0x4321, { 0, 1, 2, 3, 4, 5, 6, 7 } };
+
+// Event ids of the generated events.
+const uint16_t kFileEventId = 10;
+const uint16_t kRawEventId = 11;
+
+EventSchema::Property MakeProperty(const char* name,
+                                   unsigned int in_type,
+                                   unsigned int count) {
+  EventSchema::Property property;
+  property.name = name;
+  property.in_type = in_type;
+  property.count = count;
+  return property;
+}
+
+// A schema source describing the events with the id |kFileEventId|. The
+// names are longer than the small string buffers of std::string.
+class FakeSchemaSource : public SchemaSource {
+ public:
+  virtual bool GetEventSchema(const EVENT_RECORD& record,
+                              EventSchema* schema) {
+    if (record.EventHeader.EventDescriptor.Id != kFileEventId)
+      return false;
+    schema->name = "FileIoReadWithAVeryLongName";
+    schema->properties.push_back(
+        MakeProperty("IoRequestPacketAddress", TDH_INTYPE_POINTER, 1));
+    schema->properties.push_back(
+        MakeProperty("TransferSizeInBytes", TDH_INTYPE_UINT32, 1));
+    schema->properties.push_back(
+        MakeProperty("FileNameOfTheRequest", TDH_INTYPE_UNICODESTRING, 1));
+    schema->properties.push_back(
+        MakeProperty("ReservedFlagsOfTheRequest", TDH_INTYPE_UINT16, 4));
+    return true;
+  }
+
+  virtual bool GetPropertyData(const EVENT_RECORD& /* record */,
+                               const EventSchema::Property& /* property */,
+                               size_t /* element */,
+                               std::vector<char>* /* buffer */,
+                               size_t* /* size */) {
+    return false;
+  }
+};
+
+// Forces a consumer to decode its payloads field by field.
+class FieldPathObserver : public etw_observer::ETWObserver {
+ public:
+  FieldPathObserver() : consumer_(NULL) {}
+
+  void set_consumer(ETWConsumer* consumer) { consumer_ = consumer; }
+
+  virtual bool ObservesPayloadFields(ETWConsumer* consumer,
+                                     PEVENT_RECORD /* pevent */) {
+    return consumer == consumer_;
+  }
+
+ private:
+  ETWConsumer* consumer_;
+} field_path_observer;
+
+template <class T>
+void Append(T value, std::vector<uint8_t>* payload) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  payload->insert(payload->end(), bytes, bytes + sizeof(value));
+}
+
+// Generate the payload |index| of the file events.
+void MakeFilePayload(size_t index, std::vector<uint8_t>* payload) {
+  Append<uint64_t>(0xFFFFE00012340000ULL + index * 64, payload);
+  Append<uint32_t>(static_cast<uint32_t>(512 * (1 + index % 8)), payload);
+  std::string path = "C:\\Windows\\file" + std::string(index % 40, 'x');
+  for (size_t i = 0; i < path.size(); ++i)
+    Append<uint16_t>(path[i], payload);
+  Append<uint16_t>(0, payload);
+  for (uint16_t i = 0; i < 4; ++i)
+    Append<uint16_t>(i, payload);
+}
+
+// Converts generated events and counts the allocations of the steady state.
+class AllocationTest {
+ public:
+  AllocationTest() {
+    consumer_.set_schema_source(&source_);
+    consumer_.set_packet_maximal_size(4096);
+  }
+
+  ETWConsumer* consumer() { return &consumer_; }
+
+  // Generate the events. Half of them are file events. Of the others, half
+  // have no schema, so their payload is sent raw, and half are string-only
+  // events.
+  void MakeEvents(size_t count) {
+    payloads_.resize(count);
+    records_.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      MakeFilePayload(i, &payloads_[i]);
+      EVENT_RECORD& record = records_[i];
+      ::memset(&record, 0, sizeof(record));
+      record.EventHeader.ProviderId = kProvider;
+      record.EventHeader.EventDescriptor.Id =
+          i % 4 < 2 ? kFileEventId : kRawEventId;
+      record.EventHeader.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+      if (i % 4 == 3)
+        record.EventHeader.Flags |= EVENT_HEADER_FLAG_STRING_ONLY;
+      record.EventHeader.TimeStamp.QuadPart = 1000 + i;
+      record.BufferContext.ProcessorNumber = static_cast<uint8_t>(i % 4);
+      record.UserDataLength = static_cast<uint16_t>(payloads_[i].size());
+      record.UserData = &payloads_[i][0];
+    }
+  }
+
+  // Convert the events of [begin, end) and write out the full packets.
+  void Convert(size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      consumer_.ProcessEvent(&records_[i]);
+      while (consumer_.IsFullPacketReady()) {
+        const uint8_t* raw = NULL;
+        ETWConsumer::PacketInfo info;
+        consumer_.BuildFullPacket(&raw, &info);
+      }
+    }
+  }
+
+  // @returns the number of allocations made while the counted events were
+  //     converted, after the warm-up events.
+  size_t CountSteadyStateAllocations() {
+    MakeEvents(kWarmUpEventCount + kEventCount);
+    Convert(0, kWarmUpEventCount);
+
+    allocation_count = 0;
+    count_allocations = true;
+    Convert(kWarmUpEventCount, kWarmUpEventCount + kEventCount);
+    count_allocations = false;
+    return allocation_count;
+  }
+
+ private:
+  FakeSchemaSource source_;
+  ETWConsumer consumer_;
+  std::vector<std::vector<uint8_t> > payloads_;
+  std::vector<EVENT_RECORD> records_;
+};
+
+}  // namespace
+
+TEST(ETWConsumerAllocationTest, DecodeProgramPath) {
+  AllocationTest test;
+  EXPECT_EQ(0U, test.CountSteadyStateAllocations());
+}
+
+TEST(ETWConsumerAllocationTest, FieldByFieldPath) {
+  AllocationTest test;
+  field_path_observer.set_consumer(test.consumer());
+  EXPECT_EQ(0U, test.CountSteadyStateAllocations());
+  field_path_observer.set_consumer(NULL);
+}
+
+}  // namespace converter
@@ -0,0 +1,134 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/event_filter.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace converter {
+
+namespace {
+
+// Number of event ids, and of 64-bit words in a bitset of event ids.
+const size_t kNumberOfEventIds = 65536;
+const size_t kEventIdWords = kNumberOfEventIds / 64;
+
+// Parse hexadecimal digits.
+// @param text the digits to parse.
+// @param digits the number of digits to parse.
+// @param value receives the parsed value.
+// @returns true on success, false if a character is not a digit.
+bool ParseHex(const wchar_t* text, size_t digits, uint64_t* value) {
+  uint64_t result = 0;
+  for (size_t i = 0; i < digits; ++i) {
+    wchar_t c = text[i];
+    uint64_t digit = 0;
+    if (c >= L'0' && c <= L'9')
+      digit = c - L'0';
+    else if (c >= L'a' && c <= L'f')
+      digit = c - L'a' + 10;
+    else if (c >= L'A' && c <= L'F')
+      digit = c - L'A' + 10;
+    else
+      return false;
+    result = (result << 4) | digit;
+  }
+  *value = result;
+  return true;
+}
+
+}  // namespace
+
+size_t EventFilter::GuidHash::operator()(const GUID& guid) const {
+  // Mix the fields with the multiplicative constant of FNV-1a.
+  uint64_t data4 = 0;
+  ::memcpy(&data4, guid.Data4, sizeof(data4));
+  uint64_t hash = guid.Data1;
+  hash = hash * 0x100000001B3ULL ^ guid.Data2;
+  hash = hash * 0x100000001B3ULL ^ guid.Data3;
+  hash = hash * 0x100000001B3ULL ^ data4;
+  return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+bool EventFilter::ParseGuid(const std::wstring& text, GUID* guid) {
+  assert(guid != NULL);
+
+  // Layout: xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx, optionally in braces.
+  const size_t kGuidLength = 36;
+  std::wstring digits = text;
+  if (digits.size() == kGuidLength + 2 &&
+      digits[0] == L'{' && digits[kGuidLength + 1] == L'}') {
+    digits = digits.substr(1, kGuidLength);
+  }
+  if (digits.size() != kGuidLength || digits[8] != L'-' ||
+      digits[13] != L'-' || digits[18] != L'-' || digits[23] != L'-') {
+    return false;
+  }
+
+  const wchar_t* raw = digits.c_str();
+  uint64_t data1 = 0;
+  uint64_t data2 = 0;
+  uint64_t data3 = 0;
+  if (!ParseHex(raw, 8, &data1) || !ParseHex(raw + 9, 4, &data2) ||
+      !ParseHex(raw + 14, 4, &data3)) {
+    return false;
+  }
+
+  // The last two groups form the 8 bytes of Data4.
+  uint8_t data4[8];
+  const size_t kData4Offsets[8] = { 19, 21, 24, 26, 28, 30, 32, 34 };
+  for (size_t i = 0; i < 8; ++i) {
+    uint64_t byte = 0;
+    if (!ParseHex(raw + kData4Offsets[i], 2, &byte))
+      return false;
+    data4[i] = static_cast<uint8_t>(byte);
+  }
+
+  guid->Data1 = static_cast<uint32_t>(data1);
+  guid->Data2 = static_cast<uint16_t>(data2);
+  guid->Data3 = static_cast<uint16_t>(data3);
+  ::memcpy(guid->Data4, data4, sizeof(data4));
+  return true;
+}
+
+void EventFilter::IncludeProvider(const GUID& provider) {
+  providers_[provider];
+  has_inclusions_ = true;
+}
+
+void EventFilter::ExcludeProvider(const GUID& provider) {
+  providers_[provider].excluded = true;
+}
+
+void EventFilter::IncludeEventId(const GUID& provider, uint16_t id) {
+  Provider& filter = providers_[provider];
+  if (filter.ids.empty())
+    filter.ids.resize(kEventIdWords, 0);
+  filter.ids[id / 64] |= 1ULL << (id % 64);
+  has_inclusions_ = true;
+}
+
+}  // namespace converter
@@ -0,0 +1,136 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// The event filter selects the events to convert by provider and by event
+// id. The filter is compiled from the command-line options into a hashed
+// set of providers, each with a bitset of its accepted event ids: checking
+// an event costs a hash lookup and a bit test, before any decoding.
+
+#ifndef CONVERTER_EVENT_FILTER_H_
+#define CONVERTER_EVENT_FILTER_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/etw_types.h"
+
+namespace converter {
+
+class EventFilter {
+ public:
+  EventFilter() : has_inclusions_(false) {}
+
+  // Parse the string representation of a GUID, with or without braces,
+  // e.g. {29cb3580-13c6-4c85-a4cb-a2c0ffa68890}.
+  // @param text the string to parse.
+  // @param guid receives the parsed GUID.
+  // @returns true on success, false if |text| is not a GUID.
+  static bool ParseGuid(const std::wstring& text, GUID* guid);
+
+  // Accept the events of a provider. Once a provider is included, the
+  // events of the providers which are not included are rejected.
+  // @param provider the GUID of the provider.
+  void IncludeProvider(const GUID& provider);
+
+  // Reject the events of a provider, even if they are included.
+  // @param provider the GUID of the provider.
+  void ExcludeProvider(const GUID& provider);
+
+  // Accept an event id of a provider. The provider is included, and its
+  // events with other ids are rejected. Events with a classic header have
+  // no id: their opcode is used instead.
+  // @param provider the GUID of the provider.
+  // @param id the id of the accepted events.
+  void IncludeEventId(const GUID& provider, uint16_t id);
+
+  // @returns true when the filter accepts all the events.
+  bool Empty() const { return providers_.empty(); }
+
+  // Get the id identifying an event for the filter: the id of its
+  // descriptor, or its opcode for an event with a classic header.
+  // @param header the header of the event.
+  // @returns the id of the event.
+  static uint16_t GetEventId(const EVENT_HEADER& header) {
+    if ((header.Flags & EVENT_HEADER_FLAG_CLASSIC_HEADER) != 0)
+      return header.EventDescriptor.Opcode;
+    return header.EventDescriptor.Id;
+  }
+
+  // Check whether an event is accepted by the filter.
+  // @param header the header of the event.
+  // @returns true when the event is accepted, false when it is rejected.
+  bool Accepts(const EVENT_HEADER& header) const {
+    if (providers_.empty())
+      return true;
+    return Accepts(header.ProviderId, GetEventId(header));
+  }
+
+  // Check whether the events of a kind are accepted by the filter.
+  // @param provider the GUID of the provider of the events.
+  // @param id the id of the events, as returned by GetEventId.
+  // @returns true when the events are accepted, false when they are
+  //     rejected.
+  bool Accepts(const GUID& provider, uint16_t id) const {
+    ProviderMap::const_iterator it = providers_.find(provider);
+    if (it == providers_.end())
+      return !has_inclusions_;
+
+    const Provider& filter = it->second;
+    if (filter.excluded)
+      return false;
+    if (filter.ids.empty())
+      return true;
+    return (filter.ids[id / 64] & (1ULL << (id % 64))) != 0;
+  }
+
+ private:
+  // The filter of the events of a provider.
+  struct Provider {
+    Provider() : excluded(false) {}
+
+    bool excluded;
+
+    // The bitset of the accepted event ids, or empty to accept all ids.
+    std::vector<uint64_t> ids;
+  };
+
+  struct GuidHash {
+    size_t operator()(const GUID& guid) const;
+  };
+
+  typedef std::unordered_map<GUID, Provider, GuidHash> ProviderMap;
+
+  // The providers with a filter.
+  ProviderMap providers_;
+
+  // Whether some providers are included, rejecting the others.
+  bool has_inclusions_;
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_EVENT_FILTER_H_
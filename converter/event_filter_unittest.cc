@@ -0,0 +1,216 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "converter/event_filter.h"
+
+#include <cstring>
+#include <string>
+
+#include "base/unittest.h"
+
+namespace converter {
+
+namespace {
+
+const GUID kProvider = {
+    0x29CB3580, 0x13C6, 0x4C85, { 0xA4, 0xCB, 0xA2, 0xC0, 0xFF, 0xA6,
+                                  0x88, 0x90 } };
+const GUID kOtherProvider = {
+    0x0A1B2C3D, 0x1111, 0x2222, { 1, 2, 3, 4, 5, 6, 7, 8 } };
+const GUID kThirdProvider = {
+    0x0A1B2C3D, 0x1111, 0x2222, { 1, 2, 3, 4, 5, 6, 7, 9 } };
+
+// @returns the header of an event with a descriptor id and an opcode.
+EVENT_HEADER MakeHeader(const GUID& provider, uint16_t id, uint8_t opcode) {
+  EVENT_HEADER header;
+  ::memset(&header, 0, sizeof(header));
+  header.ProviderId = provider;
+  header.EventDescriptor.Id = id;
+  header.EventDescriptor.Opcode = opcode;
+  return header;
+}
+
+// @returns the header of an event with a classic header.
+EVENT_HEADER MakeClassicHeader(const GUID& provider, uint8_t opcode) {
+  EVENT_HEADER header = MakeHeader(provider, 0, opcode);
+  header.Flags = EVENT_HEADER_FLAG_CLASSIC_HEADER;
+  return header;
+}
+
+}  // namespace
+
+TEST(EventFilterTest, ParseGuid) {
+  GUID guid;
+  ::memset(&guid, 0, sizeof(guid));
+  EXPECT_TRUE(EventFilter::ParseGuid(
+      L"29cb3580-13c6-4c85-a4cb-a2c0ffa68890", &guid));
+  EXPECT_TRUE(IsEqualGUID(kProvider, guid));
+
+  // Upper-case digits and braces are accepted.
+  ::memset(&guid, 0, sizeof(guid));
+  EXPECT_TRUE(EventFilter::ParseGuid(
+      L"{29CB3580-13C6-4C85-A4CB-A2C0FFA68890}", &guid));
+  EXPECT_TRUE(IsEqualGUID(kProvider, guid));
+}
+
+TEST(EventFilterTest, ParseGuidBraces) {
+  GUID guid;
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"{29cb3580-13c6-4c85-a4cb-a2c0ffa68890", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"29cb3580-13c6-4c85-a4cb-a2c0ffa68890}", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"(29cb3580-13c6-4c85-a4cb-a2c0ffa68890)", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"{{29cb3580-13c6-4c85-a4cb-a2c0ffa68890}}", &guid));
+}
+
+TEST(EventFilterTest, ParseGuidBadSeparators) {
+  GUID guid;
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"29cb3580_13c6-4c85-a4cb-a2c0ffa68890", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"29cb3580-13c6-4c85-a4cba2c0ffa68890", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"29cb358-013c6-4c85-a4cb-a2c0ffa68890", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"29cb3580-13c6-4c85-a4cb-a2c0ffa6889", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"29cb3580-13c6-4c85-a4cb-a2c0ffa688900", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(L"", &guid));
+}
+
+TEST(EventFilterTest, ParseGuidNonHexDigits) {
+  GUID guid;
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"g9cb3580-13c6-4c85-a4cb-a2c0ffa68890", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"29cb3580-13c6-4c8z-a4cb-a2c0ffa68890", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"29cb3580-13c6-4c85-a4cb-a2c0ffa6889 ", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"29cb3580-13c6-4c85-a4cb-a2c0ffa6889-", &guid));
+  EXPECT_FALSE(EventFilter::ParseGuid(
+      L"+9cb3580-13c6-4c85-a4cb-a2c0ffa68890", &guid));
+}
+
+TEST(EventFilterTest, EmptyFilterAcceptsAll) {
+  EventFilter filter;
+  EXPECT_TRUE(filter.Empty());
+  EXPECT_TRUE(filter.Accepts(MakeHeader(kProvider, 1, 0)));
+  EXPECT_TRUE(filter.Accepts(MakeClassicHeader(kOtherProvider, 3)));
+}
+
+TEST(EventFilterTest, IncludedProviders) {
+  EventFilter filter;
+  filter.IncludeProvider(kProvider);
+  EXPECT_FALSE(filter.Empty());
+  EXPECT_TRUE(filter.Accepts(MakeHeader(kProvider, 1, 0)));
+  EXPECT_TRUE(filter.Accepts(MakeHeader(kProvider, 65535, 0)));
+  EXPECT_FALSE(filter.Accepts(MakeHeader(kOtherProvider, 1, 0)));
+}
+
+TEST(EventFilterTest, ExcludedProviders) {
+  EventFilter filter;
+  filter.ExcludeProvider(kProvider);
+  EXPECT_FALSE(filter.Accepts(MakeHeader(kProvider, 1, 0)));
+
+  // Excluding a provider doesn't reject the other providers.
+  EXPECT_TRUE(filter.Accepts(MakeHeader(kOtherProvider, 1, 0)));
+}
+
+TEST(EventFilterTest, ExclusionTakesPrecedence) {
+  // An excluded provider is rejected, even if included before or after.
+  EventFilter filter;
+  filter.IncludeProvider(kProvider);
+  filter.ExcludeProvider(kProvider);
+  filter.ExcludeProvider(kOtherProvider);
+  filter.IncludeProvider(kOtherProvider);
+  filter.IncludeProvider(kThirdProvider);
+  EXPECT_FALSE(filter.Accepts(MakeHeader(kProvider, 1, 0)));
+  EXPECT_FALSE(filter.Accepts(MakeHeader(kOtherProvider, 1, 0)));
+  EXPECT_TRUE(filter.Accepts(MakeHeader(kThirdProvider, 1, 0)));
+
+  // Even when some of its event ids are included.
+  EventFilter ids;
+  ids.IncludeEventId(kProvider, 7);
+  ids.ExcludeProvider(kProvider);
+  EXPECT_FALSE(ids.Accepts(MakeHeader(kProvider, 7, 0)));
+}
+
+TEST(EventFilterTest, IncludedEventIds) {
+  EventFilter filter;
+  filter.IncludeEventId(kProvider, 0);
+  filter.IncludeEventId(kProvider, 63);
+  filter.IncludeEventId(kProvider, 64);
+  filter.IncludeEventId(kProvider, 65535);
+  EXPECT_TRUE(filter.Accepts(MakeHeader(kProvider, 0, 0)));
+  EXPECT_TRUE(filter.Accepts(MakeHeader(kProvider, 63, 0)));
+  EXPECT_TRUE(filter.Accepts(MakeHeader(kProvider, 64, 0)));
+  EXPECT_TRUE(filter.Accepts(MakeHeader(kProvider, 65535, 0)));
+  EXPECT_FALSE(filter.Accepts(MakeHeader(kProvider, 1, 0)));
+  EXPECT_FALSE(filter.Accepts(MakeHeader(kProvider, 65, 0)));
+  EXPECT_FALSE(filter.Accepts(MakeHeader(kProvider, 65534, 0)));
+
+  // Including an event id includes its provider only.
+  EXPECT_FALSE(filter.Accepts(MakeHeader(kOtherProvider, 0, 0)));
+
+  // The ids of a provider are kept when the provider is included again.
+  filter.IncludeProvider(kProvider);
+  EXPECT_FALSE(filter.Accepts(MakeHeader(kProvider, 1, 0)));
+}
+
+TEST(EventFilterTest, ClassicEventsUseOpcode) {
+  EventFilter filter;
+  filter.IncludeEventId(kProvider, 10);
+
+  // A classic header has no id: its opcode identifies the event.
+  EXPECT_EQ(10U, EventFilter::GetEventId(MakeClassicHeader(kProvider, 10)));
+  EXPECT_TRUE(filter.Accepts(MakeClassicHeader(kProvider, 10)));
+  EXPECT_FALSE(filter.Accepts(MakeClassicHeader(kProvider, 3)));
+
+  // The id of the descriptor is used otherwise, not the opcode.
+  EXPECT_EQ(3U, EventFilter::GetEventId(MakeHeader(kProvider, 3, 10)));
+  EXPECT_FALSE(filter.Accepts(MakeHeader(kProvider, 3, 10)));
+  EXPECT_TRUE(filter.Accepts(MakeHeader(kProvider, 10, 3)));
+
+  // The descriptor id of a classic header is ignored.
+  EVENT_HEADER header = MakeClassicHeader(kProvider, 3);
+  header.EventDescriptor.Id = 10;
+  EXPECT_FALSE(filter.Accepts(header));
+}
+
+TEST(EventFilterTest, AcceptsKindOfEvents) {
+  EventFilter filter;
+  filter.IncludeEventId(kProvider, 5);
+  filter.ExcludeProvider(kOtherProvider);
+  EXPECT_TRUE(filter.Accepts(kProvider, 5));
+  EXPECT_FALSE(filter.Accepts(kProvider, 6));
+  EXPECT_FALSE(filter.Accepts(kOtherProvider, 5));
+  EXPECT_FALSE(filter.Accepts(kThirdProvider, 5));
+}
+
+}  // namespace converter
@@ -0,0 +1,126 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// An event schema describes the layout of the payload of an ETW event: the
+// name of the event and the list of its top-level properties. A schema source
+// provides the schema of events and extracts the value of their properties.
+//
+// The schema of an event only depends on its provider, id, version and
+// opcode. Schemas are thus retrieved once and cached by the decode plan cache.
+
+#ifndef CONVERTER_EVENT_SCHEMA_H_
+#define CONVERTER_EVENT_SCHEMA_H_
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "base/etw_types.h"
+
+namespace converter {
+
+struct EventSchema {
+  // A top-level property of the payload.
+  struct Property {
+    Property()
+        : in_type(TDH_INTYPE_NULL),
+          out_type(TDH_OUTTYPE_NULL),
+          flags(0),
+          count(0),
+          length(0),
+          count_property(0),
+          length_property(0) {
+    }
+
+    // The name of the property.
+    std::string name;
+    // The name of the property, as known by the schema source. It is used to
+    // retrieve the value of the property from the source.
+    std::wstring source_name;
+    // The input and output types of the property (TDH_INTYPE_* and
+    // TDH_OUTTYPE_*).
+    unsigned int in_type;
+    unsigned int out_type;
+    // The property flags (PROPERTY_FLAGS).
+    unsigned int flags;
+    // The number of elements of the property, or 0 when it is given by
+    // another property (PropertyParamCount).
+    unsigned int count;
+    // The length of the property, in bytes, or 0 when it is given by another
+    // property (PropertyParamLength).
+    unsigned int length;
+    // The index of the property holding the number of elements, when the
+    // flags include PropertyParamCount.
+    unsigned int count_property;
+    // The index of the property holding the length, when the flags include
+    // PropertyParamLength.
+    unsigned int length_property;
+  };
+
+  EventSchema() {
+    ::memset(&event_guid, 0, sizeof(event_guid));
+  }
+
+  // The GUID identifying the event class.
+  GUID event_guid;
+  // The name of the event (the opcode name), or empty when unknown.
+  std::string name;
+  // The top-level properties of the payload, in order.
+  std::vector<Property> properties;
+};
+
+// Interface of the providers of event schemas.
+class SchemaSource {
+ public:
+  virtual ~SchemaSource() {}
+
+  // Retrieve the schema of an event.
+  // @param record the event.
+  // @param schema receives the schema of the event.
+  // @returns true when the schema is known and can be decoded, false
+  //     otherwise.
+  virtual bool GetEventSchema(const EVENT_RECORD& record,
+                              EventSchema* schema) = 0;
+
+  // Retrieve the value of an element of a property of an event.
+  // @param record the event.
+  // @param property the property to retrieve, taken from the schema of the
+  //     event.
+  // @param element the index of the element to retrieve.
+  // @param buffer receives the value of the element, followed by null bytes
+  //     so that string values are always terminated. The buffer is only
+  //     grown, to be reused from call to call.
+  // @param size receives the size of the value, in bytes.
+  // @returns true on success, false otherwise.
+  virtual bool GetPropertyData(const EVENT_RECORD& record,
+                               const EventSchema::Property& property,
+                               size_t element,
+                               std::vector<char>* buffer,
+                               size_t* size) = 0;
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_EVENT_SCHEMA_H_
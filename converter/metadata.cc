@@ -25,14 +25,105 @@
 
 #include "converter/metadata.h"
 
+#include <algorithm>
 #include <cassert>
 #include <string>
+#include <utility>
+
+#include "converter/unicode.h"
 
 namespace converter {
 
+namespace {
+
+// Initial capacity of a packet, large enough to hold most encoded events
+// without reallocation.
+const size_t kDefaultPacketCapacity = 256;
+
+// Parameters of the 64-bit FNV-1a hash used to fingerprint event layouts.
+const uint64_t kFingerprintBasis = 0xCBF29CE484222325ULL;
+const uint64_t kFingerprintPrime = 0x100000001B3ULL;
+
+// Hash a sequence of bytes.
+// @param hash the hash of the previous bytes.
+// @param data the bytes to hash.
+// @param length the number of bytes to hash.
+// @returns the updated hash.
+uint64_t HashBytes(uint64_t hash, const void* data, size_t length) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= bytes[i];
+    hash *= kFingerprintPrime;
+  }
+  return hash;
+}
+
+// Hash an integer value, independently of its type width.
+uint64_t HashValue(uint64_t hash, uint64_t value) {
+  return HashBytes(hash, &value, sizeof(value));
+}
+
+// Hash a string, including its length to delimit it.
+uint64_t HashString(uint64_t hash, const std::string& str) {
+  hash = HashValue(hash, str.size());
+  return HashBytes(hash, str.data(), str.size());
+}
+
+// Default function used to index the layouts.
+uint64_t EventFingerprint(const Metadata::Event& event) {
+  return event.Fingerprint();
+}
+
+}  // namespace
+
 const size_t Metadata::kRootScope = static_cast<size_t>(-1);
 
+Metadata::Event::Event(const Event& event)
+    : name_(event.name_),
+      guid_(event.guid_),
+      opcode_(event.opcode_),
+      version_(event.version_),
+      event_id_(event.event_id_),
+      fields_(event.fields_.begin(), event.fields_.begin() + event.size()),
+      fields_size_(event.size()),
+      info_hash_(event.info_hash_),
+      fields_hashes_(event.fields_hashes_.begin(),
+                     event.fields_hashes_.begin() + event.size()) {
+}
+
+Metadata::Event& Metadata::Event::operator=(const Event& event) {
+  if (this == &event)
+    return *this;
+
+  name_ = event.name_;
+  guid_ = event.guid_;
+  opcode_ = event.opcode_;
+  version_ = event.version_;
+  event_id_ = event.event_id_;
+  info_hash_ = event.info_hash_;
+
+  Reset();
+  for (size_t i = 0; i < event.size(); ++i)
+    AddField(event.at(i));
+
+  return *this;
+}
+
+void Metadata::Event::Clear() {
+  name_.clear();
+  ::memset(&guid_, 0, sizeof(GUID));
+  opcode_ = 0;
+  version_ = 0;
+  event_id_ = 0;
+  UpdateInfoHash();
+  Reset();
+}
+
 bool Metadata::Event::operator==(const Event& event) const {
+  // Rule out most of the different events with a single comparison.
+  if (Fingerprint() != event.Fingerprint())
+    return false;
+
   if (guid_ != event.guid_ ||
       opcode_ != event.opcode_ ||
       version_ != event.version_ ||
@@ -41,9 +132,9 @@ bool Metadata::Event::operator==(const Event& event) const {
     return false;
   }
 
-  if (fields_.size() != event.fields_.size())
+  if (fields_size_ != event.fields_size_)
     return false;
-  for (size_t i = 0; i < fields_.size(); ++i) {
+  for (size_t i = 0; i < fields_size_; ++i) {
     if (fields_[i] != event.fields_[i])
       return false;
   }
@@ -51,6 +142,23 @@ bool Metadata::Event::operator==(const Event& event) const {
   return true;
 }
 
+uint64_t Metadata::Event::Fingerprint() const {
+  uint64_t fields_hash = kFingerprintBasis;
+  if (fields_size_ != 0)
+    fields_hash = fields_hashes_[fields_size_ - 1];
+  return HashValue(info_hash_, fields_hash);
+}
+
+void Metadata::Event::UpdateInfoHash() {
+  uint64_t hash = kFingerprintBasis;
+  hash = HashBytes(hash, &guid_, sizeof(guid_));
+  hash = HashValue(hash, opcode_);
+  hash = HashValue(hash, version_);
+  hash = HashValue(hash, event_id_);
+  hash = HashString(hash, name_);
+  info_hash_ = hash;
+}
+
 bool Metadata::Field::operator==(const Field& field) const {
   return type_ == field.type_ &&
       size_ == field.size_ &&
@@ -59,29 +167,70 @@ bool Metadata::Field::operator==(const Field& field) const {
       field_size_.compare(field.field_size_) == 0;
 }
 
+Metadata::Metadata() : fingerprint_(&EventFingerprint) {
+}
+
+Metadata::Metadata(FingerprintFunction fingerprint)
+    : fingerprint_(fingerprint) {
+  assert(fingerprint != NULL);
+}
+
 size_t Metadata::GetIdForEvent(const Event& event) {
-  for (size_t i = 0; i < events_.size(); ++i) {
-    if (event == events_[i])
-      return i + 1;
+  uint64_t fingerprint = fingerprint_(event);
+
+  // Look for an existing event with the same fingerprint.
+  std::pair<FingerprintIndex::const_iterator,
+            FingerprintIndex::const_iterator> candidates =
+      index_.equal_range(fingerprint);
+  for (FingerprintIndex::const_iterator it = candidates.first;
+       it != candidates.second; ++it) {
+    if (event == events_[it->second])
+      return it->second + 1;
   }
+
+  // Add the new event to the dictionary.
   events_.push_back(event);
+  index_.insert(std::make_pair(fingerprint, events_.size() - 1));
   return events_.size();
 }
 
 void Metadata::Event::AddField(const Field& field) {
-  for (size_t i = 0; i < fields_.size(); ++i) {
+  for (size_t i = 0; i < fields_size_; ++i) {
     // Avoid same field name in a scope.
     if (field.parent() == fields_[i].parent()) {
       assert(fields_[i].name() != field.name());
     }
   }
-  fields_.push_back(field);
+
+  // Extend the rolling hash of the fields.
+  uint64_t hash = kFingerprintBasis;
+  if (fields_size_ != 0)
+    hash = fields_hashes_[fields_size_ - 1];
+  hash = HashValue(hash, field.type());
+  hash = HashValue(hash, field.size());
+  hash = HashValue(hash, field.parent());
+  hash = HashString(hash, field.name());
+  hash = HashString(hash, field.field_size());
+
+  // Recycle a previously removed field when possible.
+  if (fields_size_ < fields_.size()) {
+    fields_[fields_size_] = field;
+    fields_hashes_[fields_size_] = hash;
+  } else {
+    fields_.push_back(field);
+    fields_hashes_.push_back(hash);
+  }
+  ++fields_size_;
 }
 
 Metadata::Packet::Packet()
-    : timestamp_(0),
+    : size_(0),
+      allocations_(0),
+      timestamp_(0),
       event_id_offset_(0),
-      packet_context_offset_(0) {}
+      packet_context_offset_(0) {
+  Grow(kDefaultPacketCapacity);
+}
 
 uint64_t Metadata::Packet::timestamp() const {
   return timestamp_;
@@ -91,61 +240,108 @@ void Metadata::Packet::set_timestamp(uint64_t time) {
   timestamp_ = time;
 }
 
-size_t Metadata::Packet::size() const {
-  return buffer_.size();
-}
-
 const uint8_t* Metadata::Packet::raw_bytes() const {
-  if (buffer_.empty())
+  if (size_ == 0)
     return NULL;
-  return reinterpret_cast<const uint8_t*>(&buffer_[0]);
+  return &buffer_[0];
+}
+
+void Metadata::Packet::Reserve(size_t capacity) {
+  if (capacity > buffer_.size())
+    Grow(capacity);
 }
 
 void Metadata::Packet::Reset(size_t offset) {
-  buffer_.resize(offset);
+  assert(offset <= size_);
+  size_ = offset;
+}
+
+void Metadata::Packet::Swap(Packet* other) {
+  assert(other != NULL);
+  buffer_.swap(other->buffer_);
+  std::swap(size_, other->size_);
+  std::swap(allocations_, other->allocations_);
+  std::swap(timestamp_, other->timestamp_);
+  std::swap(event_id_offset_, other->event_id_offset_);
+  std::swap(packet_context_offset_, other->packet_context_offset_);
+}
+
+void Metadata::Packet::Grow(size_t capacity) {
+  assert(capacity > buffer_.size());
+  // Grow geometrically to amortize the reallocations.
+  buffer_.resize(std::max(capacity, buffer_.size() * 2));
+  ++allocations_;
 }
 
 void Metadata::Packet::UpdateUInt32(size_t offset, uint32_t value) {
-  assert(offset + 3 < buffer_.size());
-  buffer_[offset] = static_cast<char>(value);
-  buffer_[offset + 1] = static_cast<char>(value >> 8);
-  buffer_[offset + 2] = static_cast<char>(value >> 16);
-  buffer_[offset + 3] = static_cast<char>(value >> 24);
+  assert(offset + sizeof(value) <= size_);
+  ::memcpy(&buffer_[offset], &value, sizeof(value));
 }
 
 void Metadata::Packet::UpdateUInt64(size_t offset, uint64_t value) {
-  UpdateUInt32(offset, static_cast<uint32_t>(value));
-  UpdateUInt32(offset + 4, static_cast<uint32_t>(value >> 32));
+  assert(offset + sizeof(value) <= size_);
+  ::memcpy(&buffer_[offset], &value, sizeof(value));
 }
 
-void Metadata::Packet::EncodeUInt8(uint8_t value) {
-  buffer_.push_back(value);
+void Metadata::Packet::UpdateBytes(size_t offset,
+                                   const uint8_t* value,
+                                   size_t length) {
+  if (length == 0)
+    return;
+  assert(value != NULL);
+  assert(offset + length <= size_);
+  ::memcpy(&buffer_[offset], value, length);
 }
 
-void Metadata::Packet::EncodeUInt16(uint16_t value) {
-  EncodeUInt8(static_cast<uint8_t>(value));
-  EncodeUInt8(static_cast<uint8_t>(value >> 8));
+void Metadata::Packet::Insert(size_t position, size_t length) {
+  assert(position <= size_);
+  if (length == 0)
+    return;
+  size_t moved = size_ - position;
+  Append(length);
+  if (moved != 0)
+    ::memmove(&buffer_[position + length], &buffer_[position], moved);
+  ::memset(&buffer_[position], 0, length);
 }
 
-void Metadata::Packet::EncodeUInt32(uint32_t value) {
-  EncodeUInt16(static_cast<uint16_t>(value));
-  EncodeUInt16(static_cast<uint16_t>(value >> 16));
+void Metadata::Packet::Erase(size_t position, size_t length) {
+  assert(position + length <= size_);
+  if (length == 0)
+    return;
+  size_t moved = size_ - position - length;
+  if (moved != 0)
+    ::memmove(&buffer_[position], &buffer_[position + length], moved);
+  size_ -= length;
 }
 
-void Metadata::Packet::EncodeUInt64(uint64_t value) {
-  EncodeUInt32(static_cast<uint32_t>(value));
-  EncodeUInt32(static_cast<uint32_t>(value >> 32));
+void Metadata::Packet::EncodeBytes(const uint8_t* value, size_t length) {
+  if (length == 0)
+    return;
+  assert(value != NULL);
+  ::memcpy(Append(length), value, length);
 }
 
-void Metadata::Packet::EncodeBytes(const uint8_t* value, size_t length) {
-  for (size_t i = 0; i < length; ++i)
-    EncodeUInt8(value[i]);
+void Metadata::Packet::EncodeZeros(size_t length) {
+  if (length == 0)
+    return;
+  ::memset(Append(length), 0, length);
 }
 
 void Metadata::Packet::EncodeString(const std::string& str) {
-  const uint8_t* raw = reinterpret_cast<const uint8_t*>(str.c_str());
   // The length must take into account the terminal '\0'.
-  EncodeBytes(raw, str.length() + 1);
+  size_t length = str.length() + 1;
+  ::memcpy(Append(length), str.c_str(), length);
+}
+
+void Metadata::Packet::EncodeUTF16String(const uint16_t* str, size_t length) {
+  assert(str != NULL || length == 0);
+
+  // Reserve the space of the worst case, then keep the space used.
+  size_t reserved = GetMaxUTF8Length(length) + 1;
+  uint8_t* out = Append(reserved);
+  size_t written = ConvertUTF16ToUTF8(str, length, out);
+  out[written] = 0;
+  size_ -= reserved - (written + 1);
 }
 
 }  // namespace converter
@@ -32,12 +32,15 @@
 #ifndef CONVERTER_METADATA_H_
 #define CONVERTER_METADATA_H_
 
-#include <initguid.h>
-
+#include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "base/disallow_copy_and_assign.h"
+#include "base/etw_types.h"
 
 namespace converter {
 
@@ -46,16 +49,30 @@ namespace converter {
 // description in this dictionary.
 class Metadata {
  public:
-  Metadata() {}
-
   // Forward declaration.
   class Event;
   class Field;
   class Packet;
 
+  // Function used to index the layouts. Equal events must produce the same
+  // key.
+  typedef uint64_t (*FingerprintFunction)(const Event& event);
+
+  // @name Constructors.
+  // @{
+  // @param fingerprint the function used to index the layouts. Defaults to
+  //     Event::Fingerprint. Providing a coarser function forces collisions
+  //     in the index, which the benchmark uses to exercise the candidates
+  //     comparison.
+  Metadata();
+  explicit Metadata(FingerprintFunction fingerprint);
+  // @}
+
   // Get a unique event id for this event.
   // If the event already exists the function returns the previous id,
-  // otherwise it returns a newly created event id.
+  // otherwise it returns a newly created event id. Ids are assigned in
+  // order of insertion and never change. The lookup is a hash probe on the
+  // layout fingerprint, followed by a full comparison of the candidates.
   // @param event The event whose id we wish to find.
   // @returns a unique event id.
   size_t GetIdForEvent(const Event& event);
@@ -78,6 +95,13 @@ class Metadata {
   // The event id is the offset in this vector.
   std::vector<Event> events_;
 
+  // Index of the offsets in |events_| by layout fingerprint.
+  typedef std::unordered_multimap<uint64_t, size_t> FingerprintIndex;
+  FingerprintIndex index_;
+
+  // Function computing the keys of |index_|.
+  FingerprintFunction fingerprint_;
+
   DISALLOW_COPY_AND_ASSIGN(Metadata);
 };
 
@@ -85,13 +109,23 @@ class Metadata {
 class Metadata::Event {
  public:
   // Constructor.
-  Event() : opcode_(0), version_(0), event_id_(0) {
+  Event() : opcode_(0), version_(0), event_id_(0), fields_size_(0) {
     ::memset(&guid_, 0, sizeof(GUID));
+    UpdateInfoHash();
   }
 
+  // @name Copy operations. Only the fields in use are copied.
+  // @{
+  Event(const Event& event);
+  Event& operator=(const Event& event);
+  // @}
+
   // Accessors.
   const std::string& name() const { return name_; }
-  void set_name(const std::string& name) { name_ = name; }
+  void set_name(const std::string& name) {
+    name_ = name;
+    UpdateInfoHash();
+  }
 
   const GUID& guid() const { return guid_; }
   unsigned char opcode() const { return opcode_; }
@@ -109,22 +143,40 @@ class Metadata::Event {
     opcode_ = opcode;
     version_ = version;
     event_id_ = event_id;
+    UpdateInfoHash();
   }
 
-  size_t size() const { return fields_.size(); }
-  const Field& at(size_t offset) const { return fields_.at(offset); }
+  size_t size() const { return fields_size_; }
+  const Field& at(size_t offset) const {
+    assert(offset < fields_size_);
+    return fields_[offset];
+  }
 
   // Compare the event and fields.
   // @param event the event to compare with.
   // @returns true when the event descriptor and layout are the same.
   bool operator==(const Event& event) const;
 
-  // Remove all fields.
-  void Reset() { fields_.clear(); }
+  // Get a hash of the event descriptor and layout. Equal events have the
+  // same fingerprint. The fingerprint is maintained while the event is built,
+  // so this call does not depend on the number of fields.
+  // @returns the fingerprint of this event.
+  uint64_t Fingerprint() const;
+
+  // Remove all fields. The memory held by the fields is kept to be reused by
+  // the next added fields.
+  void Reset() { fields_size_ = 0; }
 
   // Remove fields after offset.
   // @param offset the offset of first field to remove.
-  void Reset(size_t offset) { fields_.resize(offset); }
+  void Reset(size_t offset) {
+    assert(offset <= fields_size_);
+    fields_size_ = offset;
+  }
+
+  // Remove the name, the event descriptor and all fields, making the event
+  // ready to describe a new layout.
+  void Clear();
 
   // Add a field to the layout. The added field is assumed to have a unique
   // name.
@@ -132,6 +184,9 @@ class Metadata::Event {
   void AddField(const Field& field);
 
  private:
+  // Recompute the hash of the name and the event descriptor.
+  void UpdateInfoHash();
+
   // Event identification.
   std::string name_;
 
@@ -141,8 +196,17 @@ class Metadata::Event {
   unsigned char version_;
   unsigned short event_id_;
 
-  // Fields of this event.
+  // Fields of this event. Only the first |fields_size_| fields are in use,
+  // the remaining ones are kept to be recycled.
   std::vector<Metadata::Field> fields_;
+  size_t fields_size_;
+
+  // Hash of the name and the event descriptor.
+  uint64_t info_hash_;
+
+  // Rolling hash of the fields: |fields_hashes_[i]| is the hash of the
+  // fields 0 to i. Removing fields does not invalidate the remaining hashes.
+  std::vector<uint64_t> fields_hashes_;
 };
 
 // This class describes the layout of a field.
@@ -206,6 +270,35 @@ class Metadata::Field {
   }
   // @}
 
+  // Reassign the field, reusing the memory of its strings.
+  // @param type the type of the encoded layout.
+  // @param name the name of the field.
+  // @param size the number of elements in an aggregate.
+  // @param parent The parent of this field.
+  void Assign(FieldType type, const std::string& name, size_t size,
+              size_t parent) {
+    type_ = type;
+    name_.assign(name);
+    size_ = size;
+    field_size_.clear();
+    parent_ = parent;
+  }
+
+  // Reassign the field, reusing the memory of its strings.
+  // @param type the type of the encoded layout.
+  // @param name the name of the field.
+  // @param field_size the name of the field containing the number of elements
+  //     in an aggregate type.
+  // @param parent The parent of this field.
+  void Assign(FieldType type, const std::string& name,
+              const std::string& field_size, size_t parent) {
+    type_ = type;
+    name_.assign(name);
+    size_ = 0;
+    field_size_.assign(field_size);
+    parent_ = parent;
+  }
+
   // @name Accessors.
   // @{
   FieldType type() const { return type_; }
@@ -243,6 +336,10 @@ class Metadata::Field {
 
 // This class holds an encoded event with a binary layout described by
 // the corresponding description in the Metadata dictionary.
+//
+// Values are encoded in little-endian byte order, which is the native byte
+// order of the platforms producing ETW traces. Scalars are written with a
+// single unaligned store and byte sequences with a single copy.
 class Metadata::Packet {
  public:
   Packet();
@@ -274,12 +371,29 @@ class Metadata::Packet {
   const uint8_t* raw_bytes() const;
 
   // @returns the current size of the encoded packet.
-  size_t size() const;
+  size_t size() const { return size_; }
 
-  // Remove every bytes encoded after the offset.
+  // @returns the number of bytes that can be encoded without reallocating
+  //     the internal buffer.
+  size_t capacity() const { return buffer_.size(); }
+
+  // @returns the number of times the internal buffer has been allocated.
+  size_t allocations() const { return allocations_; }
+
+  // Make sure the packet can hold at least |capacity| bytes without
+  // reallocating its internal buffer.
+  // @param capacity the number of bytes to reserve.
+  void Reserve(size_t capacity);
+
+  // Remove every bytes encoded after the offset. The memory is kept to be
+  // reused by the next encoded values.
   // @param offset the offset of first byte to remove.
   void Reset(size_t offset);
 
+  // Exchange the content of two packets, without copying their bytes.
+  // @param other the packet to exchange content with.
+  void Swap(Packet* other);
+
   // Update an encoded 32-bit value at a given position.
   // @param position the position to update.
   // @param value the new value to encode.
@@ -290,35 +404,90 @@ class Metadata::Packet {
   // @param value the new value to encode.
   void UpdateUInt64(size_t position, uint64_t value);
 
+  // Update a sequence of encoded bytes at a given position.
+  // @param position the position to update.
+  // @param value the new bytes to encode.
+  // @param length the number of bytes to update.
+  void UpdateBytes(size_t position, const uint8_t* value, size_t length);
+
+  // Insert zero bytes at a given position, moving the following bytes.
+  // @param position the position of the first inserted byte.
+  // @param length the number of bytes to insert.
+  void Insert(size_t position, size_t length);
+
+  // Remove bytes at a given position, moving the following bytes.
+  // @param position the position of the first removed byte.
+  // @param length the number of bytes to remove.
+  void Erase(size_t position, size_t length);
+
   // Encode an 8-bit value.
   // @param value the value to encode.
-  void EncodeUInt8(uint8_t value);
+  void EncodeUInt8(uint8_t value) { *Append(1) = value; }
 
   // Encode a 16-bit value.
   // @param value the value to encode.
-  void EncodeUInt16(uint16_t value);
+  void EncodeUInt16(uint16_t value) { EncodeScalar(value); }
 
   // Encode a 32-bit value.
   // @param value the value to encode.
-  void EncodeUInt32(uint32_t value);
+  void EncodeUInt32(uint32_t value) { EncodeScalar(value); }
 
   // Encode a 64-bit value.
   // @param value the value to encode.
-  void EncodeUInt64(uint64_t value);
+  void EncodeUInt64(uint64_t value) { EncodeScalar(value); }
 
   // Encode a sequence of raw bytes.
   // @param value the value to encode.
   // @param length the number of bytes to encode.
   void EncodeBytes(const uint8_t* value, size_t length);
 
+  // Encode a sequence of zero bytes (i.e. padding).
+  // @param length the number of bytes to encode.
+  void EncodeZeros(size_t length);
+
   // Encode a string terminated by zero.
   // @param str the string to encode.
   void EncodeString(const std::string& str);
 
+  // Encode a UTF-16 string as a UTF-8 string terminated by zero.
+  // @param str the characters of the string.
+  // @param length the number of characters, without the terminal '\0'.
+  void EncodeUTF16String(const uint16_t* str, size_t length);
+
  private:
-  // Internal buffer holding the raw encoded bytes.
+  // Extend the encoded size by |length| bytes, growing the internal buffer
+  // when needed.
+  // @param length the number of bytes to append.
+  // @returns a pointer to the first appended byte.
+  uint8_t* Append(size_t length) {
+    if (size_ + length > buffer_.size())
+      Grow(size_ + length);
+    uint8_t* position = &buffer_[size_];
+    size_ += length;
+    return position;
+  }
+
+  // Encode a scalar value in the native (little-endian) byte order.
+  // @param value the value to encode.
+  template<typename T>
+  void EncodeScalar(T value) {
+    ::memcpy(Append(sizeof(T)), &value, sizeof(T));
+  }
+
+  // Reallocate the internal buffer to hold at least |capacity| bytes.
+  // @param capacity the minimal capacity required.
+  void Grow(size_t capacity);
+
+  // Internal buffer holding the raw encoded bytes. Only the first |size_|
+  // bytes are meaningful, the remaining bytes are reserved space.
   std::vector<uint8_t> buffer_;
 
+  // The number of bytes encoded in |buffer_|.
+  size_t size_;
+
+  // The number of allocations of |buffer_|.
+  size_t allocations_;
+
   // Timestamp of this packet.
   uint64_t timestamp_;
 
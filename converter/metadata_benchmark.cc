@@ -0,0 +1,171 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Benchmark of the layout dictionary. Inserts distinct layouts, checks that
+// the assigned ids are stable, and measures the lookup time as the dictionary
+// grows. The lookups are measured with the layout fingerprints and with a
+// coarse index key that forces several layouts to collide on each key.
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base/stopwatch.h"
+#include "converter/metadata.h"
+
+namespace {
+
+using converter::Metadata;
+
+// Number of distinct layouts inserted in the dictionary.
+const size_t kLayoutCount = 20000;
+
+// Number of layouts sharing an index key with the colliding function.
+const size_t kLayoutsPerKey = 4;
+
+// Dictionary sizes at which the lookup time is measured.
+const size_t kCheckpoints[] = { 1000, 5000, 10000, 20000 };
+
+// Number of lookups of each layout per measure.
+const size_t kRepetitions = 10;
+
+// Largest accepted ratio between the lookup times of the largest and the
+// smallest dictionaries. A linear scan would exceed it by far.
+const double kMaximalGrowth = 8.0;
+
+// Index key shared by |kLayoutsPerKey| consecutive layouts.
+uint64_t CollidingFingerprint(const Metadata::Event& event) {
+  return event.event_id();
+}
+
+// Build the layout |index|. Layouts differ by name, descriptor and fields.
+void BuildLayout(size_t index, Metadata::Event* event) {
+  GUID guid = {};
+  guid.Data1 = static_cast<unsigned long>(index);
+  guid.Data2 = 0xCAFE;
+  event->Clear();
+  event->set_info(guid, static_cast<unsigned char>(index % 256), 0,
+                  static_cast<unsigned short>(index / kLayoutsPerKey));
+  event->set_name("Layout" + std::to_string(index));
+
+  size_t field_count = 1 + index % 8;
+  for (size_t i = 0; i < field_count; ++i) {
+    Metadata::Field::FieldType type =
+        (i + index) % 2 == 0 ? Metadata::Field::UINT32 :
+                               Metadata::Field::STRING;
+    event->AddField(Metadata::Field(type, "field" + std::to_string(i)));
+  }
+}
+
+// Look up each of the first |count| layouts |kRepetitions| times.
+// @param layouts the layouts to look up.
+// @param count the number of layouts in the dictionary.
+// @param metadata the dictionary.
+// @param seconds receives the average lookup time, in seconds.
+// @returns true if every layout kept its id.
+bool MeasureLookups(const std::vector<Metadata::Event>& layouts, size_t count,
+                    Metadata* metadata, double* seconds) {
+  base::Stopwatch stopwatch;
+  for (size_t repetition = 0; repetition < kRepetitions; ++repetition) {
+    for (size_t i = 0; i < count; ++i) {
+      if (metadata->GetIdForEvent(layouts[i]) != i + 1) {
+        std::cerr << "Layout " << i << " changed id." << std::endl;
+        return false;
+      }
+    }
+  }
+  *seconds = stopwatch.Elapsed() / (count * kRepetitions);
+  return true;
+}
+
+// Fill a dictionary with the layouts and measure the lookups at each
+// checkpoint.
+// @param layouts the layouts to insert.
+// @param description the name of the measured configuration.
+// @param metadata an empty dictionary.
+// @returns true if the ids are stable and the lookups stay flat.
+bool Run(const std::vector<Metadata::Event>& layouts, const char* description,
+         Metadata* metadata) {
+  std::cout << description << std::endl;
+
+  size_t checkpoint_count = sizeof(kCheckpoints) / sizeof(kCheckpoints[0]);
+  double first = 0;
+  double last = 0;
+  size_t inserted = 0;
+  for (size_t c = 0; c < checkpoint_count; ++c) {
+    base::Stopwatch stopwatch;
+    for (; inserted < kCheckpoints[c]; ++inserted) {
+      if (metadata->GetIdForEvent(layouts[inserted]) != inserted + 1) {
+        std::cerr << "Layout " << inserted << " got an unexpected id."
+                  << std::endl;
+        return false;
+      }
+    }
+    double insert_seconds = stopwatch.Elapsed();
+
+    double lookup_seconds = 0;
+    if (!MeasureLookups(layouts, inserted, metadata, &lookup_seconds))
+      return false;
+    if (metadata->size() != inserted) {
+      std::cerr << "Lookups added layouts." << std::endl;
+      return false;
+    }
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "  " << std::setw(6) << inserted << " layouts: insert "
+              << std::setw(7) << insert_seconds * 1e3 << " ms, lookup "
+              << std::setw(6) << lookup_seconds * 1e9 << " ns" << std::endl;
+    if (c == 0)
+      first = lookup_seconds;
+    last = lookup_seconds;
+  }
+
+  if (last > first * kMaximalGrowth) {
+    std::cerr << "Lookup time grew from " << first * 1e9 << " ns to "
+              << last * 1e9 << " ns." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  std::vector<Metadata::Event> layouts(kLayoutCount);
+  for (size_t i = 0; i < kLayoutCount; ++i)
+    BuildLayout(i, &layouts[i]);
+
+  Metadata metadata;
+  if (!Run(layouts, "Fingerprint index:", &metadata))
+    return 1;
+
+  Metadata colliding_metadata(&CollidingFingerprint);
+  if (!Run(layouts, "Colliding index:", &colliding_metadata))
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,200 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Benchmark of the packet encoder. Encodes events the way the consumer does:
+// the event header of ETWConsumer::EncodeEventHeader followed by a payload of
+// scalars, raw bytes and a string, into a packet reused from event to event.
+// Only the public encoding methods of Metadata::Packet are used, so the
+// benchmark also builds against the per-byte encoder for a comparison.
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base/stopwatch.h"
+#include "converter/metadata.h"
+
+namespace {
+
+using converter::Metadata;
+
+// Number of events encoded per measure.
+const size_t kEventCount = 4000000;
+
+// Number of measures. The fastest one is reported.
+const size_t kRepetitions = 3;
+
+// Number of distinct generated events.
+const size_t kSampleCount = 256;
+
+// Size of the raw bytes of the payloads.
+const size_t kRawPayloadSize = 32;
+
+// The fields of a generated event.
+struct SampleEvent {
+  uint64_t timestamp;
+  uint16_t id;
+  uint8_t version;
+  uint8_t channel;
+  uint8_t level;
+  uint8_t opcode;
+  uint16_t task;
+  uint64_t keyword;
+  uint32_t process_id;
+  uint32_t thread_id;
+  uint8_t processor;
+  uint16_t logger_id;
+  GUID provider;
+  GUID activity;
+  uint16_t header_type;
+  uint16_t flags;
+  uint16_t property;
+
+  uint32_t values[3];
+  uint64_t addresses[2];
+  uint8_t raw[kRawPayloadSize];
+  std::string name;
+};
+
+// Encode a GUID as the consumer does: Data1, Data2 and Data3 in big-endian
+// order, then Data4.
+void EncodeGUID(const GUID& guid, Metadata::Packet* packet) {
+  uint8_t raw[16];
+  raw[0] = static_cast<uint8_t>(guid.Data1 >> 24);
+  raw[1] = static_cast<uint8_t>(guid.Data1 >> 16);
+  raw[2] = static_cast<uint8_t>(guid.Data1 >> 8);
+  raw[3] = static_cast<uint8_t>(guid.Data1);
+  raw[4] = static_cast<uint8_t>(guid.Data2 >> 8);
+  raw[5] = static_cast<uint8_t>(guid.Data2);
+  raw[6] = static_cast<uint8_t>(guid.Data3 >> 8);
+  raw[7] = static_cast<uint8_t>(guid.Data3);
+  ::memcpy(&raw[8], guid.Data4, 8);
+  packet->EncodeBytes(raw, sizeof(raw));
+}
+
+// Encode an event header and payload, and patch its event id.
+// @param event the event to encode.
+// @param packet the packet receiving the event.
+void EncodeEvent(const SampleEvent& event, Metadata::Packet* packet) {
+  packet->set_timestamp(event.timestamp);
+  packet->EncodeUInt64(event.timestamp);
+  packet->set_event_id_offset(packet->size());
+  packet->EncodeUInt32(0);
+
+  packet->EncodeUInt16(event.id);
+  packet->EncodeUInt8(event.version);
+  packet->EncodeUInt8(event.channel);
+  packet->EncodeUInt8(event.level);
+  packet->EncodeUInt8(event.opcode);
+  packet->EncodeUInt16(event.task);
+  packet->EncodeUInt64(event.keyword);
+
+  packet->EncodeUInt32(event.process_id);
+  packet->EncodeUInt32(event.thread_id);
+  packet->EncodeUInt8(event.processor);
+  packet->EncodeUInt16(event.logger_id);
+
+  EncodeGUID(event.provider, packet);
+  EncodeGUID(event.activity, packet);
+
+  packet->EncodeUInt16(event.header_type);
+  packet->EncodeUInt16(event.flags);
+  packet->EncodeUInt16(event.flags);
+  packet->EncodeUInt16(event.property);
+  packet->EncodeUInt16(event.property);
+
+  for (size_t i = 0; i < 3; ++i)
+    packet->EncodeUInt32(event.values[i]);
+  for (size_t i = 0; i < 2; ++i)
+    packet->EncodeUInt64(event.addresses[i]);
+  packet->EncodeBytes(event.raw, sizeof(event.raw));
+  packet->EncodeString(event.name);
+
+  packet->UpdateUInt32(packet->event_id_offset(), 1 + event.id % 64);
+}
+
+// Generate the event |index| from a simple pseudo-random sequence.
+// @param index the index of the event.
+// @param event a value-initialized event receiving the fields.
+void BuildSample(size_t index, SampleEvent* event) {
+  uint32_t seed = static_cast<uint32_t>(index) * 2654435761u + 1;
+  event->timestamp = 130000000000000000ULL + index * 1000;
+  event->id = static_cast<uint16_t>(seed % 512);
+  event->version = static_cast<uint8_t>(seed >> 9);
+  event->level = 4;
+  event->opcode = static_cast<uint8_t>(seed >> 13);
+  event->task = static_cast<uint16_t>(seed >> 3);
+  event->keyword = seed * 0x100000001ULL;
+  event->process_id = 4 + seed % 4096;
+  event->thread_id = 8 + seed % 65536;
+  event->processor = static_cast<uint8_t>(index % 8);
+  event->provider.Data1 = seed;
+  event->provider.Data2 = static_cast<unsigned short>(seed >> 16);
+  event->activity.Data3 = static_cast<unsigned short>(index);
+  event->header_type = 0x12;
+  event->flags = 0x240;
+  for (size_t i = 0; i < 3; ++i)
+    event->values[i] = seed + static_cast<uint32_t>(i);
+  for (size_t i = 0; i < 2; ++i)
+    event->addresses[i] = 0xFFFFF80000000000ULL + seed * (i + 1);
+  for (size_t i = 0; i < kRawPayloadSize; ++i)
+    event->raw[i] = static_cast<uint8_t>(seed >> (i % 24));
+  event->name = "Process" + std::string(1 + seed % 24, 'x');
+}
+
+}  // namespace
+
+int main() {
+  std::vector<SampleEvent> samples(kSampleCount);
+  for (size_t i = 0; i < kSampleCount; ++i)
+    BuildSample(i, &samples[i]);
+
+  Metadata::Packet packet;
+  double best = 0;
+  uint64_t total_bytes = 0;
+  for (size_t repetition = 0; repetition < kRepetitions; ++repetition) {
+    uint64_t bytes = 0;
+    base::Stopwatch stopwatch;
+    for (size_t i = 0; i < kEventCount; ++i) {
+      packet.Reset(0);
+      EncodeEvent(samples[i % kSampleCount], &packet);
+      bytes += packet.size();
+    }
+    double seconds = stopwatch.Elapsed();
+    if (repetition == 0 || seconds < best)
+      best = seconds;
+    total_bytes = bytes;
+  }
+
+  std::cout << std::fixed << std::setprecision(1)
+            << kEventCount << " events, "
+            << static_cast<double>(total_bytes) / kEventCount
+            << " bytes per event: "
+            << best * 1e9 / kEventCount << " ns/event" << std::endl;
+  return 0;
+}
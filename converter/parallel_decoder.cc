@@ -0,0 +1,492 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/parallel_decoder.h"
+
+#include <cassert>
+#include <cstring>
+
+#include "base/stopwatch.h"
+#include "converter/record_stream_writer.h"
+
+namespace converter {
+
+namespace {
+
+// Number of tasks dispatched ahead of the merge, per worker.
+const size_t kTasksInFlightPerWorker = 4;
+
+// Index of no stream.
+const size_t kNoStream = static_cast<size_t>(-1);
+
+}  // namespace
+
+ParallelDecoder::ParallelDecoder(
+    const std::vector<ETLReader*>& readers, size_t jobs,
+    const EventFilter& filter, const std::vector<EventFilter>& observed_events,
+    bool split_cpu, Metadata* metadata)
+    : readers_(readers),
+      metadata_(metadata),
+      observed_events_(observed_events),
+      observed_frame_(NULL),
+      stopping_(false),
+      next_dispatch_(0),
+      tasks_in_flight_(0),
+      maximal_tasks_in_flight_(jobs * kTasksInFlightPerWorker),
+      layouts_(jobs),
+      event_ids_(jobs),
+      started_(false),
+      consumed_stream_(kNoStream),
+      buffers_read_(0),
+      events_processed_(0),
+      unsupported_events_(0),
+      skipped_events_(0),
+      io_wait_time_(0),
+      decode_time_(0) {
+  assert(jobs > 0);
+  assert(metadata != NULL);
+
+  // Number the buffers of all the traces.
+  size_t buffers = 0;
+  for (size_t i = 0; i < readers_.size(); ++i) {
+    first_buffers_.push_back(buffers);
+    buffers += readers_[i]->buffers().size();
+  }
+  tasks_.resize(buffers, NULL);
+  dispatched_.resize(buffers, false);
+
+  // Take the next buffer to decode of each trace in turn.
+  size_t selected_buffers = 0;
+  for (size_t i = 0; i < readers_.size(); ++i)
+    selected_buffers += readers_[i]->selected_buffers().size();
+  for (size_t rank = 0; dispatch_order_.size() < selected_buffers; ++rank) {
+    for (size_t i = 0; i < readers_.size(); ++i) {
+      const std::vector<size_t>& selected = readers_[i]->selected_buffers();
+      if (rank < selected.size())
+        dispatch_order_.push_back(first_buffers_[i] + selected[rank]);
+    }
+  }
+
+  for (size_t i = 0; i < jobs; ++i) {
+    ETWConsumer* consumer = new ETWConsumer();
+    consumer->set_pack_events(false);
+    consumer->set_observed(false);
+    consumer->set_split_cpu(split_cpu);
+    consumer->SetEventFilter(filter);
+    consumers_.push_back(consumer);
+  }
+
+  for (size_t i = 0; i < jobs; ++i)
+    threads_.push_back(std::thread(&ParallelDecoder::RunWorker, this, i));
+}
+
+ParallelDecoder::~ParallelDecoder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_pending_.notify_all();
+  for (size_t i = 0; i < threads_.size(); ++i)
+    threads_[i].join();
+
+  // Tasks are owned by |tasks_| from their dispatch until they are merged.
+  for (size_t i = 0; i < tasks_.size(); ++i)
+    delete tasks_[i];
+  for (size_t i = 0; i < consumers_.size(); ++i)
+    delete consumers_[i];
+}
+
+bool ParallelDecoder::ReadNextEvent(const uint8_t** bytes,
+                                    ETWConsumer::EncodedEvent* event) {
+  assert(bytes != NULL);
+  assert(event != NULL);
+
+  // Wait for the first buffer of each processor of each trace.
+  if (!started_) {
+    started_ = true;
+    for (size_t i = 0; i < readers_.size(); ++i) {
+      const std::vector<std::vector<size_t> >& processor_buffers =
+          readers_[i]->processor_buffers();
+      for (size_t j = 0; j < processor_buffers.size(); ++j) {
+        Stream stream;
+        stream.reader = i;
+        stream.buffers = &processor_buffers[j];
+        stream.next_buffer = 0;
+        stream.task = NULL;
+        stream.next_event = 0;
+        stream.next_observed_event = 0;
+        stream.end_offset = 0;
+        streams_.push_back(stream);
+      }
+    }
+    for (size_t i = 0; i < streams_.size(); ++i) {
+      if (AdvanceStream(i)) {
+        const Task* task = streams_[i].task;
+        queue_.push(QueueEntry(task->events[0].timestamp, i));
+      }
+    }
+  }
+
+  // The stream of the previous event was not advanced, to keep the event
+  // returned by the previous call valid.
+  observed_frame_ = NULL;
+  if (consumed_stream_ != kNoStream) {
+    size_t index = consumed_stream_;
+    consumed_stream_ = kNoStream;
+    ++streams_[index].next_event;
+    if (AdvanceStream(index)) {
+      const Stream& stream = streams_[index];
+      uint64_t timestamp = stream.task->events[stream.next_event].timestamp;
+      queue_.push(QueueEntry(timestamp, index));
+    }
+  }
+
+  if (queue_.empty())
+    return false;
+
+  size_t index = queue_.top().second;
+  queue_.pop();
+  Stream& stream = streams_[index];
+  Task* task = stream.task;
+  const ETWConsumer::EncodedEvent& encoded = task->events[stream.next_event];
+
+  // The observed events of a buffer are ordered as its encoded events.
+  size_t observed = stream.next_observed_event;
+  if (observed < task->observed_events.size() &&
+      task->observed_events[observed].first == stream.next_event) {
+    observed_frame_ =
+        task->observed_frames.data() + task->observed_events[observed].second;
+    ++stream.next_observed_event;
+  } else {
+    BindEvent(task, encoded);
+  }
+
+  *bytes = task->bytes.raw_bytes();
+  *event = encoded;
+  consumed_stream_ = index;
+  return true;
+}
+
+bool ParallelDecoder::GetObservedEvent(EVENT_RECORD* record) {
+  assert(record != NULL);
+
+  if (observed_frame_ == NULL)
+    return false;
+
+  // The frame holds its size, the buffer context and the event.
+  uint32_t size = 0;
+  ::memcpy(&size, observed_frame_, sizeof(size));
+  const char* frame = observed_frame_ + sizeof(size);
+  ::memset(record, 0, sizeof(*record));
+  ::memcpy(&record->BufferContext, frame, sizeof(ETW_BUFFER_CONTEXT));
+  const uint8_t* raw =
+      reinterpret_cast<const uint8_t*>(frame + sizeof(ETW_BUFFER_CONTEXT));
+  return observed_reader_.DecodeEventHeader(
+      raw, size - sizeof(ETW_BUFFER_CONTEXT), record);
+}
+
+void ParallelDecoder::BindObservedEvent() {
+  assert(observed_frame_ != NULL);
+  assert(consumed_stream_ != kNoStream);
+
+  const Stream& stream = streams_[consumed_stream_];
+  BindEvent(stream.task, stream.task->events[stream.next_event]);
+}
+
+void ParallelDecoder::GetPositions(
+    std::vector<std::vector<ETLPosition> >* positions) const {
+  assert(positions != NULL);
+
+  positions->resize(readers_.size());
+  for (size_t i = 0; i < readers_.size(); ++i)
+    readers_[i]->GetPositions(false, &(*positions)[i]);
+  if (!started_)
+    return;
+
+  // The streams of each reader follow the order of its processors.
+  size_t processor = 0;
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    const Stream& stream = streams_[i];
+    if (i != 0 && stream.reader != streams_[i - 1].reader)
+      processor = 0;
+    ETLPosition& position = (*positions)[stream.reader][processor++];
+    if (stream.next_buffer == 0)
+      continue;
+
+    // The events of a buffer are merged after the end of the source of the
+    // last merged event.
+    position.buffer = (*stream.buffers)[stream.next_buffer - 1];
+    const Task* task = stream.task;
+    if (task == NULL) {
+      position.offset = stream.end_offset;
+    } else {
+      size_t merged = stream.next_event;
+      if (i == consumed_stream_)
+        ++merged;
+      position.offset =
+          merged == 0 ? task->start_offset : task->event_ends[merged - 1];
+    }
+  }
+}
+
+void ParallelDecoder::AddStatistics(DecodePlanCache* decode_plans,
+                                    size_t* passthrough_events,
+                                    size_t* filtered_events) const {
+  assert(decode_plans != NULL);
+  assert(passthrough_events != NULL);
+  assert(filtered_events != NULL);
+
+  // The workers are idle once all the buffers are merged.
+  for (size_t i = 0; i < consumers_.size(); ++i) {
+    decode_plans->AddStatistics(consumers_[i]->decode_plans());
+    *passthrough_events += consumers_[i]->passthrough_events();
+    *filtered_events += consumers_[i]->filtered_events();
+  }
+}
+
+void ParallelDecoder::RunWorker(size_t worker) {
+  ETWConsumer* consumer = consumers_[worker];
+  ETLBufferReader buffer_reader;
+  std::string frame;
+
+  while (true) {
+    Task* task = NULL;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!stopping_ && pending_tasks_.empty())
+        task_pending_.wait(lock);
+      if (stopping_)
+        return;
+      task = pending_tasks_.front();
+      pending_tasks_.pop_front();
+    }
+
+    // Wait for the buffer to be read from the file.
+    const ETLReader& reader = *readers_[task->reader];
+    base::Stopwatch io_stopwatch;
+    reader.LoadBuffer(task->buffer);
+    task->io_wait_time = io_stopwatch.Elapsed();
+
+    // Decode the events of the buffer.
+    base::Stopwatch decode_stopwatch;
+    size_t known_layouts = consumer->metadata().size();
+    size_t unsupported_events = buffer_reader.unsupported_events();
+    size_t skipped_events = buffer_reader.skipped_events();
+    buffer_reader.SetTimeRange(reader.range_start(), reader.range_end());
+    buffer_reader.Reset(reader.info(), reader.buffers()[task->buffer]);
+    buffer_reader.Seek(reader.GetFirstEventOffset(task->buffer));
+    task->start_offset = buffer_reader.offset();
+    EVENT_RECORD record;
+    while (buffer_reader.ReadNextEvent(&record)) {
+      size_t encoded_events = consumer->encoded_events();
+      consumer->ProcessEvent(&record);
+      ++task->events_processed;
+
+      // Keep a copy of the observed events, to replay them once merged.
+      // Observers only see the events which are encoded.
+      if (consumer->encoded_events() != encoded_events &&
+          IsObserved(record.EventHeader)) {
+        size_t offset = task->observed_frames.size();
+        if (RecordStreamWriter::EncodeFrame(record, &frame)) {
+          task->observed_frames.append(frame);
+          task->observed_events.push_back(
+              std::make_pair(encoded_events, offset));
+        }
+      }
+
+      // Each event is encoded once at most, when accepted by the filter.
+      task->event_ends.resize(consumer->encoded_events(),
+                              buffer_reader.offset());
+    }
+    task->end_offset = buffer_reader.offset();
+    task->unsupported_events =
+        buffer_reader.unsupported_events() - unsupported_events;
+    task->skipped_events = buffer_reader.skipped_events() - skipped_events;
+    consumer->TakeEncodedEvents(&task->bytes, &task->events);
+
+    // Hand over the layouts discovered in this buffer.
+    const Metadata& metadata = consumer->metadata();
+    for (size_t i = known_layouts; i < metadata.size(); ++i)
+      task->layouts.push_back(metadata.GetEventWithId(i));
+    task->worker = worker;
+    task->decode_time = decode_stopwatch.Elapsed();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      decoded_tasks_.push_back(task);
+    }
+    task_decoded_.notify_one();
+  }
+}
+
+void ParallelDecoder::Dispatch(size_t index) {
+  assert(index < tasks_.size());
+  assert(!dispatched_[index]);
+
+  // Locate the buffer in its trace.
+  size_t reader = readers_.size() - 1;
+  while (first_buffers_[reader] > index)
+    --reader;
+
+  Task* task = new Task();
+  task->index = index;
+  task->reader = reader;
+  task->buffer = index - first_buffers_[reader];
+  task->received = false;
+  task->worker = 0;
+  task->start_offset = 0;
+  task->end_offset = 0;
+  task->events_processed = 0;
+  task->unsupported_events = 0;
+  task->skipped_events = 0;
+  task->io_wait_time = 0;
+  task->decode_time = 0;
+
+  // Read the following buffers of the trace while this one is decoded.
+  readers_[reader]->ReadAhead(task->buffer);
+
+  tasks_[index] = task;
+  dispatched_[index] = true;
+  ++tasks_in_flight_;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_tasks_.push_back(task);
+  }
+  task_pending_.notify_one();
+}
+
+void ParallelDecoder::DispatchAhead() {
+  while (tasks_in_flight_ < maximal_tasks_in_flight_ &&
+         next_dispatch_ < dispatch_order_.size()) {
+    size_t index = dispatch_order_[next_dispatch_];
+    if (!dispatched_[index])
+      Dispatch(index);
+    ++next_dispatch_;
+  }
+}
+
+ParallelDecoder::Task* ParallelDecoder::WaitForTask(size_t index) {
+  // The merge may need a buffer beyond the buffers dispatched ahead.
+  if (!dispatched_[index])
+    Dispatch(index);
+  DispatchAhead();
+
+  Task* task = tasks_[index];
+  assert(task != NULL);
+
+  // Tasks are received in the order they were decoded, so that the layouts
+  // of each worker are received in the order of their ids.
+  while (!task->received) {
+    Task* decoded = NULL;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (decoded_tasks_.empty())
+        task_decoded_.wait(lock);
+      decoded = decoded_tasks_.front();
+      decoded_tasks_.pop_front();
+    }
+    ReceiveTask(decoded);
+  }
+
+  return task;
+}
+
+void ParallelDecoder::ReceiveTask(Task* task) {
+  assert(task != NULL);
+  assert(!task->received);
+
+  std::vector<Metadata::Event>& layouts = layouts_[task->worker];
+  layouts.insert(layouts.end(), task->layouts.begin(), task->layouts.end());
+  event_ids_[task->worker].resize(layouts.size(), 0);
+  task->layouts.clear();
+
+  task->received = true;
+}
+
+bool ParallelDecoder::AdvanceStream(size_t index) {
+  assert(index < streams_.size());
+  Stream& stream = streams_[index];
+
+  while (true) {
+    if (stream.task != NULL) {
+      if (stream.next_event < stream.task->events.size())
+        return true;
+
+      // All the events of the buffer are merged.
+      stream.end_offset = stream.task->end_offset;
+      events_processed_ += stream.task->events_processed;
+      unsupported_events_ += stream.task->unsupported_events;
+      skipped_events_ += stream.task->skipped_events;
+      io_wait_time_ += stream.task->io_wait_time;
+      decode_time_ += stream.task->decode_time;
+      tasks_[stream.task->index] = NULL;
+      delete stream.task;
+      stream.task = NULL;
+      --tasks_in_flight_;
+      ++buffers_read_;
+    }
+
+    if (stream.next_buffer == stream.buffers->size())
+      return false;
+    size_t buffer = (*stream.buffers)[stream.next_buffer];
+    stream.task = WaitForTask(first_buffers_[stream.reader] + buffer);
+    stream.next_event = 0;
+    stream.next_observed_event = 0;
+    ++stream.next_buffer;
+  }
+}
+
+bool ParallelDecoder::IsObserved(const EVENT_HEADER& header) const {
+  for (size_t i = 0; i < observed_events_.size(); ++i) {
+    if (observed_events_[i].Accepts(header))
+      return true;
+  }
+  return false;
+}
+
+void ParallelDecoder::BindEvent(Task* task,
+                                const ETWConsumer::EncodedEvent& event) {
+  assert(task != NULL);
+
+  // Bind the event to the id of its layout in the output metadata.
+  size_t id_offset = event.offset + event.event_id_offset;
+  uint32_t local_id = 0;
+  ::memcpy(&local_id, task->bytes.raw_bytes() + id_offset, sizeof(local_id));
+  size_t event_id = GetEventId(task->worker, local_id);
+  task->bytes.UpdateUInt32(id_offset, static_cast<uint32_t>(event_id));
+}
+
+size_t ParallelDecoder::GetEventId(size_t worker, size_t local_id) {
+  assert(worker < event_ids_.size());
+  assert(local_id > 0 && local_id <= event_ids_[worker].size());
+
+  size_t& event_id = event_ids_[worker][local_id - 1];
+  if (event_id == 0)
+    event_id = metadata_->GetIdForEvent(layouts_[worker][local_id - 1]);
+  return event_id;
+}
+
+}  // namespace converter
@@ -0,0 +1,267 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Parallel decoding of the buffers of ETL traces.
+//
+// The buffers of an ETL trace are independent: each one holds the events of
+// one processor, in timestamp order. Buffers are decoded on a pool of
+// threads, each with its own consumer encoding the events without packing
+// them into CTF packets. The decoded buffers of all the processors of all
+// the traces are merged in timestamp order, as the ETLReaderMerger merges
+// the events, and the layouts of the events are registered in the output
+// metadata in the order the events are merged: the output does not depend
+// on the number of threads.
+
+#ifndef CONVERTER_PARALLEL_DECODER_H_
+#define CONVERTER_PARALLEL_DECODER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "converter/etl_reader.h"
+#include "converter/etw_consumer.h"
+#include "converter/event_filter.h"
+#include "converter/metadata.h"
+#include "base/disallow_copy_and_assign.h"
+
+namespace converter {
+
+class ParallelDecoder {
+ public:
+  // @param readers the readers of opened traces. Their events are not read:
+  //     only their buffers are used.
+  // @param jobs the number of decoding threads.
+  // @param filter the filter of the events to decode.
+  // @param observed_events the filters of the events kept for the ETW
+  //     observers, one per observer.
+  // @param split_cpu true to encode the events for streams split by
+  //     processor.
+  // @param metadata the dictionary receiving the layouts of the events.
+  ParallelDecoder(const std::vector<ETLReader*>& readers, size_t jobs,
+                  const EventFilter& filter,
+                  const std::vector<EventFilter>& observed_events,
+                  bool split_cpu, Metadata* metadata);
+  ~ParallelDecoder();
+
+  // Get the next decoded event of the traces, in timestamp order. The id of
+  // the event refers to the layouts of |metadata|, once BindObservedEvent is
+  // called for an observed event. The event stays valid until the next call
+  // to ReadNextEvent.
+  // @param bytes receives the encoded bytes holding the event.
+  // @param event receives the location of the event in |bytes|.
+  // @returns true when an event was decoded, false at the end of the traces.
+  bool ReadNextEvent(const uint8_t** bytes, ETWConsumer::EncodedEvent* event);
+
+  // Get the event returned by the last call to ReadNextEvent, as read from
+  // its trace file, when an ETW observer observes it. The record stays valid
+  // until the next call to ReadNextEvent.
+  // @param record receives the event.
+  // @returns true when the event is observed, false otherwise.
+  bool GetObservedEvent(EVENT_RECORD* record);
+
+  // Bind the observed event returned by the last call to ReadNextEvent to
+  // the id of its layout in |metadata|. Called once the ETW observers saw
+  // the start of its processing: they may add layouts to |metadata| before
+  // its layout, as they do for an event decoded on a single thread.
+  void BindObservedEvent();
+
+  // Get the position of the next event to merge from each processor of each
+  // trace. The events returned by ReadNextEvent are consumed.
+  // @param positions receives the positions of the processors of each
+  //     reader.
+  void GetPositions(std::vector<std::vector<ETLPosition> >* positions) const;
+
+  // @returns the number of buffers whose events were all merged.
+  size_t buffers_read() const { return buffers_read_; }
+
+  // @returns the number of events read from the merged buffers.
+  uint64_t events_processed() const { return events_processed_; }
+
+  // @returns the number of events skipped because their layout is not
+  //     supported.
+  size_t unsupported_events() const { return unsupported_events_; }
+
+  // @returns the number of events skipped because they are out of the time
+  //     range of their trace.
+  size_t skipped_events() const { return skipped_events_; }
+
+  // @returns the time spent by the workers waiting for buffers to be read
+  //     from the files, in seconds, summed over the workers.
+  double io_wait_time() const { return io_wait_time_; }
+
+  // @returns the time spent by the workers decoding buffers, in seconds,
+  //     summed over the workers.
+  double decode_time() const { return decode_time_; }
+
+  // Account for the decode plan lookups, the passthrough events and the
+  // filtered events of the workers in the statistics of a consumer. Must be
+  // called at the end of the traces.
+  // @param decode_plans the decode plan cache of the consumer.
+  // @param passthrough_events the passthrough events of the consumer.
+  // @param filtered_events the filtered events of the consumer.
+  void AddStatistics(DecodePlanCache* decode_plans,
+                     size_t* passthrough_events,
+                     size_t* filtered_events) const;
+
+ private:
+  // A buffer to decode, and its decoded events.
+  struct Task {
+    // The index of the buffer among the buffers of all the traces, and its
+    // location in its trace.
+    size_t index;
+    size_t reader;
+    size_t buffer;
+    bool received;
+
+    // The worker which decoded the buffer.
+    size_t worker;
+
+    // The encoded events. Their ids refer to the layouts of the worker.
+    Metadata::Packet bytes;
+    std::vector<ETWConsumer::EncodedEvent> events;
+
+    // The offsets in the buffer of the first event read, of the end of the
+    // source of each encoded event, and of the end of the events read.
+    size_t start_offset;
+    std::vector<size_t> event_ends;
+    size_t end_offset;
+
+    // The layouts added to the metadata of the worker by this buffer.
+    std::vector<Metadata::Event> layouts;
+
+    // The observed events, as frames of a record stream, with the index of
+    // each observed event among the encoded events and the offset of its
+    // frame.
+    std::string observed_frames;
+    std::vector<std::pair<size_t, size_t> > observed_events;
+
+    uint64_t events_processed;
+    size_t unsupported_events;
+    size_t skipped_events;
+    double io_wait_time;
+    double decode_time;
+  };
+
+  // The buffers of a processor, merged in sequence.
+  struct Stream {
+    size_t reader;
+    const std::vector<size_t>* buffers;
+    size_t next_buffer;
+    Task* task;
+    size_t next_event;
+    size_t next_observed_event;
+
+    // The offset of the end of the events read in the last merged buffer.
+    size_t end_offset;
+  };
+
+  void RunWorker(size_t worker);
+
+  void Dispatch(size_t index);
+  void DispatchAhead();
+  Task* WaitForTask(size_t index);
+  void ReceiveTask(Task* task);
+  bool AdvanceStream(size_t index);
+  void BindEvent(Task* task, const ETWConsumer::EncodedEvent& event);
+  size_t GetEventId(size_t worker, size_t local_id);
+
+  bool IsObserved(const EVENT_HEADER& header) const;
+
+  std::vector<ETLReader*> readers_;
+  Metadata* metadata_;
+
+  // The filters of the observed events, the frame of the observed event
+  // returned last, or NULL, and the reader decoding it.
+  std::vector<EventFilter> observed_events_;
+  const char* observed_frame_;
+  ETLBufferReader observed_reader_;
+
+  // The index of the first buffer of each trace, among the buffers of all
+  // the traces.
+  std::vector<size_t> first_buffers_;
+
+  // The consumers and the threads of the workers.
+  std::vector<ETWConsumer*> consumers_;
+  std::vector<std::thread> threads_;
+
+  // The tasks waiting for a worker, and the decoded tasks not yet received,
+  // in the order they were decoded.
+  std::mutex mutex_;
+  std::condition_variable task_pending_;
+  std::condition_variable task_decoded_;
+  std::deque<Task*> pending_tasks_;
+  std::deque<Task*> decoded_tasks_;
+  bool stopping_;
+
+  // The task of each buffer, from its dispatch until its events are merged.
+  std::vector<Task*> tasks_;
+  std::vector<bool> dispatched_;
+
+  // Buffers are dispatched ahead of the merge, up to a number of tasks not
+  // yet merged. The traces progress together: their buffers are dispatched
+  // in turn, each in file order.
+  std::vector<size_t> dispatch_order_;
+  size_t next_dispatch_;
+  size_t tasks_in_flight_;
+  size_t maximal_tasks_in_flight_;
+
+  // The layouts known by each worker, indexed by their id minus one, and
+  // the ids of the same layouts in |metadata_|, or 0 when not yet known.
+  std::vector<std::vector<Metadata::Event> > layouts_;
+  std::vector<std::vector<size_t> > event_ids_;
+
+  // The streams of events of each processor, and a queue of the streams
+  // having a pending event, ordered by timestamp.
+  std::vector<Stream> streams_;
+  typedef std::pair<uint64_t, size_t> QueueEntry;
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>,
+                      std::greater<QueueEntry> > queue_;
+  bool started_;
+
+  // The stream whose event was returned last, advanced by the next call to
+  // ReadNextEvent.
+  size_t consumed_stream_;
+
+  size_t buffers_read_;
+  uint64_t events_processed_;
+  size_t unsupported_events_;
+  size_t skipped_events_;
+  double io_wait_time_;
+  double decode_time_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelDecoder);
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_PARALLEL_DECODER_H_
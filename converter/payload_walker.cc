@@ -0,0 +1,375 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/payload_walker.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace converter {
+
+namespace {
+
+// @returns the number of elements of a property, when it is not given by
+//     another property.
+size_t GetFixedCount(const EventSchema::Property& property) {
+  return property.count == 0 ? 1 : property.count;
+}
+
+}  // namespace
+
+size_t PayloadWalker::GetPointerSize(const EVENT_RECORD& record) {
+  // The size of the pointers depends on the architecture of the process
+  // which produced the event.
+  uint16_t flags = record.EventHeader.Flags;
+  if ((flags & EVENT_HEADER_FLAG_32_BIT_HEADER) != 0)
+    return 4;
+  if ((flags & EVENT_HEADER_FLAG_64_BIT_HEADER) != 0)
+    return 8;
+  return 0;
+}
+
+PayloadWalker::PayloadWalker()
+    : schema_(NULL),
+      record_(NULL),
+      pointer_size_(0),
+      property_(0),
+      element_(0),
+      offset_(0),
+      valid_(false) {
+}
+
+void PayloadWalker::Reset(const EventSchema* schema,
+                          const EVENT_RECORD* record) {
+  assert(schema != NULL);
+  assert(record != NULL);
+
+  schema_ = schema;
+  record_ = record;
+
+  pointer_size_ = GetPointerSize(*record);
+
+  property_ = 0;
+  element_ = 0;
+  offset_ = 0;
+  property_offsets_.resize(schema->properties.size());
+  valid_ = true;
+  EnterProperty();
+}
+
+bool PayloadWalker::GetPropertyData(size_t property, size_t element,
+                                    const uint8_t** data, size_t* size) {
+  assert(schema_ != NULL);
+  assert(record_ != NULL);
+  assert(data != NULL);
+  assert(size != NULL);
+
+  if (property >= schema_->properties.size())
+    return false;
+
+  // Restart the walk when the element is before the cursor.
+  if (property < property_ ||
+      (property == property_ && element < element_)) {
+    Reset(schema_, record_);
+  }
+
+  // Move the cursor up to the requested element. The cursor moves past the
+  // property when it has fewer elements.
+  while (valid_ && (property_ < property ||
+                    (property_ == property && element_ < element))) {
+    if (!Advance())
+      return false;
+  }
+
+  if (!valid_ || property_ != property)
+    return false;
+
+  if (!GetCurrentSize(size)) {
+    valid_ = false;
+    return false;
+  }
+
+  const uint8_t* payload = static_cast<const uint8_t*>(record_->UserData);
+  *data = &payload[offset_];
+  return true;
+}
+
+bool PayloadWalker::GetElementCount(size_t property, size_t* count) {
+  assert(schema_ != NULL);
+  assert(record_ != NULL);
+  assert(count != NULL);
+
+  if (property >= schema_->properties.size())
+    return false;
+
+  const EventSchema::Property& current = schema_->properties[property];
+  if ((current.flags & PropertyParamCount) == 0) {
+    *count = GetFixedCount(current);
+    return true;
+  }
+
+  // The number of elements is held by a previous property. Each element
+  // takes at least a byte of the payload.
+  uint64_t value = 0;
+  if (current.count_property >= property ||
+      !GetCountValue(current.count_property, &value) ||
+      value > record_->UserDataLength) {
+    return false;
+  }
+
+  *count = static_cast<size_t>(value);
+  return true;
+}
+
+bool PayloadWalker::Advance() {
+  assert(valid_);
+
+  size_t size = 0;
+  size_t count = 0;
+  if (!GetCurrentSize(&size) || !GetElementCount(property_, &count)) {
+    valid_ = false;
+    return false;
+  }
+
+  offset_ += size;
+  ++element_;
+  if (element_ >= count) {
+    ++property_;
+    element_ = 0;
+    return EnterProperty();
+  }
+
+  return true;
+}
+
+bool PayloadWalker::EnterProperty() {
+  assert(valid_);
+  assert(element_ == 0);
+
+  // Skip the properties without elements: counted arrays may be empty.
+  while (property_ < schema_->properties.size()) {
+    property_offsets_[property_] = offset_;
+
+    size_t count = 0;
+    if (!GetElementCount(property_, &count)) {
+      valid_ = false;
+      return false;
+    }
+    if (count != 0)
+      return true;
+
+    ++property_;
+  }
+
+  valid_ = false;
+  return false;
+}
+
+bool PayloadWalker::GetCurrentSize(size_t* size) {
+  assert(valid_);
+  assert(size != NULL);
+
+  const uint8_t* payload = static_cast<const uint8_t*>(record_->UserData);
+  size_t remaining = record_->UserDataLength - offset_;
+  const EventSchema::Property& current = schema_->properties[property_];
+
+  if ((current.flags & PropertyParamLength) == 0) {
+    return GetElementSize(current, &payload[offset_], remaining,
+                          pointer_size_, size);
+  }
+
+  // Only the length of binary values is read from another property. The
+  // length of strings is in characters, and arrays of them are not walked.
+  uint64_t length = 0;
+  if (current.flags != PropertyParamLength ||
+      current.in_type != TDH_INTYPE_BINARY ||
+      current.length_property >= property_ ||
+      !GetCountValue(current.length_property, &length) ||
+      length > remaining) {
+    return false;
+  }
+
+  *size = static_cast<size_t>(length);
+  return true;
+}
+
+bool PayloadWalker::GetCountValue(size_t property, uint64_t* value) {
+  assert(value != NULL);
+
+  const EventSchema::Property& count = schema_->properties[property];
+  if (!IsCountProperty(count))
+    return false;
+
+  // The properties before the cursor have a known offset. The others are
+  // walked first.
+  const uint8_t* data = NULL;
+  size_t size = GetFixedSize(count, pointer_size_);
+  if (property < property_) {
+    size_t offset = property_offsets_[property];
+    if (size > record_->UserDataLength - offset)
+      return false;
+    data = static_cast<const uint8_t*>(record_->UserData) + offset;
+  } else if (!GetPropertyData(property, 0, &data, &size)) {
+    return false;
+  }
+
+  *value = LoadCount(data, size);
+  return true;
+}
+
+uint64_t PayloadWalker::LoadCount(const uint8_t* data, size_t size) {
+  switch (size) {
+    case 1:
+      return data[0];
+    case 2: {
+      uint16_t value = 0;
+      ::memcpy(&value, data, sizeof(value));
+      return value;
+    }
+    case 4: {
+      uint32_t value = 0;
+      ::memcpy(&value, data, sizeof(value));
+      return value;
+    }
+    case 8: {
+      uint64_t value = 0;
+      ::memcpy(&value, data, sizeof(value));
+      return value;
+    }
+  }
+  assert(false);
+  return 0;
+}
+
+bool PayloadWalker::IsCountProperty(const EventSchema::Property& property) {
+  if (property.flags != 0 || GetFixedCount(property) != 1)
+    return false;
+
+  switch (property.in_type) {
+    case TDH_INTYPE_UINT8:
+    case TDH_INTYPE_UINT16:
+    case TDH_INTYPE_UINT32:
+    case TDH_INTYPE_UINT64:
+    case TDH_INTYPE_HEXINT32:
+    case TDH_INTYPE_HEXINT64:
+      return true;
+  }
+
+  return false;
+}
+
+size_t PayloadWalker::GetFixedSize(const EventSchema::Property& property,
+                                   size_t pointer_size) {
+  // The length of properties with other flags than PropertyParamCount
+  // depends on the value of other properties, or on their structure.
+  if ((property.flags & ~PropertyParamCount) != 0)
+    return 0;
+
+  switch (property.in_type) {
+    case TDH_INTYPE_INT8:
+    case TDH_INTYPE_UINT8:
+    case TDH_INTYPE_ANSICHAR:
+      return 1;
+
+    case TDH_INTYPE_INT16:
+    case TDH_INTYPE_UINT16:
+    case TDH_INTYPE_UNICODECHAR:
+      return 2;
+
+    case TDH_INTYPE_INT32:
+    case TDH_INTYPE_UINT32:
+    case TDH_INTYPE_HEXINT32:
+    case TDH_INTYPE_FLOAT:
+    case TDH_INTYPE_BOOLEAN:
+      return 4;
+
+    case TDH_INTYPE_INT64:
+    case TDH_INTYPE_UINT64:
+    case TDH_INTYPE_HEXINT64:
+    case TDH_INTYPE_DOUBLE:
+    case TDH_INTYPE_FILETIME:
+      return 8;
+
+    case TDH_INTYPE_GUID:
+    case TDH_INTYPE_SYSTEMTIME:
+      return 16;
+
+    case TDH_INTYPE_POINTER:
+    case TDH_INTYPE_SIZET:
+      return pointer_size;
+
+    case TDH_INTYPE_BINARY:
+      return property.length;
+  }
+
+  return 0;
+}
+
+bool PayloadWalker::GetElementSize(const EventSchema::Property& property,
+                                   const uint8_t* data,
+                                   size_t remaining,
+                                   size_t pointer_size,
+                                   size_t* size) {
+  assert(size != NULL);
+
+  // The size of properties with other flags than PropertyParamCount depends
+  // on other properties. The size of the elements of counted arrays doesn't.
+  if ((property.flags & ~PropertyParamCount) != 0)
+    return false;
+
+  size_t element_size = GetFixedSize(property, pointer_size);
+  switch (property.in_type) {
+    case TDH_INTYPE_UNICODESTRING:
+      // A null-terminated UTF-16 string, unless it has a fixed length.
+      if (property.length != 0)
+        return false;
+      for (size_t i = 0; i + 1 < remaining; i += 2) {
+        if (data[i] == 0 && data[i + 1] == 0) {
+          element_size = i + 2;
+          break;
+        }
+      }
+      break;
+
+    case TDH_INTYPE_ANSISTRING:
+      // A null-terminated string, unless it has a fixed length.
+      if (property.length != 0)
+        return false;
+      if (remaining > 0) {
+        const void* end = ::memchr(data, 0, remaining);
+        if (end != NULL)
+          element_size = static_cast<const uint8_t*>(end) - data + 1;
+      }
+      break;
+  }
+
+  if (element_size == 0 || element_size > remaining)
+    return false;
+
+  *size = element_size;
+  return true;
+}
+
+}  // namespace converter
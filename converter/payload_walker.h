@@ -0,0 +1,167 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// The payload walker locates the properties of an event payload using the
+// event schema. Fixed-size values, null-terminated strings and arrays of
+// fixed length are read directly from the payload, without calling the
+// schema source. So are the arrays whose number of elements, and the binary
+// values whose length, is held by a previous property of the payload
+// (PropertyParamCount and PropertyParamLength): the count or the length is
+// read from the value of that property, already walked.
+//
+// Properties must be walked in order: the offset of a property depends on
+// the size of the previous ones. When the size of a property can't be
+// determined from the schema, the walker stops and the property, like the
+// following ones, must be retrieved from the schema source.
+
+#ifndef CONVERTER_PAYLOAD_WALKER_H_
+#define CONVERTER_PAYLOAD_WALKER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "converter/event_schema.h"
+#include "base/disallow_copy_and_assign.h"
+#include "base/etw_types.h"
+
+namespace converter {
+
+class PayloadWalker {
+ public:
+  PayloadWalker();
+
+  // Start walking the payload of an event.
+  // @param schema the schema of the event. Must outlive the walk.
+  // @param record the event. Must outlive the walk.
+  void Reset(const EventSchema* schema, const EVENT_RECORD* record);
+
+  // Locate an element of a property in the payload. Elements are usually
+  // located in order; locating a previous element restarts the walk.
+  // @param property the index of the property in the schema.
+  // @param element the index of the element in the property.
+  // @param data receives a pointer to the element, in the payload.
+  // @param size receives the size of the element, in bytes.
+  // @returns true on success, false when the element can't be located
+  //     without the schema source.
+  bool GetPropertyData(size_t property, size_t element,
+                       const uint8_t** data, size_t* size);
+
+  // Determine the number of elements of a property. The number of elements
+  // of a counted array is read from the property holding it.
+  // @param property the index of the property in the schema.
+  // @param count receives the number of elements, which may be 0.
+  // @returns true on success, false when the number of elements can't be
+  //     determined without the schema source.
+  bool GetElementCount(size_t property, size_t* count);
+
+  // Determine the size of the pointers of an event.
+  // @param record the event.
+  // @returns the size of the pointers, in bytes, or 0 when unknown.
+  static size_t GetPointerSize(const EVENT_RECORD& record);
+
+  // Determine whether a property can hold the number of elements or the
+  // length of another property: an unsigned integer scalar.
+  // @param property the property.
+  // @returns true when the property can be a count, false otherwise.
+  static bool IsCountProperty(const EventSchema::Property& property);
+
+  // Read the value of a count property.
+  // @param data the value, in the payload.
+  // @param size the size of the value: 1, 2, 4 or 8 bytes.
+  // @returns the value.
+  static uint64_t LoadCount(const uint8_t* data, size_t size);
+
+  // Determine the size of the elements of a property, when it doesn't depend
+  // on their value.
+  // @param property the property.
+  // @param pointer_size the size of the pointers of the event, or 0 when
+  //     unknown.
+  // @returns the size of the elements, in bytes, or 0 when their size is not
+  //     fixed or unknown.
+  static size_t GetFixedSize(const EventSchema::Property& property,
+                             size_t pointer_size);
+
+  // Determine the size of an element of a property.
+  // @param property the property.
+  // @param data the element, in the payload.
+  // @param remaining the number of bytes from |data| to the end of the
+  //     payload.
+  // @param pointer_size the size of the pointers of the event, or 0 when
+  //     unknown.
+  // @param size receives the size of the element, in bytes.
+  // @returns true on success, false when the size can't be determined.
+  static bool GetElementSize(const EventSchema::Property& property,
+                             const uint8_t* data,
+                             size_t remaining,
+                             size_t pointer_size,
+                             size_t* size);
+
+ private:
+  // Move the cursor after the current element.
+  // @returns true on success, false when the walk can't continue.
+  bool Advance();
+
+  // Move the cursor to the first element of the next properties, skipping
+  // the properties without elements.
+  // @returns true on success, false when the walk can't continue.
+  bool EnterProperty();
+
+  // Determine the size of the element at the cursor.
+  // @param size receives the size of the element, in bytes.
+  // @returns true on success, false when the size can't be determined.
+  bool GetCurrentSize(size_t* size);
+
+  // Read the value of a count property, before the cursor.
+  // @param property the index of the count property in the schema.
+  // @param value receives the value of the property.
+  // @returns true on success, false when the property is not a count or
+  //     has not been walked.
+  bool GetCountValue(size_t property, uint64_t* value);
+
+  // The walked event and its schema.
+  const EventSchema* schema_;
+  const EVENT_RECORD* record_;
+
+  // The size of the pointers of the event, or 0 when unknown.
+  size_t pointer_size_;
+
+  // The cursor: the current element and its offset in the payload.
+  size_t property_;
+  size_t element_;
+  size_t offset_;
+
+  // The offsets of the properties in the payload, known up to the property
+  // at the cursor.
+  std::vector<size_t> property_offsets_;
+
+  // Whether the walk can continue from the cursor.
+  bool valid_;
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadWalker);
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_PAYLOAD_WALKER_H_
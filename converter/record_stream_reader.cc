@@ -0,0 +1,226 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/record_stream_reader.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "base/file_util.h"
+#endif
+
+namespace converter {
+
+namespace {
+
+// The source naming the standard input, and the prefix of the sources
+// naming a Unix socket.
+const wchar_t kStandardInput[] = L"-";
+const wchar_t kUnixSocketPrefix[] = L"unix:";
+
+// The descriptor of the standard input.
+const int kStandardInputFd = 0;
+
+// The largest payload of an event.
+const size_t kMaximalPayloadSize = 0xFFFF;
+
+}  // namespace
+
+const char RecordStreamReader::kStreamMagic[8] =
+    { 'E', 'T', 'W', 'R', 'E', 'C', 'S', '1' };
+const size_t RecordStreamReader::kMinimalFrameSize =
+    sizeof(ETW_BUFFER_CONTEXT) + sizeof(EVENT_HEADER);
+const size_t RecordStreamReader::kMaximalFrameSize = 1 << 20;
+
+RecordStreamReader::RecordStreamReader()
+    : fd_(-1),
+      owned_(false),
+      truncated_(false),
+      corrupted_(false),
+      unsupported_events_(0) {
+}
+
+RecordStreamReader::~RecordStreamReader() {
+  Close();
+}
+
+bool RecordStreamReader::Open(const std::wstring& source) {
+  Close();
+
+  if (source == kStandardInput) {
+#if defined(_WIN32)
+    // Frames are binary: the standard input must not translate newlines.
+    ::_setmode(kStandardInputFd, _O_BINARY);
+#endif
+    fd_ = kStandardInputFd;
+    owned_ = false;
+  } else if (source.compare(0, ::wcslen(kUnixSocketPrefix),
+                            kUnixSocketPrefix) == 0) {
+#if defined(_WIN32)
+    return false;
+#else
+    std::string path = base::NarrowNativePath(
+        source.substr(::wcslen(kUnixSocketPrefix)));
+    struct sockaddr_un address;
+    ::memset(&address, 0, sizeof(address));
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+      return false;
+    address.sun_family = AF_UNIX;
+    ::memcpy(address.sun_path, path.c_str(), path.size());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return false;
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&address),
+                  sizeof(address)) != 0) {
+      ::close(fd);
+      return false;
+    }
+    fd_ = fd;
+    owned_ = true;
+#endif
+  } else {
+#if defined(_WIN32)
+    int fd = ::_wopen(source.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int fd = ::open(base::NarrowNativePath(source).c_str(), O_RDONLY);
+#endif
+    if (fd < 0)
+      return false;
+    fd_ = fd;
+    owned_ = true;
+  }
+
+  char magic[sizeof(kStreamMagic)];
+  if (Read(reinterpret_cast<uint8_t*>(magic), sizeof(magic)) !=
+          sizeof(magic) ||
+      ::memcmp(magic, kStreamMagic, sizeof(magic)) != 0) {
+    Close();
+    return false;
+  }
+
+  return true;
+}
+
+void RecordStreamReader::Close() {
+  if (fd_ >= 0 && owned_) {
+#if defined(_WIN32)
+    ::_close(fd_);
+#else
+    ::close(fd_);
+#endif
+  }
+  fd_ = -1;
+  owned_ = false;
+  frame_.clear();
+}
+
+bool RecordStreamReader::ReadNextEvent(EVENT_RECORD* record) {
+  assert(record != NULL);
+
+  while (fd_ >= 0) {
+    // A stream ending between two frames ends cleanly.
+    uint8_t prefix[sizeof(uint32_t)];
+    size_t read = Read(prefix, sizeof(prefix));
+    if (read != sizeof(prefix)) {
+      truncated_ = read != 0;
+      return false;
+    }
+
+    uint32_t size = 0;
+    ::memcpy(&size, prefix, sizeof(size));
+    if (size > kMaximalFrameSize) {
+      corrupted_ = true;
+      return false;
+    }
+
+    frame_.resize(size);
+    if (size != 0 && Read(&frame_[0], size) != size) {
+      truncated_ = true;
+      return false;
+    }
+
+    if (size < kMinimalFrameSize) {
+      ++unsupported_events_;
+      continue;
+    }
+
+    ::memset(record, 0, sizeof(*record));
+    ::memcpy(&record->BufferContext, &frame_[0], sizeof(ETW_BUFFER_CONTEXT));
+    if (!decoder_.DecodeEventHeader(&frame_[sizeof(ETW_BUFFER_CONTEXT)],
+                                    size - sizeof(ETW_BUFFER_CONTEXT),
+                                    record)) {
+      ++unsupported_events_;
+      continue;
+    }
+
+    // The length of the payload must fit in the record.
+    const uint8_t* end = &frame_[0] + size;
+    if (end - static_cast<const uint8_t*>(record->UserData) >
+            static_cast<ptrdiff_t>(kMaximalPayloadSize)) {
+      ++unsupported_events_;
+      continue;
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+size_t RecordStreamReader::Read(uint8_t* data, size_t size) {
+  assert(data != NULL);
+  assert(fd_ >= 0);
+
+  size_t offset = 0;
+  while (offset < size) {
+#if defined(_WIN32)
+    int read = ::_read(fd_, data + offset,
+                       static_cast<unsigned int>(size - offset));
+#else
+    ssize_t read = ::read(fd_, data + offset, size - offset);
+    if (read < 0 && errno == EINTR)
+      continue;
+#endif
+    if (read <= 0)
+      break;
+    offset += static_cast<size_t>(read);
+  }
+
+  return offset;
+}
+
+}  // namespace converter
@@ -0,0 +1,131 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Reader of a stream of framed event records. A collector consuming ETW
+// events in real time forwards each EVENT_RECORD it receives as a frame, and
+// the converter decodes the frames as they arrive, from the standard input
+// or from a Unix socket. A stream recorded in a file by RecordStreamWriter is
+// replayed the same way.
+//
+// The stream starts with the 8 bytes "ETWRECS1", followed by the frames.
+// Values are stored in little-endian byte order. Each frame is:
+//
+//   uint32_t size;                 // The number of bytes following.
+//   ETW_BUFFER_CONTEXT context;    // The processor and the logger.
+//   EVENT_HEADER header;           // As received by the collector.
+//   extended data items;           // When EVENT_HEADER_FLAG_EXTENDED_INFO.
+//   uint8_t payload[];             // The UserData of the event.
+//
+// The timestamp of the header is a FILETIME, and the pointer size of the
+// payload is given by the flags of the header. Each extended data item is
+// stored as in the buffers of an ETL file: a header made of a reserved
+// uint16_t, the ExtType, a linkage uint16_t whose low bit tells whether
+// another item follows, and the DataSize, then the data, padded to a
+// multiple of 8 bytes.
+
+#ifndef CONVERTER_RECORD_STREAM_READER_H_
+#define CONVERTER_RECORD_STREAM_READER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/disallow_copy_and_assign.h"
+#include "base/etw_types.h"
+#include "converter/etl_reader.h"
+
+namespace converter {
+
+class RecordStreamReader {
+ public:
+  RecordStreamReader();
+  ~RecordStreamReader();
+
+  // The magic number at the start of a record stream, with the version of
+  // its format.
+  static const char kStreamMagic[8];
+
+  // The smallest frame holds the context and the header of an event. The
+  // largest frame holds extended data items and a payload of up to 64 KiB
+  // each: larger frames are corrupted.
+  static const size_t kMinimalFrameSize;
+  static const size_t kMaximalFrameSize;
+
+  // Open a record stream and check its magic number.
+  // @param source "-" for the standard input, "unix:<path>" to connect to
+  //     a Unix socket, or the path of a recorded stream file.
+  // @returns true on success, false if the stream cannot be opened or is
+  //     not a record stream.
+  bool Open(const std::wstring& source);
+
+  // Close the stream.
+  void Close();
+
+  // Decode the next event of the stream, waiting for it to arrive. The
+  // decoded record stays valid until the next call to ReadNextEvent.
+  // @param record receives the decoded event.
+  // @returns true when an event was decoded, false at the end of the stream
+  //     or when a frame is invalid.
+  bool ReadNextEvent(EVENT_RECORD* record);
+
+  // @returns true when the stream ended in the middle of a frame.
+  bool truncated() const { return truncated_; }
+
+  // @returns true when an invalid frame ended the stream.
+  bool corrupted() const { return corrupted_; }
+
+  // @returns the number of events skipped because their frame is too small
+  //     to hold their header, their extended data is truncated, or their
+  //     payload is larger than 64 KiB.
+  size_t unsupported_events() const { return unsupported_events_; }
+
+ private:
+  // Read bytes from the stream, waiting for them to arrive.
+  // @param data receives the bytes.
+  // @param size the number of bytes to read.
+  // @returns the number of bytes read, less than |size| at the end of the
+  //     stream.
+  size_t Read(uint8_t* data, size_t size);
+
+  // The descriptor of the stream, and whether it is closed with the reader.
+  int fd_;
+  bool owned_;
+
+  // The bytes of the last frame read.
+  std::vector<uint8_t> frame_;
+
+  // Decodes the events of the frames.
+  ETLBufferReader decoder_;
+
+  bool truncated_;
+  bool corrupted_;
+  size_t unsupported_events_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordStreamReader);
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_RECORD_STREAM_READER_H_
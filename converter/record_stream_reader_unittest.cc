@@ -0,0 +1,379 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "converter/record_stream_reader.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "base/file_util.h"
+#include "base/unittest.h"
+#include "converter/record_stream_writer.h"
+
+namespace converter {
+
+namespace {
+
+const GUID kProvider = {
+    0x0A1B2C3D, 0x1111, 0x2222, { 1, 2, 3, 4, 5, 6, 7, 8 } };
+
+// The extended data type of a process start key.
+const uint16_t kProcessStartKey = 0x000D;
+const uint16_t kStackTrace64 = 0x0006;
+
+// An event to record, with the storage of its extended data and payload.
+class Event {
+ public:
+  Event(uint16_t id, int64_t timestamp, uint8_t processor,
+        const std::string& payload)
+      : payload_(payload) {
+    ::memset(&record_, 0, sizeof(record_));
+    EVENT_HEADER& header = record_.EventHeader;
+    header.Size = sizeof(header);
+    header.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+    header.ThreadId = 100 + id;
+    header.ProcessId = 200 + id;
+    header.TimeStamp.QuadPart = timestamp;
+    header.ProviderId = kProvider;
+    header.EventDescriptor.Id = id;
+    header.EventDescriptor.Version = 1;
+    record_.BufferContext.ProcessorNumber = processor;
+    record_.BufferContext.LoggerId = 7;
+  }
+
+  // Add an extended data item.
+  Event& AddItem(uint16_t type, const std::string& data) {
+    items_data_.push_back(data);
+    EVENT_HEADER_EXTENDED_DATA_ITEM item;
+    ::memset(&item, 0, sizeof(item));
+    item.ExtType = type;
+    item.DataSize = static_cast<uint16_t>(data.size());
+    items_.push_back(item);
+    return *this;
+  }
+
+  // @returns the record of the event, pointing to its storage.
+  const EVENT_RECORD& record() {
+    for (size_t i = 0; i < items_.size(); ++i)
+      items_[i].DataPtr = reinterpret_cast<uintptr_t>(items_data_[i].data());
+    record_.ExtendedDataCount = static_cast<uint16_t>(items_.size());
+    record_.ExtendedData = items_.empty() ? NULL : &items_[0];
+    record_.UserDataLength = static_cast<uint16_t>(payload_.size());
+    record_.UserData = const_cast<char*>(payload_.data());
+    return record_;
+  }
+
+  // @returns the frame of the event.
+  std::string Frame() {
+    std::string frame;
+    RecordStreamWriter::EncodeFrame(record(), &frame);
+    return frame;
+  }
+
+  // Check that a record decoded by the reader matches the event.
+  void ExpectDecoded(const EVENT_RECORD& decoded) {
+    const EVENT_RECORD& expected = record();
+    const EVENT_HEADER& header = decoded.EventHeader;
+    EXPECT_TRUE(IsEqualGUID(kProvider, header.ProviderId));
+    EXPECT_EQ(expected.EventHeader.EventDescriptor.Id,
+              header.EventDescriptor.Id);
+    EXPECT_EQ(expected.EventHeader.ThreadId, header.ThreadId);
+    EXPECT_EQ(expected.EventHeader.ProcessId, header.ProcessId);
+    EXPECT_EQ(expected.EventHeader.TimeStamp.QuadPart,
+              header.TimeStamp.QuadPart);
+    EXPECT_EQ(items_.empty() ? 0 : EVENT_HEADER_FLAG_EXTENDED_INFO,
+              header.Flags & EVENT_HEADER_FLAG_EXTENDED_INFO);
+    EXPECT_EQ(EVENT_HEADER_FLAG_64_BIT_HEADER,
+              header.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER);
+    EXPECT_EQ(expected.BufferContext.ProcessorNumber,
+              decoded.BufferContext.ProcessorNumber);
+    EXPECT_EQ(expected.BufferContext.LoggerId,
+              decoded.BufferContext.LoggerId);
+
+    ASSERT_EQ(items_.size(), decoded.ExtendedDataCount);
+    for (size_t i = 0; i < items_.size(); ++i) {
+      const EVENT_HEADER_EXTENDED_DATA_ITEM& item = decoded.ExtendedData[i];
+      EXPECT_EQ(items_[i].ExtType, item.ExtType);
+      EXPECT_EQ(items_data_[i],
+                std::string(reinterpret_cast<const char*>(
+                                static_cast<uintptr_t>(item.DataPtr)),
+                            item.DataSize));
+    }
+
+    EXPECT_EQ(payload_,
+              std::string(static_cast<const char*>(decoded.UserData),
+                          decoded.UserDataLength));
+  }
+
+ private:
+  EVENT_RECORD record_;
+  std::vector<EVENT_HEADER_EXTENDED_DATA_ITEM> items_;
+  std::vector<std::string> items_data_;
+  std::string payload_;
+};
+
+std::string Magic() {
+  return std::string(RecordStreamReader::kStreamMagic,
+                     sizeof(RecordStreamReader::kStreamMagic));
+}
+
+// A frame of a given size, made of zeros.
+std::string FrameOfSize(uint32_t size) {
+  std::string frame(reinterpret_cast<const char*>(&size), sizeof(size));
+  frame.append(size, '\0');
+  return frame;
+}
+
+// Resize a frame, and update its size.
+std::string ResizeFrame(const std::string& frame, uint32_t size) {
+  std::string resized = frame;
+  resized.resize(sizeof(size) + size);
+  ::memcpy(&resized[0], &size, sizeof(size));
+  return resized;
+}
+
+// A record stream file, removed with the object.
+class StreamFile {
+ public:
+  explicit StreamFile(const std::string& content)
+      : path_(base::WriteTestFile(L"record_stream_reader_unittest.bin",
+                                  content)) {
+  }
+
+  ~StreamFile() {
+    if (!path_.empty())
+      base::RemoveFile(path_);
+  }
+
+  const std::wstring& path() const { return path_; }
+
+ private:
+  std::wstring path_;
+};
+
+}  // namespace
+
+TEST(RecordStreamReaderTest, ReplayRecordedEvents) {
+  Event first(1, 130000000000000000LL, 0, "first payload");
+  Event second(2, 130000000000000100LL, 3, "");
+  second.AddItem(kProcessStartKey, std::string("\x01\x02\x03\x04", 4));
+  second.AddItem(kStackTrace64, std::string(20, 'x'));
+  Event third(3, 130000000000000200LL, 1, std::string(0xFFFF, 'p'));
+  third.AddItem(kProcessStartKey, std::string(8, 'k'));
+
+  std::wstring path = L"record_stream_reader_unittest.bin";
+  {
+    RecordStreamWriter writer;
+    ASSERT_TRUE(writer.Open(path));
+    EXPECT_TRUE(writer.WriteEvent(first.record()));
+    EXPECT_TRUE(writer.WriteEvent(second.record()));
+    EXPECT_TRUE(writer.WriteEvent(third.record()));
+    EXPECT_EQ(3U, writer.events());
+    EXPECT_TRUE(writer.Close());
+  }
+
+  RecordStreamReader reader;
+  ASSERT_TRUE(reader.Open(path));
+  EVENT_RECORD record;
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  first.ExpectDecoded(record);
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  second.ExpectDecoded(record);
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  third.ExpectDecoded(record);
+
+  // The stream ends cleanly between two frames.
+  EXPECT_FALSE(reader.ReadNextEvent(&record));
+  EXPECT_FALSE(reader.truncated());
+  EXPECT_FALSE(reader.corrupted());
+  EXPECT_EQ(0U, reader.unsupported_events());
+  reader.Close();
+
+  base::RemoveFile(path);
+}
+
+TEST(RecordStreamReaderTest, EmptyStream) {
+  StreamFile file(Magic());
+  RecordStreamReader reader;
+  ASSERT_TRUE(reader.Open(file.path()));
+  EVENT_RECORD record;
+  EXPECT_FALSE(reader.ReadNextEvent(&record));
+  EXPECT_FALSE(reader.truncated());
+  EXPECT_FALSE(reader.corrupted());
+}
+
+TEST(RecordStreamReaderTest, InvalidMagic) {
+  std::string magic = Magic();
+  magic[7] = '2';
+  Event event(1, 0, 0, "payload");
+  StreamFile file(magic + event.Frame());
+  RecordStreamReader reader;
+  EXPECT_FALSE(reader.Open(file.path()));
+
+  StreamFile short_file(Magic().substr(0, 5));
+  EXPECT_FALSE(reader.Open(short_file.path()));
+
+  EXPECT_FALSE(reader.Open(L"record_stream_reader_unittest.missing"));
+}
+
+TEST(RecordStreamReaderTest, TruncatedSize) {
+  Event event(1, 0, 0, "payload");
+  StreamFile file(Magic() + event.Frame() + event.Frame().substr(0, 3));
+  RecordStreamReader reader;
+  ASSERT_TRUE(reader.Open(file.path()));
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  event.ExpectDecoded(record);
+  EXPECT_FALSE(reader.ReadNextEvent(&record));
+  EXPECT_TRUE(reader.truncated());
+  EXPECT_FALSE(reader.corrupted());
+}
+
+TEST(RecordStreamReaderTest, TruncatedFrame) {
+  Event event(1, 0, 0, "payload");
+  std::string frame = event.Frame();
+  StreamFile file(Magic() + frame + frame.substr(0, frame.size() - 1));
+  RecordStreamReader reader;
+  ASSERT_TRUE(reader.Open(file.path()));
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  EXPECT_FALSE(reader.ReadNextEvent(&record));
+  EXPECT_TRUE(reader.truncated());
+  EXPECT_FALSE(reader.corrupted());
+}
+
+TEST(RecordStreamReaderTest, OversizedFrame) {
+  Event event(1, 0, 0, "payload");
+  uint32_t size =
+      static_cast<uint32_t>(RecordStreamReader::kMaximalFrameSize + 1);
+  StreamFile file(Magic() + event.Frame() + FrameOfSize(size) +
+                  event.Frame());
+  RecordStreamReader reader;
+  ASSERT_TRUE(reader.Open(file.path()));
+
+  // The stream ends at the oversized frame.
+  EVENT_RECORD record;
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  EXPECT_FALSE(reader.ReadNextEvent(&record));
+  EXPECT_TRUE(reader.corrupted());
+  EXPECT_FALSE(reader.truncated());
+}
+
+TEST(RecordStreamReaderTest, MaximalFrame) {
+  // A frame of the maximal size is read, but its payload does not fit in a
+  // record: the event is skipped.
+  Event event(1, 0, 0, "payload");
+  std::string large = ResizeFrame(
+      event.Frame(),
+      static_cast<uint32_t>(RecordStreamReader::kMaximalFrameSize));
+  Event next(2, 0, 0, "next");
+  StreamFile file(Magic() + large + next.Frame());
+  RecordStreamReader reader;
+  ASSERT_TRUE(reader.Open(file.path()));
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  next.ExpectDecoded(record);
+  EXPECT_EQ(1U, reader.unsupported_events());
+  EXPECT_FALSE(reader.ReadNextEvent(&record));
+  EXPECT_FALSE(reader.corrupted());
+  EXPECT_FALSE(reader.truncated());
+}
+
+TEST(RecordStreamReaderTest, UndersizedFrame) {
+  // Frames too small to hold a header are skipped.
+  uint32_t size =
+      static_cast<uint32_t>(RecordStreamReader::kMinimalFrameSize - 1);
+  Event event(1, 0, 0, "payload");
+  StreamFile file(Magic() + FrameOfSize(0) + FrameOfSize(size) +
+                  event.Frame());
+  RecordStreamReader reader;
+  ASSERT_TRUE(reader.Open(file.path()));
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  event.ExpectDecoded(record);
+  EXPECT_EQ(2U, reader.unsupported_events());
+  EXPECT_FALSE(reader.ReadNextEvent(&record));
+  EXPECT_FALSE(reader.truncated());
+}
+
+TEST(RecordStreamReaderTest, MinimalFrame) {
+  // A frame holding only the context and the header has no payload.
+  Event event(1, 0, 0, "");
+  std::string frame = event.Frame();
+  EXPECT_EQ(sizeof(uint32_t) + RecordStreamReader::kMinimalFrameSize,
+            frame.size());
+  StreamFile file(Magic() + frame);
+  RecordStreamReader reader;
+  ASSERT_TRUE(reader.Open(file.path()));
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  event.ExpectDecoded(record);
+  EXPECT_EQ(0U, reader.unsupported_events());
+}
+
+TEST(RecordStreamReaderTest, TruncatedExtendedData) {
+  // The header announces extended data items missing from the frame.
+  Event event(1, 0, 0, "");
+  event.AddItem(kProcessStartKey, std::string(8, 'k'));
+  std::string truncated = ResizeFrame(
+      event.Frame(),
+      static_cast<uint32_t>(RecordStreamReader::kMinimalFrameSize + 4));
+  Event next(2, 0, 0, "next");
+  StreamFile file(Magic() + truncated + next.Frame());
+  RecordStreamReader reader;
+  ASSERT_TRUE(reader.Open(file.path()));
+
+  EVENT_RECORD record;
+  ASSERT_TRUE(reader.ReadNextEvent(&record));
+  next.ExpectDecoded(record);
+  EXPECT_EQ(1U, reader.unsupported_events());
+}
+
+TEST(RecordStreamWriterTest, OversizedEvent) {
+  // The extended data items of an event do not fit in a frame.
+  Event event(1, 0, 0, "payload");
+  for (size_t i = 0; i < 20; ++i)
+    event.AddItem(kStackTrace64, std::string(0xFFF8, 's'));
+  std::string frame;
+  EXPECT_FALSE(RecordStreamWriter::EncodeFrame(event.record(), &frame));
+
+  // The stream misses the event: closing it fails.
+  std::wstring path = L"record_stream_reader_unittest.bin";
+  RecordStreamWriter writer;
+  ASSERT_TRUE(writer.Open(path));
+  EXPECT_FALSE(writer.WriteEvent(event.record()));
+  EXPECT_EQ(0U, writer.events());
+  EXPECT_FALSE(writer.Close());
+  base::RemoveFile(path);
+}
+
+}  // namespace converter
@@ -0,0 +1,148 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/record_stream_writer.h"
+
+#include <cassert>
+
+#include "base/binary_codec.h"
+#include "converter/record_stream_reader.h"
+
+#if !defined(_WIN32)
+#include "base/file_util.h"
+#endif
+
+namespace converter {
+
+namespace {
+
+// The extended data items and the payload are aligned on 8 bytes from the
+// start of the header, which follows the size and the context of the frame.
+const size_t kItemAlignment = 8;
+
+}  // namespace
+
+RecordStreamWriter::RecordStreamWriter() : events_(0) {
+}
+
+RecordStreamWriter::~RecordStreamWriter() {
+  Close();
+}
+
+bool RecordStreamWriter::Open(const std::wstring& path) {
+  Close();
+
+#if defined(_WIN32)
+  const std::wstring& native_path = path;
+#else
+  std::string native_path = base::NarrowNativePath(path);
+#endif
+
+  stream_.clear();
+  stream_.open(native_path.c_str(),
+      std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+  if (!stream_.is_open())
+    return false;
+
+  events_ = 0;
+  stream_.write(RecordStreamReader::kStreamMagic,
+                sizeof(RecordStreamReader::kStreamMagic));
+  return !stream_.fail();
+}
+
+bool RecordStreamWriter::Close() {
+  if (!stream_.is_open())
+    return true;
+  stream_.close();
+  return !stream_.fail();
+}
+
+bool RecordStreamWriter::WriteEvent(const EVENT_RECORD& record) {
+  if (!stream_.is_open())
+    return false;
+
+  // The stream misses an event: closing it reports the failure.
+  if (!EncodeFrame(record, &frame_)) {
+    stream_.setstate(std::ofstream::failbit);
+    return false;
+  }
+
+  stream_.write(frame_.data(), frame_.size());
+  if (stream_.fail())
+    return false;
+
+  ++events_;
+  return true;
+}
+
+bool RecordStreamWriter::EncodeFrame(const EVENT_RECORD& record,
+                                     std::string* frame) {
+  assert(frame != NULL);
+  assert(record.ExtendedDataCount == 0 || record.ExtendedData != NULL);
+
+  frame->clear();
+
+  // The size is known once the frame is encoded.
+  base::EncodeValue(static_cast<uint32_t>(0), frame);
+  base::EncodeValue(record.BufferContext, frame);
+
+  // The flags of the header tell whether extended data items follow.
+  EVENT_HEADER header = record.EventHeader;
+  if (record.ExtendedDataCount != 0)
+    header.Flags |= EVENT_HEADER_FLAG_EXTENDED_INFO;
+  else
+    header.Flags &= ~EVENT_HEADER_FLAG_EXTENDED_INFO;
+  base::EncodeValue(header, frame);
+
+  for (uint16_t i = 0; i < record.ExtendedDataCount; ++i) {
+    const EVENT_HEADER_EXTENDED_DATA_ITEM& item = record.ExtendedData[i];
+    uint16_t linkage = i + 1 < record.ExtendedDataCount ? 1 : 0;
+    base::EncodeValue(static_cast<uint16_t>(0), frame);
+    base::EncodeValue(item.ExtType, frame);
+    base::EncodeValue(linkage, frame);
+    base::EncodeValue(item.DataSize, frame);
+    frame->append(
+        reinterpret_cast<const char*>(static_cast<uintptr_t>(item.DataPtr)),
+        item.DataSize);
+    frame->resize((frame->size() + kItemAlignment - 1) &
+                  ~(kItemAlignment - 1));
+  }
+
+  if (record.UserDataLength != 0) {
+    frame->append(static_cast<const char*>(record.UserData),
+                  record.UserDataLength);
+  }
+
+  size_t size = frame->size() - sizeof(uint32_t);
+  if (size > RecordStreamReader::kMaximalFrameSize)
+    return false;
+
+  uint32_t value = static_cast<uint32_t>(size);
+  frame->replace(0, sizeof(value), reinterpret_cast<const char*>(&value),
+                 sizeof(value));
+  return true;
+}
+
+}  // namespace converter
@@ -0,0 +1,84 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//
+// Writer of a stream of framed event records, in the format decoded by
+// RecordStreamReader. It records the events of a conversion in a file, to
+// replay them later as a record stream.
+
+#ifndef CONVERTER_RECORD_STREAM_WRITER_H_
+#define CONVERTER_RECORD_STREAM_WRITER_H_
+
+#include <fstream>
+#include <string>
+
+#include "base/disallow_copy_and_assign.h"
+#include "base/etw_types.h"
+
+namespace converter {
+
+class RecordStreamWriter {
+ public:
+  RecordStreamWriter();
+  ~RecordStreamWriter();
+
+  // Create a record stream file and write its magic number.
+  // @param path the path of the file, replaced when it exists.
+  // @returns true on success, false if the file cannot be created.
+  bool Open(const std::wstring& path);
+
+  // Close the file.
+  // @returns true when all the events were written.
+  bool Close();
+
+  // Append the frame of an event to the stream.
+  // @param record the event to write.
+  // @returns true on success, false if the event does not fit in a frame or
+  //     cannot be written.
+  bool WriteEvent(const EVENT_RECORD& record);
+
+  // Encode the frame of an event, with its size.
+  // @param record the event to encode.
+  // @param frame receives the bytes of the frame.
+  // @returns true on success, false if the event does not fit in a frame.
+  static bool EncodeFrame(const EVENT_RECORD& record, std::string* frame);
+
+  // @returns the number of events written.
+  size_t events() const { return events_; }
+
+ private:
+  std::ofstream stream_;
+
+  // The bytes of the last frame encoded.
+  std::string frame_;
+
+  size_t events_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordStreamWriter);
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_RECORD_STREAM_WRITER_H_
@@ -0,0 +1,186 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/tdh_schema_source.h"
+
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include "converter/unicode.h"
+
+namespace converter {
+
+#if defined(_WIN32)
+
+bool TdhSchemaSource::GetEventSchema(const EVENT_RECORD& record,
+                                     EventSchema* schema) {
+  assert(schema != NULL);
+
+  PEVENT_RECORD pevent = const_cast<PEVENT_RECORD>(&record);
+
+  // Decode the metadata via trace data helper (TDH) using
+  // TdhGetEventInformation.
+  if (event_info_buffer_.empty())
+    event_info_buffer_.resize(64*1024);
+  DWORD buffer_size = event_info_buffer_.size();
+  PTRACE_EVENT_INFO pinfo =
+      reinterpret_cast<PTRACE_EVENT_INFO>(&event_info_buffer_[0]);
+
+  DWORD status = TdhGetEventInformation(pevent, 0, NULL, pinfo, &buffer_size);
+  if (status == ERROR_INSUFFICIENT_BUFFER) {
+    // The internal buffer is too small, resize it and try again.
+    event_info_buffer_.resize(buffer_size);
+    pinfo = reinterpret_cast<PTRACE_EVENT_INFO>(&event_info_buffer_[0]);
+    status = TdhGetEventInformation(pevent, 0, NULL, pinfo, &buffer_size);
+  }
+
+  if (status != ERROR_SUCCESS)
+    return false;
+
+  // Filter the decoding source we don't know how to handle.
+  if (pinfo->DecodingSource != DecodingSourceWbem &&
+      pinfo->DecodingSource != DecodingSourceXMLFile) {
+    return false;
+  }
+
+  // Keep a raw byte pointer to ease indirection through pinfo.
+  PBYTE raw_info = reinterpret_cast<PBYTE>(pinfo);
+
+  schema->event_guid = pinfo->EventGuid;
+
+  // Retrieve event opcode name.
+  schema->name.clear();
+  if (pinfo->OpcodeNameOffset > 0) {
+    size_t name_offset = pinfo->OpcodeNameOffset;
+    const uint16_t* opcode_ptr =
+        reinterpret_cast<const uint16_t*>(&raw_info[name_offset]);
+    ConvertUTF16ToUTF8(opcode_ptr, &schema->name);
+  }
+
+  // Retrieve the top-level properties.
+  schema->properties.resize(pinfo->TopLevelPropertyCount);
+  for (size_t i = 0; i < pinfo->TopLevelPropertyCount; ++i) {
+    const EVENT_PROPERTY_INFO& field = pinfo->EventPropertyInfoArray[i];
+    EventSchema::Property& property = schema->properties[i];
+
+    // Retrieve property name.
+    assert(field.NameOffset != 0);
+    size_t name_offset = field.NameOffset;
+    LPWSTR name_ptr = reinterpret_cast<LPWSTR>(&raw_info[name_offset]);
+    property.source_name = name_ptr;
+    ConvertUTF16ToUTF8(reinterpret_cast<const uint16_t*>(name_ptr),
+                       &property.name);
+
+    property.in_type = field.nonStructType.InType;
+    property.out_type = field.nonStructType.OutType;
+    property.flags = field.Flags;
+
+    // The count and the length share their storage with the index of the
+    // property holding them.
+    property.count = 0;
+    property.count_property = 0;
+    if ((field.Flags & PropertyParamCount) != 0)
+      property.count_property = field.countPropertyIndex;
+    else
+      property.count = field.count;
+
+    property.length = 0;
+    property.length_property = 0;
+    if ((field.Flags & PropertyParamLength) != 0)
+      property.length_property = field.lengthPropertyIndex;
+    else
+      property.length = field.length;
+  }
+
+  return true;
+}
+
+bool TdhSchemaSource::GetPropertyData(const EVENT_RECORD& record,
+                                      const EventSchema::Property& property,
+                                      size_t element,
+                                      std::vector<char>* buffer,
+                                      size_t* size) {
+  assert(buffer != NULL);
+  assert(size != NULL);
+
+  PEVENT_RECORD pevent = const_cast<PEVENT_RECORD>(&record);
+
+  // Descriptor used to fetch properties information.
+  PROPERTY_DATA_DESCRIPTOR data_descriptor;
+  data_descriptor.PropertyName =
+      reinterpret_cast<ULONGLONG>(property.source_name.c_str());
+  data_descriptor.ArrayIndex = static_cast<ULONG>(element);
+  data_descriptor.Reserved = 0;
+
+  // Determine the property size.
+  ULONG property_size = 0;
+  ULONG status = TdhGetPropertySize(pevent, 0, NULL, 1, &data_descriptor,
+                                    &property_size);
+  if (status != ERROR_SUCCESS)
+    return false;
+
+  // Get a buffer large enough to hold the property and a null terminator.
+  size_t needed = property_size + sizeof(wchar_t);
+  if (buffer->size() < needed)
+    buffer->resize(needed);
+  ::memset(&(*buffer)[0], 0, needed);
+  PBYTE raw_data = reinterpret_cast<PBYTE>(&(*buffer)[0]);
+
+  // Retrieve the property.
+  status = TdhGetProperty(pevent, 0, NULL, 1, &data_descriptor,
+                          property_size, raw_data);
+  if (status != ERROR_SUCCESS)
+    return false;
+
+  *size = property_size;
+  return true;
+}
+
+#else  // defined(_WIN32)
+
+// The Trace Data Helper is only available on Windows. Without schemas, the
+// payloads of the events are sent raw.
+
+bool TdhSchemaSource::GetEventSchema(const EVENT_RECORD& /* record */,
+                                     EventSchema* schema) {
+  assert(schema != NULL);
+  return false;
+}
+
+bool TdhSchemaSource::GetPropertyData(
+    const EVENT_RECORD& /* record */,
+    const EventSchema::Property& /* property */,
+    size_t /* element */,
+    std::vector<char>* buffer,
+    size_t* size) {
+  assert(buffer != NULL);
+  assert(size != NULL);
+  return false;
+}
+
+#endif  // defined(_WIN32)
+
+}  // namespace converter
@@ -0,0 +1,65 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// A schema source using the Trace Data Helper (TDH) API to retrieve the
+// schema of events and the value of their properties. TDH is only available
+// on Windows: on other platforms, no schema is found.
+
+#ifndef CONVERTER_TDH_SCHEMA_SOURCE_H_
+#define CONVERTER_TDH_SCHEMA_SOURCE_H_
+
+#include <vector>
+
+#include "converter/event_schema.h"
+#include "base/disallow_copy_and_assign.h"
+#include "base/etw_types.h"
+
+namespace converter {
+
+class TdhSchemaSource : public SchemaSource {
+ public:
+  TdhSchemaSource() {}
+
+  // @name SchemaSource implementation.
+  // @{
+  virtual bool GetEventSchema(const EVENT_RECORD& record,
+                              EventSchema* schema);
+  virtual bool GetPropertyData(const EVENT_RECORD& record,
+                               const EventSchema::Property& property,
+                               size_t element,
+                               std::vector<char>* buffer,
+                               size_t* size);
+  // @}
+
+ private:
+  // Temporary buffer used to hold the event information produced by TDH.
+  std::vector<char> event_info_buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(TdhSchemaSource);
+};
+
+}  // namespace converter
+
+#endif  // CONVERTER_TDH_SCHEMA_SOURCE_H_
@@ -0,0 +1,178 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "converter/unicode.h"
+
+#include <cassert>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CONVERTER_UNICODE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace converter {
+
+namespace {
+
+const uint32_t kReplacementCharacter = 0xFFFD;
+
+// Read a little-endian code unit.
+uint32_t LoadUnit(const uint8_t* data) {
+  return data[0] | (static_cast<uint32_t>(data[1]) << 8);
+}
+
+bool IsHighSurrogate(uint32_t unit) {
+  return unit >= 0xD800 && unit <= 0xDBFF;
+}
+
+bool IsLowSurrogate(uint32_t unit) {
+  return unit >= 0xDC00 && unit <= 0xDFFF;
+}
+
+// Convert the leading ASCII characters of a string.
+// @param in the code units to convert.
+// @param length the number of code units.
+// @param out receives the converted characters.
+// @returns the number of converted characters.
+size_t ConvertASCII(const uint8_t* in, size_t length, uint8_t* out) {
+  size_t i = 0;
+
+#if defined(CONVERTER_UNICODE_SSE2)
+  // Convert 8 code units at a time. A code unit is ASCII when its 9 upper
+  // bits are cleared.
+  const __m128i kNonASCIIMask = _mm_set1_epi16(static_cast<int16_t>(0xFF80));
+  const __m128i kZero = _mm_setzero_si128();
+  for (; i + 8 <= length; i += 8) {
+    __m128i units =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(&in[2 * i]));
+    __m128i non_ascii = _mm_and_si128(units, kNonASCIIMask);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(non_ascii, kZero)) != 0xFFFF)
+      break;
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(&out[i]),
+                     _mm_packus_epi16(units, units));
+  }
+#else
+  // Convert 4 code units at a time.
+  for (; i + 4 <= length; i += 4) {
+    const uint8_t* units = &in[2 * i];
+    if (((units[0] | units[2] | units[4] | units[6]) & 0x80) != 0 ||
+        (units[1] | units[3] | units[5] | units[7]) != 0) {
+      break;
+    }
+    out[i] = units[0];
+    out[i + 1] = units[2];
+    out[i + 2] = units[4];
+    out[i + 3] = units[6];
+  }
+#endif
+
+  // Convert the remaining ASCII code units one at a time.
+  for (; i < length; ++i) {
+    uint32_t unit = LoadUnit(&in[2 * i]);
+    if (unit >= 0x80)
+      break;
+    out[i] = static_cast<uint8_t>(unit);
+  }
+
+  return i;
+}
+
+}  // namespace
+
+size_t GetUTF16Length(const uint16_t* str, size_t max_length) {
+  assert(str != NULL || max_length == 0);
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(str);
+  for (size_t i = 0; i < max_length; ++i) {
+    if (in[2 * i] == 0 && in[2 * i + 1] == 0)
+      return i;
+  }
+  return max_length;
+}
+
+size_t ConvertUTF16ToUTF8(const uint16_t* str, size_t length, uint8_t* out) {
+  assert(str != NULL || length == 0);
+  assert(out != NULL || length == 0);
+
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(str);
+  uint8_t* begin = out;
+
+  size_t i = 0;
+  while (i < length) {
+    // Fast path for runs of ASCII characters.
+    size_t converted = ConvertASCII(&in[2 * i], length - i, out);
+    i += converted;
+    out += converted;
+    if (i == length)
+      break;
+
+    // Decode a code point.
+    uint32_t code_point = LoadUnit(&in[2 * i]);
+    ++i;
+    if (IsHighSurrogate(code_point) && i < length &&
+        IsLowSurrogate(LoadUnit(&in[2 * i]))) {
+      uint32_t low = LoadUnit(&in[2 * i]);
+      ++i;
+      code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+    } else if (IsHighSurrogate(code_point) || IsLowSurrogate(code_point)) {
+      code_point = kReplacementCharacter;
+    }
+
+    // Encode the code point.
+    if (code_point < 0x80) {
+      *out++ = static_cast<uint8_t>(code_point);
+    } else if (code_point < 0x800) {
+      *out++ = static_cast<uint8_t>(0xC0 | (code_point >> 6));
+      *out++ = static_cast<uint8_t>(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+      *out++ = static_cast<uint8_t>(0xE0 | (code_point >> 12));
+      *out++ = static_cast<uint8_t>(0x80 | ((code_point >> 6) & 0x3F));
+      *out++ = static_cast<uint8_t>(0x80 | (code_point & 0x3F));
+    } else {
+      *out++ = static_cast<uint8_t>(0xF0 | (code_point >> 18));
+      *out++ = static_cast<uint8_t>(0x80 | ((code_point >> 12) & 0x3F));
+      *out++ = static_cast<uint8_t>(0x80 | ((code_point >> 6) & 0x3F));
+      *out++ = static_cast<uint8_t>(0x80 | (code_point & 0x3F));
+    }
+  }
+
+  return out - begin;
+}
+
+void ConvertUTF16ToUTF8(const uint16_t* str, std::string* out) {
+  assert(str != NULL);
+  assert(out != NULL);
+
+  size_t length = GetUTF16Length(str, SIZE_MAX);
+  out->resize(GetMaxUTF8Length(length));
+  if (length == 0)
+    return;
+
+  uint8_t* raw = reinterpret_cast<uint8_t*>(&(*out)[0]);
+  out->resize(ConvertUTF16ToUTF8(str, length, raw));
+}
+
+}  // namespace converter
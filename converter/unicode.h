@@ -0,0 +1,69 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Conversion of the UTF-16 strings found in ETW events to the UTF-8 strings
+// of CTF streams. The conversion writes in a caller-provided buffer and never
+// allocates. Runs of ASCII characters are converted several characters at a
+// time. Unpaired surrogates are replaced by U+FFFD.
+//
+// UTF-16 strings are read as little-endian code units and don't need to be
+// aligned.
+
+#ifndef CONVERTER_UNICODE_H_
+#define CONVERTER_UNICODE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace converter {
+
+// Determine the length of a null-terminated UTF-16 string.
+// @param str the string.
+// @param max_length the maximal number of code units to scan.
+// @returns the number of code units before the terminal '\0', or
+//     |max_length| when there is no terminal '\0'.
+size_t GetUTF16Length(const uint16_t* str, size_t max_length);
+
+// @param length a number of UTF-16 code units.
+// @returns the maximal size of their UTF-8 conversion, in bytes.
+inline size_t GetMaxUTF8Length(size_t length) { return length * 3; }
+
+// Convert a UTF-16 string to UTF-8.
+// @param str the code units to convert.
+// @param length the number of code units to convert.
+// @param out receives the UTF-8 bytes. Must hold at least
+//     GetMaxUTF8Length(length) bytes.
+// @returns the number of bytes written to |out|.
+size_t ConvertUTF16ToUTF8(const uint16_t* str, size_t length, uint8_t* out);
+
+// Convert a null-terminated UTF-16 string to UTF-8.
+// @param str the string to convert.
+// @param out receives the UTF-8 string.
+void ConvertUTF16ToUTF8(const uint16_t* str, std::string* out);
+
+}  // namespace converter
+
+#endif  // CONVERTER_UNICODE_H_
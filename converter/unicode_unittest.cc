@@ -0,0 +1,223 @@
+// Copyright (c) 2013 The ETW2CTF Authors.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of the <organization> nor the
+//     names of its contributors may be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "converter/unicode.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "base/unittest.h"
+
+namespace converter {
+
+namespace {
+
+// Value of the bytes of the output buffers not written by a conversion.
+const uint8_t kGuard = 0xAB;
+
+// Convert code units with the buffer interface.
+// @param units the code units to convert.
+// @param misalign whether the code units are read at an odd address.
+// @returns the UTF-8 bytes, or "overflow" when the conversion wrote past
+//     GetMaxUTF8Length.
+std::string Convert(const std::vector<uint16_t>& units, bool misalign) {
+  size_t length = units.size();
+  std::vector<uint8_t> in(2 * length + 1);
+  if (length != 0)
+    ::memcpy(&in[misalign ? 1 : 0], &units[0], 2 * length);
+  const uint16_t* str =
+      reinterpret_cast<const uint16_t*>(&in[misalign ? 1 : 0]);
+
+  size_t max_length = GetMaxUTF8Length(length);
+  std::vector<uint8_t> out(max_length + 16, kGuard);
+  size_t written = ConvertUTF16ToUTF8(str, length, &out[0]);
+  if (written > max_length)
+    return "overflow";
+  for (size_t i = max_length; i < out.size(); ++i) {
+    if (out[i] != kGuard)
+      return "overflow";
+  }
+  return std::string(reinterpret_cast<const char*>(&out[0]), written);
+}
+
+std::string Convert(const std::vector<uint16_t>& units) {
+  return Convert(units, false);
+}
+
+// @returns the code units of a string of ASCII characters.
+std::vector<uint16_t> ASCII(const std::string& str) {
+  return std::vector<uint16_t>(str.begin(), str.end());
+}
+
+// A string of |length| ASCII characters.
+std::string MakeASCII(size_t length) {
+  std::string str;
+  for (size_t i = 0; i < length; ++i)
+    str.push_back(static_cast<char>('a' + i % 26));
+  return str;
+}
+
+}  // namespace
+
+TEST(UnicodeTest, GetUTF16Length) {
+  const uint16_t str[] = { 'a', 'b', 0, 'c' };
+  EXPECT_EQ(2U, GetUTF16Length(str, 4));
+  EXPECT_EQ(1U, GetUTF16Length(str, 1));
+  EXPECT_EQ(0U, GetUTF16Length(str, 0));
+  EXPECT_EQ(0U, GetUTF16Length(NULL, 0));
+
+  // A zero byte inside a code unit doesn't terminate the string.
+  const uint16_t high_zero[] = { 0x0100, 0x4100, 0 };
+  EXPECT_EQ(2U, GetUTF16Length(high_zero, 3));
+}
+
+TEST(UnicodeTest, ASCIIRuns) {
+  // Cover the runs shorter than, equal to and longer than the 8 code units
+  // converted at a time.
+  for (size_t length = 0; length <= 17; ++length) {
+    std::string expected = MakeASCII(length);
+    EXPECT_EQ(expected, Convert(ASCII(expected)));
+    EXPECT_EQ(expected, Convert(ASCII(expected), true));
+  }
+
+  // All ASCII characters.
+  std::string all;
+  for (int c = 1; c < 0x80; ++c)
+    all.push_back(static_cast<char>(c));
+  EXPECT_EQ(all, Convert(ASCII(all)));
+}
+
+TEST(UnicodeTest, NonASCIIAtEachPosition) {
+  // A non-ASCII character interrupts the run at each position, including
+  // inside and right after a block of 8 code units.
+  for (size_t length = 1; length <= 17; ++length) {
+    for (size_t position = 0; position < length; ++position) {
+      std::string ascii = MakeASCII(length);
+      std::vector<uint16_t> units = ASCII(ascii);
+      units[position] = 0x00E9;
+      std::string expected = ascii.substr(0, position) + "\xC3\xA9" +
+          ascii.substr(position + 1);
+      EXPECT_EQ(expected, Convert(units));
+      EXPECT_EQ(expected, Convert(units, true));
+    }
+  }
+
+  // A code unit with only its upper byte set is not ASCII.
+  std::vector<uint16_t> upper_byte = ASCII("abcdefgh");
+  upper_byte[3] = 0x0164;
+  EXPECT_EQ(std::string("abc\xC5\xA4" "efgh"), Convert(upper_byte));
+}
+
+TEST(UnicodeTest, MultiByteCodePoints) {
+  // The boundaries of the 2-byte and 3-byte sequences.
+  std::vector<uint16_t> two_bytes;
+  two_bytes.push_back(0x0080);
+  two_bytes.push_back(0x00E9);
+  two_bytes.push_back(0x07FF);
+  EXPECT_EQ(std::string("\xC2\x80\xC3\xA9\xDF\xBF"), Convert(two_bytes));
+
+  std::vector<uint16_t> three_bytes;
+  three_bytes.push_back(0x0800);
+  three_bytes.push_back(0x20AC);
+  three_bytes.push_back(0xD7FF);
+  three_bytes.push_back(0xE000);
+  three_bytes.push_back(0xFFFF);
+  EXPECT_EQ(std::string("\xE0\xA0\x80\xE2\x82\xAC\xED\x9F\xBF"
+                        "\xEE\x80\x80\xEF\xBF\xBF"),
+            Convert(three_bytes));
+
+  // Every code unit converts to 3 bytes at most.
+  std::vector<uint16_t> worst_case(17, 0x20AC);
+  EXPECT_EQ(GetMaxUTF8Length(17), Convert(worst_case).size());
+}
+
+TEST(UnicodeTest, SurrogatePairs) {
+  // U+10000, U+1F600 and U+10FFFF.
+  std::vector<uint16_t> pairs;
+  pairs.push_back(0xD800);
+  pairs.push_back(0xDC00);
+  pairs.push_back(0xD83D);
+  pairs.push_back(0xDE00);
+  pairs.push_back(0xDBFF);
+  pairs.push_back(0xDFFF);
+  EXPECT_EQ(std::string("\xF0\x90\x80\x80\xF0\x9F\x98\x80\xF4\x8F\xBF\xBF"),
+            Convert(pairs));
+  EXPECT_EQ(std::string("\xF0\x90\x80\x80\xF0\x9F\x98\x80\xF4\x8F\xBF\xBF"),
+            Convert(pairs, true));
+
+  // A pair between ASCII runs.
+  std::vector<uint16_t> mixed = ASCII("abcdefghij");
+  mixed.insert(mixed.begin() + 9, 0xDE00);
+  mixed.insert(mixed.begin() + 9, 0xD83D);
+  EXPECT_EQ(std::string("abcdefghi\xF0\x9F\x98\x80j"), Convert(mixed));
+}
+
+TEST(UnicodeTest, LoneSurrogates) {
+  const std::string kReplacement = "\xEF\xBF\xBD";
+
+  // A high surrogate at the end of the string.
+  std::vector<uint16_t> high_at_end = ASCII("abc");
+  high_at_end.push_back(0xD83D);
+  EXPECT_EQ("abc" + kReplacement, Convert(high_at_end));
+
+  // A high surrogate followed by something else than a low surrogate.
+  std::vector<uint16_t> high_then_ascii;
+  high_then_ascii.push_back(0xD83D);
+  high_then_ascii.push_back('x');
+  EXPECT_EQ(kReplacement + "x", Convert(high_then_ascii));
+
+  std::vector<uint16_t> two_highs;
+  two_highs.push_back(0xD800);
+  two_highs.push_back(0xD83D);
+  two_highs.push_back(0xDE00);
+  EXPECT_EQ(kReplacement + "\xF0\x9F\x98\x80", Convert(two_highs));
+
+  // A low surrogate without a high surrogate.
+  std::vector<uint16_t> low = ASCII("a");
+  low.push_back(0xDC00);
+  low.push_back('b');
+  EXPECT_EQ("a" + kReplacement + "b", Convert(low));
+
+  // A pair in the wrong order.
+  std::vector<uint16_t> reversed;
+  reversed.push_back(0xDE00);
+  reversed.push_back(0xD83D);
+  EXPECT_EQ(kReplacement + kReplacement, Convert(reversed));
+}
+
+TEST(UnicodeTest, ConvertToString) {
+  const uint16_t str[] = { 'a', 0x00E9, 0xD83D, 0xDE00, 0, 'b' };
+  std::string out = "previous";
+  ConvertUTF16ToUTF8(str, &out);
+  EXPECT_EQ(std::string("a\xC3\xA9\xF0\x9F\x98\x80"), out);
+
+  const uint16_t empty[] = { 0 };
+  ConvertUTF16ToUTF8(empty, &out);
+  EXPECT_TRUE(out.empty());
+}
+
+}  // namespace converter
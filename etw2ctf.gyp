@@ -29,45 +29,230 @@
   ],
   'targets': [
     {
-      'target_name': 'etw2ctf',
-      'type': 'executable',
-      'msvs_settings': {
-        'VCLinkerTool': {
-          'AdditionalDependencies': [
-            'advapi32.lib',
-            'dbghelp.lib',
-            'tdh.lib',
-          ],
-        },
-      },
+      # The converter, shared by the executable, the unit tests and the
+      # benchmarks.
+      'target_name': 'etw2ctf_lib',
+      'type': 'static_library',
       'sources': [
-        'main.cc',
+        'base/binary_codec.h',
         'base/compiler_specific.h',
         'base/disallow_copy_and_assign.h',
+        'base/etw_types.h',
+        'base/file_util.cc',
+        'base/file_util.h',
         'base/logging.h',
-        'base/scoped_handle.cc',
-        'base/scoped_handle.h',
+        'base/mapped_file.cc',
+        'base/mapped_file.h',
+        'base/output_file.cc',
+        'base/output_file.h',
+        'base/stopwatch.h',
+        'converter/checkpoint.cc',
+        'converter/checkpoint.h',
         'converter/ctf_producer.cc',
         'converter/ctf_producer.h',
+        'converter/decode_plan_cache.cc',
+        'converter/decode_plan_cache.h',
+        'converter/decode_program.cc',
+        'converter/decode_program.h',
+        'converter/etl_index.cc',
+        'converter/etl_index.h',
+        'converter/etl_reader.cc',
+        'converter/etl_reader.h',
         'converter/etw_consumer.cc',
         'converter/etw_consumer.h',
+        'converter/event_filter.cc',
+        'converter/event_filter.h',
+        'converter/event_schema.h',
         'converter/metadata.cc',
         'converter/metadata.h',
+        'converter/parallel_decoder.cc',
+        'converter/parallel_decoder.h',
+        'converter/payload_walker.cc',
+        'converter/payload_walker.h',
+        'converter/record_stream_reader.cc',
+        'converter/record_stream_reader.h',
+        'converter/record_stream_writer.cc',
+        'converter/record_stream_writer.h',
+        'converter/tdh_schema_source.cc',
+        'converter/tdh_schema_source.h',
+        'converter/unicode.cc',
+        'converter/unicode.h',
         'dissector/chrome_dissector.cc',
         'dissector/dissectors.cc',
         'dissector/dissectors.h',
         'etw_observer/etw_observer.cc',
         'etw_observer/etw_observer.h',
-        'etw_observer/etw_observer_utils.cc',
-        'etw_observer/etw_observer_utils.h',
-        'etw_observer/symbols_observer.cc',
-        'sym_util/image.cc',
-        'sym_util/image.h',
-        'sym_util/symbol_lookup_service.cc',
-        'sym_util/symbol_lookup_service.h',
       ],
+      'conditions': [
+        ['OS=="win"', {
+          'link_settings': {
+            'msvs_settings': {
+              'VCLinkerTool': {
+                'AdditionalDependencies': [
+                  'advapi32.lib',
+                  'dbghelp.lib',
+                  'tdh.lib',
+                ],
+              },
+            },
+          },
+          'sources': [
+            'base/scoped_handle.cc',
+            'base/scoped_handle.h',
+          ],
+        }],
+      ],
+    }, {
+      'target_name': 'etw2ctf',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'main.cc',
+      ],
+      'conditions': [
+        ['OS=="win"', {
+          # The symbol resolution relies on the Windows debugging tools. The
+          # observers register themselves at static initialization: they are
+          # linked in the executable, not in the library.
+          'sources': [
+            'etw_observer/etw_observer_utils.cc',
+            'etw_observer/etw_observer_utils.h',
+            'etw_observer/symbols_observer.cc',
+            'sym_util/image.cc',
+            'sym_util/image.h',
+            'sym_util/symbol_lookup_service.cc',
+            'sym_util/symbol_lookup_service.h',
+          ],
+          'dependencies': [
+            'output_dlls',
+          ],
+        }],
+      ],
+    }, {
+      'target_name': 'metadata_benchmark',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'converter/metadata_benchmark.cc',
+      ],
+    }, {
+      'target_name': 'decode_plan_cache_unittest',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'base/unittest.h',
+        'base/unittest_main.cc',
+        'converter/decode_plan_cache_unittest.cc',
+      ],
+    }, {
+      'target_name': 'decode_plan_cache_benchmark',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'converter/decode_plan_cache_benchmark.cc',
+      ],
+    }, {
+      'target_name': 'decode_program_unittest',
+      'type': 'executable',
       'dependencies': [
-        'output_dlls',
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'base/unittest.h',
+        'base/unittest_main.cc',
+        'converter/decode_program_unittest.cc',
+      ],
+    }, {
+      'target_name': 'decode_program_benchmark',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'converter/decode_program_benchmark.cc',
+      ],
+    }, {
+      'target_name': 'unicode_unittest',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'base/unittest.h',
+        'base/unittest_main.cc',
+        'converter/unicode_unittest.cc',
+      ],
+    }, {
+      'target_name': 'etl_reader_unittest',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'base/unittest.h',
+        'base/unittest_main.cc',
+        'converter/etl_reader_unittest.cc',
+      ],
+    }, {
+      'target_name': 'record_stream_reader_unittest',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'base/unittest.h',
+        'base/unittest_main.cc',
+        'converter/record_stream_reader_unittest.cc',
+      ],
+    }, {
+      'target_name': 'packet_encode_benchmark',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'converter/packet_encode_benchmark.cc',
+      ],
+    }, {
+      'target_name': 'etw_consumer_unittest',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'base/unittest.h',
+        'base/unittest_main.cc',
+        'converter/etw_consumer_unittest.cc',
+      ],
+    }, {
+      'target_name': 'event_filter_unittest',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'base/unittest.h',
+        'base/unittest_main.cc',
+        'converter/event_filter_unittest.cc',
+      ],
+    }, {
+      'target_name': 'ctf_producer_unittest',
+      'type': 'executable',
+      'dependencies': [
+        'etw2ctf_lib',
+      ],
+      'sources': [
+        'base/unittest.h',
+        'base/unittest_main.cc',
+        'converter/ctf_producer_unittest.cc',
       ],
     }, {
       # The dbghelp and symsrv DLLs distributed with ETW2CTF are needed to
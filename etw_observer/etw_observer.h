@@ -41,15 +41,14 @@
 #ifndef ETW_OBSERVER_ETW_OBSERVER_H_
 #define ETW_OBSERVER_ETW_OBSERVER_H_
 
-// Restrict the import to the Windows basic includes.
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>  // NOLINT
-#include <evntcons.h>
-#include <tdh.h>
 #include <string>
 
+#include "base/etw_types.h"
+#include "converter/event_schema.h"
+
 namespace converter {
 class ETWConsumer;
+class EventFilter;
 }  // namespace converter
 
 namespace etw_observer {
@@ -59,20 +58,44 @@ class ETWObserver {
   ETWObserver();
   virtual ~ETWObserver() {}
 
+  // Called before any event is processed, to know the events needed by the
+  // observer. The other events may then be decoded on several threads: the
+  // observed events are still processed in order, on a single thread, once
+  // decoded. Only the events converted to the CTF stream are observed then.
+  // @param filter receives the events observed.
+  // @returns true when |filter| holds the events observed, false when all the
+  //     events are observed.
+  virtual bool GetObservedEvents(converter::EventFilter* /* filter */) {
+    return false;
+  }
+
   // Called when an ETW consumer starts processing an event.
   // @param consumer the observed consumer.
   // @param pevent the ETW event that is processed.
   virtual void OnBeginProcessEvent(converter::ETWConsumer* /* consumer */,
                                    PEVENT_RECORD /* pevent */) {}
 
-  // Called when TRACE_EVENT_INFO is extracted from an event. Is only called
-  // between calls to OnBeginProcessEvent() and OnEndProcessEvent().
+  // Called when the schema of an event is retrieved, before its payload is
+  // decoded. Is only called between calls to OnBeginProcessEvent() and
+  // OnEndProcessEvent().
   // @param consumer the observed consumer.
   // @param pevent the ETW event that is processed.
-  // @param pinfo information about the event.
+  // @param schema the schema of the event.
   virtual void OnExtractEventInfo(converter::ETWConsumer* /* consumer */,
                                   PEVENT_RECORD /* pevent */,
-                                  PTRACE_EVENT_INFO /* pinfo */) {}
+                                  const converter::EventSchema& /* schema */) {}
+
+  // Called after OnExtractEventInfo(). Payloads are decoded field by field,
+  // and their fields reported through OnDecodePayloadField(), only when an
+  // observer needs them.
+  // @param consumer the observed consumer.
+  // @param pevent the ETW event that is processed.
+  // @returns true when the fields of the event must be reported, false
+  //     otherwise.
+  virtual bool ObservesPayloadFields(converter::ETWConsumer* /* consumer */,
+                                     PEVENT_RECORD /* pevent */) {
+    return false;
+  }
 
   // Called when a payload field is decoded. Is only called between calls to
   // OnBeginProcessEvent() and OnEndProcessEvent().
@@ -100,6 +123,26 @@ class ETWObserver {
   virtual void OnEndProcessEvent(converter::ETWConsumer* /* consumer */,
                                  PEVENT_RECORD /* pevent */) {}
 
+  // Called when a checkpoint of the conversion is recorded, to save the
+  // state kept by the observer from event to event. A conversion resumed
+  // from the checkpoint restores it with RestoreState(), so that its output
+  // is the same as the output of an uninterrupted conversion.
+  // @param consumer the observed consumer.
+  // @param state receives the state of the observer.
+  virtual void SaveState(const converter::ETWConsumer* /* consumer */,
+                         std::string* /* state */) {}
+
+  // Called when a conversion resumes from a checkpoint, before the first
+  // event is processed.
+  // @param consumer the observed consumer.
+  // @param state the state saved by SaveState().
+  // @returns true on success, false when the state is invalid. The state of
+  //     the observer is then left unchanged.
+  virtual bool RestoreState(converter::ETWConsumer* /* consumer */,
+                            const std::string& /* state */) {
+    return true;
+  }
+
   // @returns the next registered observer.
   ETWObserver* next() const { return next_; }
 
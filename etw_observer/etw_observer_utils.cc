@@ -27,6 +27,8 @@
 
 #include <tdh.h>
 
+#include <cstring>
+
 namespace etw_observer {
 
 bool CaptureUint32(unsigned int in_type, ULONG property_size, void* raw_data,
@@ -35,7 +37,7 @@ bool CaptureUint32(unsigned int in_type, ULONG property_size, void* raw_data,
       !(in_type == TDH_INTYPE_POINTER && property_size == 4)) {
     return false;
   }
-  *out = *reinterpret_cast<uint32_t*>(raw_data);
+  ::memcpy(out, raw_data, sizeof(*out));
   return true;
 }
 
@@ -45,7 +47,7 @@ bool CaptureUint64(unsigned int in_type, ULONG property_size, void* raw_data,
       !(in_type == TDH_INTYPE_POINTER && property_size == 8)) {
     return false;
   }
-  *out = *reinterpret_cast<uint64_t*>(raw_data);
+  ::memcpy(out, raw_data, sizeof(*out));
   return true;
 }
 
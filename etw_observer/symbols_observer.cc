@@ -35,10 +35,12 @@
 #include <set>
 #include <string>
 
+#include "base/binary_codec.h"
 #include "base/compiler_specific.h"
 #include "base/disallow_copy_and_assign.h"
 #include "base/logging.h"
 #include "converter/etw_consumer.h"
+#include "converter/event_filter.h"
 #include "converter/metadata.h"
 #include "etw_observer/etw_observer.h"
 #include "etw_observer/etw_observer_utils.h"
@@ -48,6 +50,8 @@
 namespace {
 
 using converter::ETWConsumer;
+using converter::EventFilter;
+using converter::EventSchema;
 using converter::Metadata;
 using etw_observer::CaptureLong;
 using etw_observer::CaptureUint32;
@@ -110,6 +114,9 @@ struct EnumerateSymbolsCallbackParams {
   // ETW consumer to use to send new events.
   ETWConsumer* consumer;
 
+  // Event id of the SymbolInfo events, or 0 if not yet known.
+  size_t* event_id;
+
   // Timestamp of generated events.
   uint64_t timestamp;
 };
@@ -127,37 +134,46 @@ BOOL CALLBACK EnumerateSymbolsCallback(PCWSTR SymbolName,
   ETWConsumer* consumer = params->consumer;
   assert(consumer != NULL);
 
+  assert(params->event_id != NULL);
+
   // Generate an event with the symbol information.
-  Metadata::Packet packet;
-  ETWConsumer::EncodeGeneratedEventHeader(params->timestamp,
-                                          kSymbolInfoOpcode,
-                                          kSymbolsEventVersion,
-                                          kSymbolsProviderGUID,
-                                          &packet);
-  Metadata::Event descr;
-  descr.set_info(kSymbolsEventGUID, kSymbolInfoOpcode, kSymbolsEventVersion, 0);
-  descr.set_name(kSymbolInfoEventName);
-
-  descr.AddField(Metadata::Field(Metadata::Field::XINT64,
-                                 kImageIdentifierFieldName,
-                                 Metadata::kRootScope));
-  packet.EncodeUInt64(params->image_id);
+  Metadata::Packet* packet = consumer->AcquirePacket();
+  consumer->EncodeGeneratedEventHeader(params->timestamp,
+                                       kSymbolInfoOpcode,
+                                       kSymbolsEventVersion,
+                                       kSymbolsProviderGUID,
+                                       packet);
+  packet->EncodeUInt64(params->image_id);
 
   // TODO(fdoray): Support Unicode.
-  descr.AddField(Metadata::Field(Metadata::Field::STRING,
-                                 kSymbolNameFieldName,
-                                 Metadata::kRootScope));
   std::wstring symbol_name_wstr(SymbolName);
   std::string symbol_name_str(symbol_name_wstr.begin(),
                               symbol_name_wstr.end());
-  packet.EncodeString(symbol_name_str);
-
-  descr.AddField(Metadata::Field(Metadata::Field::XINT64,
-                                 kSymbolAddressFieldName,
-                                 Metadata::kRootScope));
-  packet.EncodeUInt64(SymbolAddress);
+  packet->EncodeString(symbol_name_str);
+
+  packet->EncodeUInt64(SymbolAddress);
+
+  // The layout of SymbolInfo events never changes: describe it only once and
+  // reuse its event id for the next symbols.
+  if (*params->event_id != 0) {
+    consumer->FinalizePacket(*params->event_id, packet);
+  } else {
+    Metadata::Event descr;
+    descr.set_info(kSymbolsEventGUID, kSymbolInfoOpcode,
+                   kSymbolsEventVersion, 0);
+    descr.set_name(kSymbolInfoEventName);
+    descr.AddField(Metadata::Field(Metadata::Field::XINT64,
+                                   kImageIdentifierFieldName,
+                                   Metadata::kRootScope));
+    descr.AddField(Metadata::Field(Metadata::Field::STRING,
+                                   kSymbolNameFieldName,
+                                   Metadata::kRootScope));
+    descr.AddField(Metadata::Field(Metadata::Field::XINT64,
+                                   kSymbolAddressFieldName,
+                                   Metadata::kRootScope));
+    *params->event_id = consumer->FinalizePacket(descr, packet);
+  }
 
-  consumer->FinalizePacket(descr, &packet);
   consumer->AddPacketToSendingQueue(packet);
 
   return TRUE;
@@ -170,9 +186,12 @@ class SymbolsObserver : public etw_observer::ETWObserver {
  private:
   // Override etw_observer::ETWObserver:
   // @{
+  virtual bool GetObservedEvents(EventFilter* filter) OVERRIDE;
   virtual void OnExtractEventInfo(ETWConsumer* consumer,
                                   PEVENT_RECORD pevent,
-                                  PTRACE_EVENT_INFO pinfo) OVERRIDE;
+                                  const EventSchema& schema) OVERRIDE;
+  virtual bool ObservesPayloadFields(ETWConsumer* consumer,
+                                     PEVENT_RECORD pevent) OVERRIDE;
   virtual void OnDecodePayloadField(ETWConsumer* consumer,
                                     size_t parent,
                                     size_t array_offset,
@@ -183,6 +202,10 @@ class SymbolsObserver : public etw_observer::ETWObserver {
                                     void* raw_data) OVERRIDE;
   virtual void OnEndProcessEvent(ETWConsumer* consumer,
                                  PEVENT_RECORD pevent) OVERRIDE;
+  virtual void SaveState(const ETWConsumer* consumer,
+                         std::string* state) OVERRIDE;
+  virtual bool RestoreState(ETWConsumer* consumer,
+                            const std::string& state) OVERRIDE;
   // @}
 
   // Indicates whether the event that is currently being processed by the
@@ -200,24 +223,42 @@ class SymbolsObserver : public etw_observer::ETWObserver {
   // identical if they are not loaded at the same base address.
   std::set<sym_util::Image> processed_images_;
 
+  // Event ids of the generated ImageId and SymbolInfo events, or 0 if they
+  // are not yet known. Their layouts never change.
+  size_t image_id_event_id_;
+  size_t symbol_info_event_id_;
+
   DISALLOW_COPY_AND_ASSIGN(SymbolsObserver);
 } symbols_observer;
 
-SymbolsObserver::SymbolsObserver() : is_loading_image_(false) {}
+SymbolsObserver::SymbolsObserver()
+    : is_loading_image_(false),
+      image_id_event_id_(0),
+      symbol_info_event_id_(0) {
+}
+
+bool SymbolsObserver::GetObservedEvents(EventFilter* filter) {
+  assert(filter != NULL);
+
+  // Only the Image events are needed. Their classic header has no id: their
+  // opcode identifies them.
+  filter->IncludeEventId(kImageEventGUID, kImageDCStartOpcode);
+  filter->IncludeEventId(kImageEventGUID, kImageLoadOpcode);
+  return true;
+}
 
 void SymbolsObserver::OnExtractEventInfo(ETWConsumer* consumer,
                                          PEVENT_RECORD pevent,
-                                         PTRACE_EVENT_INFO pinfo) {
+                                         const EventSchema& schema) {
   assert(consumer != NULL);
   assert(pevent != NULL);
-  assert(pinfo != NULL);
 
   // OnEndProcessEvent() should always set |is_loading_image_| to false before
   // this method is called again for a new event.
   assert(is_loading_image_ == false);
 
   const unsigned char event_opcode = pevent->EventHeader.EventDescriptor.Opcode;
-  if (IsEqualGUID(pinfo->EventGuid, kImageEventGUID) &&
+  if (IsEqualGUID(schema.event_guid, kImageEventGUID) &&
       (event_opcode == kImageDCStartOpcode ||
        event_opcode == kImageLoadOpcode)) {
     is_loading_image_ = true;
@@ -225,6 +266,15 @@ void SymbolsObserver::OnExtractEventInfo(ETWConsumer* consumer,
   }
 }
 
+bool SymbolsObserver::ObservesPayloadFields(ETWConsumer* consumer,
+                                            PEVENT_RECORD pevent) {
+  assert(consumer != NULL);
+  assert(pevent != NULL);
+
+  // Only the fields of the Image events are needed.
+  return is_loading_image_;
+}
+
 void SymbolsObserver::OnDecodePayloadField(ETWConsumer* consumer,
                                            size_t parent,
                                            size_t array_offset,
@@ -271,57 +321,62 @@ void SymbolsObserver::OnEndProcessEvent(ETWConsumer* consumer,
     return;
 
   // Create an event that associates an identifier with this image.
-  Metadata::Packet packet;
-  ETWConsumer::EncodeGeneratedEventHeader(
+  Metadata::Packet* packet = consumer->AcquirePacket();
+  consumer->EncodeGeneratedEventHeader(
       pevent->EventHeader.TimeStamp.QuadPart,
       kImageIdOpcode,
       kSymbolsEventVersion,
       kSymbolsProviderGUID,
-      &packet);
-  Metadata::Event descr;
-  descr.set_info(kSymbolsEventGUID, kImageIdOpcode,
-                 kSymbolsEventVersion, 0);
-  descr.set_name(kImageIdEventName);
+      packet);
 
   // Populate packet fields.
-  descr.AddField(Metadata::Field(Metadata::Field::XINT64,
-                                 kImageBaseFieldName, Metadata::kRootScope));
-  packet.EncodeUInt64(image_.base_address);
-
-  descr.AddField(Metadata::Field(Metadata::Field::UINT64,
-                                 kImageSizeFieldName, Metadata::kRootScope));
-  packet.EncodeUInt64(image_.size);
-
-  descr.AddField(Metadata::Field(Metadata::Field::UINT32,
-                                 kImageChecksumFieldName,
-                                 Metadata::kRootScope));
-  packet.EncodeUInt32(image_.checksum);
-
-  descr.AddField(Metadata::Field(Metadata::Field::UINT32,
-                                 kImageTimestampFieldName,
-                                 Metadata::kRootScope));
-  packet.EncodeUInt32(image_.timestamp);
+  packet->EncodeUInt64(image_.base_address);
+  packet->EncodeUInt64(image_.size);
+  packet->EncodeUInt32(image_.checksum);
+  packet->EncodeUInt32(image_.timestamp);
 
   // TODO(fdoray): Support Unicode.
-  descr.AddField(Metadata::Field(Metadata::Field::STRING,
-                                 kImageFileNameFieldName,
-                                 Metadata::kRootScope));
   std::string filename(image_.filename.begin(), image_.filename.end());
-  packet.EncodeString(filename);
-
-  descr.AddField(Metadata::Field(Metadata::Field::XINT64,
-                                 kImageIdentifierFieldName,
-                                 Metadata::kRootScope));
-  packet.EncodeUInt64(processed_images_.size());
+  packet->EncodeString(filename);
+
+  packet->EncodeUInt64(processed_images_.size());
+
+  // Describe the layout of the first ImageId event, and reuse its event id
+  // for the next ones.
+  if (image_id_event_id_ != 0) {
+    consumer->FinalizePacket(image_id_event_id_, packet);
+  } else {
+    Metadata::Event descr;
+    descr.set_info(kSymbolsEventGUID, kImageIdOpcode,
+                   kSymbolsEventVersion, 0);
+    descr.set_name(kImageIdEventName);
+    descr.AddField(Metadata::Field(Metadata::Field::XINT64,
+                                   kImageBaseFieldName, Metadata::kRootScope));
+    descr.AddField(Metadata::Field(Metadata::Field::UINT64,
+                                   kImageSizeFieldName, Metadata::kRootScope));
+    descr.AddField(Metadata::Field(Metadata::Field::UINT32,
+                                   kImageChecksumFieldName,
+                                   Metadata::kRootScope));
+    descr.AddField(Metadata::Field(Metadata::Field::UINT32,
+                                   kImageTimestampFieldName,
+                                   Metadata::kRootScope));
+    descr.AddField(Metadata::Field(Metadata::Field::STRING,
+                                   kImageFileNameFieldName,
+                                   Metadata::kRootScope));
+    descr.AddField(Metadata::Field(Metadata::Field::XINT64,
+                                   kImageIdentifierFieldName,
+                                   Metadata::kRootScope));
+    image_id_event_id_ = consumer->FinalizePacket(descr, packet);
+  }
 
   // Push the generated event to the sending queue.
-  consumer->FinalizePacket(descr, &packet);
   consumer->AddPacketToSendingQueue(packet);
 
   // Create a parameters structure for the symbol enumeration callback.
   EnumerateSymbolsCallbackParams enumerate_symbols_params;
   enumerate_symbols_params.image_id = processed_images_.size();
   enumerate_symbols_params.consumer = consumer;
+  enumerate_symbols_params.event_id = &symbol_info_event_id_;
   enumerate_symbols_params.timestamp = pevent->EventHeader.TimeStamp.QuadPart;
 
   // Enumerate all symbols.
@@ -334,4 +389,62 @@ void SymbolsObserver::OnEndProcessEvent(ETWConsumer* consumer,
   processed_images_.insert(image_);
 }
 
+void SymbolsObserver::SaveState(const ETWConsumer* consumer,
+                                std::string* state) {
+  assert(consumer != NULL);
+  assert(state != NULL);
+
+  // The identifiers of the images are given in the order they are
+  // processed: a resumed conversion keeps numbering them from there.
+  base::EncodeValue(static_cast<uint64_t>(image_id_event_id_), state);
+  base::EncodeValue(static_cast<uint64_t>(symbol_info_event_id_), state);
+  base::EncodeValue(static_cast<uint32_t>(processed_images_.size()), state);
+  std::set<sym_util::Image>::const_iterator it = processed_images_.begin();
+  for (; it != processed_images_.end(); ++it) {
+    base::EncodeValue(it->base_address, state);
+    base::EncodeValue(it->size, state);
+    base::EncodeValue(it->checksum, state);
+    base::EncodeValue(it->timestamp, state);
+    base::EncodeString(it->filename, state);
+  }
+}
+
+bool SymbolsObserver::RestoreState(ETWConsumer* consumer,
+                                   const std::string& state) {
+  assert(consumer != NULL);
+
+  base::BinaryDecoder decoder(
+      reinterpret_cast<const uint8_t*>(state.data()), state.size());
+  uint64_t image_id_event_id = 0;
+  uint64_t symbol_info_event_id = 0;
+  uint32_t number_of_images = 0;
+  if (!decoder.Decode(&image_id_event_id) ||
+      !decoder.Decode(&symbol_info_event_id) ||
+      !decoder.Decode(&number_of_images)) {
+    return false;
+  }
+
+  std::set<sym_util::Image> processed_images;
+  for (uint32_t i = 0; i < number_of_images; ++i) {
+    sym_util::Image image;
+    if (!decoder.Decode(&image.base_address) ||
+        !decoder.Decode(&image.size) ||
+        !decoder.Decode(&image.checksum) ||
+        !decoder.Decode(&image.timestamp) ||
+        !decoder.DecodeString(&image.filename)) {
+      return false;
+    }
+    processed_images.insert(image);
+  }
+  if (decoder.remaining() != 0 ||
+      processed_images.size() != number_of_images) {
+    return false;
+  }
+
+  image_id_event_id_ = static_cast<size_t>(image_id_event_id);
+  symbol_info_event_id_ = static_cast<size_t>(symbol_info_event_id);
+  processed_images_.swap(processed_images);
+  return true;
+}
+
 }  // namespace
@@ -43,48 +43,201 @@
 //
 // See: http://www.efficios.com/ctf
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <sstream>
 #include <string>
+#include <vector>
 
+#include "base/file_util.h"
+#include "base/output_file.h"
+#include "converter/checkpoint.h"
 #include "converter/ctf_producer.h"
 #include "converter/etw_consumer.h"
+#include "converter/event_filter.h"
 #include "converter/metadata.h"
+#include "converter/record_stream_writer.h"
 
 namespace {
 
 using converter::Metadata;
 
+// The number of units of the event timestamps, FILETIME, in a second.
+const double kTimestampsPerSecond = 10000000.0;
+
 converter::ETWConsumer consumer;
 converter::CTFProducer producer;
 
+// Records the events consumed when they are dumped to a record stream.
+converter::RecordStreamWriter record_writer;
+
+// The checkpoint of the conversion, and the file it is saved to.
+converter::Checkpoint checkpoint;
+std::wstring checkpoint_path;
+
+// The streams of the processors when the events are split by processor,
+// indexed by processor. They are opened with their first packet, with the
+// settings of |producer|.
+std::vector<converter::CTFProducer*> cpu_producers;
+
+converter::CTFProducer* GetCpuProducer(size_t cpu) {
+  if (cpu >= cpu_producers.size())
+    cpu_producers.resize(cpu + 1, NULL);
+  if (cpu_producers[cpu] != NULL)
+    return cpu_producers[cpu];
+
+  converter::CTFProducer* cpu_producer = new converter::CTFProducer();
+  cpu_producer->ReopenFolder(producer.folder());
+  cpu_producer->set_write_blocks(producer.write_blocks());
+  cpu_producer->set_direct_io(producer.direct_io());
+  cpu_producer->set_io_uring(producer.io_uring());
+  cpu_producer->set_max_stream_size(producer.max_stream_size());
+  cpu_producer->set_max_stream_duration(producer.max_stream_duration());
+  cpu_producer->set_packet_index(producer.packet_index());
+  cpu_producers[cpu] = cpu_producer;
+
+  std::wstring stream_name;
+  consumer.GetCpuStreamName(cpu, &stream_name);
+  if (!cpu_producer->OpenStream(stream_name)) {
+    std::wcerr << L"Cannot open output stream: \"" << stream_name << L"\""
+               << std::endl;
+    return NULL;
+  }
+  return cpu_producer;
+}
+
+bool CloseCpuStreams() {
+  bool closed = true;
+  for (size_t i = 0; i < cpu_producers.size(); ++i) {
+    if (cpu_producers[i] != NULL && !cpu_producers[i]->CloseStream())
+      closed = false;
+  }
+  return closed;
+}
+
+bool WriteFullPacket() {
+  // Write the full packet into the current stream, or into the stream of its
+  // processor.
+  converter::CTFProducer* output = &producer;
+  if (consumer.split_cpu()) {
+    output = GetCpuProducer(consumer.active_cpu());
+    if (output == NULL)
+      return false;
+  }
+
+  const uint8_t* raw = NULL;
+  converter::ETWConsumer::PacketInfo packet;
+  consumer.BuildFullPacket(&raw, &packet);
+  if (!output->WritePacket(reinterpret_cast<const char*>(raw), packet.size,
+                           packet.content_size, packet.events,
+                           packet.start_timestamp, packet.stop_timestamp)) {
+    std::cerr << "Cannot write packet into stream." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void WriteFullPackets() {
+  while (consumer.IsFullPacketReady()) {
+    if (!WriteFullPacket())
+      return;
+  }
+}
+
 void WINAPI ProcessEvent(PEVENT_RECORD pevent) {
   assert(pevent != NULL);
 
   consumer.ProcessEvent(pevent);
+  WriteFullPackets();
+}
 
-  while (consumer.IsFullPacketReady()) {
-     // Write the full packet into the current stream.
-     Metadata::Packet output;
-     consumer.BuildFullPacket(&output);
-     const char* raw = reinterpret_cast<const char*>(output.raw_bytes());
-     if (!producer.Write(raw, output.size())) {
-       std::cerr << "Cannot write packet into stream." << std::endl;
-       return;
-     }
+void FlushEvents() {
+  // Each processor has its own sending queue when the events are split by
+  // processor.
+  size_t queues = consumer.split_cpu() ? consumer.cpu_count() : 1;
+  for (size_t cpu = 0; cpu < queues; ++cpu) {
+    if (consumer.split_cpu())
+      consumer.SelectCpu(cpu);
+    while (!consumer.IsSendingQueueEmpty()) {
+      if (!WriteFullPacket())
+        return;
+    }
   }
 }
 
-void FlushEvents() {
-  while (!consumer.IsSendingQueueEmpty()) {
-     // Write the full packet into the current stream.
-     Metadata::Packet output;
-     consumer.BuildFullPacket(&output);
-     const char* raw = reinterpret_cast<const char*>(output.raw_bytes());
-     if (!producer.Write(raw, output.size())) {
-       std::cerr << "Cannot write packet into stream." << std::endl;
-       return;
-     }
+bool WriteMetadata() {
+  std::string metadata;
+  if (!consumer.SerializeMetadata(&metadata))
+    return false;
+  if (!producer.RewriteStream(L"metadata", metadata.c_str(),
+                              metadata.size())) {
+    std::wcerr << L"Cannot write metadata stream." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool SaveCheckpoint() {
+  // The checkpoint refers only to bytes written to the disk: the stream and
+  // the metadata describing it are kept by a crash of the system.
+  if (!producer.Sync()) {
+    std::wcerr << L"Cannot write packet into stream." << std::endl;
+    return false;
+  }
+
+  consumer.UpdateCheckpoint(&checkpoint);
+  checkpoint.set_stream_size(producer.stream_size());
+  if (!checkpoint.Save(checkpoint_path)) {
+    std::wcerr << L"Cannot write the checkpoint \"" << checkpoint_path
+               << L"\"" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void RecordCheckpoint() {
+  // The checkpoint refers to the packets written to the stream, and the
+  // metadata describes them: the output is readable up to the checkpoint.
+  WriteFullPackets();
+  if (consumer.IsFullPacketReady() || !WriteMetadata())
+    return;
+  SaveCheckpoint();
+}
+
+void PrintStatistics() {
+  size_t write_queue_depth = producer.max_write_queue_depth();
+  double write_stall_time = producer.write_stall_time();
+  double write_time = producer.write_time();
+  size_t stream_files = producer.stream_files();
+  for (size_t i = 0; i < cpu_producers.size(); ++i) {
+    if (cpu_producers[i] == NULL)
+      continue;
+    write_queue_depth = std::max(write_queue_depth,
+                                 cpu_producers[i]->max_write_queue_depth());
+    write_stall_time += cpu_producers[i]->write_stall_time();
+    write_time += cpu_producers[i]->write_time();
+    stream_files += cpu_producers[i]->stream_files();
   }
+
+  std::wcerr
+      << L"Events processed: " << consumer.events_processed() << L"\n"
+      << L"Sending queue allocations: "
+      << consumer.sending_queue_allocations() << L"\n"
+      << L"Decode plan hits: " << consumer.decode_plans().hits() << L"\n"
+      << L"Decode plan misses: " << consumer.decode_plans().misses() << L"\n"
+      << L"Passthrough events: " << consumer.passthrough_events() << L"\n"
+      << L"Unsupported events: " << consumer.unsupported_events() << L"\n"
+      << L"I/O wait time: " << consumer.io_wait_time() << L" s\n"
+      << L"Decode time: " << consumer.decode_time() << L" s\n"
+      << L"Skipped buffers: " << consumer.skipped_buffers() << L"\n"
+      << L"Skipped events: " << consumer.skipped_events() << L"\n"
+      << L"Filtered events: " << consumer.filtered_events() << L"\n"
+      << L"Write queue depth: " << write_queue_depth << L"\n"
+      << L"Write stall time: " << write_stall_time << L" s\n"
+      << L"Write time: " << write_time << L" s\n"
+      << L"Stream files: " << stream_files << L"\n"
+      << std::endl;
 }
 
 ULONG WINAPI ProcessBuffer(PEVENT_TRACE_LOGFILEW ptrace) {
@@ -112,17 +265,32 @@ ULONG WINAPI ProcessBuffer(PEVENT_TRACE_LOGFILEW ptrace) {
   return TRUE;
 }
 
-bool FileExists(const std::wstring& path) {
-  DWORD attrib = GetFileAttributes(path.c_str());
-  return (attrib != INVALID_FILE_ATTRIBUTES &&
-         !(attrib & FILE_ATTRIBUTE_DIRECTORY));
-}
-
 struct Options {
   bool help;
+  size_t jobs;
+  bool native_reader;
+  bool use_index;
+  std::wstring record_stream;
+  std::wstring dump_records;
+  std::wstring checkpoint;
+  double checkpoint_interval;
+  bool resume;
   bool overwrite;
   std::wstring output;
+  size_t read_ahead;
+  size_t write_blocks;
+  bool direct_io;
+  bool io_uring;
+  bool packet_index;
+  converter::EventFilter filter;
+  bool has_time_range;
+  double start;
+  double end;
   bool split_buffer;
+  bool split_cpu;
+  uint64_t max_stream_size;
+  double max_stream_duration;
+  bool stats;
   size_t packet_size;
   std::vector<std::wstring> files;
 };
@@ -130,12 +298,56 @@ struct Options {
 void DefaultOptions(Options* options) {
   assert(options != NULL);
   options->help = false;
+  options->jobs = 1;
+  options->native_reader = false;
+  options->use_index = false;
   options->output = L"ctf";
+  options->checkpoint_interval = 60;
+  options->resume = false;
   options->overwrite = false;
+  options->read_ahead = converter::ETWConsumer::kDefaultReadAhead;
+  options->write_blocks = converter::CTFProducer::kDefaultWriteBlocks;
+  options->direct_io = true;
+  options->io_uring = false;
+  options->packet_index = true;
+  options->has_time_range = false;
+  options->start = 0;
+  options->end = std::numeric_limits<double>::infinity();
   options->split_buffer = false;
+  options->split_cpu = false;
+  options->max_stream_size = 0;
+  options->max_stream_duration = 0;
+  options->stats = false;
   options->packet_size = 4096;
 }
 
+// Parse the event ids of a provider, as <guid>:<id>[,<id>...].
+bool ParseEventIds(const std::wstring& param, converter::EventFilter* filter) {
+  assert(filter != NULL);
+
+  size_t separator = param.find(L':');
+  if (separator == std::wstring::npos)
+    return false;
+
+  GUID provider;
+  if (!converter::EventFilter::ParseGuid(param.substr(0, separator),
+                                         &provider)) {
+    return false;
+  }
+
+  std::wstringstream ids(param.substr(separator + 1));
+  std::wstring id;
+  while (std::getline(ids, id, L',')) {
+    std::string p(id.begin(), id.end());
+    char* end = NULL;
+    long value = strtol(p.c_str(), &end, 10);
+    if (p.empty() || *end != '\0' || value < 0 || value > 0xFFFF)
+      return false;
+    filter->IncludeEventId(provider, static_cast<uint16_t>(value));
+  }
+  return true;
+}
+
 bool ParseOptions(int argc, wchar_t** argv, Options* options) {
   assert(argv != NULL);
   assert(options != NULL);
@@ -152,7 +364,7 @@ bool ParseOptions(int argc, wchar_t** argv, Options* options) {
     // Not an option, push it as a file to process.
     if (!arg.empty() && arg[0] != '-') {
       // Check whether the file exists.
-      if (!FileExists(arg)) {
+      if (!base::FileExists(arg)) {
         std::wcerr << "File doesn't exist: \"" << arg << "\"" << std::endl;
         return false;
       }
@@ -176,16 +388,192 @@ bool ParseOptions(int argc, wchar_t** argv, Options* options) {
       continue;
     }
 
+    if (arg == L"--native-reader") {
+      options->native_reader = true;
+      continue;
+    }
+
+    if (arg == L"--record-stream" && !param.empty()) {
+      options->record_stream = param;
+      ++i;
+      continue;
+    }
+
+    if (arg == L"--dump-records" && !param.empty()) {
+      options->dump_records = param;
+      ++i;
+      continue;
+    }
+
+    if (arg == L"--checkpoint" && !param.empty()) {
+      options->checkpoint = param;
+      ++i;
+      continue;
+    }
+
+    if (arg == L"--checkpoint-interval" && !param.empty()) {
+      std::string p(param.begin(), param.end());
+      char* end = NULL;
+      double seconds = strtod(p.c_str(), &end);
+      if (end == p.c_str() || *end != '\0' || !(seconds > 0)) {
+        std::wcerr << "Invalid checkpoint interval '" << param << "'"
+                   << std::endl;
+        return false;
+      }
+      ++i;
+      options->checkpoint_interval = seconds;
+      continue;
+    }
+
+    if (arg == L"--resume") {
+      options->resume = true;
+      continue;
+    }
+
+    if (arg == L"--index") {
+      options->use_index = true;
+      continue;
+    }
+
+    if (arg == L"--jobs") {
+      std::string p(param.begin(), param.end());
+      int jobs = atoi(p.c_str());
+      if (jobs < 1) {
+        std::wcerr << "Invalid number of jobs '" << param << "'" << std::endl;
+        return false;
+      }
+      ++i;
+      options->jobs = jobs;
+      continue;
+    }
+
+    if (arg == L"--read-ahead" && !param.empty()) {
+      std::string p(param.begin(), param.end());
+      int buffers = atoi(p.c_str());
+      if (buffers < 0) {
+        std::wcerr << "Invalid read ahead '" << param << "'" << std::endl;
+        return false;
+      }
+      ++i;
+      options->read_ahead = buffers;
+      continue;
+    }
+
+    if (arg == L"--write-blocks" && !param.empty()) {
+      std::string p(param.begin(), param.end());
+      int blocks = atoi(p.c_str());
+      if (blocks < 0 || blocks == 1) {
+        std::wcerr << "Invalid write blocks '" << param << "'" << std::endl;
+        return false;
+      }
+      ++i;
+      options->write_blocks = blocks;
+      continue;
+    }
+
+    if ((arg == L"--include-provider" || arg == L"--exclude-provider") &&
+        !param.empty()) {
+      GUID provider;
+      if (!converter::EventFilter::ParseGuid(param, &provider)) {
+        std::wcerr << "Invalid provider '" << param << "'" << std::endl;
+        return false;
+      }
+      ++i;
+      if (arg == L"--include-provider")
+        options->filter.IncludeProvider(provider);
+      else
+        options->filter.ExcludeProvider(provider);
+      continue;
+    }
+
+    if (arg == L"--event-id" && !param.empty()) {
+      if (!ParseEventIds(param, &options->filter)) {
+        std::wcerr << "Invalid event ids '" << param << "'" << std::endl;
+        return false;
+      }
+      ++i;
+      continue;
+    }
+
+    if ((arg == L"--start" || arg == L"--end") && !param.empty()) {
+      std::string p(param.begin(), param.end());
+      char* end = NULL;
+      double seconds = strtod(p.c_str(), &end);
+      if (end == p.c_str() || *end != '\0') {
+        std::wcerr << "Invalid time '" << param << "'" << std::endl;
+        return false;
+      }
+      ++i;
+      options->has_time_range = true;
+      if (arg == L"--start")
+        options->start = seconds;
+      else
+        options->end = seconds;
+      continue;
+    }
+
     if (arg == L"--overwrite") {
       options->overwrite = true;
       continue;
     }
 
+    if (arg == L"--no-direct-io") {
+      options->direct_io = false;
+      continue;
+    }
+
+    if (arg == L"--io-uring") {
+      options->io_uring = true;
+      continue;
+    }
+
+    if (arg == L"--no-packet-index") {
+      options->packet_index = false;
+      continue;
+    }
+
     if (arg == L"--split-buffer") {
       options->split_buffer = true;
       continue;
     }
 
+    if (arg == L"--split-cpu") {
+      options->split_cpu = true;
+      continue;
+    }
+
+    if (arg == L"--max-stream-size" && !param.empty()) {
+      std::string p(param.begin(), param.end());
+      char* end = NULL;
+      unsigned long long size = strtoull(p.c_str(), &end, 10);
+      if (end == p.c_str() || *end != '\0' || size == 0) {
+        std::wcerr << "Invalid stream size '" << param << "'" << std::endl;
+        return false;
+      }
+      ++i;
+      options->max_stream_size = size;
+      continue;
+    }
+
+    if (arg == L"--max-stream-duration" && !param.empty()) {
+      std::string p(param.begin(), param.end());
+      char* end = NULL;
+      double seconds = strtod(p.c_str(), &end);
+      if (end == p.c_str() || *end != '\0' || !(seconds > 0)) {
+        std::wcerr << "Invalid stream duration '" << param << "'"
+                   << std::endl;
+        return false;
+      }
+      ++i;
+      options->max_stream_duration = seconds;
+      continue;
+    }
+
+    if (arg == L"--stats") {
+      options->stats = true;
+      continue;
+    }
+
     if (arg == L"--packet-size") {
       std::string p(param.begin(), param.end());
       int size = atoi(p.c_str());
@@ -202,6 +590,43 @@ bool ParseOptions(int argc, wchar_t** argv, Options* options) {
     return false;
   }
 
+  // A record stream is not made of buffers, and has no start time.
+  if (!options->record_stream.empty() &&
+      (!options->files.empty() || options->has_time_range ||
+       options->use_index || options->split_buffer)) {
+    std::wcerr << "A record stream cannot be converted with trace files, a "
+               << "time range, an index or split buffers." << std::endl;
+    return false;
+  }
+
+  // The checkpoint records the position of the conversion in all the
+  // buffers of the trace files, and in a single stream file.
+  if (!options->checkpoint.empty() &&
+      (!options->record_stream.empty() || options->has_time_range ||
+       options->use_index || options->split_buffer || options->split_cpu ||
+       options->max_stream_size != 0 || options->max_stream_duration != 0)) {
+    std::wcerr << "A checkpoint cannot be used with a record stream, a time "
+               << "range, an index, split streams or rotated streams."
+               << std::endl;
+    return false;
+  }
+
+  if (options->split_buffer && options->split_cpu) {
+    std::wcerr << "The streams cannot be split by buffer and by processor."
+               << std::endl;
+    return false;
+  }
+
+  if (options->resume && options->checkpoint.empty()) {
+    std::wcerr << "Resuming a conversion requires a checkpoint." << std::endl;
+    return false;
+  }
+
+  if (options->start > options->end) {
+    std::wcerr << "The start of the time range is after its end." << std::endl;
+    return false;
+  }
+
   return true;
 }
 
@@ -217,17 +642,122 @@ void PrintUsage() {
       << "        Specify the output directory for the produced CTF trace.\n"
       << "    --overwrite\n"
       << "        Overwrite the output directory.\n"
+      << "    --native-reader\n"
+      << "        Read the trace files directly, without the Windows API.\n"
+      << "        Always enabled on other platforms.\n"
+      << "    --jobs <n>\n"
+      << "        Decode the trace files on <n> threads. Implies\n"
+      << "        --native-reader.\n"
+      << "    --include-provider <guid>\n"
+      << "        Convert only the events of the included providers.\n"
+      << "    --exclude-provider <guid>\n"
+      << "        Do not convert the events of a provider.\n"
+      << "    --event-id <guid>:<id>[,<id>...]\n"
+      << "        Convert only the listed events of a provider. The opcode\n"
+      << "        identifies the events of classic providers.\n"
+      << "    --start <seconds>\n"
+      << "    --end <seconds>\n"
+      << "        Convert only the events of a time range, in seconds since\n"
+      << "        the start of the earliest trace. Implies --native-reader.\n"
+      << "    --record-stream <source>\n"
+      << "        Convert the framed event records of a stream as they\n"
+      << "        arrive, instead of trace files. <source> is - for the\n"
+      << "        standard input, unix:<path> for a Unix socket, or the\n"
+      << "        path of a stream recorded by --dump-records.\n"
+      << "    --dump-records <file>\n"
+      << "        Record the events read in <file>, as a record stream to\n"
+      << "        replay with --record-stream. Decodes the trace files on\n"
+      << "        a single thread.\n"
+      << "    --checkpoint <file>\n"
+      << "        Record the position of the conversion in <file>, during\n"
+      << "        the conversion and at its end. Convert only the buffers\n"
+      << "        added to the trace files since the conversion recorded in\n"
+      << "        <file>, and append their packets to the output. The trace\n"
+      << "        files are converted again when they do not match <file>.\n"
+      << "        Implies --native-reader.\n"
+      << "    --checkpoint-interval <seconds>\n"
+      << "        Record a checkpoint every <seconds> during the conversion.\n"
+      << "        60 by default.\n"
+      << "    --resume\n"
+      << "        Resume the interrupted conversion recorded in the\n"
+      << "        checkpoint, with the same output as an uninterrupted one.\n"
+      << "    --index\n"
+      << "        Skip the buffers without events to convert with the index\n"
+      << "        of each trace, <trace>.idx, built when missing or stale.\n"
+      << "        Implies --native-reader.\n"
+      << "    --read-ahead <n>\n"
+      << "        Read <n> buffers ahead of the decoded buffers, with the\n"
+      << "        native reader. 0 relies on the system read ahead only.\n"
+      << "    --write-blocks <n>\n"
+      << "        Write the CTF streams on a dedicated thread, through <n>\n"
+      << "        blocks of 1 MiB: one is filled while the others are\n"
+      << "        written. 0 writes on the conversion thread. 2 by default.\n"
+      << "        The blocks bypass the system cache when the packet size\n"
+      << "        is a multiple of the page size.\n"
+      << "    --no-direct-io\n"
+      << "        Write the blocks through the system cache.\n"
+      << "    --io-uring\n"
+      << "        Keep all the queued blocks in flight through io_uring, on\n"
+      << "        Linux.\n"
+      << "    --no-packet-index\n"
+      << "        Do not write the index of the packets of each CTF stream,\n"
+      << "        index/<stream>.idx, used by viewers to seek.\n"
       << "    --split-buffer\n"
       << "        Split each ETW buffers in a separate CTF stream.\n"
+      << "    --split-cpu\n"
+      << "        Split the events in a CTF stream per processor,\n"
+      << "        stream_<n>, with the processor in the packet context.\n"
+      << "    --max-stream-size <bytes>\n"
+      << "        Rotate each CTF stream to a new file, <stream>.<n>, before\n"
+      << "        a packet that would make the file exceed <bytes>.\n"
+      << "    --max-stream-duration <seconds>\n"
+      << "        Rotate each CTF stream to a new file, <stream>.<n>, before\n"
+      << "        a packet that would make the file span over <seconds>.\n"
       << "    --packet-size <size>\n"
       << "        Split CTF stream into CTF packets of <size> bytes.\n"
+      << "    --stats\n"
+      << "        Print conversion statistics.\n"
       << "\n"
       << std::endl;
 }
 
-}  // namespace
+// Resume a previous conversion of the trace files, recorded in a checkpoint.
+// @param options the command-line options.
+// @returns true when the conversion can resume, false if the trace files or
+//     the output do not match the checkpoint.
+bool ResumeConversion(const Options& options) {
+  if (!checkpoint.Load(options.checkpoint) ||
+      checkpoint.packet_size() != options.packet_size) {
+    return false;
+  }
 
-int wmain(int argc, wchar_t** argv) {
+  // The output of an interrupted conversion is incomplete: it is continued
+  // only on request.
+  if (!checkpoint.complete() && !options.resume) {
+    std::wcerr << L"The checkpoint records an interrupted conversion: use "
+               << L"--resume to continue it." << std::endl;
+    return false;
+  }
+
+  // The packets written after the checkpoint are discarded.
+  uint64_t stream_size = 0;
+  std::wstring stream = base::JoinPath(options.output, L"stream");
+  if (!base::GetFileSize(stream, &stream_size) ||
+      stream_size < checkpoint.stream_size()) {
+    return false;
+  }
+
+  // The packet index of the stream is continued as well.
+  if (options.packet_index &&
+      !converter::CTFProducer::CheckPacketIndex(
+          options.output, L"stream", checkpoint.stream_size())) {
+    return false;
+  }
+
+  return consumer.Resume(checkpoint);
+}
+
+int Run(int argc, wchar_t** argv) {
   struct Options options;
 
   // Initialize options with default values.
@@ -243,18 +773,55 @@ int wmain(int argc, wchar_t** argv) {
     return 0;
   }
 
+  // Add traces to be consumed to the consumer.
+  for (std::vector<std::wstring>::iterator it = options.files.begin();
+       it != options.files.end();
+       ++it) {
+    consumer.AddTraceFile(*it);
+  }
+
+  // Resume the previous conversion of the trace files. When they do not
+  // match its checkpoint, its output is replaced, unless resuming was
+  // requested.
+  bool resume = false;
+  bool overwrite = options.overwrite;
+  if (!options.checkpoint.empty() && base::FileExists(options.checkpoint)) {
+    resume = ResumeConversion(options);
+    if (!resume && options.resume) {
+      std::wcerr << L"Cannot resume the conversion recorded in \""
+                 << options.checkpoint << L"\"" << std::endl;
+      return -1;
+    }
+    if (!resume) {
+      std::wcerr << L"The checkpoint cannot be resumed: converting the "
+                 << L"trace files again." << std::endl;
+      overwrite = true;
+    }
+  } else if (options.resume) {
+    std::wcerr << L"No checkpoint to resume: \"" << options.checkpoint
+               << L"\"" << std::endl;
+    return -1;
+  }
+
   // Open the output folder.
-  if (!producer.OpenFolder(options.output, options.overwrite)) {
+  bool opened = resume ? producer.ReopenFolder(options.output) :
+                         producer.OpenFolder(options.output, overwrite);
+  if (!opened) {
     std::wcerr << L"Cannot open output directory \"" << options.output << L"\""
                << std::endl;
     return -1;
   }
 
-  // Add traces to be consumed to the consumer.
-  for (std::vector<std::wstring>::iterator it = options.files.begin();
-       it != options.files.end();
-       ++it) {
-    consumer.AddTraceFile(*it);
+  if (!options.record_stream.empty())
+    consumer.SetRecordStream(options.record_stream);
+
+  if (!options.dump_records.empty()) {
+    if (!record_writer.Open(options.dump_records)) {
+      std::wcerr << L"Cannot create the record stream \""
+                 << options.dump_records << L"\"" << std::endl;
+      return -1;
+    }
+    consumer.set_record_writer(&record_writer);
   }
 
   // No trace files to consume.
@@ -262,13 +829,59 @@ int wmain(int argc, wchar_t** argv) {
     return 0;
 
   consumer.SetEventCallback(ProcessEvent);
+  consumer.SetPacketCallback(WriteFullPackets);
   if (options.split_buffer)
     consumer.SetBufferCallback(ProcessBuffer);
 
   consumer.set_packet_maximal_size(options.packet_size);
+  consumer.set_split_cpu(options.split_cpu);
+  if (options.native_reader)
+    consumer.set_native_reader(true);
+  consumer.set_read_ahead(options.read_ahead);
+  producer.set_write_blocks(options.write_blocks);
+  producer.set_direct_io(
+      options.direct_io &&
+      options.packet_size % base::OutputFile::GetDirectAlignment() == 0);
+  producer.set_io_uring(options.io_uring);
+  producer.set_packet_index(options.packet_index);
+  producer.set_max_stream_size(options.max_stream_size);
+  if (options.max_stream_duration != 0) {
+    // The duration is at least one unit, and saturates on overflow.
+    double duration = options.max_stream_duration * kTimestampsPerSecond;
+    double max_duration =
+        static_cast<double>(std::numeric_limits<int64_t>::max());
+    producer.set_max_stream_duration(
+        static_cast<uint64_t>(std::max(1.0, std::min(duration, max_duration))));
+  }
+  consumer.SetEventFilter(options.filter);
+  if (options.has_time_range) {
+    consumer.set_native_reader(true);
+    consumer.SetTimeRange(options.start, options.end);
+  }
+  if (options.jobs > 1) {
+    consumer.set_native_reader(true);
+    consumer.set_jobs(options.jobs);
+  }
+  if (options.use_index) {
+    consumer.set_native_reader(true);
+    consumer.set_use_index(true);
+  }
+  if (!options.checkpoint.empty()) {
+    consumer.set_native_reader(true);
+    consumer.SetCheckpointCallback(RecordCheckpoint,
+                                   options.checkpoint_interval);
+    checkpoint_path = options.checkpoint;
+    checkpoint.set_packet_size(options.packet_size);
+  }
 
-  // Consume trace files.
-  if (!producer.OpenStream(L"stream")) {
+  // Consume trace files. The streams of the processors are opened with their
+  // first packet.
+  bool stream_opened = true;
+  if (resume)
+    stream_opened = producer.AppendStream(L"stream", checkpoint.stream_size());
+  else if (!options.split_cpu)
+    stream_opened = producer.OpenStream(L"stream");
+  if (!stream_opened) {
     std::wcerr << L"Cannot open output stream." << std::endl;
     return -1;
   }
@@ -283,20 +896,58 @@ int wmain(int argc, wchar_t** argv) {
     return -1;
   }
   FlushEvents();
-  producer.CloseStream();
 
-  // Serialize the metadata build during events processing.
-  if (!producer.OpenStream(L"metadata")) {
-    std::wcerr << L"Cannot open metadata stream." << std::endl;
+  if (!record_writer.Close()) {
+    std::wcerr << L"Cannot write the record stream \""
+               << options.dump_records << L"\"" << std::endl;
     return -1;
   }
 
-  std::string metadata;
-  if (!consumer.SerializeMetadata(&metadata))
+  // Serialize the metadata build during events processing.
+  if (!WriteMetadata())
     return -1;
-  if (!producer.Write(metadata.c_str(), metadata.size()))
+
+  // Record the position of the conversion, once its output is complete.
+  if (!options.checkpoint.empty() && !SaveCheckpoint())
     return -1;
-  producer.CloseStream();
+  bool closed = options.split_cpu ? CloseCpuStreams() :
+                                   producer.CloseStream();
+  if (!closed) {
+    std::wcerr << L"Cannot write packet into stream." << std::endl;
+    return -1;
+  }
+
+  if (options.stats)
+    PrintStatistics();
+
+  for (size_t i = 0; i < cpu_producers.size(); ++i)
+    delete cpu_producers[i];
+  cpu_producers.clear();
 
   return 0;
 }
+
+}  // namespace
+
+#if defined(_WIN32)
+
+int wmain(int argc, wchar_t** argv) {
+  return Run(argc, argv);
+}
+
+#else  // defined(_WIN32)
+
+int main(int argc, char** argv) {
+  std::vector<std::wstring> arguments;
+  for (int i = 0; i < argc; ++i)
+    arguments.push_back(base::WidenNativePath(argv[i]));
+
+  std::vector<wchar_t*> wide_argv;
+  for (int i = 0; i < argc; ++i)
+    wide_argv.push_back(const_cast<wchar_t*>(arguments[i].c_str()));
+  wide_argv.push_back(NULL);
+
+  return Run(argc, &wide_argv[0]);
+}
+
+#endif  // defined(_WIN32)